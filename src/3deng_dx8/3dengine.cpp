@@ -1,5 +1,6 @@
 #include <fstream>
 #include <string>
+#include <vector>
 #include <cmath>
 #include <cassert>
 #include "d3dx8.h"
@@ -7,6 +8,10 @@
 #include "exceptions.h"
 #include "3dgeom.h"
 #include "lights.h"
+#include "datacache.h"
+#include "meshopt.h"
+#include "shadowvol.h"
+#include "threadpool.h"
 
 // local helper functions
 ColorDepth GetColorDepthFromPixelFormat(D3DFORMAT fmt);
@@ -17,7 +22,10 @@ D3DFORMAT GetDepthStencilFormat(int depthbits, bool stencil);
 
 GraphicsContext::GraphicsContext() {
 	D3DDevice = 0;
+	workers = 0;
+	MaxVertexIndex = MaxShortIndexVertices;
 	BackfaceCulling = true;
+	VertexProgram = VertexFormat;
 }
 
 ///////////////////////////////////
@@ -49,8 +57,9 @@ bool GraphicsContext::CreateVertexBuffer(uint32 VertexCount, UsageFlags usage, V
 	return (hr == D3D_OK);
 }
 
-bool GraphicsContext::CreateIndexBuffer(uint32 IndexCount, UsageFlags usage, IndexBuffer **ib) const {
-	long hr = D3DDevice->CreateIndexBuffer(IndexCount * IndexSize, (dword)usage, IndexFormat, D3DPOOL_DEFAULT, ib);
+bool GraphicsContext::CreateIndexBuffer(uint32 IndexCount, UsageFlags usage, IndexBuffer **ib, D3DFORMAT format) const {
+	dword size = format == D3DFMT_INDEX32 ? 4 : 2;
+	long hr = D3DDevice->CreateIndexBuffer(IndexCount * size, (dword)usage, format, D3DPOOL_DEFAULT, ib);
 	return (hr == D3D_OK);
 }
 
@@ -96,6 +105,15 @@ bool GraphicsContext::Draw(VertexBuffer *vb) {
     return res == D3D_OK;
 }
 
+bool GraphicsContext::DrawPositions(VertexBuffer *vb, unsigned int start, unsigned int VertexCount) {
+	SetVertexProgram(PositionVertexFormat);
+	D3DDevice->SetStreamSource(0, vb, sizeof(Vector3));
+	long res = D3DDevice->DrawPrimitive(D3DPT_TRIANGLELIST, start, VertexCount / 3);
+	D3DDevice->SetStreamSource(0, 0, 0);
+	SetVertexProgram(VertexFormat);
+	return res == D3D_OK;
+}
+
 bool GraphicsContext::Draw(Vertex *varray, unsigned int VertexCount) {
 	long res = D3DDevice->DrawPrimitiveUP((D3DPRIMITIVETYPE)ptype, VertexCount / 3, varray, sizeof(Vertex));
 	return res == D3D_OK;
@@ -104,25 +122,82 @@ bool GraphicsContext::Draw(Vertex *varray, unsigned int VertexCount) {
 bool GraphicsContext::Draw(VertexBuffer *vb, IndexBuffer *ib) {
 	D3DVERTEXBUFFER_DESC vbdesc;
 	vb->GetDesc(&vbdesc);
-	unsigned int verts = vbdesc.Size / sizeof(Vertex);
+	unsigned int verts = vbdesc.Size / GetVertexSize(vbdesc.FVF);
 
 	D3DINDEXBUFFER_DESC ibdesc;
 	ib->GetDesc(&ibdesc);
-	unsigned int indices = ibdesc.Size / sizeof(Index);
+	unsigned int indices = ibdesc.Size / (ibdesc.Format == D3DFMT_INDEX32 ? 4 : 2);
 
-	D3DDevice->SetStreamSource(0, vb, sizeof(Vertex));
-	D3DDevice->SetIndices(ib, 0);
-	long res = D3DDevice->DrawIndexedPrimitive((D3DPRIMITIVETYPE)ptype, 0, verts, 0, indices / 3);
+	return Draw(vb, ib, 0, verts, 0, indices / 3);
+}
+
+bool GraphicsContext::Draw(VertexBuffer *vb, IndexBuffer *ib, dword FirstVertex, dword VertexCount, dword FirstTri, dword TriCount) {
+	D3DVERTEXBUFFER_DESC vbdesc;
+	vb->GetDesc(&vbdesc);
+	dword stride = GetVertexSize(vbdesc.FVF);
+
+	// compacted meshes carry their own format for the fixed function pipeline
+	bool OwnFormat = vbdesc.FVF != VertexFormat && VertexProgram == VertexFormat;
+	if(OwnFormat) D3DDevice->SetVertexShader(vbdesc.FVF);
+
+	D3DDevice->SetStreamSource(0, vb, stride);
+	D3DDevice->SetIndices(ib, FirstVertex);
+	long res = D3DDevice->DrawIndexedPrimitive((D3DPRIMITIVETYPE)ptype, 0, VertexCount, FirstTri * 3, TriCount);
 	D3DDevice->SetIndices(0, 0);
 	D3DDevice->SetStreamSource(0, 0, 0);
+
+	if(OwnFormat) D3DDevice->SetVertexShader(VertexFormat);
 	return res == D3D_OK;
 }
 
 bool GraphicsContext::Draw(Vertex *varray, Index *iarray, unsigned int VertexCount, unsigned int IndexCount) {
-	long res = D3DDevice->DrawIndexedPrimitiveUP((D3DPRIMITIVETYPE)ptype, 0, VertexCount, IndexCount / 3, iarray, IndexFormat, varray, sizeof(Vertex));
+	if(!IndexCount) return true;
+
+	if(VertexCount <= MaxShortIndexVertices) {
+		return DrawShort(varray, iarray, VertexCount, IndexCount);
+	}
+
+	// too big for 16 bit indices and for the device's 32 bit ones too
+	if(VertexCount - 1 > MaxVertexIndex) {
+		return DrawSplit(varray, iarray, VertexCount, IndexCount);
+	}
+
+	long res = D3DDevice->DrawIndexedPrimitiveUP((D3DPRIMITIVETYPE)ptype, 0, VertexCount, IndexCount / 3, iarray, D3DFMT_INDEX32, varray, sizeof(Vertex));
+	return res == D3D_OK;
+}
+
+// 16 bit indices work on every device
+bool GraphicsContext::DrawShort(Vertex *varray, const dword *iarray, unsigned int VertexCount, unsigned int IndexCount) {
+	ShortIndices.assign(iarray, iarray + IndexCount);
+	long res = D3DDevice->DrawIndexedPrimitiveUP((D3DPRIMITIVETYPE)ptype, 0, VertexCount, IndexCount / 3, &ShortIndices[0], D3DFMT_INDEX16, varray, sizeof(Vertex));
 	return res == D3D_OK;
 }
 
+// cuts a triangle list in chunks that fit 16 bit indices, as TriMesh does
+// with its buffers, and draws them one by one
+bool GraphicsContext::DrawSplit(Vertex *varray, Index *iarray, unsigned int VertexCount, unsigned int IndexCount) {
+	if(ptype != TriangleList) return false;
+
+	dword TriCount = IndexCount / 3;
+	chunks.resize(TriCount);
+	ChunkSources.resize(TriCount * 3);
+	ChunkIndices.resize(TriCount * 3);
+	dword ChunkCount = SplitMesh(iarray, TriCount, VertexCount, MaxShortIndexVertices, &chunks[0], &ChunkSources[0], &ChunkIndices[0]);
+
+	bool ok = true;
+	for(dword i=0; i<ChunkCount; i++) {
+		const MeshChunk &chunk = chunks[i];
+
+		ChunkVertices.resize(chunk.VertexCount);
+		for(dword j=0; j<chunk.VertexCount; j++) {
+			ChunkVertices[j] = varray[ChunkSources[chunk.FirstVertex + j]];
+		}
+
+		if(!DrawShort(&ChunkVertices[0], &ChunkIndices[chunk.FirstTri * 3], chunk.VertexCount, chunk.TriCount * 3)) ok = false;
+	}
+	return ok;
+}
+
 bool GraphicsContext::Draw(Vertex *varray, Triangle *triarray, unsigned int VertexCount, unsigned int TriCount) {
 	unsigned int IndexCount = TriCount * 3;
 	Index *iarray = new Index[IndexCount];
@@ -443,6 +518,7 @@ void GraphicsContext::SetTextureTransformState(int stage, TexTransformState TexX
 
 // programmable pipeline interface
 void GraphicsContext::SetVertexProgram(dword vs) {
+	VertexProgram = vs;
 	D3DDevice->SetVertexShader(vs);
 }
 
@@ -987,7 +1063,9 @@ GraphicsContext *Engine3D::CreateGraphicsContext(HWND WindowHandle, unsigned int
 	gc->AASamples = AASamples;
 	gc->ColorFormat = FinalColorFormat;
 	gc->MaxTextureStages = adapters[AdapterID].Capabilities.MaxSimultaneousTextures;
+	gc->MaxVertexIndex = adapters[AdapterID].Capabilities.MaxVertexIndex;
 	gc->texman = new TextureManager(gc);
+	gc->workers = new ThreadPool;
 
 	gc->SetDefaultStates();
 	
@@ -1129,6 +1207,17 @@ bool Lock(VertexBuffer *vb, Vertex **data) {
 	return (vb->Lock(0, 0, (byte**)data, flags) == D3D_OK);
 }
 
+// Locks size bytes from offset. A dynamic buffer throws away what it had if
+// discard is set, otherwise the parts not locked are taken to be in use.
+bool Lock(VertexBuffer *vb, dword offset, dword size, byte **data, bool discard) {
+	D3DVERTEXBUFFER_DESC desc;
+	vb->GetDesc(&desc);
+	dword flags = 0;
+	if(desc.Usage & D3DUSAGE_DYNAMIC) flags = discard ? D3DLOCK_DISCARD : D3DLOCK_NOOVERWRITE;
+
+	return (vb->Lock(offset, size, data, flags) == D3D_OK);
+}
+
 bool Lock(IndexBuffer *ib, Index **data) {
 	D3DINDEXBUFFER_DESC desc;
 	ib->GetDesc(&desc);
@@ -1146,6 +1235,38 @@ void Unlock(IndexBuffer *ib) {
 }
 
 
+dword GetVertexSize(dword fvf) {
+	dword size = 0;
+	switch(fvf & D3DFVF_POSITION_MASK) {
+	case D3DFVF_XYZ:
+		size = 3 * sizeof(float);
+		break;
+	case D3DFVF_XYZRHW:
+	case D3DFVF_XYZB1:
+		size = 4 * sizeof(float);
+		break;
+	case D3DFVF_XYZB2:
+		size = 5 * sizeof(float);
+		break;
+	case D3DFVF_XYZB3:
+		size = 6 * sizeof(float);
+		break;
+	case D3DFVF_XYZB4:
+		size = 7 * sizeof(float);
+		break;
+	case D3DFVF_XYZB5:
+		size = 8 * sizeof(float);
+		break;
+	}
+
+	if(fvf & D3DFVF_NORMAL) size += 3 * sizeof(float);
+	if(fvf & D3DFVF_PSIZE) size += sizeof(float);
+	if(fvf & D3DFVF_DIFFUSE) size += sizeof(dword);
+	if(fvf & D3DFVF_SPECULAR) size += sizeof(dword);
+	size += ((fvf & D3DFVF_TEXCOUNT_MASK) >> D3DFVF_TEXCOUNT_SHIFT) * 2 * sizeof(float);
+	return size;
+}
+
 void CreateProjectionMatrix(Matrix4x4 *mat, float yFOV, float Aspect, float NearClip, float FarClip) {
 
     float h, w, Q;
@@ -1225,113 +1346,132 @@ void UpdateMipmapChain(Texture *tex) {
 	D3DXFilterTexture(tex, 0, 0, D3DX_FILTER_BOX);
 }
 
-dword AddEdge(Edge *edges, dword EdgeCount, const Edge &newedge) {
-	// remove internal edges
-	for(dword i=0; i<EdgeCount; i++) {
-		if((edges[i].vertices[0] == newedge.vertices[0] && edges[i].vertices[1] == newedge.vertices[1]) || (edges[i].vertices[0] == newedge.vertices[1] && edges[i].vertices[1] == newedge.vertices[0])) {
-			edges[i] = edges[--EdgeCount];
-			return EdgeCount;
-		}
-	}
+// true if any texel of the top level isn't fully opaque
+bool HasTransparency(Texture *tex) {
+	if(!tex) return false;
 
-    edges[EdgeCount++] = newedge;
-	return EdgeCount;
-}
+	D3DLOCKED_RECT rect;
+	D3DSURFACE_DESC desc;
 
-//#define LIGHTDIR(l, p)  (l->GetType() == LTDir ? l->GetDirection() : p - l->GetPosition())
-inline Vector3 GetLightDir(const Light *light, const Vector3 &pos, const Matrix4x4 &mat) {
-	if(light->GetType() == LTDir) {
-		return light->GetDirection();
-	} else {
-		Vector3 lpos = light->GetPosition();
-		lpos.Transform(mat);
-		return pos - lpos;
+	tex->GetLevelDesc(0, &desc);
+	if(desc.Format != D3DFMT_A8R8G8B8) return false;	// no alpha channel
+
+	if(tex->LockRect(0, &rect, 0, D3DLOCK_READONLY) != D3D_OK) {
+		return false;
+	}
+
+	bool transparent = false;
+	for(dword y=0; y<desc.Height && !transparent; y++) {
+		dword *pix = (dword*)((byte*)rect.pBits + y * rect.Pitch);
+		for(dword x=0; x<desc.Width; x++) {
+			if((*pix++ >> 24) < 0xff) {
+				transparent = true;
+				break;
+			}
+		}
 	}
-	return Vector3();
+	tex->UnlockRect(0);
+
+	return transparent;
 }
-		
 
 //////////////////////////////////////////
 // ----==( CreateShadowVolume )==----
 // (Helper Function)
-// Creates a graphics context with the specified parameters
-// Light version, basic info passed, fills in the rest
+// Appends the sides of the shadow volume of a mesh to pos,
+// in world space, returns how many positions it added
 //////////////////////////////////////////
 
-TriMesh *CreateShadowVolume(const TriMesh &mesh, const Light *light, const Matrix4x4 &MeshXForm, bool WorldCoords) {
+dword CreateShadowVolume(const TriMesh &mesh, const Light *light, const Matrix4x4 &MeshXForm, std::vector<Vector3> *pos) {
 
-	// transform light into object's local coordinate system
-	//const_cast<Light*>(light)->Transform(MeshXForm.Inverse());
-	Matrix4x4 InvXForm = MeshXForm.Inverse();
+	// the light in the object's local coordinate system
+	// (directional lights aren't rotated into it, they never were)
+	ShadowLight slight;
+	slight.directional = light->GetType() == LTDir;
+	if(slight.directional) {
+		slight.vec = light->GetDirection();
+	} else {
+		slight.vec = light->GetPosition();
+		slight.vec.Transform(MeshXForm.Inverse());
+	}
 
 	const Vertex *varray = mesh.GetVertexArray();
-	const Triangle *triarray = mesh.GetTriangleArray();
-
-	dword VertexCount = mesh.GetVertexCount();
+	const Index *indices = mesh.GetIndexArray();
+	const Vector3 *normals = mesh.GetFaceNormalArray();
 	dword TriangleCount = mesh.GetTriangleCount();
 
-	Edge *edges = new Edge[TriangleCount];
-	dword EdgeCount = 0;
+	bool *backfacing = new bool[TriangleCount];
 
-	// first find the contour edges
+	// first find the contour edges, between the triangles that look away
+	// from the light and the ones that don't
 
 	for(dword i=0; i<TriangleCount; i++) {
-
 		// find the light vector incident at this triangle
-		Vertex TriVerts[3];
-		TriVerts[0] = varray[triarray[i].vertices[0]];
-		TriVerts[1] = varray[triarray[i].vertices[1]];
-		TriVerts[2] = varray[triarray[i].vertices[2]];
-
-		Vector3 pos = (TriVerts[0].pos + TriVerts[1].pos + TriVerts[2].pos) / 3.0f;
-		//Vector3 LightDir = LIGHTDIR(light, pos);
-		Vector3 LightDir = GetLightDir(light, pos, InvXForm);
-
-		// if it looks away from the light...
-		if(DotProduct(triarray[i].normal, LightDir) >= 0.0f) {
-			EdgeCount = AddEdge(edges, EdgeCount, Edge(triarray[i].vertices[0], triarray[i].vertices[1]));
-			EdgeCount = AddEdge(edges, EdgeCount, Edge(triarray[i].vertices[1], triarray[i].vertices[2]));
-			EdgeCount = AddEdge(edges, EdgeCount, Edge(triarray[i].vertices[2], triarray[i].vertices[0]));
-		}
-	}
+		Vector3 center = (varray[indices[i * 3]].pos + varray[indices[i * 3 + 1]].pos + varray[indices[i * 3 + 2]].pos) / 3.0f;
+		Vector3 LightDir = GetShadowLightDir(slight, center);
 
-	// now extract the contour edges to build the shadow volume boundrary
-	const float ExtrudeMagnitude = 100000.0f;
-	Vertex *ShadowVertices = new Vertex[EdgeCount * 6];
-
-	for(dword i=0; i<EdgeCount; i++) {
-		Vertex QuadVert[4];
-		QuadVert[0] = varray[edges[i].vertices[0]];
-		QuadVert[1] = varray[edges[i].vertices[1]];
-		//QuadVert[2] = QuadVert[1].pos + (Vector3)LIGHTDIR(light, QuadVert[1].pos) * ExtrudeMagnitude;
-		//QuadVert[3] = QuadVert[0].pos + (Vector3)LIGHTDIR(light, QuadVert[0].pos) * ExtrudeMagnitude;
-		QuadVert[2] = QuadVert[1].pos + GetLightDir(light, QuadVert[1].pos, InvXForm) * ExtrudeMagnitude;
-		QuadVert[3] = QuadVert[0].pos + GetLightDir(light, QuadVert[0].pos, InvXForm) * ExtrudeMagnitude;
-
-        ShadowVertices[i*6] = QuadVert[0];
-		ShadowVertices[i*6+1] = QuadVert[1];
-		ShadowVertices[i*6+2] = QuadVert[2];
-
-		ShadowVertices[i*6+3] = QuadVert[0];
-		ShadowVertices[i*6+4] = QuadVert[2];
-		ShadowVertices[i*6+5] = QuadVert[3];
-
-		if(WorldCoords) {
-			for(int j=0; j<6; j++) {
-				ShadowVertices[i*6+j].pos.Transform(MeshXForm);
-			}
-		}
+		// does it look away from the light?
+		backfacing[i] = DotProduct(normals[i], LightDir) >= 0.0f;
 	}
 
-	TriMesh *ShadowMesh = new TriMesh(1);
-	ShadowMesh->SetData(ShadowVertices, 0, EdgeCount * 6, 0);
+	// the mesh keeps its edge table between frames
+	dword MeshEdgeCount = mesh.GetEdgeCount();
+	dword *edges = new dword[MeshEdgeCount * 2];
+	dword EdgeCount = FindSilhouetteEdges(mesh.GetEdgeArray(), MeshEdgeCount, backfacing, edges);
+
+	delete [] backfacing;
+
+	// now extrude the contour edges to build the shadow volume boundrary
+	dword start = (dword)pos->size();
+	pos->resize(start + EdgeCount * 6);
+	if(EdgeCount) {
+		ExtrudeSilhouette(varray, sizeof(Vertex), edges, EdgeCount, slight, MeshXForm, &(*pos)[start]);
+	}
 
-	delete [] ShadowVertices;
 	delete [] edges;
 
-	//const_cast<Light*>(light)->Transform(MeshXForm);	// return light to world coordinate system
+	return EdgeCount * 6;
+}
+
+// bump when CreateShadowVolume changes
+const dword ShadowVolumeVersion = 2;
+
+//////////////////////////////////////////
+// ----==( CreateStaticShadowVolume )==----
+// (Helper Function)
+// World space shadow volume of a mesh and light that never move,
+// taken from the derived data cache if it has been made before
+//////////////////////////////////////////
+
+void CreateStaticShadowVolume(const TriMesh &mesh, const Light *light, const Matrix4x4 &MeshXForm, std::vector<Vector3> *pos) {
+
+	const Vertex *varray = mesh.GetVertexArray();
+	dword VertexCount = mesh.GetVertexCount();
+	dword TriangleCount = mesh.GetTriangleCount();
+
+	CacheKey key("shadowvol", ShadowVolumeVersion);
+	key.Add(VertexCount);
+	key.Add(TriangleCount);
+	for(dword i=0; i<VertexCount; i++) {
+		key.Add(&varray[i].pos, sizeof(Vector3));
+	}
+	key.Add(mesh.GetIndexArray(), TriangleCount * 3 * sizeof(Index));
+	key.Add(mesh.GetFaceNormalArray(), TriangleCount * sizeof(Vector3));
+	key.Add((dword)light->GetType());
+	Vector3 LightVec = light->GetType() == LTDir ? light->GetDirection() : light->GetPosition();
+	key.Add(&LightVec, sizeof(Vector3));
+	key.Add(&MeshXForm.m[0][0], 16 * sizeof(float));
+
+	CacheEntry ent;
+	if(ent.Open("shadowvol", key.Get()) && ent.GetSize() % sizeof(Vector3) == 0) {
+		const Vector3 *cached = (const Vector3*)ent.GetData();
+		pos->insert(pos->end(), cached, cached + ent.GetSize() / sizeof(Vector3));
+		return;
+	}
 
-	return ShadowMesh;	
+	dword start = (dword)pos->size();
+	dword count = CreateShadowVolume(mesh, light, MeshXForm, pos);
+	datacache::Store("shadowvol", key.Get(), count ? &(*pos)[start] : 0, count * (dword)sizeof(Vector3));
 }
 
 
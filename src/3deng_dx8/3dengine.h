@@ -209,6 +209,7 @@ struct ContextInitParameters {
 class GraphicsContext {
 private:
 	PrimitiveType ptype;
+	dword VertexProgram;	// the one set last
 	FaceOrder CullOrder;
 	bool BackfaceCulling;
 	bool MipMapEnabled;
@@ -218,6 +219,15 @@ private:
 	// cache of current transformation matrices
 	Matrix4x4 WorldMat[256], ViewMat, ProjMat, TexMat[8];
 
+	// kept between the Draw calls from arrays, they only ever grow
+	std::vector<word> ShortIndices;
+	std::vector<Vertex> ChunkVertices;
+	std::vector<MeshChunk> chunks;
+	std::vector<dword> ChunkSources, ChunkIndices;
+
+	bool DrawShort(Vertex *varray, const dword *iarray, unsigned int VertexCount, unsigned int IndexCount);
+	bool DrawSplit(Vertex *varray, Index *iarray, unsigned int VertexCount, unsigned int IndexCount);
+
 	// disable copying contexts by making copy constructor and assignment private
 	GraphicsContext(const GraphicsContext &gc);
 	const GraphicsContext &operator =(const GraphicsContext &gc);
@@ -230,15 +240,17 @@ public:
 	D3DFORMAT ColorFormat, ZFormat;
 	int AASamples;
 	int MaxTextureStages;
+	dword MaxVertexIndex;		// 0xffff when only 16 bit indices work
 
 	TextureManager *texman;		// texture manager
+	ThreadPool *workers;		// for cpu work that doesn't touch the device
 	
 	GraphicsContext();
 
 	void SetDefaultStates();
 
 	bool CreateVertexBuffer(uint32 VertexCount, UsageFlags usage, VertexBuffer **vb) const;
-	bool CreateIndexBuffer(uint32 IndexCount, UsageFlags usage, IndexBuffer **ib) const;
+	bool CreateIndexBuffer(uint32 IndexCount, UsageFlags usage, IndexBuffer **ib, D3DFORMAT format = D3DFMT_INDEX16) const;
 
 	bool CreateSurface(uint32 Width, uint32 Height, Surface **surf) const;
 	bool CreateDepthStencil(uint32 Width, uint32 Height, Surface **zsurf) const;
@@ -252,7 +264,11 @@ public:
 
 	bool Draw(VertexBuffer *vb);
 	bool Draw(Vertex *varray, unsigned int VertexCount);
+	// triangle list of bare positions (PositionVertexFormat), like shadow volumes
+	bool DrawPositions(VertexBuffer *vb, unsigned int start, unsigned int VertexCount);
 	bool Draw(VertexBuffer *vb, IndexBuffer *ib);
+	// part of an indexed buffer, the indices counted from FirstVertex
+	bool Draw(VertexBuffer *vb, IndexBuffer *ib, dword FirstVertex, dword VertexCount, dword FirstTri, dword TriCount);
 	bool Draw(Vertex *varray, Index *iarray, unsigned int VertexCount, unsigned int IndexCount);
 	bool Draw(Vertex *varray, Triangle *triarray, unsigned int VertexCount, unsigned int TriCount);
 
@@ -381,11 +397,15 @@ class Light;
 // helper functions
 bool Lock(VertexBuffer *vb, Vertex **data);
 bool Lock(IndexBuffer *ib, Index **data);
+bool Lock(VertexBuffer *vb, dword offset, dword size, byte **data, bool discard);
 void Unlock(VertexBuffer *vb);
 void Unlock(IndexBuffer *ib);
 void CreateProjectionMatrix(Matrix4x4 *mat, float yFOV, float Aspect, float NearClip, float FarClip);
+dword GetVertexSize(dword fvf);	// 2D texture coordinates only
 void NormalMapFromHeightField(Texture *tex);
 void UpdateMipmapChain(Texture *tex);
-TriMesh *CreateShadowVolume(const TriMesh &mesh, const Light *light, const Matrix4x4 &MeshXForm, bool WorldCoords = false);
+bool HasTransparency(Texture *tex);
+dword CreateShadowVolume(const TriMesh &mesh, const Light *light, const Matrix4x4 &MeshXForm, std::vector<Vector3> *pos);
+void CreateStaticShadowVolume(const TriMesh &mesh, const Light *light, const Matrix4x4 &MeshXForm, std::vector<Vector3> *pos);
 
 #endif	// _3DENGINE_H_
\ No newline at end of file
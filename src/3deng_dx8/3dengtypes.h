@@ -14,9 +14,11 @@ typedef IDirect3DIndexBuffer8 IndexBuffer;
 //const dword VertexFormat = D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_DIFFUSE | D3DFVF_TEX4;
 //const dword VertexFormat = D3DFVF_XYZ | D3DFVF_XYZB1 | D3DFVF_NORMAL | D3DFVF_DIFFUSE | D3DFVF_TEX4;
 const dword VertexFormat = D3DFVF_XYZB2 | D3DFVF_LASTBETA_UBYTE4 | D3DFVF_NORMAL | D3DFVF_DIFFUSE | D3DFVF_TEX4;
-const D3DFORMAT IndexFormat = D3DFMT_INDEX16;
-const dword IndexSize = 2;
-typedef uint16 Index;
+const dword PositionVertexFormat = D3DFVF_XYZ;
+// 32 bit in system memory, the index buffers of meshes that fit in 16 bit
+// indices get those
+typedef uint32 Index;
+const dword MaxShortIndexVertices = 0xffff;
 
 
 #endif	// _3DENGTYPES_H_
\ No newline at end of file
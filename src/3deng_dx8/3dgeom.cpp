@@ -1,6 +1,8 @@
 #include <cassert>
 #include "3dgeom.h"
 #include "3dengine.h"
+#include "threads.h"
+#include "meshopt.h"
 
 using std::vector;
 
@@ -39,19 +41,6 @@ void Vertex::CalculateNormal(const Vertex *vbuffer, const Triangle *triangles, l
 	normal.Normalize();
 }
 
-/////////// Edge class implementation ///////////
-
-Edge::Edge() {
-	vertices[0] = vertices[1] = adjfaces[0] = adjfaces[1] = 0;
-}
-
-Edge::Edge(Index v1, Index v2, Index af1, Index af2) {
-	vertices[0] = v1;
-	vertices[1] = v2;
-	adjfaces[0] = af1;
-	adjfaces[1] = af2;
-}
-
 /////////// Triangle class implementation /////////////
 Triangle::Triangle(Index v1, Index v2, Index v3) {
 	vertices[0] = v1;
@@ -67,6 +56,46 @@ void Triangle::CalculateNormal(Vertex *vbuffer, bool normalize) {
 }
 
 
+/////////////// shared mesh data /////////////
+
+// a new array for a level, letting go of the old one
+template <class T>
+static T *NewLevelData(MeshData<T> **data, T **arrays, byte level, dword count) {
+	if(data[level]) data[level]->Release();
+	data[level] = MeshData<T>::Create(count);
+	return arrays[level] = data[level]->GetData();
+}
+
+// the array of a level, a copy of its own if other meshes share it, with
+// the contents too if keep is set
+template <class T>
+static T *UnshareLevelData(MeshData<T> **data, T **arrays, byte level, bool keep = true) {
+	MeshData<T> *shared = data[level];
+	if(!shared || !shared->IsShared()) return arrays[level];
+
+	data[level] = MeshData<T>::Create(shared->GetCount());
+	if(keep) memcpy(data[level]->GetData(), shared->GetData(), shared->GetCount() * sizeof(T));
+	shared->Release();
+	return arrays[level] = data[level]->GetData();
+}
+
+template <class T>
+static void ShareLevelData(MeshData<T> **data, T **arrays, byte level, MeshData<T> *shared) {
+	if(shared) shared->Share();
+	if(data[level]) data[level]->Release();
+	data[level] = shared;
+	arrays[level] = shared ? shared->GetData() : 0;
+}
+
+template <class T>
+static void ReleaseLevelData(MeshData<T> **data, byte levels) {
+	if(!data) return;
+	for(byte i=0; i<levels; i++) {
+		if(data[i]) data[i]->Release();
+	}
+	delete [] data;
+}
+
 /////////////// Triangular Mesh implementation /////////////
 
 TriMesh::TriMesh(byte LODLevels, GraphicsContext *gc) {
@@ -77,8 +106,23 @@ TriMesh::TriMesh(byte LODLevels, GraphicsContext *gc) {
 	varray = new Vertex*[Levels];
 	memset(varray, 0, Levels * sizeof(Vertex*));
 	
-	triarray = new Triangle*[Levels];
-	memset(triarray, 0, Levels * sizeof(Triangle*));
+	iarray = new Index*[Levels];
+	memset(iarray, 0, Levels * sizeof(Index*));
+
+	FaceNormals = new Vector3*[Levels];
+	memset(FaceNormals, 0, Levels * sizeof(Vector3*));
+
+	SmoothingGroups = new dword*[Levels];
+	memset(SmoothingGroups, 0, Levels * sizeof(dword*));
+
+	VertexData = new MeshData<Vertex>*[Levels];
+	memset(VertexData, 0, Levels * sizeof(MeshData<Vertex>*));
+	IndexData = new MeshData<Index>*[Levels];
+	memset(IndexData, 0, Levels * sizeof(MeshData<Index>*));
+	FaceNormalData = new MeshData<Vector3>*[Levels];
+	memset(FaceNormalData, 0, Levels * sizeof(MeshData<Vector3>*));
+	SmoothingGroupData = new MeshData<dword>*[Levels];
+	memset(SmoothingGroupData, 0, Levels * sizeof(MeshData<dword>*));
 	
 	vbuffer = new VertexBuffer*[Levels];
 	memset(vbuffer, 0, Levels * sizeof(VertexBuffer*));
@@ -86,44 +130,128 @@ TriMesh::TriMesh(byte LODLevels, GraphicsContext *gc) {
 	ibuffer = new IndexBuffer*[Levels];
 	memset(ibuffer, 0, Levels * sizeof(IndexBuffer*));
 
-	AdjTriangles = new std::vector<dword>*[Levels];
-	memset(AdjTriangles, 0, Levels * sizeof(std::vector<dword>*));
+	chunks = new MeshChunk*[Levels];
+	memset(chunks, 0, Levels * sizeof(MeshChunk*));
+
+	ChunkCount = new dword[Levels];
+	memset(ChunkCount, 0, Levels * sizeof(dword));
+
+	AdjOffsets = new dword*[Levels];
+	memset(AdjOffsets, 0, Levels * sizeof(dword*));
+
+	AdjTriangles = new dword*[Levels];
+	memset(AdjTriangles, 0, Levels * sizeof(dword*));
 
 	VertexCount = new dword[Levels];
 	TriCount = new dword[Levels];
 
-	BuffersValid = new bool[Levels];
-	memset(BuffersValid, 0, Levels * sizeof(bool));
-
-	AdjValid = new bool[Levels];
-	memset(AdjValid, 0, Levels * sizeof(bool));
+	BackBuffer = new VertexBuffer*[Levels];
+	memset(BackBuffer, 0, Levels * sizeof(VertexBuffer*));
+	FrontDirty = new DirtySpan[Levels];
+	memset(FrontDirty, 0, Levels * sizeof(DirtySpan));
+	BackDirty = new DirtySpan[Levels];
+	memset(BackDirty, 0, Levels * sizeof(DirtySpan));
+	BuffersValid = new byte[Levels];
+	InvalidateBuffers();
+
+	edges = new MeshEdge*[Levels];
+	memset(edges, 0, Levels * sizeof(MeshEdge*));
+	EdgeCount = new dword[Levels];
+	memset(EdgeCount, 0, Levels * sizeof(dword));
+	AdjValid = new byte[Levels];
+	memset(AdjValid, 0, Levels * sizeof(byte));
+
+	LevelSource = new dword*[Levels];
+	memset(LevelSource, 0, Levels * sizeof(dword*));
+	LODDirty = new DirtySpan[Levels];
+	memset(LODDirty, 0, Levels * sizeof(DirtySpan));
+
+	CompactVertices = true;
+	layout = MakeVertexLayout();
 }
 
 TriMesh::TriMesh(const TriMesh &mesh) {
+	Copy(mesh);
+}
+
+TriMesh::~TriMesh() {
+	Destroy();
+}
+
+const TriMesh &TriMesh::operator =(const TriMesh &mesh) {
+	if(&mesh == this) return *this;
+
+	Destroy();
+	Copy(mesh);
+	return *this;
+}
 
+// shares the data of mesh, the rest is made again when needed
+void TriMesh::Copy(const TriMesh &mesh) {
 	memcpy(this, &mesh, sizeof(TriMesh));
 
-	BuffersValid = new bool[Levels];
-	memset(BuffersValid, 0, Levels * sizeof(bool));
+	BackBuffer = new VertexBuffer*[Levels];
+	memset(BackBuffer, 0, Levels * sizeof(VertexBuffer*));
+	FrontDirty = new DirtySpan[Levels];
+	memset(FrontDirty, 0, Levels * sizeof(DirtySpan));
+	BackDirty = new DirtySpan[Levels];
+	memset(BackDirty, 0, Levels * sizeof(DirtySpan));
+	BuffersValid = new byte[Levels];
+	InvalidateBuffers();
+
+	// the adjacency and the edges are made again when needed
+	AdjOffsets = new dword*[Levels];
+	memset(AdjOffsets, 0, Levels * sizeof(dword*));
+	AdjTriangles = new dword*[Levels];
+	memset(AdjTriangles, 0, Levels * sizeof(dword*));
+	edges = new MeshEdge*[Levels];
+	memset(edges, 0, Levels * sizeof(MeshEdge*));
+	EdgeCount = new dword[Levels];
+	memset(EdgeCount, 0, Levels * sizeof(dword));
+	AdjValid = new byte[Levels];
+	memset(AdjValid, 0, Levels * sizeof(byte));
     
+	// the data itself is shared
 	varray = new Vertex*[Levels];
-	triarray = new Triangle*[Levels];
+	iarray = new Index*[Levels];
+	FaceNormals = new Vector3*[Levels];
+	SmoothingGroups = new dword*[Levels];
+	VertexData = new MeshData<Vertex>*[Levels];
+	memset(VertexData, 0, Levels * sizeof(MeshData<Vertex>*));
+	IndexData = new MeshData<Index>*[Levels];
+	memset(IndexData, 0, Levels * sizeof(MeshData<Index>*));
+	FaceNormalData = new MeshData<Vector3>*[Levels];
+	memset(FaceNormalData, 0, Levels * sizeof(MeshData<Vector3>*));
+	SmoothingGroupData = new MeshData<dword>*[Levels];
+	memset(SmoothingGroupData, 0, Levels * sizeof(MeshData<dword>*));
 	vbuffer = new VertexBuffer*[Levels];
 	ibuffer = new IndexBuffer*[Levels];
+	chunks = new MeshChunk*[Levels];
+	memset(chunks, 0, Levels * sizeof(MeshChunk*));
+	ChunkCount = new dword[Levels];
+	memset(ChunkCount, 0, Levels * sizeof(dword));
 
 	VertexCount = new dword[Levels];
 	TriCount = new dword[Levels];
+	LevelSource = new dword*[Levels];
+	LODDirty = new DirtySpan[Levels];
+	memcpy(LODDirty, mesh.LODDirty, Levels * sizeof(DirtySpan));
 
 	for(int i=0; i<Levels; i++) {
 		
 		VertexCount[i] = mesh.VertexCount[i];
 		TriCount[i] = mesh.TriCount[i];
 		
-        varray[i] = new Vertex[VertexCount[i]];
-		triarray[i] = new Triangle[TriCount[i]];
-		
-		memcpy(varray[i], mesh.varray[i], VertexCount[i] * sizeof(Vertex));
-		memcpy(triarray[i], mesh.triarray[i], TriCount[i] * sizeof(Triangle));
+		ShareLevelData(VertexData, varray, i, mesh.VertexData[i]);
+		ShareLevelData(IndexData, iarray, i, mesh.IndexData[i]);
+		ShareLevelData(FaceNormalData, FaceNormals, i, mesh.FaceNormalData[i]);
+		ShareLevelData(SmoothingGroupData, SmoothingGroups, i, mesh.SmoothingGroupData[i]);
+
+		LevelSource[i] = 0;
+		if(mesh.LevelSource[i]) {
+			LevelSource[i] = new dword[VertexCount[i]];
+			memcpy(LevelSource[i], mesh.LevelSource[i], VertexCount[i] * sizeof(dword));
+		}
 
 		vbuffer[i] = 0;
 		ibuffer[i] = 0;
@@ -132,100 +260,140 @@ TriMesh::TriMesh(const TriMesh &mesh) {
 	}
 }
 
-TriMesh::~TriMesh() {
-	if(varray) {
+// frees everything, the shared data is only let go of
+void TriMesh::Destroy() {
+	delete [] varray;
+	delete [] iarray;
+	delete [] FaceNormals;
+	delete [] SmoothingGroups;
+
+	ReleaseLevelData(VertexData, Levels);
+	ReleaseLevelData(IndexData, Levels);
+	ReleaseLevelData(FaceNormalData, Levels);
+	ReleaseLevelData(SmoothingGroupData, Levels);
+	
+	if(vbuffer) {
 		for(int i=0; i<Levels; i++) {
-            delete [] varray[i];
+			if(vbuffer[i]) vbuffer[i]->Release();
 		}
-		delete [] varray;
+		delete [] vbuffer;
 	}
-
-	if(triarray) {
+	if(ibuffer) {
 		for(int i=0; i<Levels; i++) {
-			delete [] triarray[i];
+			if(ibuffer[i]) ibuffer[i]->Release();
 		}
-		delete triarray;
+		delete [] ibuffer;
 	}
-	
-	if(vbuffer) {
+	if(BackBuffer) {
 		for(int i=0; i<Levels; i++) {
-			if(vbuffer[i]) vbuffer[i]->Release();
+			if(BackBuffer[i]) BackBuffer[i]->Release();
 		}
+		delete [] BackBuffer;
 	}
-	if(ibuffer) {
+	delete [] FrontDirty;
+	delete [] BackDirty;
+	delete [] BuffersValid;
+
+	if(chunks) {
 		for(int i=0; i<Levels; i++) {
-			if(ibuffer[i]) ibuffer[i]->Release();
+			delete [] chunks[i];
+		}
+		delete [] chunks;
+	}
+	delete [] ChunkCount;
+
+	if(AdjOffsets) {
+		for(int i=0; i<Levels; i++) {
+			delete [] AdjOffsets[i];
 		}
+		delete [] AdjOffsets;
 	}
 
 	if(AdjTriangles) {
 		for(int i=0; i<Levels; i++) {
 			delete [] AdjTriangles[i];
 		}
-		delete AdjTriangles;
+		delete [] AdjTriangles;
 	}
-}
-
-const TriMesh &TriMesh::operator =(const TriMesh &mesh) {
-	memcpy(this, &mesh, sizeof(TriMesh));
-
-	BuffersValid = new bool[Levels];
-	memset(BuffersValid, 0, Levels * sizeof(bool));
-    
-	varray = new Vertex*[Levels];
-	triarray = new Triangle*[Levels];
-	vbuffer = new VertexBuffer*[Levels];
-	ibuffer = new IndexBuffer*[Levels];
-
-	VertexCount = new dword[Levels];
-	TriCount = new dword[Levels];
-
-	for(int i=0; i<Levels; i++) {
-		
-		VertexCount[i] = mesh.VertexCount[i];
-		TriCount[i] = mesh.TriCount[i];
-		
-        varray[i] = new Vertex[VertexCount[i]];
-		triarray[i] = new Triangle[TriCount[i]];
-		
-		memcpy(varray[i], mesh.varray[i], VertexCount[i] * sizeof(Vertex));
-		memcpy(triarray[i], mesh.triarray[i], TriCount[i] * sizeof(Triangle));
+	if(edges) {
+		for(int i=0; i<Levels; i++) {
+			delete [] edges[i];
+		}
+		delete [] edges;
+	}
+	delete [] EdgeCount;
+	delete [] AdjValid;
 
-		vbuffer[i] = 0;
-		ibuffer[i] = 0;
+	delete [] VertexCount;
+	delete [] TriCount;
 
-		UpdateSystemBuffers(i);
+	if(LevelSource) {
+		for(int i=0; i<Levels; i++) {
+			delete [] LevelSource[i];
+		}
+		delete [] LevelSource;
 	}
-	return mesh;
+	delete [] LODDirty;
 }
 
 
 const Vertex *TriMesh::GetVertexArray(byte level) const {
 	if(level >= Levels) return 0;
+	if(level && LODDirty[level].first < LODDirty[level].end) const_cast<TriMesh*>(this)->UpdateLODLevel(level);
 	return varray[level];
 }
 
-const Triangle *TriMesh::GetTriangleArray(byte level) const {
+const Index *TriMesh::GetIndexArray(byte level) const {
+	if(level >= Levels) return 0;
+	if(level && LODDirty[level].first < LODDirty[level].end) const_cast<TriMesh*>(this)->UpdateLODLevel(level);
+	return iarray[level];
+}
+
+const Vector3 *TriMesh::GetFaceNormalArray(byte level) const {
 	if(level >= Levels) return 0;
-	return triarray[level];
+	if(level && LODDirty[level].first < LODDirty[level].end) const_cast<TriMesh*>(this)->UpdateLODLevel(level);
+	return FaceNormals[level];
+}
+
+const dword *TriMesh::GetSmoothingGroupArray(byte level) const {
+	if(level >= Levels) return 0;
+	if(level && LODDirty[level].first < LODDirty[level].end) const_cast<TriMesh*>(this)->UpdateLODLevel(level);
+	return SmoothingGroups[level];
 }
 	
 
 Vertex *TriMesh::GetModVertexArray() {
-	memset(BuffersValid, 0, Levels * sizeof(bool));
-	return varray[0];
+	return GetModVertexArray(0, VertexCount[0]);
+}
+
+Vertex *TriMesh::GetModVertexArray(dword first, dword count) {
+	InvalidateVertices(0, first, first + count);
+	MarkLODStale(first, first + count);
+	revision++;
+	return UnshareLevelData(VertexData, varray, 0);
 }
 
-Triangle *TriMesh::GetModTriangleArray() {
-	memset(BuffersValid, 0, Levels * sizeof(bool));
-	memset(AdjValid, 0, Levels * sizeof(bool));
-	return triarray[0];
+Index *TriMesh::GetModIndexArray() {
+	InvalidateBuffers();
+	memset(AdjValid, 0, Levels * sizeof(byte));
+	LODValid = false;
+	MarkLODStale();
+	revision++;
+	return UnshareLevelData(IndexData, iarray, 0);
+}
+
+// the face normals aren't in the system buffers, and the lower levels work
+// out their own
+Vector3 *TriMesh::GetModFaceNormalArray() {
+	revision++;
+	return UnshareLevelData(FaceNormalData, FaceNormals, 0);
 }
 
 const VertexBuffer *TriMesh::GetVertexBuffer(byte level) const {
 	if(level >= Levels) return 0;
+	if(level && LODDirty[level].first < LODDirty[level].end) const_cast<TriMesh*>(this)->UpdateLODLevel(level);
 
-	if(!BuffersValid[level]) {
+	if(BuffersValid[level] != AllBuffersValid) {
 		const_cast<TriMesh*>(this)->UpdateSystemBuffers(level);
 	}
 	return vbuffer[level];
@@ -233,15 +401,40 @@ const VertexBuffer *TriMesh::GetVertexBuffer(byte level) const {
 
 const IndexBuffer *TriMesh::GetIndexBuffer(byte level) const {
 	if(level >= Levels) return 0;
+	if(level && LODDirty[level].first < LODDirty[level].end) const_cast<TriMesh*>(this)->UpdateLODLevel(level);
 
-	if(!BuffersValid[level]) {
+	if(BuffersValid[level] != AllBuffersValid) {
 		const_cast<TriMesh*>(this)->UpdateSystemBuffers(level);
 	}
 
 	return ibuffer[level];
 }
 
+dword TriMesh::GetChunkCount(byte level) const {
+	if(level >= Levels) return 0;
+	return ChunkCount[level];
+}
+
+const MeshChunk *TriMesh::GetChunks(byte level) const {
+	if(level >= Levels) return 0;
+	return chunks[level];
+}
 		
+dword TriMesh::GetEdgeCount(byte level) const {
+	if(!GetEdgeArray(level)) return 0;
+	return EdgeCount[level];
+}
+
+const MeshEdge *TriMesh::GetEdgeArray(byte level) const {
+	if(level >= Levels) return 0;
+	if(level && LODDirty[level].first < LODDirty[level].end) const_cast<TriMesh*>(this)->UpdateLODLevel(level);
+
+	if(!(AdjValid[level] & AdjEdges)) {
+		const_cast<TriMesh*>(this)->BuildEdges(level);
+	}
+	return edges[level];
+}
+
 dword TriMesh::GetVertexCount(byte level) const {
 	if(level >= Levels) return 0xdeadbeef;
 	return VertexCount[level];
@@ -256,223 +449,800 @@ byte TriMesh::GetLevelCount() const {
 	return Levels;
 }
 
+dword TriMesh::GetRevision() const {
+	return revision;
+}
+
 void TriMesh::SetGraphicsContext(GraphicsContext *gc) {
 	this->gc = gc;
-	memset(BuffersValid, 0, Levels * sizeof(bool));	// invalidate all system buffers in all levels
+	InvalidateBuffers();	// invalidate all system buffers in all levels
 }
 
-void TriMesh::SetData(const Vertex *vdata, const Triangle *tridata, dword vcount, dword tricount) {
+void TriMesh::SetLevel0Size(dword vcount, dword tricount) {
 
-	memset(BuffersValid, 0, Levels * sizeof(bool));
-	memset(AdjValid, 0, Levels * sizeof(bool));
+	InvalidateBuffers();
+	memset(AdjValid, 0, Levels * sizeof(byte));
+	LODValid = false;
+	revision++;
 	
-	if(varray[0]) delete [] varray[0];
-	if(triarray[0]) delete [] triarray[0];
-	varray[0] = new Vertex[vcount];
-	triarray[0] = new Triangle[tricount];
+	NewLevelData(VertexData, varray, 0, vcount);
+	NewLevelData(IndexData, iarray, 0, tricount * 3);
+	NewLevelData(FaceNormalData, FaceNormals, 0, tricount);
+	NewLevelData(SmoothingGroupData, SmoothingGroups, 0, tricount);
 
-	if(vdata) memcpy(varray[0], vdata, vcount * sizeof(Vertex));
-	if(tridata) memcpy(triarray[0], tridata, tricount * sizeof(Triangle));
 	VertexCount[0] = vcount;
 	TriCount[0] = tricount;
+}
+
+void TriMesh::SetData(const Vertex *vdata, const Triangle *tridata, dword vcount, dword tricount) {
+	SetLevel0Size(vcount, tricount);
+
+	if(vdata) memcpy(varray[0], vdata, vcount * sizeof(Vertex));
+	if(tridata) {
+		for(dword i=0; i<tricount; i++) {
+			iarray[0][i * 3] = tridata[i].vertices[0];
+			iarray[0][i * 3 + 1] = tridata[i].vertices[1];
+			iarray[0][i * 3 + 2] = tridata[i].vertices[2];
+			FaceNormals[0][i] = tridata[i].normal;
+			SmoothingGroups[0][i] = tridata[i].SmoothingGroup;
+		}
+	} else {
+		memset(iarray[0], 0, tricount * 3 * sizeof(Index));
+		memset(SmoothingGroups[0], 0, tricount * sizeof(dword));
+	}
 
 	UpdateLODChain();
 }
 
+// any of the arrays may be null, the normals and smoothing groups one per
+// triangle
+void TriMesh::SetData(const Vertex *vdata, const Index *idata, const Vector3 *normals, const dword *groups, dword vcount, dword tricount) {
+	SetLevel0Size(vcount, tricount);
+
+	if(vdata) memcpy(varray[0], vdata, vcount * sizeof(Vertex));
+	if(idata) {
+		memcpy(iarray[0], idata, tricount * 3 * sizeof(Index));
+	} else {
+		memset(iarray[0], 0, tricount * 3 * sizeof(Index));
+	}
+	if(normals) memcpy(FaceNormals[0], normals, tricount * sizeof(Vector3));
+	if(groups) {
+		memcpy(SmoothingGroups[0], groups, tricount * sizeof(dword));
+	} else {
+		memset(SmoothingGroups[0], 0, tricount * sizeof(dword));
+	}
+
+	UpdateLODChain();
+}
+
+// Going back to the data of an untouched mesh this way costs next to nothing:
+// with the same triangles as before the index buffers, the adjacency and the
+// lower levels all stay as they are, only the vertices are uploaded again.
+void TriMesh::ShareData(const TriMesh &mesh) {
+	if(&mesh == this) return;
+
+	bool SameTriangles = IndexData[0] && IndexData[0] == mesh.IndexData[0];
+
+	ShareLevelData(VertexData, varray, 0, mesh.VertexData[0]);
+	ShareLevelData(IndexData, iarray, 0, mesh.IndexData[0]);
+	ShareLevelData(FaceNormalData, FaceNormals, 0, mesh.FaceNormalData[0]);
+	ShareLevelData(SmoothingGroupData, SmoothingGroups, 0, mesh.SmoothingGroupData[0]);
+	VertexCount[0] = mesh.VertexCount[0];
+	TriCount[0] = mesh.TriCount[0];
+
+	if(SameTriangles) {
+		InvalidateVertices(0);
+	} else {
+		InvalidateBuffers(0);
+		AdjValid[0] = 0;
+	}
+
+	// the lower levels are made from the triangles, so the ones made from
+	// the same triangles do, otherwise mesh's are taken if it has them
+	if(!(SameTriangles && LODValid)) {
+		LODValid = Levels == mesh.Levels && mesh.LODValid;
+		for(byte i=1; i<Levels && LODValid; i++) {
+			ShareLevelData(VertexData, varray, i, mesh.VertexData[i]);
+			ShareLevelData(IndexData, iarray, i, mesh.IndexData[i]);
+			ShareLevelData(FaceNormalData, FaceNormals, i, mesh.FaceNormalData[i]);
+			ShareLevelData(SmoothingGroupData, SmoothingGroups, i, mesh.SmoothingGroupData[i]);
+			VertexCount[i] = mesh.VertexCount[i];
+			TriCount[i] = mesh.TriCount[i];
+
+			delete [] LevelSource[i];
+			LevelSource[i] = new dword[VertexCount[i]];
+			memcpy(LevelSource[i], mesh.LevelSource[i], VertexCount[i] * sizeof(dword));
+
+			InvalidateBuffers(i);
+			AdjValid[i] = 0;
+		}
+	}
+	MarkLODStale();
+	revision++;
+}
+
+void TriMesh::ResetVertices(const TriMesh &mesh) {
+	if(&mesh == this) return;
+
+	MeshData<Vertex> *verts = VertexData[0];
+	bool reuse = IndexData[0] && IndexData[0] == mesh.IndexData[0] && verts && !verts->IsShared() && verts != mesh.VertexData[0] && VertexCount[0] == mesh.VertexCount[0];
+	if(!reuse) {
+		ShareData(mesh);
+		return;
+	}
+
+	memcpy(varray[0], mesh.varray[0], VertexCount[0] * sizeof(Vertex));
+
+	MeshData<Vector3> *normals = FaceNormalData[0];
+	if(normals && !normals->IsShared() && mesh.FaceNormalData[0] && normals != mesh.FaceNormalData[0]) {
+		memcpy(FaceNormals[0], mesh.FaceNormals[0], TriCount[0] * sizeof(Vector3));
+	} else {
+		ShareLevelData(FaceNormalData, FaceNormals, 0, mesh.FaceNormalData[0]);
+	}
+
+	InvalidateVertices(0);
+	MarkLODStale();
+	revision++;
+}
+
+void TriMesh::OptimizeVertexOrder(float *AcmrBefore, float *AcmrAfter) {
+	dword vcount = VertexCount[0];
+	dword tcount = TriCount[0];
+	if(AcmrBefore) *AcmrBefore = 0.0f;
+	if(AcmrAfter) *AcmrAfter = 0.0f;
+	if(!vcount || !tcount) return;
+
+	vector<dword> indices(iarray[0], iarray[0] + tcount * 3);
+	if(AcmrBefore) *AcmrBefore = CalcACMR(&indices[0], tcount);
+
+	vector<dword> order(tcount), remap(vcount);
+	OptimizeVertexCache(&indices[0], tcount, vcount, &order[0]);
+	ReorderVerticesByFirstUse(&indices[0], tcount * 3, vcount, &remap[0]);
+	if(AcmrAfter) *AcmrAfter = CalcACMR(&indices[0], tcount);
+
+	// everything goes to new arrays, other meshes may share the old ones
+	MeshData<Vertex> *OldVerts = VertexData[0]->Share();
+	MeshData<Vector3> *OldNormals = FaceNormalData[0]->Share();
+	MeshData<dword> *OldGroups = SmoothingGroupData[0]->Share();
+
+	// the triangles keep their normals and smoothing groups
+	Vector3 *normals = NewLevelData(FaceNormalData, FaceNormals, 0, tcount);
+	dword *groups = NewLevelData(SmoothingGroupData, SmoothingGroups, 0, tcount);
+	for(dword i=0; i<tcount; i++) {
+		normals[i] = OldNormals->GetData()[order[i]];
+		groups[i] = OldGroups->GetData()[order[i]];
+	}
+
+	Index *tri = NewLevelData(IndexData, iarray, 0, tcount * 3);
+	for(dword i=0; i<tcount * 3; i++) {
+		tri[i] = (Index)remap[indices[i]];
+	}
+
+	// unused vertices are kept, at the end
+	Vertex *verts = NewLevelData(VertexData, varray, 0, vcount);
+	for(dword i=0; i<vcount; i++) {
+		verts[remap[i]] = OldVerts->GetData()[i];
+	}
+
+	OldVerts->Release();
+	OldNormals->Release();
+	OldGroups->Release();
+
+	// same surface, the lower levels just have to find their vertices again,
+	// the changes they have yet to take were numbered the old way though
+	for(byte i=1; i<Levels; i++) {
+		if(!LevelSource[i]) continue;
+		for(dword j=0; j<VertexCount[i]; j++) {
+			LevelSource[i][j] = remap[LevelSource[i][j]];
+		}
+		if(LODDirty[i].first < LODDirty[i].end) {
+			LODDirty[i].first = 0;
+			LODDirty[i].end = 0xffffffff;
+		}
+	}
+
+	InvalidateBuffers(0);
+	AdjValid[0] = 0;
+	revision++;
+
+	UpdateSystemBuffers(0);
+}
+
+// all the levels share the layout that fits level 0
+VertexLayout TriMesh::MakeVertexLayout() const {
+	VertexLayout vl;
+	if(!CompactVertices) {
+		vl.fvf = VertexFormat;
+		vl.size = sizeof(Vertex);
+		vl.blend = true;
+		vl.TexSetCount = 4;
+		for(byte i=0; i<4; i++) vl.TexSets[i] = i;
+		return vl;
+	}
+
+	// same[i][j] for j < i: set i repeats set j in every vertex
+	bool blend = false;
+	bool zero[4] = {true, true, true, true};
+	bool same[4][4];
+	memset(same, 1, sizeof same);
+
+	const Vertex *v = varray[0];
+	const Vertex *vend = v + (varray[0] ? VertexCount[0] : 0);
+	while(v != vend) {
+		if(v->BlendFactor != 0.0f || v->BlendIndex) blend = true;
+		for(int i=0; i<4; i++) {
+			if(v->tex[i].u != 0.0f || v->tex[i].v != 0.0f) zero[i] = false;
+			for(int j=0; j<i; j++) {
+				if(v->tex[i].u != v->tex[j].u || v->tex[i].v != v->tex[j].v) same[i][j] = false;
+			}
+		}
+		v++;
+	}
+
+	// the first set is always there, for textures on meshes without coordinates
+	vl.TexSetCount = 0;
+	for(int i=0; i<4; i++) {
+		vl.TexSets[i] = 0xff;
+		if(i && zero[i]) vl.TexSets[i] = vl.TexSets[0];
+		for(int j=0; j<i && vl.TexSets[i] == 0xff; j++) {
+			if(same[i][j]) vl.TexSets[i] = vl.TexSets[j];
+		}
+		if(vl.TexSets[i] == 0xff) vl.TexSets[i] = vl.TexSetCount++;
+	}
+
+	vl.blend = blend;
+	vl.fvf = (blend ? D3DFVF_XYZB2 | D3DFVF_LASTBETA_UBYTE4 : D3DFVF_XYZ) | D3DFVF_NORMAL | D3DFVF_DIFFUSE | (vl.TexSetCount << D3DFVF_TEXCOUNT_SHIFT);
+	vl.size = (blend ? 20 : 12) + sizeof(Vector3) + sizeof(dword) + vl.TexSetCount * sizeof(TexCoord);
+	return vl;
+}
+
+static void PackVertices(const Vertex *varray, dword count, const VertexLayout &vl, byte *dest) {
+	// the set to take each stored one from
+	int sources[4];
+	for(int i=3; i>=0; i--) {
+		sources[vl.TexSets[i]] = i;
+	}
+
+	for(dword i=0; i<count; i++) {
+		const Vertex &v = varray[i];
+		memcpy(dest, &v.pos, sizeof(Vector3));
+		dest += sizeof(Vector3);
+		if(vl.blend) {
+			memcpy(dest, &v.BlendFactor, sizeof(float));
+			memcpy(dest + sizeof(float), &v.BlendIndex, sizeof(dword));
+			dest += sizeof(float) + sizeof(dword);
+		}
+		memcpy(dest, &v.normal, sizeof(Vector3));
+		dest += sizeof(Vector3);
+		memcpy(dest, &v.color, sizeof(dword));
+		dest += sizeof(dword);
+		for(int j=0; j<vl.TexSetCount; j++) {
+			memcpy(dest, &v.tex[sources[j]], sizeof(TexCoord));
+			dest += sizeof(TexCoord);
+		}
+	}
+}
+
+// in the first of an empty DirtySpan
+const dword NoDirtyVertex = 0xffffffff;
+
+// Brings the system buffers of a level up to date: the index buffer only when
+// the triangles changed, and of the vertex buffer only the vertices changed
+// since it was last written.
 bool TriMesh::UpdateSystemBuffers(byte level) {
 
 	if(!gc || level >= Levels) return false;
 
-	if(vbuffer[level]) {
-		D3DVERTEXBUFFER_DESC vbdesc;
-		vbuffer[level]->GetDesc(&vbdesc);
-		if(vbdesc.Size / sizeof(Vertex) != VertexCount[level]) {
-			vbuffer[level]->Release();
-
-			if(gc->D3DDevice->CreateVertexBuffer(VertexCount[level] * sizeof(Vertex), dynamic ? D3DUSAGE_DYNAMIC : 0, VertexFormat, D3DPOOL_DEFAULT, &vbuffer[level]) != D3D_OK) {
-				return false;
+	// all the levels share the layout of level 0
+	if(level == 0) {
+		VertexLayout NewLayout = MakeVertexLayout();
+		if(NewLayout.fvf != layout.fvf || memcmp(NewLayout.TexSets, layout.TexSets, sizeof layout.TexSets)) {
+			// the other levels have to follow
+			for(byte i=0; i<Levels; i++) {
+				InvalidateVertices(i);
 			}
 		}
+		layout = NewLayout;
+	}
+
+	// split meshes gather their vertices chunk by chunk, and the chunks are
+	// made along with the indices
+	if(ChunkCount[level] > 1 && !(BuffersValid[level] & VertexBufferValid)) {
+		BuffersValid[level] &= (byte)~IndexBufferValid;
+	}
+
+	vector<dword> sources;
+	if(!(BuffersValid[level] & IndexBufferValid)) {
+		if(!UpdateIndexBuffer(level, &sources)) return false;
+		InvalidateVertices(level);
+	}
+
+	if(!(BuffersValid[level] & VertexBufferValid)) {
+		if(!UpdateVertexBuffer(level, sources)) return false;
+	}
+	return true;
+}
+
+// Makes the chunks of a level and fills its index buffer. For split meshes
+// sources gets the vertex each vertex of the chunks is a copy of.
+bool TriMesh::UpdateIndexBuffer(byte level, vector<dword> *sources) {
+	dword vcount = VertexCount[level];
+	dword tcount = TriCount[level];
+	const Index *isource = iarray[level];
+
+	// too big for 16 bit indices, see if the device takes 32 bit ones or cut
+	// it up in chunks that fit, each with its own copy of the vertices it uses
+	bool wide = vcount > MaxShortIndexVertices;
+	vector<dword> ChunkIndices;
+
+	delete [] chunks[level];
+	if(wide && tcount && vcount - 1 > gc->MaxVertexIndex) {
+		sources->resize(tcount * 3);
+		ChunkIndices.resize(tcount * 3);
+		vector<MeshChunk> split(tcount);
+		ChunkCount[level] = SplitMesh(isource, tcount, vcount, MaxShortIndexVertices, &split[0], &(*sources)[0], &ChunkIndices[0]);
+
+		chunks[level] = new MeshChunk[ChunkCount[level]];
+		memcpy(chunks[level], &split[0], ChunkCount[level] * sizeof(MeshChunk));
+
+		const MeshChunk &last = chunks[level][ChunkCount[level] - 1];
+		sources->resize(last.FirstVertex + last.VertexCount);
+		isource = &ChunkIndices[0];
+		wide = false;
 	} else {
-		if(gc->D3DDevice->CreateVertexBuffer(VertexCount[level] * sizeof(Vertex), dynamic ? D3DUSAGE_DYNAMIC : 0, VertexFormat, D3DPOOL_DEFAULT, &vbuffer[level]) != D3D_OK) {
-			return false;
-		}
+		chunks[level] = new MeshChunk[1];
+		chunks[level][0].FirstVertex = 0;
+		chunks[level][0].VertexCount = vcount;
+		chunks[level][0].FirstTri = 0;
+		chunks[level][0].TriCount = tcount;
+		ChunkCount[level] = 1;
 	}
-	
-	Vertex *vbdata;
-	Lock(vbuffer[level], &vbdata);
-	memcpy(vbdata, varray[level], VertexCount[level] * sizeof(Vertex));
-	Unlock(vbuffer[level]);
 
+	D3DFORMAT IndexFormat = wide ? D3DFMT_INDEX32 : D3DFMT_INDEX16;
+	dword IndexSize = wide ? 4 : 2;
+
+	// a buffer big enough is kept, the chunks say how much of it is used
 	if(ibuffer[level]) {
 		D3DINDEXBUFFER_DESC ibdesc;
 		ibuffer[level]->GetDesc(&ibdesc);
-		if(ibdesc.Size / IndexSize != TriCount[level] * 3) {
+		if(ibdesc.Size < tcount * 3 * IndexSize || ibdesc.Format != IndexFormat) {
 			ibuffer[level]->Release();
-
-			if(gc->D3DDevice->CreateIndexBuffer(TriCount[level] * 3 * IndexSize, dynamic ? D3DUSAGE_DYNAMIC : 0, IndexFormat, D3DPOOL_DEFAULT, &ibuffer[level]) != D3D_OK) {
-				return false;
-			}
+			ibuffer[level] = 0;
 		}
-	} else {
-		if(gc->D3DDevice->CreateIndexBuffer(TriCount[level] * 3 * IndexSize, dynamic ? D3DUSAGE_DYNAMIC : 0, IndexFormat, D3DPOOL_DEFAULT, &ibuffer[level]) != D3D_OK) {
+	}
+
+	// the indices stay put on dynamic meshes too, only GetModIndexArray and
+	// SetData change them
+	if(!ibuffer[level]) {
+		if(gc->D3DDevice->CreateIndexBuffer(tcount * 3 * IndexSize, 0, IndexFormat, D3DPOOL_DEFAULT, &ibuffer[level]) != D3D_OK) {
 			return false;
 		}
 	}
 
-
 	Index *ibdata;
 	Lock(ibuffer[level], &ibdata);
-	for(dword i=0; i<TriCount[level]; i++) {
-		*ibdata++ = triarray[level][i].vertices[0];
-		*ibdata++ = triarray[level][i].vertices[1];
-		*ibdata++ = triarray[level][i].vertices[2];
+	if(wide) {
+		memcpy(ibdata, isource, tcount * 3 * sizeof(Index));
+	} else {
+		word *dest = (word*)ibdata;
+		for(dword i=0; i<tcount * 3; i++) {
+			dest[i] = (word)isource[i];
+		}
 	}
 	Unlock(ibuffer[level]);
 
-	BuffersValid[level] = true;
+	BuffersValid[level] |= IndexBufferValid;
 	return true;
 }
 
-void TriMesh::UpdateLODChain() {
-	for(byte i=1; i<Levels; i++) {
-		// TODO: apply mesh optimization, for now, just copy as it is
-		VertexCount[i] = VertexCount[0];
-		TriCount[i] = TriCount[0];
-		
-		if(!varray[i]) varray[i] = new Vertex[VertexCount[i]];
-		memcpy(varray[i], varray[0], VertexCount[i] * sizeof(Vertex));
+bool TriMesh::UpdateVertexBuffer(byte level, const vector<dword> &sources) {
+	dword vcount = VertexCount[level];
+	const Vertex *vsource = varray[level];
+
+	vector<Vertex> ChunkVerts;
+	if(!sources.empty()) {
+		vcount = (dword)sources.size();
+		ChunkVerts.resize(vcount);
+		for(dword i=0; i<vcount; i++) {
+			ChunkVerts[i] = varray[level][sources[i]];
+		}
+		vsource = &ChunkVerts[0];
+	}
 
-		if(!triarray[i]) triarray[i] = new Triangle[TriCount[i]];
-		memcpy(triarray[i], triarray[0], TriCount[i] * sizeof(Triangle));
+	// dynamic meshes write the buffer that wasn't drawn last, the card may
+	// still be busy with the other one
+	VertexBuffer *&vb = dynamic ? BackBuffer[level] : vbuffer[level];
+	DirtySpan &dirty = dynamic ? BackDirty[level] : FrontDirty[level];
 
-		UpdateSystemBuffers(i);
+	if(vb) {
+		D3DVERTEXBUFFER_DESC vbdesc;
+		vb->GetDesc(&vbdesc);
+		if(vbdesc.Size < vcount * layout.size || vbdesc.FVF != layout.fvf) {
+			vb->Release();
+			vb = 0;
+		}
 	}
 
-	if(!BuffersValid[0]) UpdateSystemBuffers(0);
-}
+	if(!vb) {
+		if(gc->D3DDevice->CreateVertexBuffer(vcount * layout.size, dynamic ? D3DUSAGE_DYNAMIC : 0, layout.fvf, D3DPOOL_DEFAULT, &vb) != D3D_OK) {
+			return false;
+		}
+		dirty.first = 0;
+		dirty.end = vcount;
+	}
 
-// TODO: this will brake currently with multiple LOD levels, revise LOD normal calculation
-// and revise UpdateLODChain() too
-void TriMesh::CalculateNormals() {
-	memset(BuffersValid, 0, Levels * sizeof(bool));
+	if(dirty.end > vcount) dirty.end = vcount;
+	if(dirty.first < dirty.end) {
+		dword count = dirty.end - dirty.first;
 
-	Triangle *tri = triarray[0];
-	Triangle *tend = tri + TriCount[0];
+		byte *vbdata;
+		if(!Lock(vb, dirty.first * layout.size, count * layout.size, &vbdata, count == vcount)) return false;
+		if(layout.fvf == VertexFormat) {
+			memcpy(vbdata, vsource + dirty.first, count * sizeof(Vertex));
+		} else {
+			PackVertices(vsource + dirty.first, count, layout, vbdata);
+		}
+		Unlock(vb);
+	}
+	dirty.first = NoDirtyVertex;
+	dirty.end = 0;
 
-	while(tri != tend) {
-		(*tri++).CalculateNormal(varray[0], false);
+	if(dynamic) {
+		VertexBuffer *DrawnLast = vbuffer[level];
+		vbuffer[level] = BackBuffer[level];
+		BackBuffer[level] = DrawnLast;
+
+		DirtySpan span = FrontDirty[level];
+		FrontDirty[level] = BackDirty[level];
+		BackDirty[level] = span;
 	}
 
-	/*
-	Vertex *vert = varray[0];
-	Vertex *vend = vert + VertexCount[0];
+	BuffersValid[level] |= VertexBufferValid;
+	return true;
+}
+
+// marks vertices [first, end) of a level as changed for both its vertex buffers
+void TriMesh::InvalidateVertices(byte level, dword first, dword end) {
+	BuffersValid[level] &= (byte)~VertexBufferValid;
 
-	while(vert != vend) {
-		(*vert++).CalculateNormal(varray[0], triarray[0], TriCount[0]);
+	DirtySpan *spans[] = {&FrontDirty[level], &BackDirty[level]};
+	for(int i=0; i<2; i++) {
+		if(first < spans[i]->first) spans[i]->first = first;
+		if(end > spans[i]->end) spans[i]->end = end;
 	}
-	*/
+}
 
-	if(!AdjValid[0]) {
-        if(AdjTriangles[0]) delete [] AdjTriangles[0];
-		AdjTriangles[0] = new std::vector<dword>[VertexCount[0]];
+void TriMesh::InvalidateBuffers(byte level) {
+	BuffersValid[level] = 0;
+	InvalidateVertices(level);
+}
+
+void TriMesh::InvalidateBuffers() {
+	for(byte i=0; i<Levels; i++) {
+		InvalidateBuffers(i);
 	}
+}
 
-	for(dword i=0; i<VertexCount[0]; i++) {
-		if(AdjValid[0]) {
-			assert(AdjTriangles[0]);
-			Vector3 normal(0.0f, 0.0f, 0.0f);
-			for(dword j=0; j<AdjTriangles[0][i].size(); j++) {
-				normal += triarray[0][AdjTriangles[0][i][j]].normal;
+// The normals of the vertices sharing a triangle with a changed one change
+// too, this takes them into the dirty spans of level 0. With no changes
+// marked it's all of them, the normals may have been made some other way.
+void TriMesh::SpreadDirtyVertices() {
+	if(BuffersValid[0] & VertexBufferValid) {
+		InvalidateVertices(0);
+		return;
+	}
+
+	DirtySpan *spans[] = {&FrontDirty[0], &BackDirty[0]};
+	for(int i=0; i<2; i++) {
+		DirtySpan &span = *spans[i];
+		if(span.first >= span.end || (span.first == 0 && span.end >= VertexCount[0])) continue;
+
+		dword first = span.first, end = span.end;
+		const Index *tri = iarray[0];
+		for(dword j=0; j<TriCount[0]; j++, tri += 3) {
+			bool touched = false;
+			for(int k=0; k<3; k++) {
+				if(tri[k] >= span.first && tri[k] < span.end) touched = true;
 			}
-			normal.Normalize();
-			varray[0][i].normal = normal;
-		} else {
+			if(!touched) continue;
 
-			AdjTriangles[0][i].erase(AdjTriangles[0][i].begin(), AdjTriangles[0][i].end());
-			Vector3 normal(0.0f, 0.0f, 0.0f);
-			for(dword j=0; j<TriCount[0]; j++) {
-				if(triarray[0][j].vertices[0] == i || triarray[0][j].vertices[1] == i || triarray[0][j].vertices[2] == i) {
-					AdjTriangles[0][i].push_back(j);
-					normal += triarray[0][j].normal;
-				}
+			for(int k=0; k<3; k++) {
+				if(tri[k] < first) first = tri[k];
+				if(tri[k] + 1 > end) end = tri[k] + 1;
 			}
-			normal.Normalize();
-			varray[0][i].normal = normal;
 		}
+		span.first = first;
+		span.end = end;
 	}
+}
 
-	AdjValid[0] = true;
-	
-	UpdateLODChain();
+// unnormalized, so that the bigger triangles weigh more in the vertex normals
+static inline Vector3 FaceNormal(const Vertex *varray, const Index *tri) {
+	Vector3 v1 = varray[tri[1]].pos - varray[tri[0]].pos;
+	Vector3 v2 = varray[tri[2]].pos - varray[tri[0]].pos;
+	return v1.CrossProduct(v2);
 }
 
-void TriMesh::CalculateNormalsFast() {
-	memset(BuffersValid, 0, Levels * sizeof(bool));
+// marks level 0 vertices [first, end) as changed for all the lower levels
+void TriMesh::MarkLODStale(dword first, dword end) {
+	for(byte i=1; i<Levels; i++) {
+		if(first < LODDirty[i].first) LODDirty[i].first = first;
+		if(end > LODDirty[i].end) LODDirty[i].end = end;
+	}
+}
 
-	Triangle *tri = triarray[0];
-	Triangle *tend = tri + TriCount[0];
+// Level 0 changed: its buffers are brought up to date, the lower levels are
+// only told which of its vertices to take again, each does when it's asked
+// for (UpdateLODLevel), so only the levels drawn cost anything.
+void TriMesh::UpdateLODChain() {
+	if(Levels > 1 && !LODValid) SimplifyLODChain();
 
-	while(tri != tend) {
-		tri->CalculateNormal(varray[0], true);
-		varray[0][tri->vertices[0]].normal = tri->normal;
-		varray[0][tri->vertices[1]].normal = tri->normal;
-		varray[0][tri->vertices[2]].normal = tri->normal;
-		tri++;
-	}
+	// the dirty spans of level 0 have the normals changed around the moved
+	// vertices too, so they're passed on before level 0 is written
+	MarkLODStale(FrontDirty[0].first, FrontDirty[0].end);
+	MarkLODStale(BackDirty[0].first, BackDirty[0].end);
 
-	UpdateLODChain();
+	// level 0 first, the layout of the others comes from it
+	if(BuffersValid[0] != AllBuffersValid) UpdateSystemBuffers(0);
 }
 
-void TriMesh::ChangeMode(TriMeshMode mode) {
-	dynamic = mode == TriMeshDynamic;
+// The lower levels are only simplified again when the triangles changed, the
+// vertices are just copied over, so meshes deformed every frame keep the
+// simplification they had. Only the vertices taken from changed ones are,
+// and the face normals of the triangles using them.
+void TriMesh::UpdateLODLevel(byte level) {
+	if(!LODValid) SimplifyLODChain();
+
+	DirtySpan &span = LODDirty[level];
+	if(span.first >= span.end) return;
+	bool all = span.first == 0 && span.end >= VertexCount[0];
+
+	// both arrays may still be shared with another mesh
+	Vertex *verts = UnshareLevelData(VertexData, varray, level, !all);
+	const dword *source = LevelSource[level];
+	dword first = NoDirtyVertex, end = 0;
+	for(dword i=0; i<VertexCount[level]; i++) {
+		if(source[i] < span.first || source[i] >= span.end) continue;
+		verts[i] = varray[0][source[i]];
+		if(i < first) first = i;
+		end = i + 1;
+	}
+	span.first = NoDirtyVertex;
+	span.end = 0;
+	if(first >= end) return;
+
+	Vector3 *normals = UnshareLevelData(FaceNormalData, FaceNormals, level, !all);
+	const Index *tri = iarray[level];
+	for(dword i=0; i<TriCount[level]; i++, tri += 3) {
+		bool touched = false;
+		for(int k=0; k<3; k++) {
+			if(tri[k] >= first && tri[k] < end) touched = true;
+		}
+		if(touched) normals[i] = FaceNormal(verts, tri);
+	}
+
+	InvalidateVertices(level, first, end);
 }
 
-/*
+// each level gets about half the triangles of the one above, made from it
+// with quadric error edge collapses
+void TriMesh::SimplifyLODChain() {
+	dword tcount = TriCount[0];
+	vector<dword> indices(tcount * 3 + 1), remap(VertexCount[0] + 1);
+	for(dword i=0; i<tcount * 3; i++) {
+		indices[i] = iarray[0][i];
+	}
 
-void TriMesh::CalculateEdges() {
+	// level 1 starts from the edges level 0 keeps, the others from the
+	// triangles SimplifyMesh left
+	const MeshEdge *StartEdges = GetEdgeArray(0);
+	dword StartEdgeCount = GetEdgeCount(0);
 
-	//build a list of triangles that share each vertex
-	std::list<Triangle*> *ShareTris = new std::list<Triangle*>[VertexCount[0]];
+	for(byte i=1; i<Levels; i++) {
+		tcount = SimplifyMesh(varray[0], VertexCount[0], sizeof(Vertex), &indices[0], tcount, tcount / 2, &indices[0], StartEdges, StartEdgeCount);
+		StartEdges = 0;
+		StartEdgeCount = 0;
+		dword vcount = ReorderVerticesByFirstUse(&indices[0], tcount * 3, VertexCount[0], &remap[0]);
+
+		NewLevelData(VertexData, varray, i, vcount);
+		NewLevelData(IndexData, iarray, i, tcount * 3);
+		NewLevelData(FaceNormalData, FaceNormals, i, tcount);
+		NewLevelData(SmoothingGroupData, SmoothingGroups, i, tcount);
+		delete [] LevelSource[i];
+		LevelSource[i] = new dword[vcount];
+
+		for(dword j=0; j<VertexCount[0]; j++) {
+			if(remap[j] < vcount) LevelSource[i][remap[j]] = j;
+		}
 
-	for(dword i=0; i<VertexCount[0]; i++) {
-        for(dword j=0; j<TriCount[0]; j++) {
-			Index VertexIndex = (Index)((Vertex*)&varray[0][i] - (Vertex*)&varray[0][0]);
-			if(triarray[0][j].vertices[0] == VertexIndex || triarray[0][j].vertices[1] == VertexIndex || triarray[0][j].vertices[2] == VertexIndex) {
-				ShareTris[i].push_back(&triarray[0][j]);	// if it references this vertex add it
-			}
+		for(dword j=0; j<tcount * 3; j++) {
+			iarray[i][j] = (Index)remap[indices[j]];
 		}
+		memset(SmoothingGroups[i], 0, tcount * sizeof(dword));
+
+		VertexCount[i] = vcount;
+		TriCount[i] = tcount;
+		InvalidateBuffers(i);
+		AdjValid[i] = 0;
+	}
+
+	LODValid = true;
+	MarkLODStale();
+}
+
+// builds the vertex -> triangle adjacency of a level with a counting sort,
+// linear in the number of vertices and triangles
+void TriMesh::BuildAdjacency(byte level) {
+	dword vcount = VertexCount[level];
+	dword tcount = TriCount[level];
+	const Index *tri = iarray[level];
+
+	delete [] AdjOffsets[level];
+	delete [] AdjTriangles[level];
+	dword *offsets = AdjOffsets[level] = new dword[vcount + 1];
+	dword *adj = AdjTriangles[level] = new dword[tcount * 3];
+
+	// count the triangles on each vertex, one slot along...
+	memset(offsets, 0, (vcount + 1) * sizeof(dword));
+	for(dword i=0; i<tcount * 3; i++) {
+		offsets[tri[i] + 1]++;
+	}
+
+	// ...turn the counts into the start of each vertex's run...
+	for(dword i=0; i<vcount; i++) {
+		offsets[i + 1] += offsets[i];
+	}
+
+	// ...and drop the triangles in, using offsets[i] as the write position of
+	// vertex i, which leaves it at the start of vertex i+1 when done
+	for(dword i=0; i<tcount * 3; i++) {
+		adj[offsets[tri[i]]++] = i / 3;
+	}
+
+	// shift it back one vertex
+	for(dword i=vcount; i>0; i--) {
+		offsets[i] = offsets[i - 1];
 	}
+	offsets[0] = 0;
 
-	// find the adjacent triangles of each edge
-	for(dword i=0; i<TriCount[0]; i++) {
-		Triangle *tri = &triarray[0][i];
+	AdjValid[level] |= AdjVertexTriangles;
+}
+
+void TriMesh::BuildEdges(byte level) {
+	vector<MeshEdge> table(TriCount[level] * 3 + 1);
+	EdgeCount[level] = BuildEdgeTable(iarray[level], TriCount[level], &table[0]);
+
+	delete [] edges[level];
+	edges[level] = new MeshEdge[EdgeCount[level]];
+	memcpy(edges[level], &table[0], EdgeCount[level] * sizeof(MeshEdge));
+
+	AdjValid[level] |= AdjEdges;
+}
+
+// the normals are worked out in blocks of this many triangles or vertices,
+// and the blocks are shared between the context's worker threads when there
+// are enough of them
+const dword NormalBlockSize = 4096;
+const dword ParallelNormalBlocks = 4;
+
+struct NormalJob {
+	Vertex *varray;
+	const Index *iarray;
+	Vector3 *FaceNormals;
+	dword VertexCount, TriCount;
+	const dword *AdjOffsets, *AdjTriangles;
+};
+
+static void FaceNormalBlock(int block, void *data) {
+	NormalJob *job = (NormalJob*)data;
+
+	dword start = (dword)block * NormalBlockSize;
+	dword end = start + NormalBlockSize < job->TriCount ? start + NormalBlockSize : job->TriCount;
+
+	const Index *tri = job->iarray + start * 3;
+	for(dword i=start; i<end; i++, tri += 3) {
+		job->FaceNormals[i] = FaceNormal(job->varray, tri);
+	}
+}
+
+// each vertex only gathers from its own triangles, so the blocks never write
+// to the same place
+static void VertexNormalBlock(int block, void *data) {
+	NormalJob *job = (NormalJob*)data;
 
-		for(int j=0; j<3; j++) {
-			tri->edges[j].vertices[0] = tri->vertices[j];
-			tri->edges[j].vertices[1] = tri->vertices[(j+1) % 3];
-			tri->edges[j].adjfaces[0] = (Index)i;
+	dword start = (dword)block * NormalBlockSize;
+	dword end = start + NormalBlockSize < job->VertexCount ? start + NormalBlockSize : job->VertexCount;
+
+	const Vector3 *FaceNormals = job->FaceNormals;
+	const dword *adj = job->AdjTriangles;
+
+	for(dword i=start; i<end; i++) {
+		const dword *t = adj + job->AdjOffsets[i];
+		const dword *tend = adj + job->AdjOffsets[i + 1];
+
+		float x = 0.0f, y = 0.0f, z = 0.0f;
+		while(t != tend) {
+			const Vector3 &n = FaceNormals[*t++];
+			x += n.x;
+			y += n.y;
+			z += n.z;
 		}
 
-		for(int j=0; j<3; j++) {
-			Index v0 = (Index)((Vertex*)&varray[0][tri->edges[j].vertices[0]] - (Vertex*)&varray[0][0]);
-			Index v1 = (Index)((Vertex*)&varray[0][tri->edges[j].vertices[1]] - (Vertex*)&varray[0][0]);
+		Vector3 normal(x, y, z);
+		normal.Normalize();
+		job->varray[i].normal = normal;
+	}
+}
 
-			std::list<Triangle*>::iterator iter = ShareTris[v0].begin();
-			while(iter != ShareTris[v0].end()) {
-				Index TriIndex = (Index)(*iter - &triarray[0][0]);
-				
-				if((TriIndex != i) && ((*iter)->vertices[0] == v1 || (*iter)->vertices[1] == v1 || (*iter)->vertices[2] == v1)) {
-					tri->edges[j].adjfaces[1] = TriIndex;
-					break;
-				}
-				iter++;
-			}
-			if(iter == ShareTris[v0].end()) tri->edges[j].adjfaces[1] = (Index)0xffffffff;
+static void RunNormalBlocks(ThreadPool *workers, dword count, ParallelFunc func, NormalJob *job) {
+	dword blocks = (count + NormalBlockSize - 1) / NormalBlockSize;
+
+	if(workers && blocks >= ParallelNormalBlocks) {
+		workers->ParallelFor((int)blocks, func, job);
+	} else {
+		for(dword i=0; i<blocks; i++) {
+			func((int)i, job);
 		}
 	}
+}
+
+// the lower levels take the normals of the vertices they were made from
+void TriMesh::CalculateNormals() {
+	SpreadDirtyVertices();
+
+	if(!(AdjValid[0] & AdjVertexTriangles)) BuildAdjacency(0);
+
+	NormalJob job;
+	job.varray = UnshareLevelData(VertexData, varray, 0);
+	job.iarray = iarray[0];
+	job.FaceNormals = UnshareLevelData(FaceNormalData, FaceNormals, 0, false);
+	job.VertexCount = VertexCount[0];
+	job.TriCount = TriCount[0];
+	job.AdjOffsets = AdjOffsets[0];
+	job.AdjTriangles = AdjTriangles[0];
+
+	// all the face normals have to be there before any vertex sums them
+	ThreadPool *workers = gc ? gc->workers : 0;
+	RunNormalBlocks(workers, TriCount[0], FaceNormalBlock, &job);
+	RunNormalBlocks(workers, VertexCount[0], VertexNormalBlock, &job);
+	
+	UpdateLODChain();
+}
+
+void TriMesh::CalculateNormalsFast() {
+	SpreadDirtyVertices();
+	UnshareLevelData(VertexData, varray, 0);
+	UnshareLevelData(FaceNormalData, FaceNormals, 0, false);
+
+	const Index *tri = iarray[0];
+	for(dword i=0; i<TriCount[0]; i++, tri += 3) {
+		Vector3 normal = FaceNormal(varray[0], tri);
+		normal.Normalize();
+		FaceNormals[0][i] = normal;
+		varray[0][tri[0]].normal = normal;
+		varray[0][tri[1]].normal = normal;
+		varray[0][tri[2]].normal = normal;
+	}
+
+	UpdateLODChain();
+}
+
+void TriMesh::ChangeMode(TriMeshMode mode) {
+	dynamic = mode == TriMeshDynamic;
+}
+
+void TriMesh::SetVertexCompacting(bool enable) {
+	if(enable == CompactVertices) return;
+	CompactVertices = enable;
+	for(byte i=0; i<Levels; i++) {
+		InvalidateVertices(i);
+	}
+}
 
-	// TODO: wield duplicate edges
+byte TriMesh::GetTexCoordIndex(byte set) const {
+	return layout.TexSets[set];
 }
 
-*/
\ No newline at end of file
+dword TriMesh::GetVertexSize() const {
+	return layout.size;
+}
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include "n3dmath.h"
 #include "3dengtypes.h"
 #include "switches.h"
+#include "meshopt.h"
+#include "threads.h"
 
 struct TexCoord {
 	float u, v;
@@ -30,16 +32,8 @@ public:
 };
 
 
-class Edge {
-public:
-	Index vertices[2];
-	Index adjfaces[2];
-
-	Edge();
-	Edge(Index v1, Index v2, Index af1 = 0, Index af2 = 0);
-};
-
-
+// what the loaders and generators hand to TriMesh::SetData, the mesh keeps the
+// indices, normals and smoothing groups in arrays of their own
 class Triangle {
 public:
 	Index vertices[3];
@@ -54,31 +48,130 @@ public:
 
 enum TriMeshMode {TriMeshDynamic, TriMeshStatic};
 
+// The parts of Vertex stored in the system buffers. Texture coordinate sets
+// that repeat an earlier one or are all zero aren't stored, TexSets has the
+// stored set that stands in for each of the four.
+struct VertexLayout {
+	dword fvf;
+	dword size;
+	bool blend;			// blend factor and index stored
+	byte TexSetCount;
+	byte TexSets[4];
+};
+
+// An array of mesh data with a reference count, shared by the meshes that
+// have the same data until one of them changes it (see TriMesh::ShareData).
+template <class T>
+class MeshData {
+private:
+	T *data;
+	dword count;
+	volatile long refs;
+
+	MeshData(dword count) : count(count), refs(1) {data = new T[count];}
+	~MeshData() {delete [] data;}
+
+	MeshData(const MeshData &md) {}
+	void operator =(const MeshData &md) {}
+
+public:
+	static MeshData *Create(dword count) {return new MeshData(count);}
+
+	MeshData *Share() {AtomicIncrement(&refs); return this;}
+	void Release() {if(AtomicDecrement(&refs) == 0) delete this;}
+	bool IsShared() const {return refs > 1;}
+
+	T *GetData() const {return data;}
+	dword GetCount() const {return count;}
+};
+
 class GraphicsContext;
 
 class TriMesh {
 private:
 	GraphicsContext *gc;
 
-	// LOD arrays of vertex and triangle arrays for the mesh
+	// LOD arrays of vertex and triangle arrays for the mesh, the triangles as
+	// three indices each with their normals and smoothing groups kept apart,
+	// so the indices go to the index buffers as they are
 	Vertex **varray;
-	Triangle **triarray;
+	Index **iarray;
+	Vector3 **FaceNormals;
+	dword **SmoothingGroups;
+
+	// what the arrays above are the data of, a mesh copies an array before
+	// changing it if another one shares it
+	MeshData<Vertex> **VertexData;
+	MeshData<Index> **IndexData;
+	MeshData<Vector3> **FaceNormalData;
+	MeshData<dword> **SmoothingGroupData;
 	// system managed copy of the data (probably on the video ram or something)
 	VertexBuffer **vbuffer;
 	IndexBuffer **ibuffer;
-
-	std::vector<dword> **AdjTriangles;
-	bool *AdjValid;
+	// dynamic meshes write this one while vbuffer is drawn, then swap them
+	VertexBuffer **BackBuffer;
+
+	// vertices [first, end) of a vertex buffer that are behind varray
+	struct DirtySpan {
+		dword first, end;
+	};
+	DirtySpan *FrontDirty, *BackDirty;	// of vbuffer and BackBuffer
+
+	// the runs each level is drawn in, one for all of it unless it has more
+	// vertices than 16 bit indices reach and the device can't take 32 bit ones
+	MeshChunk **chunks;
+	dword *ChunkCount;
+
+	// triangles using each vertex, packed one vertex after the other: those of
+	// vertex i are AdjTriangles[AdjOffsets[i]] up to AdjTriangles[AdjOffsets[i+1]]
+	dword **AdjOffsets, **AdjTriangles;
+
+	// the edges of each level with the triangles on either side, see
+	// BuildEdgeTable
+	MeshEdge **edges;
+	dword *EdgeCount;
+
+	// which of the above each level has up to date, cleared all together
+	// whenever the triangles change
+	enum {AdjVertexTriangles = 1, AdjEdges = 2};
+	byte *AdjValid;
 	
 	dword *VertexCount, *TriCount;
 	byte Levels;
 
-	bool *BuffersValid;
+	// the level 0 vertex each vertex of the lower levels was taken from
+	dword **LevelSource;
+	bool LODValid;		// cleared when the triangles change
+	DirtySpan *LODDirty;	// the level 0 vertices changed since each lower level was made from them
+
+	// which of the system buffers of each level are up to date
+	enum {VertexBufferValid = 1, IndexBufferValid = 2, AllBuffersValid = 3};
+	byte *BuffersValid;
 	bool dynamic;
 
+	VertexLayout layout;	// of the system buffers
+	bool CompactVertices;
+
+	dword revision;		// bumped whenever the geometry may have changed
+
 	// synchronizes the system managed copy of vertices/indices with the local data
 	bool UpdateSystemBuffers(byte level);
+	bool UpdateIndexBuffer(byte level, std::vector<dword> *sources);
+	bool UpdateVertexBuffer(byte level, const std::vector<dword> &sources);
+	void InvalidateVertices(byte level, dword first = 0, dword end = 0xffffffff);
+	void InvalidateBuffers(byte level);
+	void InvalidateBuffers();	// all the levels
+	void SpreadDirtyVertices();
+	void SetLevel0Size(dword vcount, dword tricount);
+	VertexLayout MakeVertexLayout() const;
+	void MarkLODStale(dword first = 0, dword end = 0xffffffff);
 	void UpdateLODChain();
+	void UpdateLODLevel(byte level);
+	void SimplifyLODChain();
+	void BuildAdjacency(byte level);
+	void BuildEdges(byte level);
+	void Copy(const TriMesh &mesh);
+	void Destroy();
 
 public:
 	TriMesh(byte LODLevels, GraphicsContext *gc = 0);
@@ -88,25 +181,67 @@ public:
 	const TriMesh &operator =(const TriMesh &mesh);
 
 	const Vertex *GetVertexArray(byte level = 0) const;
-	const Triangle *GetTriangleArray(byte level = 0) const;
+	const Index *GetIndexArray(byte level = 0) const;	// three per triangle
+	const Vector3 *GetFaceNormalArray(byte level = 0) const;
+	const dword *GetSmoothingGroupArray(byte level = 0) const;
 	
 	Vertex *GetModVertexArray();
-	Triangle *GetModTriangleArray();
+	// for changes to the count vertices from first only, the rest of the
+	// system buffers is left as it is
+	Vertex *GetModVertexArray(dword first, dword count);
+	Index *GetModIndexArray();
+	Vector3 *GetModFaceNormalArray();
 
 	const VertexBuffer *GetVertexBuffer(byte level = 0) const;
 	const IndexBuffer *GetIndexBuffer(byte level = 0) const;
 
+	// the parts of the system buffers to draw one after the other, made
+	// along with the buffers
+	dword GetChunkCount(byte level = 0) const;
+	const MeshChunk *GetChunks(byte level = 0) const;
+
+	// made on first use and kept until the triangles change, open edges have
+	// NoFace for the second triangle (IsOpenEdge); the first use changes the
+	// mesh, so it can't race with other threads reading it
+	dword GetEdgeCount(byte level = 0) const;
+	const MeshEdge *GetEdgeArray(byte level = 0) const;
+
 	dword GetVertexCount(byte level = 0) const;
 	dword GetTriangleCount(byte level = 0) const;
 	byte GetLevelCount() const;
 
 	void ChangeMode(TriMeshMode mode);
+
+	// Without compacting the system buffers hold whole Vertex structures, as
+	// vertex programs expect them. With it they only get what the vertices
+	// use, in a format for the fixed function pipeline. The texture stages
+	// have to take coordinate set GetTexCoordIndex(set) for set.
+	void SetVertexCompacting(bool enable);
+	byte GetTexCoordIndex(byte set) const;
+	dword GetVertexSize() const;	// in the system buffers
 	void SetGraphicsContext(GraphicsContext *gc);
 	void SetData(const Vertex *vdata, const Triangle *tridata, dword vcount, dword tricount);
+	void SetData(const Vertex *vdata, const Index *idata, const Vector3 *normals, const dword *groups, dword vcount, dword tricount);
+
+	// Takes the data of mesh without copying it. The two share it until one
+	// of them changes a part of it, which gets a copy of that part only.
+	void ShareData(const TriMesh &mesh);
+	// Puts back the vertices and face normals of mesh, which has the same
+	// triangles, for meshes that change them all over again every frame. The
+	// arrays this mesh made its own last time are copied into rather than
+	// let go of and made again; otherwise it's ShareData.
+	void ResetVertices(const TriMesh &mesh);
+
+	dword GetRevision() const;
+
+	// Reorders the triangles for the post transform vertex cache, then the
+	// vertices in the order the triangles first use them. The average number
+	// of vertices transformed per triangle before and after (ACMR) goes to
+	// the pointers given.
+	void OptimizeVertexOrder(float *AcmrBefore = 0, float *AcmrAfter = 0);
 
 	void CalculateNormals();
 	void CalculateNormalsFast();
-	//void CalculateEdges();
 };
 
 #endif	// _3DGEOM_H_
\ No newline at end of file
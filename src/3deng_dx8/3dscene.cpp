@@ -1,5 +1,7 @@
 #include <string>
+#include <vector>
 #include "3dscene.h"
+#include "threadpool.h"
 
 using std::string;
 
@@ -8,18 +10,31 @@ Scene::Scene(GraphicsContext *gc) {
 
 	ActiveCamera = 0;
 	Shadows = false;
+	ShadowTolerance = 0.0f;
+	ShadowRebuilds = 0;
 	LightHalos = false;
 	HaloSize = 10.0f;
 	UseFog = false;
 
 	memset(lights, 0, 8 * sizeof(Light*));
 
+	for(int i=0; i<8; i++) {
+		ShadowBatches[i].vb = 0;
+		ShadowBatches[i].capacity = 0;
+		ShadowBatches[i].VertexCount = 0;
+		ShadowBatches[i].valid = false;
+	}
+
 	AmbientLight = Color(0.0f, 0.0f, 0.0f);
 	ManageData = true;
 }
 
 Scene::~Scene() {
 
+	for(int i=0; i<8; i++) {
+		if(ShadowBatches[i].vb) ShadowBatches[i].vb->Release();
+	}
+
 	if(ManageData) {
 		std::list<Object*>::iterator obj = objects.begin();
 		while(obj != objects.end()) {
@@ -39,11 +54,6 @@ Scene::~Scene() {
 		while(citer != curves.end()) {
 			delete *citer++;
 		}
-
-		std::list<ShadowVolume>::iterator sv = StaticShadowVolumes.begin();
-		while(sv != StaticShadowVolumes.end()) {
-			delete (*sv++).shadow_mesh;
-		}
 	}
 
 }
@@ -61,6 +71,7 @@ void Scene::AddLight(Light *light) {
 	for(int i=0; i<8; i++) {
 		if(!lights[i]) {
 			lights[i] = light;
+			ShadowBatches[i].valid = false;
 			break;
 		}
 	}
@@ -75,10 +86,31 @@ void Scene::AddObject(Object *obj) {
 }
 
 void Scene::AddStaticShadowVolume(TriMesh *mesh, const Light *light) {
-	ShadowVolume svol;
-	svol.shadow_mesh = mesh;
+	StaticShadowVolumes.push_back(ShadowVolume());
+	ShadowVolume &svol = StaticShadowVolumes.back();
 	svol.light = light;
-	StaticShadowVolumes.push_back(svol);
+
+	// only the positions are kept
+	const Vertex *varray = mesh->GetVertexArray();
+	svol.pos.resize(mesh->GetVertexCount());
+	for(dword i=0; i<mesh->GetVertexCount(); i++) {
+		svol.pos[i] = varray[i].pos;
+	}
+	delete mesh;
+
+	for(int i=0; i<8; i++) {
+		ShadowBatches[i].valid = false;
+	}
+}
+
+void Scene::AddStaticShadowVolume(Object *caster, const Light *light) {
+	StaticShadowVolumes.push_back(ShadowVolume());
+	StaticShadowVolumes.back().light = light;
+	CreateStaticShadowVolume(*caster->GetTriMesh(), light, caster->GetWorldTransform(), &StaticShadowVolumes.back().pos);
+
+	for(int i=0; i<8; i++) {
+		ShadowBatches[i].valid = false;
+	}
 }
 
 void Scene::AddCurve(Curve *curve) {
@@ -101,6 +133,7 @@ void Scene::RemoveLight(const Light *light) {
 	for(int i=0; i<8; i++) {
 		if(light = lights[i]) {
 			lights[i] = 0;
+			ShadowBatches[i].valid = false;
 			return;
 		}
 	}
@@ -146,6 +179,18 @@ std::list<Object*> *Scene::GetObjectsList() {
 	return &objects;
 }
 
+std::list<Camera*> *Scene::GetCamerasList() {
+	return &cameras;
+}
+
+std::list<Curve*> *Scene::GetCurvesList() {
+	return &curves;
+}
+
+Light **Scene::GetLightsArray() {
+	return lights;
+}
+
 
 void Scene::SetActiveCamera(Camera *cam) {
 	ActiveCamera = cam;
@@ -159,6 +204,14 @@ void Scene::SetShadows(bool enable) {
 	Shadows = enable;
 }
 
+void Scene::SetShadowTolerance(float tolerance) {
+	ShadowTolerance = tolerance;
+}
+
+int Scene::GetShadowRebuildCount() const {
+	return ShadowRebuilds;
+}
+
 void Scene::SetHaloDrawing(bool enable) {
 	LightHalos = enable;
 }
@@ -196,18 +249,113 @@ void Scene::SetupLights() const {
 }
 
 
+void Scene::UpdateShadowBatch(int light, int slight) const {
+	ShadowBatch &batch = ShadowBatches[light];
+
+	// still good if the objects with volumes are the ones it was made from,
+	// in the same order, and none of their volumes changed since
+	if(batch.valid) {
+		size_t r = 0;
+		std::list<Object*>::const_iterator iter = objects.begin();
+		while(iter != objects.end()) {
+			const Object *obj = *iter++;
+			if(!obj->GetShadowVolume(slight)) continue;
+
+			if(r == batch.ranges.size() || batch.ranges[r].obj != obj || batch.ranges[r].revision != obj->GetShadowRevision()) {
+				batch.valid = false;
+				break;
+			}
+			r++;
+		}
+		if(r != batch.ranges.size()) batch.valid = false;
+	}
+	if(batch.valid) return;
+
+	batch.ranges.clear();
+	dword count = 0;
+
+	std::list<Object*>::const_iterator iter = objects.begin();
+	while(iter != objects.end()) {
+		const Object *obj = *iter++;
+		const std::vector<Vector3> *vol = obj->GetShadowVolume(slight);
+		if(!vol) continue;
+
+		ShadowRange range;
+		range.obj = obj;
+		range.revision = obj->GetShadowRevision();
+		range.start = count;
+		range.count = (dword)vol->size();
+		batch.ranges.push_back(range);
+		count += range.count;
+	}
+
+	std::list<ShadowVolume>::const_iterator sv = StaticShadowVolumes.begin();
+	while(sv != StaticShadowVolumes.end()) {
+		if(sv->light == lights[light]) count += (dword)sv->pos.size();
+		sv++;
+	}
+
+	batch.VertexCount = 0;
+
+	// grow the buffer with some room to spare, volumes change size as things move
+	if(count > batch.capacity) {
+		if(batch.vb) batch.vb->Release();
+		batch.vb = 0;
+		batch.capacity = count + count / 2;
+		if(gc->D3DDevice->CreateVertexBuffer(batch.capacity * sizeof(Vector3), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, PositionVertexFormat, D3DPOOL_DEFAULT, &batch.vb) != D3D_OK) {
+			batch.vb = 0;
+			batch.capacity = 0;
+			return;
+		}
+	}
+
+	if(count) {
+		Vector3 *dest;
+		if(batch.vb->Lock(0, count * sizeof(Vector3), (byte**)&dest, D3DLOCK_DISCARD) != D3D_OK) return;
+
+		iter = objects.begin();
+		while(iter != objects.end()) {
+			const std::vector<Vector3> *vol = (*iter++)->GetShadowVolume(slight);
+			if(vol && !vol->empty()) {
+				memcpy(dest, &(*vol)[0], vol->size() * sizeof(Vector3));
+				dest += vol->size();
+			}
+		}
+
+		sv = StaticShadowVolumes.begin();
+		while(sv != StaticShadowVolumes.end()) {
+			if(sv->light == lights[light] && !sv->pos.empty()) {
+				memcpy(dest, &sv->pos[0], sv->pos.size() * sizeof(Vector3));
+				dest += sv->pos.size();
+			}
+			sv++;
+		}
+
+		batch.vb->Unlock();
+	}
+
+	batch.VertexCount = count;
+	batch.valid = true;
+}
+
 void Scene::RenderShadows() const {
 	
 	for(int i=0, slight=0; i<8; i++) {
 		if(!lights[i] || !lights[i]->GetShadowCasting()) continue;
 
+		UpdateShadowBatch(i, slight);
+		const ShadowBatch &batch = ShadowBatches[i];
+
 		// disable shadow casting light and render the scene (first pass)
 		gc->SetAlphaBlending(true);
 		gc->D3DDevice->LightEnable(i, false);
 		std::list<Object*>::const_iterator iter = objects.begin();
+		std::vector<byte>::const_iterator mask = LightMasks.begin();
 		while(iter != objects.end()) {
 			Object *obj = *iter++;
-			obj->Render();
+			// out of reach of all the shadow casting lights, it's drawn
+			// without the stencil test afterwards anyway
+			if(*mask++) obj->Render();
 		}
 		gc->D3DDevice->LightEnable(i, true);
 		gc->SetAlphaBlending(false);
@@ -221,55 +369,15 @@ void Scene::RenderShadows() const {
 		gc->SetStencilFunc(CMP_ALWAYS);
 		gc->SetStencilOp(SOP_KEEP, SOP_KEEP, SOP_INC);
 
-		iter = objects.begin();
-		while(iter != objects.end()) {
-			Object *obj = *iter++;
-			TriMesh *mesh = obj->GetShadowVolume(slight);
-			if(mesh) {
-				gc->SetWorldMatrix(obj->GetWorldTransform());
-				gc->Draw(const_cast<Vertex*>(mesh->GetVertexArray()), mesh->GetVertexCount());
-
-				// back faces pass
-				//gc->SetFrontFace(CounterClockwise);
-				//gc->SetStencilOp(SOP_KEEP, SOP_KEEP, SOP_DEC);
-
-				//gc->Draw(const_cast<Vertex*>(mesh->GetVertexArray()), mesh->GetVertexCount());
-			}
-		}
-
-		// static shadow volumes
+		// all the volumes are in world space
 		gc->SetWorldMatrix(Matrix4x4());
-		std::list<ShadowVolume>::const_iterator shadow_iter = StaticShadowVolumes.begin();
-		while(shadow_iter != StaticShadowVolumes.end()) {
-			if(shadow_iter->light == lights[i]) {
-				gc->Draw(const_cast<Vertex*>(shadow_iter->shadow_mesh->GetVertexArray()), shadow_iter->shadow_mesh->GetVertexCount());
-			}
-			shadow_iter++;
-		}
+		if(batch.VertexCount) gc->DrawPositions(batch.vb, 0, batch.VertexCount);
 
 		// back faces pass
 		gc->SetFrontFace(CounterClockwise);
 		gc->SetStencilOp(SOP_KEEP, SOP_KEEP, SOP_DEC);
 
-		iter = objects.begin();
-		while(iter != objects.end()) {
-			Object *obj = *iter++;
-			TriMesh *mesh = obj->GetShadowVolume(slight);
-			if(mesh) {
-				gc->SetWorldMatrix(obj->GetWorldTransform());
-				gc->Draw(const_cast<Vertex*>(mesh->GetVertexArray()), mesh->GetVertexCount());
-			}
-		}
-
-		// static shadow volumes
-		gc->SetWorldMatrix(Matrix4x4());
-		shadow_iter = StaticShadowVolumes.begin();
-		while(shadow_iter != StaticShadowVolumes.end()) {
-			if(shadow_iter->light == lights[i]) {
-				gc->Draw(const_cast<Vertex*>(shadow_iter->shadow_mesh->GetVertexArray()), shadow_iter->shadow_mesh->GetVertexCount());
-			}
-			shadow_iter++;
-		}
+		if(batch.VertexCount) gc->DrawPositions(batch.vb, 0, batch.VertexCount);
 
 		gc->SetFrontFace(Clockwise);
 
@@ -288,6 +396,24 @@ void Scene::RenderShadows() const {
 	}
 }
 
+struct ShadowJob {
+	Object *obj;
+	int index;
+	const Light *light;
+	Matrix4x4 XForm;
+};
+
+static void BuildShadow(int index, void *data) {
+	ShadowJob *job = (ShadowJob*)data + index;
+	job->obj->RebuildShadow(job->index, job->light, job->XForm);
+}
+
+// whether the light gets to anything inside the sphere
+static bool LightReaches(const Light *light, const Vector3 &center, float radius) {
+	if(light->GetType() == LTDir) return true;
+	return (center - light->GetPosition()).Length() < light->GetRange() + radius;
+}
+
 void Scene::Render() const {
 	gc->SetAmbientLight(AmbientLight);
 
@@ -319,12 +445,50 @@ void Scene::Render() const {
 		}
 		int ShadowCasterCount = (int)(lptr - ShadowCasters);
 
+		// gather the volumes that have to be remade, each one writes only to
+		// its own slot in its caster, so they're all built at once. Objects
+		// out of a light's range don't cast a shadow from it, and the ones
+		// no shadow casting light reaches don't receive any either.
+		std::vector<ShadowJob> jobs;
+		LightMasks.resize(objects.size());
+		std::vector<byte>::iterator mask = LightMasks.begin();
 		std::list<Object *>::const_iterator iter = objects.begin();
 		while(iter != objects.end()) {
 			Object *obj = *iter++;
+
+			Vector3 center;
+			float radius;
+			obj->GetBoundingSphere(&center, &radius);
+
+			bool reach[8];
+			*mask = 0;
+			for(int i=0; i<ShadowCasterCount; i++) {
+				reach[i] = LightReaches(ShadowCasters[i], center, radius);
+				if(reach[i]) *mask |= 1 << i;
+			}
+			mask++;
 			
 			if(obj->GetShadowCasting()) {
-                obj->CalculateShadows((const Light**)ShadowCasters, ShadowCasterCount);
+				int stale[8];
+				int count = obj->FindStaleShadows((const Light**)ShadowCasters, ShadowCasterCount, ShadowTolerance, stale, reach);
+
+				ShadowJob job;
+				job.obj = obj;
+				job.XForm = obj->GetWorldTransform();
+				for(int i=0; i<count; i++) {
+					job.index = stale[i];
+					job.light = ShadowCasters[stale[i]];
+					jobs.push_back(job);
+				}
+			}
+		}
+
+		ShadowRebuilds = (int)jobs.size();
+		if(jobs.size() > 1 && gc->workers) {
+			gc->workers->ParallelFor((int)jobs.size(), BuildShadow, &jobs[0]);
+		} else {
+			for(int i=0; i<(int)jobs.size(); i++) {
+				BuildShadow(i, &jobs[0]);
 			}
 		}
 
@@ -336,20 +500,27 @@ void Scene::Render() const {
 	 * used to split them during loading? no idea.
 	 */
 	// render opaque objects
+	bool stencil = Shadows;
 	std::list<Object *>::const_iterator iter = objects.begin();
+	std::vector<byte>::const_iterator mask = LightMasks.begin();
 	while(iter != objects.end()) {
 		Object *obj = *iter++;
+		bool lit = !Shadows || *mask++;
 
 		if(obj->material.Alpha > 0.991f && !obj->material.HasTransparentTex) {
+			if(Shadows && lit != stencil) gc->SetStencilBuffering(stencil = lit);
 			obj->Render();
 		}
 	}
 	// render transparent objects
 	iter = objects.begin();
+	mask = LightMasks.begin();
 	while(iter != objects.end()) {
 		Object *obj = *iter++;
+		bool lit = !Shadows || *mask++;
 
 		if(!(obj->material.Alpha > 0.991f && !obj->material.HasTransparentTex)) {
+			if(Shadows && lit != stencil) gc->SetStencilBuffering(stencil = lit);
 			obj->SetWriteZBuffer(false);
 			obj->Render();
 		}
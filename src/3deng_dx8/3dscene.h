@@ -2,6 +2,7 @@
 #define _3DSCENE_H_
 
 #include <list>
+#include <vector>
 #include "3dengine.h"
 #include "camera.h"
 #include "lights.h"
@@ -9,10 +10,28 @@
 #include "curves.h"
 
 struct ShadowVolume {
-	TriMesh *shadow_mesh;
+	std::vector<Vector3> pos;	// world space
 	const Light *light;
 };
 
+// the part of a ShadowBatch that came from one object
+struct ShadowRange {
+	const Object *obj;
+	dword revision;		// of the object's volumes when they were copied
+	dword start, count;
+};
+
+// All the shadow volumes of a light in one vertex buffer of positions, so
+// each stencil pass is a single draw. The dynamic objects' volumes come
+// first, in ranges, the static ones after them.
+struct ShadowBatch {
+	VertexBuffer *vb;
+	dword capacity;		// in positions
+	dword VertexCount;
+	std::vector<ShadowRange> ranges;
+	bool valid;
+};
+
 class Scene {
 private:
 	GraphicsContext *gc;
@@ -27,6 +46,10 @@ private:
 	Camera *ActiveCamera;
 
 	bool Shadows;
+	float ShadowTolerance;
+	mutable int ShadowRebuilds;
+	mutable ShadowBatch ShadowBatches[8];
+	mutable std::vector<byte> LightMasks;	// per object, a bit for each shadow casting light reaching it
 	bool LightHalos;
 	float HaloSize;
 
@@ -47,6 +70,7 @@ public:
 	void AddLight(Light *light);
 	void AddObject(Object *obj);
 	void AddStaticShadowVolume(TriMesh *mesh, const Light *light);
+	void AddStaticShadowVolume(Object *caster, const Light *light);	// cached, for casters that never move
 	void AddCurve(Curve *curve);
 
 	void RemoveObject(const Object *obj);
@@ -58,11 +82,17 @@ public:
 	Curve *GetCurve(const char *name);
 
 	std::list<Object*> *GetObjectsList();
+	std::list<Camera*> *GetCamerasList();
+	std::list<Curve*> *GetCurvesList();
+	Light **GetLightsArray();	// 8 slots, unused ones are null
 
 	void SetActiveCamera(Camera *cam);
 	Camera *GetActiveCamera() const;
 
 	void SetShadows(bool enable);
+	// how far casters and lights may move before their volumes are remade
+	void SetShadowTolerance(float tolerance);
+	int GetShadowRebuildCount() const;	// volumes remade by the last Render
 	void SetHaloDrawing(bool enable);
 	void SetHaloSize(float size);
 	void SetAmbientLight(Color ambient);
@@ -72,6 +102,9 @@ public:
 	// render states
 	void SetupLights() const;
 
+	// brings the light's batch up to date with the object volumes
+	void UpdateShadowBatch(int light, int slight) const;
+
 	void RenderShadows() const;
 	void Render() const;
 };
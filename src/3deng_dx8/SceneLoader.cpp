@@ -1,32 +1,85 @@
 //#include <fstream>
 #include <windows.h>
 #include <string>
+#include <vector>
+#include <utility>
 #include <cassert>
 #include <cctype>
 #include "sceneloader.h"
 #include "3dschunks.h"
 #include "typedefs.h"
+#include "mappedfile.h"
+#include "packfile.h"
+#include "datacache.h"
+#include "timing.h"
+#include "n3sloader.h"
+#include "threads.h"
+#include "meshopt.h"
+#include <sys/types.h>
+#include <sys/stat.h>
 
 using std::ifstream;
 using std::string;
 
-namespace SceneLoader {
-    GraphicsContext *gc;
-	dword ReadCounter;
-	Material *mat;
-	dword MatCount;
+using namespace SceneLoader;
 
-	bool eof = false;
+// An open 3ds file and the state of reading it. With file mapping enabled the
+// whole file is mapped once and the readers below just walk a pointer through
+// it, otherwise every value is fetched with its own ReadFile call as in the
+// old loader. Files in the data pack are always read through a pointer.
+struct SceneFile {
+	const Context *ctx;
+	MappedFile map;
+	std::vector<byte> PackData;
+	const byte *ptr, *end;
+	dword size;
+	HANDLE handle;
 
-	string datapath = "";
+	dword ReadCounter;			// bytes read of the chunk being parsed
+	bool eof;
+	std::vector<Material> mats;	// materials read so far
 
-	string SceneFileName;
-	string ObjectName;
+	SceneFile(const Context *ctx) : ctx(ctx), ptr(0), end(0), size(0), handle(INVALID_HANDLE_VALUE), ReadCounter(0), eof(false) {}
+	~SceneFile() { Close(); }
 
-	bool SaveNormalFile = false;
+	bool Open(const char *fname);
+	void Close();
+	bool IsMapped() const { return ptr != 0; }
+	dword GetSize();
+};
+
+bool SceneFile::Open(const char *fname) {
+	Close();
+	const PackFile *pack = packfile::GetDataPack();
+	if(pack && (ptr = pack->Read(fname, &size, &PackData))) {
+		end = ptr + size;
+	} else if(ctx->GetFileMapping()) {
+		if(!map.Open(fname)) return false;
+		ptr = map.GetData();
+		size = map.GetSize();
+		end = ptr + size;
+	} else {
+		handle = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL);
+		if(handle == INVALID_HANDLE_VALUE) return false;
+	}
+	eof = false;
+	ReadCounter = 0;
+	return true;
 }
 
-using namespace SceneLoader;
+void SceneFile::Close() {
+	map.Close();
+	PackData.clear();
+	ptr = end = 0;
+	size = 0;
+	if(handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+	handle = INVALID_HANDLE_VALUE;
+}
+
+dword SceneFile::GetSize() {
+	if(IsMapped()) return size;
+	return GetFileSize(handle, 0);
+}
 
 struct ChunkHeader {
 	ChunkID id;
@@ -50,45 +103,182 @@ struct TexMap {
 	Vector2 scale;
 };
 
+// material references are resolved after the whole file has been read,
+// so materials and objects can be picked up in the same pass
+typedef std::vector<std::pair<Object*, string> > MaterialBindings;
+
 const dword HeaderSize = 6;
 
 enum {OBJ_MESH, OBJ_PTLIGHT, OBJ_SPLIGHT, OBJ_CAMERA, OBJ_CURVE};
 
 // local function prototypes
-byte ReadByte(HANDLE file);
-word ReadWord(HANDLE file);
-dword ReadDword(HANDLE file);
-float ReadFloat(HANDLE file);
-Vector3 ReadVector(HANDLE file, bool FlipYZ = true);
-string ReadString(HANDLE file);
-Color ReadColor(HANDLE file);
-Percent ReadPercent(HANDLE file);
-ChunkHeader ReadChunkHeader(HANDLE file);
-void SkipChunk(HANDLE file, const ChunkHeader &chunk);
-void SkipBytes(HANDLE file, dword bytes);
+void ReadBlock(SceneFile &file, void *dest, dword bytes);
+byte ReadByte(SceneFile &file);
+word ReadWord(SceneFile &file);
+dword ReadDword(SceneFile &file);
+float ReadFloat(SceneFile &file);
+Vector3 ReadVector(SceneFile &file, bool FlipYZ = true);
+string ReadString(SceneFile &file);
+Color ReadColor(SceneFile &file);
+Percent ReadPercent(SceneFile &file);
+ChunkHeader ReadChunkHeader(SceneFile &file);
+void SkipChunk(SceneFile &file, const ChunkHeader &chunk);
+void SkipBytes(SceneFile &file, dword bytes);
+
+void ReadPositions(SceneFile &file, Vertex *varray, dword count);
+void ReadFaces(SceneFile &file, Triangle *tarray, dword count);
+void ReadTexCoords(SceneFile &file, Vertex *varray, dword count);
+void ReadSmoothingGroups(SceneFile &file, const ChunkHeader &chunk, Triangle *tarray, dword count);
+bool CheckFaces(const Triangle *tarray, dword TriCount, dword VertexCount);
+void WeldMesh(Vertex **varray, Triangle *tarray, dword *VertexCount, dword TriCount);
+
+int ReadObject(SceneFile &file, const ChunkHeader &ch, void **obj, string *MatName = 0);
+int ReadLight(SceneFile &file, const ChunkHeader &ch, Light **lt);
+Material ReadMaterial(SceneFile &file, const ChunkHeader &ch);
+TexMap ReadTextureMap(SceneFile &file, const ChunkHeader &ch);
+
+Texture *LoadMap(SceneFile &file, const string &fname);
+Material *FindMaterial(std::vector<Material> &mats, const string &name);
+void BindMaterials(const MaterialBindings &bindings, std::vector<Material> &mats);
+
+bool GetFileStamp(const char *fname, dword *size, dword *time);
+void CalculateNormals(const std::vector<Object*> &objects, bool SaveNormals);
+
+
+Context::Context(GraphicsContext *gc) {
+	this->gc = gc;
+	SaveNormals = false;
+	UseFileMapping = true;
+	SaveCompiledScene = false;
+	LoadCompiledScene = true;
+	DeferTextures = false;
+	DetailLevels = 1;
+	OptimizeMeshes = false;
+	OptimizedTris = 0;
+	AcmrBefore = AcmrAfter = 0.0;
+}
+
+void Context::SetGraphicsContext(GraphicsContext *gfx) {
+	gc = gfx;
+}
+
+void Context::SetDataPath(const char *path) {
+	datapath = path;
+}
 
-int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj);
-int ReadLight(HANDLE file, const ChunkHeader &ch, Light **lt);
-Material ReadMaterial(HANDLE file, const ChunkHeader &ch);
-TexMap ReadTextureMap(HANDLE file, const ChunkHeader &ch);
+void Context::SetNormalFileSaving(bool enable) {
+	SaveNormals = enable;
+}
+
+void Context::SetFileMapping(bool enable) {
+	UseFileMapping = enable;
+}
 
-Material *FindMaterial(string name);
+void Context::SetSceneCompiling(bool enable) {
+	SaveCompiledScene = enable;
+}
 
-bool LoadNormalsFromFile(const char *fname, Scene *scene);
-void SaveNormalsToFile(const char *fname, Scene *scene);
+void Context::SetTextureDeferring(bool enable) {
+	DeferTextures = enable;
+}
 
+void Context::SetDetailLevels(byte levels) {
+	DetailLevels = levels ? levels : 1;
+}
 
-void SceneLoader::SetGraphicsContext(GraphicsContext *gfx) {
-	gc = gfx;
+void Context::SetMeshOptimization(bool enable) {
+	OptimizeMeshes = enable;
 }
 
+GraphicsContext *Context::GetGraphicsContext() const {
+	return gc;
+}
+
+const string &Context::GetDataPath() const {
+	return datapath;
+}
+
+bool Context::GetFileMapping() const {
+	return UseFileMapping;
+}
+
+bool Context::GetTextureDeferring() const {
+	return DeferTextures;
+}
+
+byte Context::GetDetailLevels() const {
+	return DetailLevels;
+}
+
+dword Context::GetVertexCacheStats(float *before, float *after) const {
+	*before = OptimizedTris ? (float)(AcmrBefore / OptimizedTris) : 0.0f;
+	*after = OptimizedTris ? (float)(AcmrAfter / OptimizedTris) : 0.0f;
+	return OptimizedTris;
+}
+
+// before the normals, which are cached by the vertex order
+void Context::OptimizeVertexOrder(const std::vector<Object*> &objects) {
+	for(size_t i=0; i<objects.size(); i++) {
+		TriMesh *mesh = objects[i]->GetTriMesh();
+		dword TriCount = mesh->GetTriangleCount();
+
+		float before, after;
+		mesh->OptimizeVertexOrder(&before, &after);
+		AcmrBefore += before * TriCount;
+		AcmrAfter += after * TriCount;
+		OptimizedTris += TriCount;
+	}
+}
+
+
+// the old global interface, used by the main thread
+Context *SceneLoader::GetDefaultContext() {
+	static Context DefaultContext;
+	return &DefaultContext;
+}
+
+void SceneLoader::SetGraphicsContext(GraphicsContext *gfx) {
+	GetDefaultContext()->SetGraphicsContext(gfx);
+}
 
 void SceneLoader::SetDataPath(const char *path) {
-	datapath = path;
+	GetDefaultContext()->SetDataPath(path);
 }
 
 void SceneLoader::SetNormalFileSaving(bool enable) {
-	SaveNormalFile = enable;
+	GetDefaultContext()->SetNormalFileSaving(enable);
+}
+
+void SceneLoader::SetFileMapping(bool enable) {
+	GetDefaultContext()->SetFileMapping(enable);
+}
+
+void SceneLoader::SetSceneCompiling(bool enable) {
+	GetDefaultContext()->SetSceneCompiling(enable);
+}
+
+void SceneLoader::SetMeshOptimization(bool enable) {
+	GetDefaultContext()->SetMeshOptimization(enable);
+}
+
+bool SceneLoader::LoadObject(const char *fname, const char *ObjectName, Object **obj) {
+	return GetDefaultContext()->LoadObject(fname, ObjectName, obj);
+}
+
+bool SceneLoader::LoadScene(const char *fname, Scene **scene) {
+	return GetDefaultContext()->LoadScene(fname, scene);
+}
+
+bool SceneLoader::LoadMaterials(const char *fname, Material **materials) {
+	return GetDefaultContext()->LoadMaterials(fname, materials);
+}
+
+bool SceneLoader::LoadScenes(const char **fnames, int count, Scene **scenes) {
+	return GetDefaultContext()->LoadScenes(fnames, count, scenes);
+}
+
+bool SceneLoader::BenchmarkLoad(const char *fname, int iterations, dword *MappedTime, dword *StreamedTime, dword *CompiledTime) {
+	return GetDefaultContext()->BenchmarkLoad(fname, iterations, MappedTime, StreamedTime, CompiledTime);
 }
 
 
@@ -100,35 +290,43 @@ void SceneLoader::SetNormalFileSaving(bool enable) {
 // the data from specified file       //
 ////////////////////////////////////////
 
-bool SceneLoader::LoadScene(const char *fname, Scene **scene) {
+bool Context::LoadScene(const char *fname, Scene **scene) {
 	if(!gc) return false;
 
-	if(!LoadMaterials(fname, &mat)) return false;
+	// use the compiled scene instead, if it was made from this version of the file
+	string CompiledName = string(fname) + string(".n3s");
+	dword SrcSize = 0, SrcTime = 0;
+	bool HaveSource = GetFileStamp(fname, &SrcSize, &SrcTime);
 
-	//ifstream file(fname);
-	//if(!file.is_open()) return false;
-	HANDLE file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL);
-	assert(file != NULL);
-	eof = false;
+	dword CmpSize, CmpTime;
+	if(LoadCompiledScene && n3sfile::GetSourceStamp(CompiledName.c_str(), &CmpSize, &CmpTime)) {
+		if(!HaveSource || (CmpSize == SrcSize && CmpTime == SrcTime)) {
+			if(n3sfile::LoadScene(CompiledName.c_str(), scene, gc, datapath.c_str(), !DeferTextures, DetailLevels)) return true;
+		}
+	}
 
-	SceneFileName = string(fname);
+	SceneFile file(this);
+	if(!file.Open(fname)) return false;
 
 	ChunkHeader chunk;
-	Scene *scn = new Scene(gc);		// new scene instance
 	
 	chunk = ReadChunkHeader(file);
 	if(chunk.id != Chunk_3DSMain) {
-		CloseHandle(file);
 		return false;
 	}
 
-	//while(!file.eof()) {
-	while(!eof) {
+	Scene *scn = new Scene(gc);		// new scene instance
+	std::vector<Object*> objects;
+	MaterialBindings bindings;
+
+	while(!file.eof) {
 
 		chunk = ReadChunkHeader(file);
+		if(file.eof) break;
 
 		void *objptr;
 		int type;
+		string MatName;
 
 		switch(chunk.id) {
 		case Chunk_Main_3DEditor:
@@ -142,13 +340,18 @@ bool SceneLoader::LoadScene(const char *fname, Scene **scene) {
 			// **TODO** find out chunk structure
 			break;
 
+		case Chunk_Edit_Material:
+			file.mats.push_back(ReadMaterial(file, chunk));
+			break;
+
 		case Chunk_Edit_Object:
-			type = ReadObject(file, chunk, &objptr);
+			type = ReadObject(file, chunk, &objptr, &MatName);
 			switch(type) {
 			case OBJ_MESH:
 				{
 					Object *object = (Object*)objptr;
-					scn->AddObject(object);
+					objects.push_back(object);
+					if(!MatName.empty()) bindings.push_back(std::make_pair(object, MatName));
 				}
 				break;
 
@@ -188,61 +391,70 @@ bool SceneLoader::LoadScene(const char *fname, Scene **scene) {
 		}
 	}
 
-	CloseHandle(file);
-	
+	file.Close();
 
-	// check if there is a normals file in the same dir and load them, or else calculate them
-	if(!LoadNormalsFromFile((SceneFileName + string(".normals")).c_str(), scn)) {
-		std::list<Object*>::iterator objiter = scn->GetObjectsList()->begin();
-		while(objiter != scn->GetObjectsList()->end()) {
-			(*objiter++)->GetTriMesh()->CalculateNormals();
-		}
-		if(SaveNormalFile) SaveNormalsToFile((SceneFileName + string(".normals")).c_str(), scn);
+	BindMaterials(bindings, file.mats);
+
+	// objects are added once they have their materials, so that the transparent ones go last
+	for(dword i=0; i<(dword)objects.size(); i++) {
+		scn->AddObject(objects[i]);
 	}
 
+	if(OptimizeMeshes) OptimizeVertexOrder(objects);
+	CalculateNormals(objects, SaveNormals);
+
+	if(SaveCompiledScene) n3sfile::SaveScene(CompiledName.c_str(), scn, SrcSize, SrcTime);
+
 	*scene = scn;
     return true;
 }
 
 
 
-bool SceneLoader::LoadObject(const char *fname, const char *ObjectName, Object **obj) {
+bool Context::LoadObject(const char *fname, const char *ObjectName, Object **obj) {
 	if(!gc) return false;
 
-	if(!LoadMaterials(fname, &mat)) return false;
-
-	//ifstream file(fname);
-	//if(!file.is_open()) return false;
-	HANDLE file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL);
-	assert(file != NULL);
-	eof = false;
+	SceneFile file(this);
+	if(!file.Open(fname)) return false;
 
 	ChunkHeader chunk = ReadChunkHeader(file);
 	if(chunk.id != Chunk_3DSMain) {
-		CloseHandle(file);
 		return false;
 	}
 
-	while(!eof) {
+	Object *found = 0;
+	string FoundMatName;
+
+	while(!file.eof) {
 
 		chunk = ReadChunkHeader(file);
+		if(file.eof) break;
 
 		void *objptr;
 		int type;
+		string MatName;
 
 		switch(chunk.id) {
 		case Chunk_Main_3DEditor:
 			break;	// dont skip
 
+		case Chunk_Edit_Material:
+			file.mats.push_back(ReadMaterial(file, chunk));
+			break;
+
 		case Chunk_Edit_Object:
-			type = ReadObject(file, chunk, &objptr);
+			if(found) {
+				SkipChunk(file, chunk);
+				break;
+			}
+			type = ReadObject(file, chunk, &objptr, &MatName);
 			if(type == OBJ_MESH) {
 				Object *object = (Object*)objptr;
 				if(!strcmp(object->name.c_str(), ObjectName)) {
-					object->GetTriMesh()->CalculateNormals();
-					*obj = object;
-					CloseHandle(file);
-                    return true;
+					found = object;
+					FoundMatName = MatName;
+				} else {
+					delete object;
 				}
 			}
 			break;
@@ -252,79 +464,218 @@ bool SceneLoader::LoadObject(const char *fname, const char *ObjectName, Object *
 		}
 	}
 
-	CloseHandle(file);
-	return false;
-}
-
+	file.Close();
 
+	// materials may follow the object in the file, so keep reading them all
+	if(!found) return false;
 
-bool FindChunk(HANDLE file, word ChunkID) {
-
-	ChunkHeader chunk = ReadChunkHeader(file);
-
-	while(chunk.id != ChunkID) {
-		SkipChunk(file, chunk);
-		chunk = ReadChunkHeader(file);
+	if(!FoundMatName.empty()) {
+		MaterialBindings bindings;
+		bindings.push_back(std::make_pair(found, FoundMatName));
+		BindMaterials(bindings, file.mats);
 	}
 
-	return chunk.id == ChunkID;
+	std::vector<Object*> objects(1, found);
+	if(OptimizeMeshes) OptimizeVertexOrder(objects);
+	CalculateNormals(objects, SaveNormals);
+	*obj = found;
+	return true;
 }
 
 
 
-bool SceneLoader::LoadMaterials(const char *fname, Material **materials) {
+bool Context::LoadMaterials(const char *fname, Material **materials) {
 	if(!materials) return false;
 
-	//ifstream file(fname);
-	//if(!file.is_open()) return false;
-	HANDLE file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL);
-	assert(file != NULL);
-	eof = false;
+	SceneFile file(this);
+	if(!file.Open(fname)) return false;
 
 	ChunkHeader chunk;
 
 	chunk = ReadChunkHeader(file);
 	if(chunk.id != Chunk_3DSMain) {
-		CloseHandle(file);
-		return false;
-	}
-
-	if(!FindChunk(file, Chunk_Main_3DEditor)) {
-		CloseHandle(file);
 		return false;
 	}
 
-	std::vector<Material> mats;
-	
-	while(!eof) {
+	while(!file.eof) {
 
 		chunk = ReadChunkHeader(file);
+		if(file.eof) break;
+
+		if(chunk.id == Chunk_Main_3DEditor) continue;	// dont skip
 
 		if(chunk.id == Chunk_Edit_Material) {
             Material mat = ReadMaterial(file, chunk);
-			mats.push_back(mat);
+			file.mats.push_back(mat);
 		} else {
 			SkipChunk(file, chunk);
 		}
 	}
 
-	MatCount = (dword)mats.size();
+	file.Close();
+
+	dword MatCount = (dword)file.mats.size();
 
 	if(*materials) delete [] *materials;
 	Material *m = new Material[MatCount];
 
 	for(dword i=0; i<MatCount; i++) {
-		m[i] = mats[i];
+		m[i] = file.mats[i];
 	}
 
 	*materials = m;
-
-	CloseHandle(file);
 	return true;
 }
 
 
-TexMap ReadTextureMap(HANDLE file, const ChunkHeader &ch) {
+
+bool Context::BenchmarkLoad(const char *fname, int iterations, dword *MappedTime, dword *StreamedTime, dword *CompiledTime) {
+	// files in the data pack are read from it whatever the mode
+	if(packfile::GetDataPack()) return false;
+
+	bool PrevMapping = UseFileMapping;
+	bool PrevSaveNormals = SaveNormals;
+	bool PrevSaveCompiled = SaveCompiledScene;
+	bool PrevLoadCompiled = LoadCompiledScene;
+
+	// make sure there is an up to date compiled scene to compare against
+	SaveNormals = false;
+	SaveCompiledScene = CompiledTime != 0;
+	LoadCompiledScene = false;
+
+	Scene *scene;
+	bool ok = LoadScene(fname, &scene);
+	if(ok) delete scene;
+	SaveCompiledScene = false;
+
+	// 0: mapped 3ds, 1: streamed 3ds, 2: compiled n3s
+	dword times[3] = {0, 0, 0};
+	int modes = CompiledTime ? 3 : 2;
+	Timer timer;
+
+	for(int i=0; i<iterations && ok; i++) {
+		for(int mode=0; mode<modes && ok; mode++) {
+			UseFileMapping = mode != 1;
+			LoadCompiledScene = mode == 2;
+
+			timer.Start();
+			ok = LoadScene(fname, &scene);
+			times[mode] += timer.GetMilliSec();
+			if(ok) delete scene;
+		}
+	}
+
+	UseFileMapping = PrevMapping;
+	SaveNormals = PrevSaveNormals;
+	SaveCompiledScene = PrevSaveCompiled;
+	LoadCompiledScene = PrevLoadCompiled;
+
+	if(MappedTime) *MappedTime = times[0];
+	if(StreamedTime) *StreamedTime = times[1];
+	if(CompiledTime) *CompiledTime = times[2];
+	return ok;
+}
+
+struct LoadScenesJob {
+	const Context *ctx;
+	const char **fnames;
+	Scene **scenes;
+	volatile long failed;
+};
+
+void LoadSceneThread(int i, void *data) {
+	LoadScenesJob *job = (LoadScenesJob*)data;
+
+	Context ctx = *job->ctx;
+	ctx.SetTextureDeferring(true);
+	if(!ctx.LoadScene(job->fnames[i], &job->scenes[i])) {
+		job->scenes[i] = 0;
+		AtomicIncrement(&job->failed);
+	}
+}
+
+bool Context::LoadScenes(const char **fnames, int count, Scene **scenes) const {
+	if(!gc) return false;
+
+	LoadScenesJob job;
+	job.ctx = this;
+	job.fnames = fnames;
+	job.scenes = scenes;
+	job.failed = 0;
+	ParallelFor(count, LoadSceneThread, &job);
+
+	if(!DeferTextures) {
+		for(int i=0; i<count; i++) {
+			if(scenes[i]) LoadTextures(scenes[i]);
+		}
+	}
+	return !job.failed;
+}
+
+void Context::LoadTextures(Scene *scene) const {
+	std::list<Object*>::iterator iter = scene->GetObjectsList()->begin();
+	while(iter != scene->GetObjectsList()->end()) {
+		LoadTextures(*iter++);
+	}
+}
+
+void Context::LoadTextures(Object *obj) const {
+	if(!gc) return;
+
+	if(obj->GetGraphicsContext() != gc) {
+		obj->SetGraphicsContext(gc);
+		obj->GetTriMesh()->GetVertexBuffer();	// makes both buffers of level 0
+	}
+
+	Material &mat = obj->material;
+	for(int i=0; i<NumberOfTextureTypes; i++) {
+		if(mat.Maps[i] || mat.MapNames[i].empty()) continue;
+		mat.SetTexture(gc->texman->LoadTexture((datapath + mat.MapNames[i]).c_str()), (TextureType)i);
+	}
+
+	// couldn't tell without the texture (which may have come from
+	// RequestTextures), same hack as in ReadMaterial
+	if(mat.Maps[TextureMap] && !mat.MapNames[TextureMap].empty()) {
+		mat.HasTransparentTex = HasTransparency(mat.Maps[TextureMap]);
+	}
+}
+
+void Context::RequestTextures(Scene *scene, TextureGroup *group) const {
+	std::list<Object*>::iterator iter = scene->GetObjectsList()->begin();
+	while(iter != scene->GetObjectsList()->end()) {
+		RequestTextures(*iter++, group);
+	}
+}
+
+void Context::RequestTextures(Object *obj, TextureGroup *group) const {
+	if(!gc) return;
+
+	Material &mat = obj->material;
+	for(int i=0; i<NumberOfTextureTypes; i++) {
+		if(mat.Maps[i] || mat.MapNames[i].empty()) continue;
+		gc->texman->LoadTextureAsync((datapath + mat.MapNames[i]).c_str(), &mat.Maps[i], group);
+	}
+}
+
+void Context::ReleaseTextures(Scene *scene) const {
+	std::list<Object*>::iterator iter = scene->GetObjectsList()->begin();
+	while(iter != scene->GetObjectsList()->end()) {
+		ReleaseTextures(*iter++);
+	}
+}
+
+void Context::ReleaseTextures(Object *obj) const {
+	if(!gc || !DeferTextures) return;
+
+	Material &mat = obj->material;
+	for(int i=0; i<NumberOfTextureTypes; i++) {
+		if(!mat.Maps[i] || mat.MapNames[i].empty()) continue;
+		gc->texman->ReleaseTexture((datapath + mat.MapNames[i]).c_str());
+		mat.Maps[i] = 0;
+	}
+}
+
+TexMap ReadTextureMap(SceneFile &file, const ChunkHeader &ch) {
 	assert(ch.id == Chunk_Mat_TextureMap || ch.id == Chunk_Mat_TextureMap2 || ch.id == Chunk_Mat_OpacityMap || ch.id == Chunk_Mat_BumpMap || ch.id == Chunk_Mat_ReflectionMap || ch.id == Chunk_Mat_SelfIlluminationMap);
 
 	TexMap map;
@@ -370,16 +721,16 @@ TexMap ReadTextureMap(HANDLE file, const ChunkHeader &ch) {
 
 
 
-Material ReadMaterial(HANDLE file, const ChunkHeader &ch) {
+Material ReadMaterial(SceneFile &file, const ChunkHeader &ch) {
 
 	Material mat;
 
 	assert(ch.id == Chunk_Edit_Material);
 
-	ReadCounter = HeaderSize;
+	file.ReadCounter = HeaderSize;
 	dword ChunkSize = ch.size;
 
-	while(ReadCounter < ChunkSize) {
+	while(file.ReadCounter < ChunkSize) {
 		ChunkHeader chunk = ReadChunkHeader(file);
 
 		Percent p;
@@ -431,39 +782,26 @@ Material ReadMaterial(HANDLE file, const ChunkHeader &ch) {
 		case Chunk_Mat_OpacityMap:
 		case Chunk_Mat_SelfIlluminationMap:
 			map = ReadTextureMap(file, chunk);
-			tex = gc->texman->LoadTexture((datapath + map.filename).c_str());
+			tex = LoadMap(file, map.filename);
 			mat.SetTexture(tex, map.type);
+			mat.MapNames[map.type] = map.filename;
 			// RESTORATION: ugh ... (hack)
-			if(chunk.id == Chunk_Mat_TextureMap && tex) {
-				D3DLOCKED_RECT rect;
-				D3DSURFACE_DESC desc;
-
-				tex->GetLevelDesc(0, &desc);
-				if(desc.Format != D3DFMT_A8R8G8B8) break;	// no alpha channel
-
-				if(tex->LockRect(0, &rect, 0, D3DLOCK_READONLY) != D3D_OK) {
-					break;
-				}
-				unsigned int *pix = (unsigned int*)rect.pBits;
-				for(int i=0; i<(int)(desc.Height * desc.Width); i++) {
-					if((*pix++ >> 24) < 0xff) {
-						mat.HasTransparentTex = true;
-						break;
-					}
-				}
-				tex->UnlockRect(0);
+			if(chunk.id == Chunk_Mat_TextureMap && HasTransparency(tex)) {
+				mat.HasTransparentTex = true;
 			}
             break;
 
 		case Chunk_Mat_ReflectionMap:
 			map = ReadTextureMap(file, chunk);
-			mat.SetTexture(gc->texman->LoadTexture((datapath + map.filename).c_str()), map.type);
+			mat.SetTexture(LoadMap(file, map.filename), map.type);
+			mat.MapNames[map.type] = map.filename;
 			mat.EnvBlend = map.intensity;
             break;
 
 		case Chunk_Mat_BumpMap:
 			map = ReadTextureMap(file, chunk);
-			mat.SetTexture(gc->texman->LoadTexture((datapath + map.filename).c_str()), map.type);
+			mat.SetTexture(LoadMap(file, map.filename), map.type);
+			mat.MapNames[map.type] = map.filename;
 			mat.BumpIntensity = map.intensity;
             break;
 
@@ -480,71 +818,49 @@ Material ReadMaterial(HANDLE file, const ChunkHeader &ch) {
 
 
 ////////////////////////////////////////////////////
-byte ReadByte(HANDLE file) {
-	byte val;
-	dword numread;
-	ReadFile(file, &val, sizeof(byte), &numread, NULL);
-	if(numread < sizeof(byte)) eof = true;
-	ReadCounter++;
-	return val;
-}
-
-word ReadWord(HANDLE file) {
-	word val;
-	dword numread;
-	ReadFile(file, &val, sizeof(word), &numread, NULL);
-	if(numread < sizeof(word)) eof = true;
-	ReadCounter += sizeof(word);
-	return val;
-}
-
-dword ReadDword(HANDLE file) {
-	dword val;
-	dword numread;
-	ReadFile(file, &val, sizeof(dword), &numread, NULL);
-	if(numread < sizeof(dword)) eof = true;
-	ReadCounter += sizeof(dword);
-	return val;
+void ReadBlock(SceneFile &file, void *dest, dword bytes) {
+	if(file.IsMapped()) {
+		if((dword)(file.end - file.ptr) < bytes) {
+			file.eof = true;
+			memset(dest, 0, bytes);
+			file.ptr = file.end;
+		} else {
+			memcpy(dest, file.ptr, bytes);
+			file.ptr += bytes;
+		}
+	} else {
+		dword numread;
+		ReadFile(file.handle, dest, bytes, &numread, NULL);
+		if(numread < bytes) file.eof = true;
+	}
+	file.ReadCounter += bytes;
 }
 
-float ReadFloat(HANDLE file) {
-	float val;
-	dword numread;
-	ReadFile(file, &val, sizeof(float), &numread, NULL);
-	if(numread < sizeof(float)) eof = true;
-	ReadCounter += sizeof(float);
-	return val;
-}
-/*
-byte ReadByte(HANDLE file) {
+byte ReadByte(SceneFile &file) {
 	byte val;
-	file.read((char*)&val, 1);
-	ReadCounter++;
+	ReadBlock(file, &val, sizeof(byte));
 	return val;
 }
 
-word ReadWord(HANDLE file) {
+word ReadWord(SceneFile &file) {
 	word val;
-	file.read((char*)&val, sizeof(word));
-	ReadCounter += sizeof(word);
+	ReadBlock(file, &val, sizeof(word));
 	return val;
 }
 
-dword ReadDword(HANDLE file) {
+dword ReadDword(SceneFile &file) {
 	dword val;
-	file.read((char*)&val, sizeof(dword));
-	ReadCounter += sizeof(dword);
+	ReadBlock(file, &val, sizeof(dword));
 	return val;
 }
 
-float ReadFloat(HANDLE file) {
+float ReadFloat(SceneFile &file) {
 	float val;
-	file.read((char*)&val, sizeof(float));
-	ReadCounter += sizeof(float);
+	ReadBlock(file, &val, sizeof(float));
 	return val;
 }
-*/
-Vector3 ReadVector(HANDLE file, bool FlipYZ) {
+
+Vector3 ReadVector(SceneFile &file, bool FlipYZ) {
 	Vector3 vector;
 	vector.x = ReadFloat(file);
 	if(!FlipYZ) vector.y = ReadFloat(file);
@@ -553,32 +869,32 @@ Vector3 ReadVector(HANDLE file, bool FlipYZ) {
 	return vector;		
 }
 
-string ReadString(HANDLE file) {
-	string str;
-	char c;
-	while(c = (char)ReadByte(file)) {
-		str.push_back(c);
+string ReadString(SceneFile &file) {
+	if(file.IsMapped()) {
+		const byte *start = file.ptr;
+		while(file.ptr < file.end && *file.ptr) file.ptr++;
+
+		string str((const char*)start, file.ptr - start);
+		if(file.ptr < file.end) {
+			file.ptr++;		// terminator
+		} else {
+			file.eof = true;
+		}
+		file.ReadCounter += (dword)str.size() + 1;
+		return str;
 	}
-	ReadCounter++;
 
-	return str;
-}
-/*
-string ReadString(HANDLE file) {
 	string str;
 	char c;
-	while(c = file.get()) {
+	while(c = (char)ReadByte(file)) {
+		if(file.eof) break;
 		str.push_back(c);
-		ReadCounter++;
 	}
-	str.push_back('\0');
-	ReadCounter++;
 
 	return str;
 }
-*/
 
-Color ReadColor(HANDLE file) {
+Color ReadColor(SceneFile &file) {
 	ChunkHeader chunk = ReadChunkHeader(file);
 	if(chunk.id < 0x0010 || chunk.id > 0x0013) return Color(-1.0f, -1.0f, -1.0f);
 
@@ -598,7 +914,7 @@ Color ReadColor(HANDLE file) {
 	return color;
 }
 
-Percent ReadPercent(HANDLE file) {
+Percent ReadPercent(SceneFile &file) {
 	ChunkHeader chunk = ReadChunkHeader(file);
 	Percent p;
 	if(chunk.id != Chunk_PercentInt && chunk.id != Chunk_PercentFloat) return p;
@@ -613,39 +929,206 @@ Percent ReadPercent(HANDLE file) {
 }
 
 
-ChunkHeader ReadChunkHeader(HANDLE file) {
+ChunkHeader ReadChunkHeader(SceneFile &file) {
 	ChunkHeader chunk;
 	chunk.id = (ChunkID)ReadWord(file);
 	chunk.size = ReadDword(file);
 	return chunk;
 }
 
-void SkipChunk(HANDLE file, const ChunkHeader &chunk) {
-	//file.ignore(chunk.size - HeaderSize);
-	SetFilePointer(file, chunk.size - HeaderSize, 0, FILE_CURRENT);
-	ReadCounter += chunk.size - HeaderSize;
+void SkipChunk(SceneFile &file, const ChunkHeader &chunk) {
+	SkipBytes(file, chunk.size > HeaderSize ? chunk.size - HeaderSize : 0);
+}
+
+void SkipBytes(SceneFile &file, dword bytes) {
+	if(file.IsMapped()) {
+		if((dword)(file.end - file.ptr) < bytes) {
+			file.eof = true;
+			file.ptr = file.end;
+		} else {
+			file.ptr += bytes;
+		}
+	} else {
+		SetFilePointer(file.handle, bytes, 0, FILE_CURRENT);
+	}
+	file.ReadCounter += bytes;
+}
+
+// The array readers below copy straight out of the mapped view with a single
+// bounds check per array, falling back to per-value reads when not mapped.
+
+void ReadPositions(SceneFile &file, Vertex *varray, dword count) {
+	const dword stride = 3 * sizeof(float);
+	if(!file.IsMapped() || (dword)(file.end - file.ptr) < count * stride) {
+		for(dword i=0; i<count; i++) {
+			varray[i].pos = ReadVector(file);
+		}
+		return;
+	}
+
+	const byte *src = file.ptr;
+	for(dword i=0; i<count; i++) {
+		float v[3];
+		memcpy(v, src, stride);
+		varray[i].pos = Vector3(v[0], v[2], v[1]);	// flip YZ
+		src += stride;
+	}
+
+	file.ptr = src;
+	file.ReadCounter += count * stride;
+}
+
+void ReadFaces(SceneFile &file, Triangle *tarray, dword count) {
+	const dword stride = 4 * sizeof(word);
+	if(!file.IsMapped() || (dword)(file.end - file.ptr) < count * stride) {
+		for(dword i=0; i<count; i++) {
+			tarray[i].vertices[0] = (Index)ReadWord(file);	// 
+			tarray[i].vertices[2] = (Index)ReadWord(file);	// flip order to CW
+			tarray[i].vertices[1] = (Index)ReadWord(file);	//
+			ReadWord(file);	// discard edge visibility flags
+		}
+		return;
+	}
+
+	const byte *src = file.ptr;
+	for(dword i=0; i<count; i++) {
+		word f[4];
+		memcpy(f, src, stride);
+		tarray[i].vertices[0] = (Index)f[0];
+		tarray[i].vertices[2] = (Index)f[1];	// flip order to CW
+		tarray[i].vertices[1] = (Index)f[2];
+		src += stride;
+	}
+
+	file.ptr = src;
+	file.ReadCounter += count * stride;
+}
+
+void ReadTexCoords(SceneFile &file, Vertex *varray, dword count) {
+	const dword stride = 2 * sizeof(float);
+	if(!file.IsMapped() || (dword)(file.end - file.ptr) < count * stride) {
+		for(dword i=0; i<count; i++) {
+			varray[i].tex[0].u = varray[i].tex[1].u = ReadFloat(file);
+			varray[i].tex[0].v = varray[i].tex[1].v = -ReadFloat(file);
+		}
+		return;
+	}
+
+	const byte *src = file.ptr;
+	for(dword i=0; i<count; i++) {
+		float uv[2];
+		memcpy(uv, src, stride);
+		varray[i].tex[0].u = varray[i].tex[1].u = uv[0];
+		varray[i].tex[0].v = varray[i].tex[1].v = -uv[1];
+		src += stride;
+	}
+
+	file.ptr = src;
+	file.ReadCounter += count * stride;
+}
+
+// one dword of group bits for each face, following the faces
+void ReadSmoothingGroups(SceneFile &file, const ChunkHeader &chunk, Triangle *tarray, dword count) {
+	if(!tarray || chunk.size != HeaderSize + count * sizeof(dword)) {
+		SkipChunk(file, chunk);
+		return;
+	}
+
+	for(dword i=0; i<count; i++) {
+		tarray[i].SmoothingGroup = ReadDword(file);
+	}
 }
 
-void SkipBytes(HANDLE file, dword bytes) {
-	SetFilePointer(file, bytes, 0, FILE_CURRENT);
-	ReadCounter += bytes;
+// every face has to use vertices of the list
+bool CheckFaces(const Triangle *tarray, dword TriCount, dword VertexCount) {
+	for(dword i=0; i<TriCount; i++) {
+		for(int j=0; j<3; j++) {
+			if(tarray[i].vertices[j] >= VertexCount) return false;
+		}
+	}
+	return true;
 }
 
-Material *FindMaterial(string name) {
-	dword i=0;
-	while(i < MatCount) {
-		if(mat[i].name == name) return &mat[i];
-		i++;
+// what two vertices have to share to be welded, the normals are made later
+struct WeldKey {
+	Vector3 pos;
+	TexCoord tex[4];
+};
+
+// Exporters split the vertices wherever the texture coordinates or the
+// smoothing change, and often elsewhere too. Welds the ones that are the same
+// and splits them again only where the smoothing groups of the faces around
+// them have nothing in common, so the normals stay sharp on hard edges and
+// get averaged everywhere else.
+void WeldMesh(Vertex **varray, Triangle *tarray, dword *VertexCount, dword TriCount) {
+	dword count = *VertexCount;
+	if(!count || !TriCount) return;
+
+	std::vector<WeldKey> keys(count);
+	for(dword i=0; i<count; i++) {
+		keys[i].pos = (*varray)[i].pos;
+		memcpy(keys[i].tex, (*varray)[i].tex, sizeof keys[i].tex);
 	}
 
+	std::vector<dword> remap(count), welded(count);
+	dword unique = WeldVertices(&keys[0], count, sizeof(WeldKey), &remap[0]);
+	for(dword i=count; i>0; i--) {
+		welded[remap[i - 1]] = i - 1;	// the first of the ones welded together
+	}
+
+	std::vector<dword> indices(TriCount * 3), groups(TriCount), sources(TriCount * 3);
+	for(dword i=0; i<TriCount; i++) {
+		for(int j=0; j<3; j++) {
+			indices[i * 3 + j] = remap[tarray[i].vertices[j]];
+		}
+		groups[i] = tarray[i].SmoothingGroup;
+	}
+
+	dword NewCount = SplitBySmoothingGroups(&indices[0], TriCount, unique, &groups[0], &sources[0]);
+
+	Vertex *verts = new Vertex[NewCount];
+	for(dword i=0; i<NewCount; i++) {
+		verts[i] = (*varray)[welded[sources[i]]];
+	}
+	for(dword i=0; i<TriCount; i++) {
+		for(int j=0; j<3; j++) {
+			tarray[i].vertices[j] = indices[i * 3 + j];
+		}
+	}
+
+	delete [] *varray;
+	*varray = verts;
+	*VertexCount = NewCount;
+}
+
+// textures are left for Context::LoadTextures when deferring
+Texture *LoadMap(SceneFile &file, const string &fname) {
+	if(file.ctx->GetTextureDeferring()) return 0;
+
+	GraphicsContext *gc = file.ctx->GetGraphicsContext();
+	return gc->texman->LoadTexture((file.ctx->GetDataPath() + fname).c_str());
+}
+
+Material *FindMaterial(std::vector<Material> &mats, const string &name) {
+	for(dword i=0; i<(dword)mats.size(); i++) {
+		if(mats[i].name == name) return &mats[i];
+	}
 	return 0;
 }
 
+void BindMaterials(const MaterialBindings &bindings, std::vector<Material> &mats) {
+	for(dword i=0; i<(dword)bindings.size(); i++) {
+		Material *m = FindMaterial(mats, bindings[i].second);
+		if(m) bindings[i].first->material = *m;
+	}
+}
+
 ///////////////////// Read Object Function //////////////////////
-int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj) {
+int ReadObject(SceneFile &file, const ChunkHeader &ch, void **obj, string *MatName) {
+	GraphicsContext *gc = file.ctx->GetGraphicsContext();
 	if(!obj || !gc) return -1;
 
-	ReadCounter = HeaderSize;	// reset the global read counter
+	file.ReadCounter = HeaderSize;	// reset the global read counter
 
 	string name = ReadString(file);
 
@@ -653,8 +1136,8 @@ int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj) {
 	chunk = ReadChunkHeader(file);
 	if(chunk.id == Chunk_Obj_TriMesh) {
 		// object is a trimesh... load it
-		Vertex *varray;
-		Triangle *tarray;
+		Vertex *varray = 0;
+		Triangle *tarray = 0;
 		dword VertexCount=0, TriCount=0;
 		Material mat;
 		Base base;
@@ -664,53 +1147,57 @@ int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj) {
 
 		dword ObjChunkSize = ch.size;
 
-		while(ReadCounter < ObjChunkSize) {	// make sure we only read subchunks of this object chunk
+		while(file.ReadCounter < ObjChunkSize) {	// make sure we only read subchunks of this object chunk
 			//assert(!file.eof());
-			assert(!eof);
+			assert(!file.eof);
 			chunk = ReadChunkHeader(file);
 
             switch(chunk.id) {
 			case Chunk_TriMesh_VertexList:
 				VertexCount = (dword)ReadWord(file);
+				delete [] varray;
 				varray = new Vertex[VertexCount];
-
-				for(dword i=0; i<VertexCount; i++) {
-					varray[i].pos = ReadVector(file);
-				}
+				ReadPositions(file, varray, VertexCount);
 
 				break;
 
 			case Chunk_TriMesh_FaceDesc:
 				curve = false;	// it is a real object not a curve since it has triangles
 				TriCount = (dword)ReadWord(file);
+				delete [] tarray;
 				tarray = new Triangle[TriCount];
-
-				for(dword i=0; i<TriCount; i++) {
-					tarray[i].vertices[0] = (Index)ReadWord(file);	// 
-					tarray[i].vertices[2] = (Index)ReadWord(file);	// flip order to CW
-					tarray[i].vertices[1] = (Index)ReadWord(file);	//
-					ReadWord(file);	// discard edge visibility flags
-				}
+				ReadFaces(file, tarray, TriCount);
+				// all smooth, unless the file says otherwise
+				for(dword i=0; i<TriCount; i++) tarray[i].SmoothingGroup = 1;
 				break;
 
 			case Chunk_Face_Material:
-				mat = *FindMaterial(ReadString(file));
+				{
+					string name = ReadString(file);
+					if(MatName) {
+						*MatName = name;	// bound by the caller once all materials are read
+					} else {
+						Material *m = FindMaterial(file.mats, name);
+						if(m) mat = *m;
+					}
+				}
 
 				SkipBytes(file, ReadWord(file)<<1);
 				break;
 
 			case Chunk_TriMesh_TexCoords:
-				assert((dword)ReadWord(file) == VertexCount);
-
-				for(dword i=0; i<VertexCount; i++) {
-					varray[i].tex[0].u = varray[i].tex[1].u = ReadFloat(file);
-					varray[i].tex[0].v = varray[i].tex[1].v = -ReadFloat(file);
+				{
+					dword TexCoordCount = (dword)ReadWord(file);
+					if(varray && TexCoordCount == VertexCount) {
+						ReadTexCoords(file, varray, TexCoordCount);
+					} else {
+						SkipBytes(file, TexCoordCount * 2 * sizeof(float));
+					}
 				}
 				break;
 
 			case Chunk_TriMesh_SmoothingGroup:
-				// **TODO** abide by smoothing groups duplicate vertices, weld others etc
-				SkipChunk(file, chunk);
+				ReadSmoothingGroups(file, chunk, tarray, TriCount);
 				break;
 
 			case Chunk_TriMesh_WorldTransform:
@@ -731,10 +1218,19 @@ int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj) {
 			for(dword i=0; i<VertexCount; i++) {
 				spline->AddControlPoint(varray[i].pos);
 			}
+			delete [] varray;
+			delete [] tarray;
 
 			*obj = spline;
 			return OBJ_CURVE;
 		} else {
+			// faces without vertices or the other way around, or faces on vertices
+			// that aren't there, nothing to make of it
+			if(!varray || !tarray || !CheckFaces(tarray, TriCount, VertexCount)) {
+				delete [] varray;
+				delete [] tarray;
+				return -1;
+			}
 
 			base.i.Normalize();
 			base.j.Normalize();
@@ -747,9 +1243,15 @@ int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj) {
 				varray[i].pos.Transform(RotXForm.Transposed());
 			}
 
-            Object *object = new Object(gc);
+			WeldMesh(&varray, tarray, &VertexCount, TriCount);
+
+			// no device work off the main thread, LoadTextures attaches the context
+			GraphicsContext *ObjectContext = file.ctx->GetTextureDeferring() ? 0 : gc;
+            Object *object = new Object(ObjectContext, file.ctx->GetDetailLevels());
 			object->name = name;
 			object->GetTriMesh()->SetData(varray, tarray, VertexCount, TriCount);
+			delete [] varray;
+			delete [] tarray;
 			object->material = mat;
 			object->SetRotation(RotXForm);
 			object->SetTranslation(translation.x, translation.y, translation.z);
@@ -774,7 +1276,7 @@ int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj) {
 			float AttEnd = 10000.0f;
 			float Intensity = 1.0f;
 
-			while(ReadCounter < ObjChunkSize) {
+			while(file.ReadCounter < ObjChunkSize) {
 
 				chunk = ReadChunkHeader(file);
 
@@ -847,99 +1349,72 @@ int ReadObject(HANDLE file, const ChunkHeader &ch, void **obj) {
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// functions to save/load normals from file
-
-void WriteByte(HANDLE file, byte val) {
-	dword junk;
-	WriteFile(file, &val, sizeof(byte), &junk, 0);
-}
-
-void WriteDword(HANDLE file, dword val) {
-	dword junk;
-	WriteFile(file, &val, sizeof(dword), &junk, 0);
-	assert(junk == sizeof(dword));
-}
-
-void WriteFloat(HANDLE file, float val) {
-	dword junk;
-	WriteFile(file, &val, sizeof(float), &junk, 0);
-	assert(junk == sizeof(float));
-}
-
-void WriteString(HANDLE file, string str) {
-	dword junk;
-	for(dword i=0; i<(dword)str.size(); i++) {
-		WriteFile(file, &str[i], sizeof(char), &junk, 0);
+// normals, through the derived data cache
+
+// bump when CalculateNormals changes
+const dword NormalsVersion = 1;
+
+// Computing the normals is the slow part of loading a 3ds, so they are kept in
+// the cache under a hash of the geometry they were made from.
+void CalculateNormals(const std::vector<Object*> &objects, bool SaveNormals) {
+	CacheKey key("normals", NormalsVersion);
+	dword VertexTotal = 0, TriTotal = 0;
+
+	for(size_t i=0; i<objects.size(); i++) {
+		const TriMesh *mesh = objects[i]->GetTriMesh();
+		const Vertex *varray = mesh->GetVertexArray();
+		dword VertexCount = mesh->GetVertexCount();
+		dword TriCount = mesh->GetTriangleCount();
+
+		key.Add(VertexCount);
+		key.Add(TriCount);
+		for(dword j=0; j<VertexCount; j++) {
+			key.Add(&varray[j].pos, sizeof(Vector3));
+		}
+		key.Add(mesh->GetIndexArray(), TriCount * 3 * sizeof(Index));
+		key.Add(mesh->GetSmoothingGroupArray(), TriCount * sizeof(dword));
+		VertexTotal += VertexCount;
+		TriTotal += TriCount;
 	}
-}
-
-
-void SaveNormalsToFile(const char *fname, Scene *scene) {
-
-	HANDLE file = CreateFile(fname, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
-	assert(file);
-
-	WriteDword(file, (dword)scene->GetObjectsList()->size());
-
-	std::list<Object*>::iterator objiter = scene->GetObjectsList()->begin();
-	while(objiter != scene->GetObjectsList()->end()) {
-		WriteString(file, (*objiter)->name);
-		dword VertexCount = (*objiter)->GetTriMesh()->GetVertexCount();
-		WriteDword(file, VertexCount);
 
-		const Vertex *varray = (*objiter)->GetTriMesh()->GetVertexArray();
-		for(dword i=0; i<VertexCount; i++) {
-			WriteFloat(file, varray[i].normal.x);
-			WriteFloat(file, varray[i].normal.y);
-			WriteFloat(file, varray[i].normal.z);
+	// vertex normals of all the objects, followed by their face normals
+	std::vector<Vector3> normals(VertexTotal + TriTotal);
+	if(normals.empty()) return;
+
+	dword bytes = (dword)normals.size() * sizeof(Vector3);
+	if(datacache::Fetch("normals", key.Get(), &normals[0], bytes)) {
+		const Vector3 *vn = &normals[0];
+		const Vector3 *fn = vn + VertexTotal;
+		for(size_t i=0; i<objects.size(); i++) {
+			TriMesh *mesh = objects[i]->GetTriMesh();
+			Vertex *varray = mesh->GetModVertexArray();
+			Vector3 *FaceNormals = mesh->GetModFaceNormalArray();
+			for(dword j=0; j<mesh->GetVertexCount(); j++) varray[j].normal = *vn++;
+			for(dword j=0; j<mesh->GetTriangleCount(); j++) FaceNormals[j] = *fn++;
 		}
-
-		objiter++;
+		return;
 	}
 
-	CloseHandle(file);
-}
-
-bool LoadNormalsFromFile(const char *fname, Scene *scene) {
-
-	HANDLE file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-	if(!file) return false;
-
-	eof = false;
-	ReadCounter = 0;
-
-	dword FileSize = SetFilePointer(file, 0, 0, FILE_END) - SetFilePointer(file, 0, 0, FILE_BEGIN);
-
-	SetFilePointer(file, 0, 0, FILE_BEGIN);
+	Vector3 *vn = &normals[0];
+	Vector3 *fn = vn + VertexTotal;
+	for(size_t i=0; i<objects.size(); i++) {
+		TriMesh *mesh = objects[i]->GetTriMesh();
+		mesh->CalculateNormals();
 
-	dword ObjectCount = ReadDword(file);
-	if(ObjectCount != scene->GetObjectsList()->size()) {	// detect changes
-		CloseHandle(file);
-		return false;
+		const Vertex *varray = mesh->GetVertexArray();
+		const Vector3 *FaceNormals = mesh->GetFaceNormalArray();
+		for(dword j=0; j<mesh->GetVertexCount(); j++) *vn++ = varray[j].normal;
+		for(dword j=0; j<mesh->GetTriangleCount(); j++) *fn++ = FaceNormals[j];
 	}
-    
-	while(SceneLoader::ReadCounter < FileSize) {
-		string name = ReadString(file);
-		dword VertexCount = ReadDword(file);
-		
-		Object *obj = scene->GetObject(name.c_str());
-		if(!obj) {
-			CloseHandle(file);
-			return false;
-		}
 
-		if(VertexCount != obj->GetTriMesh()->GetVertexCount()) {	// again detect changes
-			CloseHandle(file);
-			return false;
-		}
-        
-		Vertex *varray = obj->GetTriMesh()->GetModVertexArray();
-		for(dword i=0; i<VertexCount; i++) {
-			varray[i].normal = ReadVector(file, false);
-		}
-	}
-
-	CloseHandle(file);
-	return true;
+	if(SaveNormals) datacache::Store("normals", key.Get(), &normals[0], bytes);
 }
 
+bool GetFileStamp(const char *fname, dword *size, dword *time) {
+	struct stat st;
+	if(stat(fname, &st) == -1) return false;
+
+	*size = (dword)st.st_size;
+	*time = (dword)st.st_mtime;
+	return true;
+}
\ No newline at end of file
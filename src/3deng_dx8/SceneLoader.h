@@ -1,18 +1,111 @@
 #ifndef _SCENELOADER_H_
 #define _SCENELOADER_H_
 
+#include <string>
+#include <vector>
 #include "3deng_dx8/objects.h"
 #include "3deng_dx8/3dscene.h"
 #include "3deng_dx8/material.h"
+#include "3deng_dx8/textureman.h"
 
 namespace SceneLoader {
+
+	// All the settings of the loader. A context loads one file at a time,
+	// but contexts don't share anything, so several threads can load scenes
+	// at once with a context each. The device can only be used by the main
+	// thread though, so contexts on other threads should defer the textures
+	// and have LoadTextures called on what they loaded, back on the main thread.
+	class Context {
+	private:
+		GraphicsContext *gc;
+		std::string datapath;
+
+		bool SaveNormals;
+		bool UseFileMapping;
+		bool SaveCompiledScene;
+		bool LoadCompiledScene;
+		bool DeferTextures;
+		byte DetailLevels;
+		bool OptimizeMeshes;
+
+		// ACMR sums of the meshes optimized, weighted by triangle count
+		dword OptimizedTris;
+		double AcmrBefore, AcmrAfter;
+
+		void OptimizeVertexOrder(const std::vector<Object*> &objects);
+
+	public:
+		Context(GraphicsContext *gc = 0);
+
+		void SetGraphicsContext(GraphicsContext *gfx);
+		void SetDataPath(const char *path);
+		void SetNormalFileSaving(bool enable);	// keep calculated normals in the data cache
+		void SetFileMapping(bool enable);
+		void SetSceneCompiling(bool enable);	// write a compiled .n3s next to each loaded .3ds
+		void SetTextureDeferring(bool enable);	// leave the textures and anything else on the device for LoadTextures
+		void SetDetailLevels(byte levels);		// simplified versions of each mesh, 1 for none
+		void SetMeshOptimization(bool enable);	// reorder .3ds meshes for the vertex cache
+
+		GraphicsContext *GetGraphicsContext() const;
+		const std::string &GetDataPath() const;
+		bool GetFileMapping() const;
+		bool GetTextureDeferring() const;
+		byte GetDetailLevels() const;
+
+		// average vertices transformed per triangle over all the meshes this
+		// context optimized, before and after, and their triangle count
+		dword GetVertexCacheStats(float *AcmrBefore, float *AcmrAfter) const;
+
+		bool LoadObject(const char *fname, const char *ObjectName, Object **obj);
+		bool LoadScene(const char *fname, Scene **scene);
+		bool LoadMaterials(const char *fname, Material **materials);
+
+		// Parses the files on worker threads, with a copy of this context each,
+		// then loads their textures on the calling thread. Scenes that fail to
+		// load are set to 0.
+		bool LoadScenes(const char **fnames, int count, Scene **scenes) const;
+
+		// Loads the textures left out while deferring, on the main thread. The
+		// objects were made without the graphics context so that loading off the
+		// main thread keeps away from the device; they get it here, and their
+		// mesh buffers are made.
+		void LoadTextures(Scene *scene) const;
+		void LoadTextures(Object *obj) const;
+
+		// starts loading them in the background instead, from any thread; wait
+		// for the group and call LoadTextures to finish up
+		void RequestTextures(Scene *scene, TextureGroup *group) const;
+		void RequestTextures(Object *obj, TextureGroup *group) const;
+
+		// Drops the uses LoadTextures (or RequestTextures) took, one per object
+		// and map, the objects are left without textures. Only for deferring
+		// contexts: without deferring a texture is loaded once per material and
+		// shared by all of its objects, so nothing is released then.
+		void ReleaseTextures(Scene *scene) const;
+		void ReleaseTextures(Object *obj) const;
+
+		// loads the scene repeatedly with and without file mapping (and from its
+		// compiled version if CompiledTime is given), total times in msec; fails
+		// while a data pack is open, the files would all come from it
+		bool BenchmarkLoad(const char *fname, int iterations, dword *MappedTime, dword *StreamedTime, dword *CompiledTime = 0);
+	};
+
+	// the context used by the functions below
+	Context *GetDefaultContext();
+
 	void SetGraphicsContext(GraphicsContext *gfx);
 	void SetDataPath(const char *path);
 	void SetNormalFileSaving(bool enable);
+	void SetFileMapping(bool enable);
+	void SetSceneCompiling(bool enable);
+	void SetMeshOptimization(bool enable);
 
 	bool LoadObject(const char *fname, const char *ObjectName, Object **obj);
 	bool LoadScene(const char *fname, Scene **scene);
 	bool LoadMaterials(const char *fname, Material **materials);
+	bool LoadScenes(const char **fnames, int count, Scene **scenes);
+
+	bool BenchmarkLoad(const char *fname, int iterations, dword *MappedTime, dword *StreamedTime, dword *CompiledTime = 0);
 }
 
 #endif	// _SCENELOADER_H_
\ No newline at end of file
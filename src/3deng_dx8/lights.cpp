@@ -527,6 +527,10 @@ TargetSpotLight::TargetSpotLight(const Vector3 &pos, const Vector3 &target, floa
 	Falloff = 1.0f;
 }
 
+Vector3 TargetSpotLight::GetTarget() const {
+	return Target;
+}
+
 Matrix4x4 TargetSpotLight::GetTargetTransform() const {
 	return TargXForm * TargRot * TargTrans;
 }
@@ -279,6 +279,8 @@ public:
 	TargetSpotLight();
 	TargetSpotLight(const Vector3 &pos, const Vector3 &target, float InnerCone, float OuterCone, float range = 1000.0f, float att0 = 1.0f, float att1 = 0.0f, float att2 = 0.0f);
 
+	Vector3 GetTarget() const;
+
 	virtual void ResetTargetTransform();
 	virtual void ResetTargetTranslation();
 	virtual void ResetTargetRotation();
@@ -23,6 +23,7 @@ class Material : public D3DMATERIAL8 {
 public:
 	std::string name;
 	Texture *Maps[NumberOfTextureTypes];
+	std::string MapNames[NumberOfTextureTypes];	// file names, relative to the data path
 	float EnvBlend, BumpIntensity;
 	float Alpha;
 	bool SpecularEnable;
@@ -0,0 +1,135 @@
+#ifndef _N3SFORMAT_H_
+#define _N3SFORMAT_H_
+
+#include <cmath>
+#include "typedefs.h"
+
+// Compiled scene files (.n3s) hold a Scene exactly as the engine keeps it in
+// memory: vertex and triangle arrays are stored in their runtime layout with
+// normals already calculated. Loading maps the file copy-on-write and turns
+// the stored offsets into pointers in place, no parsing is involved.
+// This header only depends on typedefs.h so that offline tools can write
+// the format without pulling in the engine.
+
+namespace n3sfile {
+
+	enum LightType {
+		LTYPE_POINT,
+		LTYPE_TARGETSPOT,
+		LTYPE_DIR,
+		LTYPE_SPOT
+	};
+
+	const dword Magic = 0x4353334e;		// "N3SC"
+	const dword Version = 4;
+
+	const int MapCount = 7;				// NumberOfTextureTypes
+	const dword TransparencyUnknown = 0xffffffff;	// HasTransparentTex to be found at load time
+
+	// file offset, replaced with a pointer into the mapped file on load (0 means none)
+	template <class T>
+	union Ref {
+		qword offset;
+		T *ptr;
+	};
+
+	// same layout as the engine's Vertex and Triangle (checked when loading)
+	struct VertexRec {
+		float pos[3];
+		float BlendFactor;
+		dword BlendIndex;
+		float normal[3];
+		dword color;
+		float tex[4][2];
+	};
+
+	struct TriangleRec {
+		uint32 vertices[3];
+		float normal[3];
+		dword SmoothingGroup;
+	};
+
+	struct MaterialRec {
+		Ref<char> name;
+		Ref<char> maps[MapCount];			// texture file names
+		float ambient[4], diffuse[4], specular[4], emissive[4];
+		float power, alpha, EnvBlend, BumpIntensity;
+		dword SpecularEnable, HasTransparentTex;
+	};
+
+	struct ObjectRec {
+		Ref<char> name;
+		Ref<VertexRec> varray;
+		Ref<TriangleRec> tarray;
+		dword VertexCount, TriCount;
+		float RotMat[16], TransMat[16];
+		float BoundSphere[4];				// center and radius, in object space
+		float BoundMin[3], BoundMax[3];
+		MaterialRec material;
+	};
+
+	struct LightRec {
+		Ref<char> name;
+		dword type;
+		float pos[3], target[3];
+		float color[4];
+		float intensity, InnerCone, OuterCone;
+		dword CastShadows;
+	};
+
+	struct CameraRec {
+		Ref<char> name;
+		float pos[3], target[3], up[3];
+		float fov, NearClip, FarClip;		// clip planes left to the camera default if both 0
+		dword pad;
+	};
+
+	struct CurveRec {
+		Ref<char> name;
+		Ref<float> points;		// 3 floats per control point
+		dword PointCount;
+		dword pad;
+	};
+
+	struct Header {
+		dword magic, version;
+		dword FileSize;
+		dword VertexSize, TriangleSize;		// catch engine layout changes
+		dword SourceSize, SourceTime;		// size and modification time of the source .3ds
+		float ambient[4];
+		dword ObjectCount, LightCount, CameraCount, CurveCount;
+		Ref<ObjectRec> objects;
+		Ref<LightRec> lights;
+		Ref<CameraRec> cameras;
+		Ref<CurveRec> curves;
+	};
+
+	// bounding volumes of a vertex array, as stored in ObjectRec
+	inline void CalcBounds(const VertexRec *varray, dword count, ObjectRec *rec) {
+		for(int i=0; i<3; i++) {
+			rec->BoundMin[i] = count ? varray[0].pos[i] : 0.0f;
+			rec->BoundMax[i] = rec->BoundMin[i];
+		}
+		for(dword i=1; i<count; i++) {
+			for(int j=0; j<3; j++) {
+				if(varray[i].pos[j] < rec->BoundMin[j]) rec->BoundMin[j] = varray[i].pos[j];
+				if(varray[i].pos[j] > rec->BoundMax[j]) rec->BoundMax[j] = varray[i].pos[j];
+			}
+		}
+
+		float rad_sq = 0.0f;
+		for(int i=0; i<3; i++) {
+			rec->BoundSphere[i] = (rec->BoundMin[i] + rec->BoundMax[i]) * 0.5f;
+		}
+		for(dword i=0; i<count; i++) {
+			float dx = varray[i].pos[0] - rec->BoundSphere[0];
+			float dy = varray[i].pos[1] - rec->BoundSphere[1];
+			float dz = varray[i].pos[2] - rec->BoundSphere[2];
+			float dsq = dx * dx + dy * dy + dz * dz;
+			if(dsq > rad_sq) rad_sq = dsq;
+		}
+		rec->BoundSphere[3] = (float)sqrt(rad_sq);
+	}
+}
+
+#endif	// _N3SFORMAT_H_
@@ -0,0 +1,457 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "n3sloader.h"
+#include "mappedfile.h"
+#include "packfile.h"
+
+using namespace n3sfile;
+using std::string;
+using std::vector;
+
+// helper functions
+template <class T>
+bool Fixup(Ref<T> &ref, byte *base, dword size, qword bytes = 1);
+bool FixupString(Ref<char> &ref, byte *base, dword size);
+bool CheckTriangles(const ObjectRec &rec);
+const char *RefString(const Ref<char> &ref);
+
+dword Append(vector<byte> &buf, const void *data, dword size);
+template <class T>
+void SetRef(Ref<T> &ref, dword offset);
+dword AppendString(vector<byte> &buf, const string &str);
+
+void PackColor(float *dest, const D3DCOLORVALUE &col);
+void PackVector(float *dest, const Vector3 &vec);
+void PackMatrix(float *dest, const Matrix4x4 &mat);
+Matrix4x4 UnpackMatrix(const float *src);
+const Triangle *GatherTriangles(const TriMesh &mesh, vector<Triangle> *tris);
+Object *CreateObject(const ObjectRec &rec, GraphicsContext *gc, const string &TexPath, bool LoadTextures, byte DetailLevels);
+
+
+bool n3sfile::LoadScene(const char *fname, Scene **scene, GraphicsContext *gc, const char *TexPath, bool LoadTextures, byte DetailLevels) {
+	if(!scene || !gc) return false;
+
+	// the fixups write to the data, so a scene from the pack gets its own copy
+	MappedFile file;
+	vector<byte> PackData;
+	const PackFile *pack = packfile::GetDataPack();
+	byte *base;
+	dword size;
+	if(pack && pack->Load(fname, &PackData)) {
+		size = (dword)PackData.size();
+		base = size ? &PackData[0] : 0;
+	} else {
+		if(!file.Open(fname, true)) return false;
+		base = file.GetModData();
+		size = file.GetSize();
+	}
+	if(size < sizeof(Header)) return false;
+
+	Header *hdr = (Header*)base;
+	if(hdr->magic != Magic || hdr->version != Version || hdr->FileSize != size) return false;
+	if(hdr->VertexSize != sizeof(Vertex) || hdr->TriangleSize != sizeof(Triangle)) return false;
+	if(sizeof(VertexRec) != sizeof(Vertex) || sizeof(TriangleRec) != sizeof(Triangle)) return false;
+
+	// turn offsets into pointers, checking that everything stays inside the file
+	if(!Fixup(hdr->objects, base, size, (qword)hdr->ObjectCount * sizeof(ObjectRec))) return false;
+	if(!Fixup(hdr->lights, base, size, (qword)hdr->LightCount * sizeof(LightRec))) return false;
+	if(!Fixup(hdr->cameras, base, size, (qword)hdr->CameraCount * sizeof(CameraRec))) return false;
+	if(!Fixup(hdr->curves, base, size, (qword)hdr->CurveCount * sizeof(CurveRec))) return false;
+
+	for(dword i=0; i<hdr->ObjectCount; i++) {
+		ObjectRec &rec = hdr->objects.ptr[i];
+		bool ok = FixupString(rec.name, base, size);
+		ok = ok && Fixup(rec.varray, base, size, (qword)rec.VertexCount * sizeof(VertexRec));
+		ok = ok && Fixup(rec.tarray, base, size, (qword)rec.TriCount * sizeof(TriangleRec));
+		ok = ok && FixupString(rec.material.name, base, size);
+		for(int j=0; j<MapCount; j++) {
+			ok = ok && FixupString(rec.material.maps[j], base, size);
+		}
+		if(!ok || !CheckTriangles(rec)) return false;
+	}
+	for(dword i=0; i<hdr->LightCount; i++) {
+		if(!FixupString(hdr->lights.ptr[i].name, base, size)) return false;
+	}
+	for(dword i=0; i<hdr->CameraCount; i++) {
+		if(!FixupString(hdr->cameras.ptr[i].name, base, size)) return false;
+	}
+	for(dword i=0; i<hdr->CurveCount; i++) {
+		CurveRec &rec = hdr->curves.ptr[i];
+		if(!FixupString(rec.name, base, size) || !Fixup(rec.points, base, size, (qword)rec.PointCount * 3 * sizeof(float))) return false;
+	}
+
+	string path = TexPath ? TexPath : "";
+	Scene *scn = new Scene(gc);
+	scn->SetAmbientLight(Color(hdr->ambient[0], hdr->ambient[1], hdr->ambient[2], hdr->ambient[3]));
+
+	// Scene::AddObject pushes opaque objects to the front, so add those in
+	// reverse to get the objects list back in the order it was saved
+	for(dword i=hdr->ObjectCount; i>0; i--) {
+		const ObjectRec &rec = hdr->objects.ptr[i - 1];
+		if(rec.material.alpha >= 1.0f) scn->AddObject(CreateObject(rec, gc, path, LoadTextures, DetailLevels));
+	}
+	for(dword i=0; i<hdr->ObjectCount; i++) {
+		const ObjectRec &rec = hdr->objects.ptr[i];
+		if(rec.material.alpha < 1.0f) scn->AddObject(CreateObject(rec, gc, path, LoadTextures, DetailLevels));
+	}
+
+	for(dword i=0; i<hdr->LightCount; i++) {
+		const LightRec &rec = hdr->lights.ptr[i];
+		Vector3 pos(rec.pos[0], rec.pos[1], rec.pos[2]);
+
+		Light *light;
+		if(rec.type == LTYPE_TARGETSPOT) {
+			Vector3 targ(rec.target[0], rec.target[1], rec.target[2]);
+			light = new TargetSpotLight(pos, targ, rec.InnerCone, rec.OuterCone);
+		} else {
+			light = new PointLight(pos);
+		}
+		light->SetColor(Color(rec.color[0], rec.color[1], rec.color[2], rec.color[3]));
+		light->SetShadowCasting(rec.CastShadows != 0);
+		light->SetIntensity(rec.intensity);
+		light->name = RefString(rec.name);
+		scn->AddLight(light);
+	}
+
+	for(dword i=0; i<hdr->CameraCount; i++) {
+		const CameraRec &rec = hdr->cameras.ptr[i];
+		Camera *cam = new Camera;
+		Vector3 pos(rec.pos[0], rec.pos[1], rec.pos[2]);
+		Vector3 targ(rec.target[0], rec.target[1], rec.target[2]);
+		Vector3 up(rec.up[0], rec.up[1], rec.up[2]);
+		cam->SetCamera(pos, targ, up);
+		cam->SetFOV(rec.fov);
+		if(rec.NearClip != 0.0f || rec.FarClip != 0.0f) {
+			cam->SetClippingPlanes(rec.NearClip, rec.FarClip);
+		}
+		cam->name = RefString(rec.name);
+		scn->AddCamera(cam);
+	}
+
+	for(dword i=0; i<hdr->CurveCount; i++) {
+		const CurveRec &rec = hdr->curves.ptr[i];
+		CatmullRomSpline *spline = new CatmullRomSpline;
+		spline->name = RefString(rec.name);
+		const float *pt = rec.points.ptr;
+		for(dword j=0; j<rec.PointCount; j++, pt += 3) {
+			spline->AddControlPoint(Vector3(pt[0], pt[1], pt[2]));
+		}
+		scn->AddCurve(spline);
+	}
+
+	*scene = scn;
+	return true;
+}
+
+
+bool n3sfile::SaveScene(const char *fname, Scene *scene, dword SourceSize, dword SourceTime) {
+	if(!scene) return false;
+
+	std::list<Object*> *objects = scene->GetObjectsList();
+	std::list<Camera*> *cameras = scene->GetCamerasList();
+	std::list<Curve*> *curves = scene->GetCurvesList();
+	Light **lights = scene->GetLightsArray();
+
+	vector<ObjectRec> ObjRecs;
+	vector<LightRec> LightRecs;
+	vector<CameraRec> CamRecs;
+	vector<CurveRec> CurveRecs;
+
+	// the header goes first, records are filled in while their data is appended
+	// and written in place at the end, once all the offsets are known
+	vector<byte> buf(sizeof(Header), 0);
+
+	vector<Triangle> tris;
+	std::list<Object*>::iterator objiter = objects->begin();
+	while(objiter != objects->end()) {
+		Object *obj = *objiter++;
+		TriMesh *mesh = obj->GetTriMesh();
+		const Material &mat = obj->material;
+
+		ObjectRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, obj->name));
+		rec.VertexCount = mesh->GetVertexCount();
+		rec.TriCount = mesh->GetTriangleCount();
+		SetRef(rec.varray, Append(buf, mesh->GetVertexArray(), rec.VertexCount * sizeof(Vertex)));
+		SetRef(rec.tarray, Append(buf, GatherTriangles(*mesh, &tris), rec.TriCount * sizeof(Triangle)));
+		CalcBounds((const VertexRec*)mesh->GetVertexArray(), rec.VertexCount, &rec);
+		PackMatrix(rec.RotMat, obj->RotMat);
+		PackMatrix(rec.TransMat, obj->TransMat);
+
+		SetRef(rec.material.name, AppendString(buf, mat.name));
+		for(int i=0; i<NumberOfTextureTypes; i++) {
+			if(!mat.MapNames[i].empty()) SetRef(rec.material.maps[i], AppendString(buf, mat.MapNames[i]));
+		}
+		PackColor(rec.material.ambient, mat.Ambient);
+		PackColor(rec.material.diffuse, mat.Diffuse);
+		PackColor(rec.material.specular, mat.Specular);
+		PackColor(rec.material.emissive, mat.Emissive);
+		rec.material.power = mat.Power;
+		rec.material.alpha = mat.Alpha;
+		rec.material.EnvBlend = mat.EnvBlend;
+		rec.material.BumpIntensity = mat.BumpIntensity;
+		rec.material.SpecularEnable = mat.SpecularEnable;
+		rec.material.HasTransparentTex = mat.HasTransparentTex;
+
+		ObjRecs.push_back(rec);
+	}
+
+	for(int i=0; i<8; i++) {
+		if(!lights[i]) continue;
+		const Light *lt = lights[i];
+
+		LightRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, lt->name));
+		PackVector(rec.pos, lt->GetPosition());
+		// the scene loader only ever creates point lights and targeted spots
+		if(lt->GetType() == LTSpot) {
+			rec.type = LTYPE_TARGETSPOT;
+			PackVector(rec.target, ((const TargetSpotLight*)lt)->GetTarget());
+			rec.InnerCone = lt->GetInnerCone();
+			rec.OuterCone = lt->GetOuterCone();
+		} else if(lt->GetType() == LTPoint) {
+			rec.type = LTYPE_POINT;
+		} else {
+			continue;
+		}
+		PackColor(rec.color, lt->GetColor());
+		rec.intensity = lt->GetIntensity();
+		rec.CastShadows = lt->GetShadowCasting();
+
+		LightRecs.push_back(rec);
+	}
+
+	std::list<Camera*>::iterator camiter = cameras->begin();
+	while(camiter != cameras->end()) {
+		const Camera *cam = *camiter++;
+
+		CameraRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, cam->name));
+		PackVector(rec.pos, cam->GetPosition());
+		PackVector(rec.target, cam->GetTargetPosition());
+		PackVector(rec.up, cam->GetUpVector());
+		rec.fov = cam->GetFOV();
+		cam->GetClippingPlanes(&rec.NearClip, &rec.FarClip);
+
+		CamRecs.push_back(rec);
+	}
+
+	std::list<Curve*>::iterator curveiter = curves->begin();
+	while(curveiter != curves->end()) {
+		Curve *curve = *curveiter++;
+
+		CurveRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, curve->name));
+
+		vector<float> points;
+		ListNode<Vector3> *node = curve->GetControlPoints()->Begin();
+		while(node) {
+			points.push_back(node->data.x);
+			points.push_back(node->data.y);
+			points.push_back(node->data.z);
+			node = node->next;
+		}
+		rec.PointCount = (dword)points.size() / 3;
+		if(rec.PointCount) SetRef(rec.points, Append(buf, &points[0], (dword)points.size() * sizeof(float)));
+
+		CurveRecs.push_back(rec);
+	}
+
+	Header hdr;
+	memset(&hdr, 0, sizeof hdr);
+	hdr.magic = Magic;
+	hdr.version = Version;
+	hdr.VertexSize = sizeof(Vertex);
+	hdr.TriangleSize = sizeof(Triangle);
+	hdr.SourceSize = SourceSize;
+	hdr.SourceTime = SourceTime;
+	PackColor(hdr.ambient, scene->GetAmbientLight());
+
+	hdr.ObjectCount = (dword)ObjRecs.size();
+	hdr.LightCount = (dword)LightRecs.size();
+	hdr.CameraCount = (dword)CamRecs.size();
+	hdr.CurveCount = (dword)CurveRecs.size();
+	if(hdr.ObjectCount) SetRef(hdr.objects, Append(buf, &ObjRecs[0], hdr.ObjectCount * sizeof(ObjectRec)));
+	if(hdr.LightCount) SetRef(hdr.lights, Append(buf, &LightRecs[0], hdr.LightCount * sizeof(LightRec)));
+	if(hdr.CameraCount) SetRef(hdr.cameras, Append(buf, &CamRecs[0], hdr.CameraCount * sizeof(CameraRec)));
+	if(hdr.CurveCount) SetRef(hdr.curves, Append(buf, &CurveRecs[0], hdr.CurveCount * sizeof(CurveRec)));
+
+	hdr.FileSize = (dword)buf.size();
+	memcpy(&buf[0], &hdr, sizeof hdr);
+
+	FILE *fp = fopen(fname, "wb");
+	if(!fp) return false;
+	bool ok = fwrite(&buf[0], 1, buf.size(), fp) == buf.size();
+	fclose(fp);
+
+	if(!ok) remove(fname);
+	return ok;
+}
+
+
+bool n3sfile::GetSourceStamp(const char *fname, dword *SourceSize, dword *SourceTime) {
+	Header hdr;
+	bool ok;
+
+	const PackFile *pack = packfile::GetDataPack();
+	vector<byte> buf;
+	dword size;
+	const byte *data = pack ? pack->Read(fname, &size, &buf) : 0;
+	if(data) {
+		ok = size >= sizeof hdr;
+		if(ok) memcpy(&hdr, data, sizeof hdr);
+	} else {
+		FILE *fp = fopen(fname, "rb");
+		if(!fp) return false;
+		ok = fread(&hdr, sizeof hdr, 1, fp) == 1;
+		fclose(fp);
+	}
+	if(!ok || hdr.magic != Magic || hdr.version != Version) return false;
+
+	if(SourceSize) *SourceSize = hdr.SourceSize;
+	if(SourceTime) *SourceTime = hdr.SourceTime;
+	return true;
+}
+
+
+////////////////////////////////////////////////////
+template <class T>
+bool Fixup(Ref<T> &ref, byte *base, dword size, qword bytes) {
+	qword offset = ref.offset;
+	if(offset && offset + bytes > size) return false;
+
+	ref.offset = 0;
+	ref.ptr = offset ? (T*)(base + offset) : 0;
+	return true;
+}
+
+// the string has to end inside the file too
+bool FixupString(Ref<char> &ref, byte *base, dword size) {
+	qword offset = ref.offset;
+	if(offset && (offset >= size || !memchr(base + offset, 0, size - (dword)offset))) return false;
+	return Fixup(ref, base, size);
+}
+
+// every triangle has to use vertices of its own object
+bool CheckTriangles(const ObjectRec &rec) {
+	const TriangleRec *tri = rec.tarray.ptr;
+	if(!tri) return !rec.TriCount;
+
+	for(dword i=0; i<rec.TriCount; i++, tri++) {
+		for(int j=0; j<3; j++) {
+			if(tri->vertices[j] >= rec.VertexCount) return false;
+		}
+	}
+	return true;
+}
+
+const char *RefString(const Ref<char> &ref) {
+	return ref.ptr ? ref.ptr : "";
+}
+
+// appends data to the file buffer aligned to 8 bytes, returns its offset
+dword Append(vector<byte> &buf, const void *data, dword size) {
+	dword offset = ((dword)buf.size() + 7) & ~7;
+	buf.resize(offset + size, 0);
+	if(size) memcpy(&buf[offset], data, size);
+	return offset;
+}
+
+template <class T>
+void SetRef(Ref<T> &ref, dword offset) {
+	ref.offset = offset;
+}
+
+dword AppendString(vector<byte> &buf, const string &str) {
+	return Append(buf, str.c_str(), (dword)str.size() + 1);
+}
+
+void PackColor(float *dest, const D3DCOLORVALUE &col) {
+	dest[0] = col.r;
+	dest[1] = col.g;
+	dest[2] = col.b;
+	dest[3] = col.a;
+}
+
+void PackVector(float *dest, const Vector3 &vec) {
+	dest[0] = vec.x;
+	dest[1] = vec.y;
+	dest[2] = vec.z;
+}
+
+void PackMatrix(float *dest, const Matrix4x4 &mat) {
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			*dest++ = mat.m[i][j];
+		}
+	}
+}
+
+Matrix4x4 UnpackMatrix(const float *src) {
+	Matrix4x4 mat;
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			mat.m[i][j] = *src++;
+		}
+	}
+	return mat;
+}
+
+// the file keeps the triangles whole, like the .n3s loaders have always read them
+const Triangle *GatherTriangles(const TriMesh &mesh, vector<Triangle> *tris) {
+	dword count = mesh.GetTriangleCount();
+	const Index *iarray = mesh.GetIndexArray();
+	const Vector3 *normals = mesh.GetFaceNormalArray();
+	const dword *groups = mesh.GetSmoothingGroupArray();
+
+	tris->resize(count);
+	for(dword i=0; i<count; i++, iarray += 3) {
+		Triangle &tri = (*tris)[i];
+		tri = Triangle(iarray[0], iarray[1], iarray[2]);
+		tri.normal = normals[i];
+		tri.SmoothingGroup = groups[i];
+	}
+	return count ? &(*tris)[0] : 0;
+}
+
+Object *CreateObject(const ObjectRec &rec, GraphicsContext *gc, const string &TexPath, bool LoadTextures, byte DetailLevels) {
+	Object *obj = new Object(LoadTextures ? gc : 0, DetailLevels);
+	obj->name = RefString(rec.name);
+	obj->GetTriMesh()->SetData((const Vertex*)rec.varray.ptr, (const Triangle*)rec.tarray.ptr, rec.VertexCount, rec.TriCount);
+	obj->RotMat = UnpackMatrix(rec.RotMat);
+	obj->TransMat = UnpackMatrix(rec.TransMat);
+
+	const MaterialRec &mrec = rec.material;
+	Material &mat = obj->material;
+	mat.name = RefString(mrec.name);
+	mat.Ambient = Color(mrec.ambient[0], mrec.ambient[1], mrec.ambient[2], mrec.ambient[3]);
+	mat.Diffuse = Color(mrec.diffuse[0], mrec.diffuse[1], mrec.diffuse[2], mrec.diffuse[3]);
+	mat.Specular = Color(mrec.specular[0], mrec.specular[1], mrec.specular[2], mrec.specular[3]);
+	mat.Emissive = Color(mrec.emissive[0], mrec.emissive[1], mrec.emissive[2], mrec.emissive[3]);
+	mat.Power = mrec.power;
+	mat.Alpha = mrec.alpha;
+	mat.EnvBlend = mrec.EnvBlend;
+	mat.BumpIntensity = mrec.BumpIntensity;
+	mat.SpecularEnable = mrec.SpecularEnable != 0;
+
+	for(int i=0; i<MapCount; i++) {
+		if(!mrec.maps[i].ptr) continue;
+		mat.MapNames[i] = mrec.maps[i].ptr;
+		if(LoadTextures) mat.SetTexture(gc->texman->LoadTexture((TexPath + mat.MapNames[i]).c_str()), (TextureType)i);
+	}
+
+	// offline cooked files can't tell without decoding the texture
+	if(mrec.HasTransparentTex == TransparencyUnknown) {
+		mat.HasTransparentTex = HasTransparency(mat.Maps[TextureMap]);
+	} else {
+		mat.HasTransparentTex = mrec.HasTransparentTex != 0;
+	}
+
+	return obj;
+}
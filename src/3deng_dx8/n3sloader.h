@@ -2,20 +2,19 @@
 #define _N3SLOADER_H_
 
 #include "typedefs.h"
+#include "n3sformat.h"
+#include "3dscene.h"
 
 namespace n3sfile {
 
-	enum LightType {
-		LTYPE_POINT,
-		LTYPE_TARGETSPOT,
-		LTYPE_DIR,
-		LTYPE_SPOT		
-	};
+	// without LoadTextures only the map names are set and the objects are made
+	// without the graphics context, see SceneLoader::Context::LoadTextures
+	// the meshes get DetailLevels levels of detail, made as they're loaded
+	bool LoadScene(const char *fname, Scene **scene, GraphicsContext *gc, const char *TexPath = 0, bool LoadTextures = true, byte DetailLevels = 1);
+	bool SaveScene(const char *fname, Scene *scene, dword SourceSize = 0, dword SourceTime = 0);
 
-	struct ChunkHeader {
-		ChunkID id;
-		dword size;
-	};
+	// reads the source stamp of a compiled file without loading it
+	bool GetSourceStamp(const char *fname, dword *SourceSize, dword *SourceTime);
 }
 
 #endif	// _N3SLOADER_H_
@@ -18,12 +18,18 @@ Object::Object(GraphicsContext *gc, byte DetailLevels) {
 	UseTextureMatrix = false;
 
 	ShadowVolumes = 0;
+	ShadowKeys = 0;
+	ShadowRevision = 0;
 	CastShadows = false;
+	BoundValid = false;
+	DetailSize = 0.25f;
 
 	AutoSetZWrite = true;
 }
 
 Object::~Object() {
+	delete [] ShadowVolumes;
+	delete [] ShadowKeys;
 	delete mesh;
 	if(rendp.VertexProgram != FixedFunction) gc->DestroyVertexProgram(rendp.VertexProgram);
 }
@@ -32,6 +38,15 @@ TriMesh *Object::GetTriMesh() {
 	return mesh;
 }
 
+void Object::SetGraphicsContext(GraphicsContext *gc) {
+	this->gc = gc;
+	mesh->SetGraphicsContext(gc);
+}
+
+GraphicsContext *Object::GetGraphicsContext() const {
+	return gc;
+}
+
 
 // Reset Transformation Matrices
 void Object::ResetTransform() {
@@ -126,6 +141,75 @@ const Matrix4x4 Object::GetWorldTransform() const {
 	return ScaleMat * RotMat * TransMat * GRotMat;
 }
 
+void Object::GetBoundingSphere(Vector3 *center, float *radius) {
+	if(!BoundValid || BoundRevision != mesh->GetRevision()) {
+		const Vertex *varray = mesh->GetVertexArray();
+		dword count = mesh->GetVertexCount();
+
+		Vector3 vmin, vmax;
+		if(count) vmin = vmax = varray[0].pos;
+		for(dword i=1; i<count; i++) {
+			const Vector3 &pos = varray[i].pos;
+			if(pos.x < vmin.x) vmin.x = pos.x;
+			if(pos.y < vmin.y) vmin.y = pos.y;
+			if(pos.z < vmin.z) vmin.z = pos.z;
+			if(pos.x > vmax.x) vmax.x = pos.x;
+			if(pos.y > vmax.y) vmax.y = pos.y;
+			if(pos.z > vmax.z) vmax.z = pos.z;
+		}
+
+		BoundCenter = (vmin + vmax) * 0.5f;
+		float RadSq = 0.0f;
+		for(dword i=0; i<count; i++) {
+			float DistSq = (varray[i].pos - BoundCenter).LengthSq();
+			if(DistSq > RadSq) RadSq = DistSq;
+		}
+		BoundRadius = (float)sqrt(RadSq);
+
+		BoundRevision = mesh->GetRevision();
+		BoundValid = true;
+	}
+
+	Matrix4x4 XForm = GetWorldTransform();
+
+	*center = BoundCenter;
+	center->Transform(XForm);
+
+	// the longest axis of the transform scales the radius
+	float ScaleSq = 0.0f;
+	for(int i=0; i<3; i++) {
+		float LenSq = XForm.m[i][0] * XForm.m[i][0] + XForm.m[i][1] * XForm.m[i][1] + XForm.m[i][2] * XForm.m[i][2];
+		if(LenSq > ScaleSq) ScaleSq = LenSq;
+	}
+	*radius = BoundRadius * (float)sqrt(ScaleSq);
+}
+
+void Object::SetDetailSize(float size) {
+	DetailSize = size;
+}
+
+byte Object::GetDetailLevel() {
+	byte levels = mesh->GetLevelCount();
+	if(levels < 2) return 0;
+
+	Vector3 center;
+	float radius;
+	GetBoundingSphere(&center, &radius);
+	center.Transform(gc->GetViewMatrix());
+	if(center.z <= radius) return 0;	// the camera is in it, or about to be
+
+	// the height of the view at that depth is 2 * z / ProjMat[1][1]
+	float size = radius * gc->GetProjectionMatrix().m[1][1] / center.z;
+
+	byte level = 0;
+	float limit = DetailSize;
+	while(level < levels - 1 && size < limit) {
+		level++;
+		limit *= 0.5f;
+	}
+	return level;
+}
+
 void Object::SetTextureMatrix(Matrix4x4 mat) {
 	UseTextureMatrix = true;
 	TextureMatrix = mat;
@@ -137,6 +221,8 @@ Matrix4x4 Object::GetTextureMatrix() const {
 
 void Object::SetVertexProgram(dword VertexProgram) {
 	rendp.VertexProgram = VertexProgram;
+	// vertex programs are declared for whole vertices
+	mesh->SetVertexCompacting(VertexProgram == FixedFunction);
 }
 
 void Object::SetPixelProgram(dword PixelProgram) {
@@ -162,25 +248,120 @@ void Object::GetBlendFunc(BlendingFactor *src, BlendingFactor *dest) {
 	*dest = rendp.DestBlendFactor;
 }
 
-void Object::CalculateShadows(const Light **lights, int LightCount) {
-	if(ShadowVolumes) {
-		for(int i=0; i<ShadowCount; i++) {
-			delete ShadowVolumes[i];
+Object::ShadowKey Object::MakeShadowKey(const Light *light, const Matrix4x4 &XForm) const {
+	ShadowKey key;
+	key.light = light;
+	key.type = light->GetType();
+	key.LightVec = key.type == LTDir ? light->GetDirection() : light->GetPosition();
+	key.XForm = XForm;
+	key.MeshRevision = mesh->GetRevision();
+	return key;
+}
+
+bool Object::ShadowKeyMatches(const ShadowKey &key, const ShadowKey &cur, float tolerance) {
+	if(key.light != cur.light || key.type != cur.type || key.MeshRevision != cur.MeshRevision) return false;
+
+	if((cur.LightVec - key.LightVec).Length() > tolerance) return false;
+
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			if(fabs(cur.XForm.m[i][j] - key.XForm.m[i][j]) > tolerance) return false;
 		}
-		delete ShadowVolumes;
 	}
+	return true;
+}
+
+void Object::CalculateShadows(const Light **lights, int LightCount) {
+	delete [] ShadowVolumes;
+	delete [] ShadowKeys;
+
+	Matrix4x4 XForm = GetWorldTransform();
 
-	ShadowVolumes = new TriMesh*[LightCount];
+	ShadowVolumes = new std::vector<Vector3>[LightCount];
+	ShadowKeys = new ShadowKey[LightCount];
 	for(int i=0; i<LightCount; i++) {
-		ShadowVolumes[i] = CreateShadowVolume(*mesh, lights[i], GetWorldTransform());
+		CreateShadowVolume(*mesh, lights[i], XForm, &ShadowVolumes[i]);
+		ShadowKeys[i] = MakeShadowKey(lights[i], XForm);
 	}
 
 	ShadowCount = LightCount;
+	ShadowRevision++;
+}
+
+int Object::UpdateShadows(const Light **lights, int LightCount, float tolerance) {
+	int *stale = new int[LightCount];
+	int count = FindStaleShadows(lights, LightCount, tolerance, stale);
+
+	Matrix4x4 XForm = GetWorldTransform();
+	for(int i=0; i<count; i++) {
+		RebuildShadow(stale[i], lights[stale[i]], XForm);
+	}
+
+	delete [] stale;
+	return count;
 }
 
-TriMesh *Object::GetShadowVolume(int light) {
+int Object::FindStaleShadows(const Light **lights, int LightCount, float tolerance, int *stale, const bool *reach) {
+	// a different set of lights, start over
+	if(!ShadowVolumes || LightCount != ShadowCount) {
+		delete [] ShadowVolumes;
+		delete [] ShadowKeys;
+
+		ShadowVolumes = new std::vector<Vector3>[LightCount];
+		ShadowKeys = new ShadowKey[LightCount];
+		ShadowCount = LightCount;
+		ShadowRevision++;
+
+		int count = 0;
+		for(int i=0; i<LightCount; i++) {
+			ShadowKeys[i].light = 0;
+			if(!reach || reach[i]) stale[count++] = i;
+		}
+
+		// the edge table is made on first use, here rather than by racing
+		// RebuildShadow calls
+		if(count) mesh->GetEdgeCount();
+		return count;
+	}
+
+	Matrix4x4 XForm = GetWorldTransform();
+
+	int count = 0;
+	bool changed = false;
+	for(int i=0; i<LightCount; i++) {
+		if(reach && !reach[i]) {
+			// no light, no shadow, and a key that won't match when it's back
+			if(ShadowKeys[i].light) {
+				ShadowVolumes[i].clear();
+				ShadowKeys[i].light = 0;
+				changed = true;
+			}
+			continue;
+		}
+
+		if(!ShadowKeyMatches(ShadowKeys[i], MakeShadowKey(lights[i], XForm), tolerance)) {
+			stale[count++] = i;
+		}
+	}
+
+	if(count || changed) ShadowRevision++;
+	if(count) mesh->GetEdgeCount();
+	return count;
+}
+
+void Object::RebuildShadow(int index, const Light *light, const Matrix4x4 &XForm) {
+	ShadowVolumes[index].clear();
+	CreateShadowVolume(*mesh, light, XForm, &ShadowVolumes[index]);
+	ShadowKeys[index] = MakeShadowKey(light, XForm);
+}
+
+const std::vector<Vector3> *Object::GetShadowVolume(int light) const {
 	if(light >= ShadowCount) return 0;
-	return ShadowVolumes[light];
+	return &ShadowVolumes[light];
+}
+
+dword Object::GetShadowRevision() const {
+	return ShadowRevision;
 }
 
 void Object::SetShadowCasting(bool enable) {
@@ -229,8 +410,7 @@ void Object::Render2TexUnits() {
 
 	SetRenderStates();
 
-	VertexBuffer *vb = const_cast<VertexBuffer*>(mesh->GetVertexBuffer());
-	IndexBuffer *ib = const_cast<IndexBuffer*>(mesh->GetIndexBuffer());
+	byte level = GetDetailLevel();
 
 	Material mat = material;
 
@@ -255,7 +435,7 @@ void Object::Render2TexUnits() {
 		
 		gc->SetAlphaBlending(true);
 		gc->SetBlendFunc(rendp.SourceBlendFactor, rendp.DestBlendFactor);
-		gc->Draw(vb, ib);
+		DrawMesh(level);
 		gc->SetAlphaBlending(false);
 	} else {
         
@@ -271,7 +451,7 @@ void Object::Render2TexUnits() {
 			} else {
 				gc->SetTextureStageAlpha(stage, TexBlendSelectArg2, TexArgCurrent, TexArgTexture);
 			}
-			gc->SetTextureCoordIndex(stage, 0);
+			gc->SetTextureCoordIndex(stage, mesh->GetTexCoordIndex(0));
 			stage++;
 		}
 
@@ -292,7 +472,7 @@ void Object::Render2TexUnits() {
 		if(stage > 0) {
 			gc->SetAlphaBlending(true);
 			gc->SetBlendFunc(rendp.SourceBlendFactor, rendp.DestBlendFactor);
-			gc->Draw(vb, ib);
+			DrawMesh(level);
 			gc->SetAlphaBlending(false);
 
 			gc->SetTextureMatrix(Matrix4x4(), 0);
@@ -311,7 +491,7 @@ void Object::Render2TexUnits() {
             gc->SetTexture(stage, mat.Maps[LightMap]);
 			gc->SetTextureStageColor(stage, TexBlendSelectArg2, TexArgCurrent, TexArgTexture);
 			gc->SetTextureStageAlpha(stage, TexBlendSelectArg1, TexArgCurrent, TexArgTexture);
-			gc->SetTextureCoordIndex(stage, 1);
+			gc->SetTextureCoordIndex(stage, mesh->GetTexCoordIndex(1));
 			stage++;
 		}
 
@@ -322,7 +502,7 @@ void Object::Render2TexUnits() {
 		gc->SetTexture(stage, 0);
 		gc->DisableTextureStage(stage);
 
-		if(stage > 0) gc->Draw(vb, ib);
+		if(stage > 0) DrawMesh(level);
 
 		gc->DisableTextureStage(1);
 		gc->SetAlphaBlending(false);
@@ -335,8 +515,7 @@ void Object::Render2TexUnits() {
 void Object::Render4TexUnits() {
 	SetRenderStates();
 
-	VertexBuffer *vb = const_cast<VertexBuffer*>(mesh->GetVertexBuffer());
-	IndexBuffer *ib = const_cast<IndexBuffer*>(mesh->GetIndexBuffer());
+	byte level = GetDetailLevel();
 
 	Material mat = material;
 
@@ -361,7 +540,7 @@ void Object::Render4TexUnits() {
 		
 		gc->SetAlphaBlending(true);
 		gc->SetBlendFunc(rendp.SourceBlendFactor, rendp.DestBlendFactor);
-		gc->Draw(vb, ib);
+		DrawMesh(level);
 		gc->SetAlphaBlending(false);
 	} else {
         
@@ -377,7 +556,7 @@ void Object::Render4TexUnits() {
 			} else {
 				gc->SetTextureStageAlpha(stage, TexBlendSelectArg2, TexArgCurrent, TexArgTexture);
 			}
-			gc->SetTextureCoordIndex(stage, 0);
+			gc->SetTextureCoordIndex(stage, mesh->GetTexCoordIndex(0));
 			stage++;
 		}
 
@@ -385,7 +564,7 @@ void Object::Render4TexUnits() {
             gc->SetTexture(stage, mat.Maps[DetailMap]);
 			gc->SetTextureStageColor(stage, TexBlendAdd, TexArgCurrent, TexArgTexture);
 			gc->SetTextureStageAlpha(stage, TexBlendSelectArg1, TexArgCurrent, TexArgTexture);
-			gc->SetTextureCoordIndex(stage, 1);
+			gc->SetTextureCoordIndex(stage, mesh->GetTexCoordIndex(1));
 			stage++;
 		}
 
@@ -410,7 +589,7 @@ void Object::Render4TexUnits() {
 		if(stage > 0) {
 			gc->SetAlphaBlending(true);
 			gc->SetBlendFunc(rendp.SourceBlendFactor, rendp.DestBlendFactor);
-			gc->Draw(vb, ib);
+			DrawMesh(level);
 			gc->SetAlphaBlending(false);
 
 			gc->SetTextureMatrix(Matrix4x4(), 0);
@@ -430,14 +609,14 @@ void Object::Render4TexUnits() {
             gc->SetTexture(stage, mat.Maps[LightMap]);
 			gc->SetTextureStageColor(stage, TexBlendSelectArg2, TexArgCurrent, TexArgTexture);
 			gc->SetTextureStageAlpha(stage, TexBlendSelectArg1, TexArgCurrent, TexArgTexture);
-			gc->SetTextureCoordIndex(stage, 1);
+			gc->SetTextureCoordIndex(stage, mesh->GetTexCoordIndex(1));
 			stage++;
 		}
 
 		gc->SetTexture(stage, 0);
 		gc->DisableTextureStage(stage);
 
-		if(stage > 0) gc->Draw(vb, ib);
+		if(stage > 0) DrawMesh(level);
 
 		gc->SetAlphaBlending(false);
 	}
@@ -550,9 +729,19 @@ void Object::Render() {
 
 
 void Object::RenderBare() {
-	VertexBuffer *vb = const_cast<VertexBuffer*>(mesh->GetVertexBuffer());
-	IndexBuffer *ib = const_cast<IndexBuffer*>(mesh->GetIndexBuffer());
-	gc->Draw(vb, ib);
+	DrawMesh(GetDetailLevel());
+}
+
+// big meshes may come in more than one piece
+void Object::DrawMesh(byte level) {
+	VertexBuffer *vb = const_cast<VertexBuffer*>(mesh->GetVertexBuffer(level));
+	IndexBuffer *ib = const_cast<IndexBuffer*>(mesh->GetIndexBuffer(level));
+	if(!vb || !ib) return;
+
+	const MeshChunk *chunks = mesh->GetChunks(level);
+	for(dword i=0; i<mesh->GetChunkCount(level); i++) {
+		gc->Draw(vb, ib, chunks[i].FirstVertex, chunks[i].VertexCount, chunks[i].FirstTri, chunks[i].TriCount);
+	}
 }
 
 
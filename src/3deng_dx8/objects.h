@@ -2,9 +2,11 @@
 #define _OBJECTS_H_
 
 #include <string>
+#include <vector>
 #include "3dengine.h"
 #include "n3dmath.h"
 #include "3dgeom.h"
+#include "lights.h"
 #include "material.h"
 #include "motion.h"
 
@@ -13,10 +15,32 @@ protected:
 	GraphicsContext *gc;
 	RenderParams rendp;
 
+	// what a shadow volume was made from, to tell when it has to be remade
+	struct ShadowKey {
+		const Light *light;
+		LightType type;
+		Vector3 LightVec;		// position, or direction for directional lights
+		Matrix4x4 XForm;
+		dword MeshRevision;
+	};
+
 	TriMesh *mesh;
-	TriMesh **ShadowVolumes;
+	std::vector<Vector3> *ShadowVolumes;	// world space positions, one list per light
+	ShadowKey *ShadowKeys;
 	int ShadowCount;
+	dword ShadowRevision;	// bumped whenever any of the volumes changes
+
+	// object space bounding sphere, for the mesh revision it was made from
+	Vector3 BoundCenter;
+	float BoundRadius;
+	dword BoundRevision;
+	bool BoundValid;
 	bool CastShadows;
+
+	float DetailSize;
+
+	ShadowKey MakeShadowKey(const Light *light, const Matrix4x4 &XForm) const;
+	static bool ShadowKeyMatches(const ShadowKey &key, const ShadowKey &cur, float tolerance);
 	
 	Matrix4x4 WorldXForm;
 //	Matrix4x4 TransMat, RotMat, ScaleMat, GRotMat;
@@ -28,6 +52,7 @@ protected:
 	void Render2TexUnits();
 	void Render4TexUnits();
 	void Render8TexUnits();
+	void DrawMesh(byte level);
 
 public:
 	std::string name;
@@ -40,6 +65,10 @@ public:
 	~Object();
 
 	TriMesh *GetTriMesh();
+
+	// the mesh's too, its buffers are made again for the new context
+	void SetGraphicsContext(GraphicsContext *gc);
+	GraphicsContext *GetGraphicsContext() const;
 	
 	void ResetTransform();
 	void ResetTranslation();
@@ -66,6 +95,13 @@ public:
 	void SetScaling(float sx, float sy, float sz);
 
     const Matrix4x4 GetWorldTransform() const;
+	void GetBoundingSphere(Vector3 *center, float *radius);	// in world space
+
+	// The mesh level drawn is picked by how much of the screen height the
+	// bounding sphere takes: level 0 down to size, each level after that down
+	// to half the size of the one before.
+	void SetDetailSize(float size);
+	byte GetDetailLevel();
 
 	void SetTextureMatrix(Matrix4x4 mat);
 	Matrix4x4 GetTextureMatrix() const;
@@ -80,7 +116,20 @@ public:
 
 	// about shadows
 	void CalculateShadows(const Light **lights, int LightCount);
-	TriMesh *GetShadowVolume(int light);
+	// only remakes the volumes of lights that, or whose caster, moved by more
+	// than tolerance since, returns how many it remade
+	int UpdateShadows(const Light **lights, int LightCount, float tolerance = 0.0f);
+	// UpdateShadows in two steps: FindStaleShadows fills stale (room for
+	// LightCount) with the lights whose volumes need remaking and returns how
+	// many, RebuildShadow remakes one. Different volumes can be remade on
+	// different threads at once, as long as the mesh has its edge table
+	// already, which FindStaleShadows makes sure of when it returns any.
+	// Lights with reach[i] false can't get to the object and get an empty
+	// volume instead (no reach for all of them).
+	int FindStaleShadows(const Light **lights, int LightCount, float tolerance, int *stale, const bool *reach = 0);
+	void RebuildShadow(int index, const Light *light, const Matrix4x4 &XForm);
+	const std::vector<Vector3> *GetShadowVolume(int light) const;
+	dword GetShadowRevision() const;
 	void SetShadowCasting(bool enable);
 	bool GetShadowCasting() const;
 
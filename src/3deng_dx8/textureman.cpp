@@ -1,181 +1,395 @@
+#include <cstdio>
 #include "textureman.h"
 #include "3dengine.h"
 #include "d3dx8.h"
+#include "packfile.h"
+#include "mappedfile.h"
+#include "datacache.h"
 
 using std::string;
 
-template <class KeyType>
-unsigned int Hash(const KeyType &key, unsigned long size) {
-	string str = (string)key;
-	return ((unsigned int)str[0] + (unsigned int)str[1] + (unsigned int)str[2]) % size;
-}
+// A texture file, read along with its cache entry. That's all the work that
+// doesn't need the device, so for LoadTextureAsync it's done by the pool.
+struct TextureRequest {
+	TextureManager *texman;
+	string fname;
+	Texture **dest;
+	TextureGroup *group;
+
+	std::vector<byte> buf;
+	MappedFile file;
+	const byte *data;
+	dword size;
+
+	qword key;
+	CacheEntry cached;
+
+	TextureRequest *next;	// in the finished stack
+};
 
 TextureManager::TextureManager(GraphicsContext *gc) {
 	this->gc = gc;
 	notfilecount = 0;
 
-	textures.SetHashFunction(Hash);
+	pool = new ThreadPool;
+	finished = 0;
 
 	CreateStockTextures();
 }
 
-TextureManager::~TextureManager() {}
+TextureManager::~TextureManager() {
+	delete pool;	// finishes the reads in flight
+
+	TextureRequest *req = (TextureRequest*)finished;
+	while(req) {
+		TextureRequest *next = req->next;
+		delete req;
+		req = next;
+	}
+}
 
 #define STOCKSIZE	256
 #include <cassert>
 
-void TextureManager::CreateStockTextures() {
-	Surface *surf;
+// bump when the stock textures or the way texture levels are cached change
+const dword TextureCacheVersion = 1;
+
+// A cached texture is a TexLevels header followed by all the mip levels,
+// top level first, each one with its rows packed together.
+struct TexLevels {
+	dword format;
+	dword width, height;
+	dword levels;
+};
+
+dword GetPixelSize(D3DFORMAT fmt) {
+	switch(fmt) {
+	case D3DFMT_A8R8G8B8:
+	case D3DFMT_X8R8G8B8:
+		return 4;
+	case D3DFMT_R8G8B8:
+		return 3;
+	case D3DFMT_R5G6B5:
+	case D3DFMT_X1R5G5B5:
+	case D3DFMT_A1R5G5B5:
+	case D3DFMT_A4R4G4B4:
+		return 2;
+	case D3DFMT_L8:
+	case D3DFMT_A8:
+		return 1;
+	default:
+		return 0;	// compressed or something exotic, not cached
+	}
+}
 
-	// ----- 1/d^2 blob texture -----
-	Texture *tmp = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true, true);
-	tmp->GetSurfaceLevel(0, &surf);
-	
-	dword *ptr, offs;
-	D3DLOCKED_RECT d3dlock;
-	assert(surf->LockRect(&d3dlock, 0, 0) == D3D_OK);
-	ptr = (dword*)d3dlock.pBits;
-	offs = (d3dlock.Pitch >> 2) - STOCKSIZE;
+// copies every level of a lockable (managed or system memory) texture into the cache
+bool SaveCachedLevels(Texture *tex, qword key) {
+	D3DSURFACE_DESC desc;
+	tex->GetLevelDesc(0, &desc);
 
-	Vector2 Center((float)(STOCKSIZE>>1), (float)(STOCKSIZE>>1));
+	TexLevels hdr;
+	hdr.format = desc.Format;
+	hdr.width = desc.Width;
+	hdr.height = desc.Height;
+	hdr.levels = tex->GetLevelCount();
+
+	dword PixelSize = GetPixelSize(desc.Format);
+	if(!PixelSize) return false;
+
+	std::vector<byte> pixels;
+	for(dword i=0; i<hdr.levels; i++) {
+		tex->GetLevelDesc(i, &desc);
+		dword RowSize = desc.Width * PixelSize;
 
-	for(int y=0; y<STOCKSIZE; y++) {
-		for(int x=0; x<STOCKSIZE; x++) {
-			Vector2 pos((float)x, (float)y);
-			float p = 100.0f / (pos - Center).LengthSq();
+		D3DLOCKED_RECT d3dlock;
+		if(tex->LockRect(i, &d3dlock, 0, D3DLOCK_READONLY) != D3D_OK) return false;
 
-			Color col(p, p, p, p);
-			*ptr++ = col.GetPacked32();
+		dword offs = (dword)pixels.size();
+		pixels.resize(offs + RowSize * desc.Height);
+		for(dword y=0; y<desc.Height; y++) {
+			memcpy(&pixels[offs + y * RowSize], (byte*)d3dlock.pBits + y * d3dlock.Pitch, RowSize);
 		}
-		ptr += offs;
+		tex->UnlockRect(i);
 	}
 
-	surf->UnlockRect();
+	return datacache::Store("texture", key, &hdr, sizeof hdr, &pixels[0], (dword)pixels.size());
+}
 
-	Texture *Blob = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true);
-	gc->D3DDevice->UpdateTexture(tmp, Blob);
+// fills the levels of tex from a cache entry made by SaveCachedLevels
+bool LoadCachedLevels(Texture *tex, const CacheEntry &ent) {
+	const TexLevels *hdr = (const TexLevels*)ent.GetData();
+	const byte *src = ent.GetData() + sizeof *hdr;
+	dword left = ent.GetSize() - sizeof *hdr;
 
-	UpdateMipmapChain(Blob);
+	if(hdr->levels != tex->GetLevelCount()) return false;
+	dword PixelSize = GetPixelSize((D3DFORMAT)hdr->format);
 
-	AddTexture(Blob, "STOCKTEX_BLOB");
-	tmp->Release();
+	for(dword i=0; i<hdr->levels; i++) {
+		D3DSURFACE_DESC desc;
+		tex->GetLevelDesc(i, &desc);
+		if(desc.Format != (D3DFORMAT)hdr->format) return false;
 
-	// ----- chessboard texture -----
-
-	tmp = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true, true);
-	tmp->GetSurfaceLevel(0, &surf);
-	
-	assert(surf->LockRect(&d3dlock, 0, 0) == D3D_OK);
-	ptr = (dword*)d3dlock.pBits;
-	offs = (d3dlock.Pitch >> 2) - STOCKSIZE;
-
-	for(int y=0; y<STOCKSIZE; y++) {
-		for(int x=0; x<STOCKSIZE; x++) {
-			int dx = x - (STOCKSIZE>>1);
-			int dy = y - (STOCKSIZE>>1);
-			if((dx > 0 && dy > 0) || (dx < 0 && dy < 0)) {
-				*ptr++ = 0xffffffff;
-			} else {
-				*ptr++ = 0xff000000;
-			}
+		dword RowSize = desc.Width * PixelSize;
+		if(left / RowSize < desc.Height) return false;
+
+		D3DLOCKED_RECT d3dlock;
+		if(tex->LockRect(i, &d3dlock, 0, 0) != D3D_OK) return false;
+		for(dword y=0; y<desc.Height; y++) {
+			memcpy((byte*)d3dlock.pBits + y * d3dlock.Pitch, src, RowSize);
+			src += RowSize;
 		}
-		ptr += offs;
+		tex->UnlockRect(i);
+		left -= RowSize * desc.Height;
 	}
+	return true;
+}
 
-	surf->UnlockRect();
+// opens a cached texture entry, checking that its header makes sense
+bool OpenCachedLevels(CacheEntry *ent, qword key) {
+	if(!ent->Open("texture", key) || ent->GetSize() < sizeof(TexLevels)) return false;
 
-	Texture *ChessBoard = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true);
-	gc->D3DDevice->UpdateTexture(tmp, ChessBoard);
+	const TexLevels *hdr = (const TexLevels*)ent->GetData();
+	return GetPixelSize((D3DFORMAT)hdr->format) && hdr->width && hdr->height && hdr->levels;
+}
 
-	UpdateMipmapChain(ChessBoard);
+// ----- stock texture generators -----
 
-	AddTexture(ChessBoard, "STOCKTEX_CHESSBOARD");
-	tmp->Release();
+// 1/d^2 blob
+dword BlobTexel(int x, int y) {
+	Vector2 Center((float)(STOCKSIZE>>1), (float)(STOCKSIZE>>1));
+	Vector2 pos((float)x, (float)y);
+	float p = 100.0f / (pos - Center).LengthSq();
 
-	// ----- grid texture -----
-
-	tmp = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true, true);
-	tmp->GetSurfaceLevel(0, &surf);
-	
-	assert(surf->LockRect(&d3dlock, 0, 0) == D3D_OK);
-	ptr = (dword*)d3dlock.pBits;
-	offs = (d3dlock.Pitch >> 2) - STOCKSIZE;
-
-	for(int y=0; y<STOCKSIZE; y++) {
-		for(int x=0; x<STOCKSIZE; x++) {
-			if(x == 0 || x == STOCKSIZE-1 || y == 0 || y == STOCKSIZE-1) {
-				*ptr++ = 0xffffffff;
-			} else {
-				*ptr++ = 0xff000000;
-			}
-		}
-		ptr += offs;
+	Color col(p, p, p, p);
+	return col.GetPacked32();
+}
+
+dword ChessBoardTexel(int x, int y) {
+	int dx = x - (STOCKSIZE>>1);
+	int dy = y - (STOCKSIZE>>1);
+	if((dx > 0 && dy > 0) || (dx < 0 && dy < 0)) {
+		return 0xffffffff;
 	}
+	return 0xff000000;
+}
+
+dword GridTexel(int x, int y) {
+	if(x == 0 || x == STOCKSIZE-1 || y == 0 || y == STOCKSIZE-1) {
+		return 0xffffffff;
+	}
+	return 0xff000000;
+}
+
+// biased linear falloff
+dword BlofmTexel(int x, int y) {
+	Vector2 Center((float)(STOCKSIZE>>1), (float)(STOCKSIZE>>1));
+	Vector2 pos((float)x, (float)y);
+	float dist = (pos - Center).Length();
+	// f[x] / ((1/b - 2) * (1 - f[x]) + 1)
+	float b = 0.3f;
+	float p = dist ? ((STOCKSIZE - dist) / STOCKSIZE) / ((1/b-2) * (1-((STOCKSIZE - dist) / STOCKSIZE)) + 1) : 1.0f;
+
+	Color col(p, p, p, p);
+	return col.GetPacked32();
+}
 
-	surf->UnlockRect();
+void TextureManager::CreateStockTextures() {
+	CreateStockTexture("STOCKTEX_BLOB", BlobTexel);
+	CreateStockTexture("STOCKTEX_CHESSBOARD", ChessBoardTexel);
+	CreateStockTexture("STOCKTEX_GRID", GridTexel);
+	CreateStockTexture("STOCKTEX_BLOFM", BlofmTexel);
+}
 
-	Texture *Grid = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true);
-	gc->D3DDevice->UpdateTexture(tmp, Grid);
+// The texture is generated in system memory along with its mip chain, which
+// then all goes to the card. All the levels are kept in the data cache, so
+// later runs only copy them in.
+Texture *TextureManager::CreateStockTexture(const char *name, StockTexelFunc texel) {
+	Texture *tmp = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true, true);
 
-	UpdateMipmapChain(Grid);
+	CacheKey key("stocktex", TextureCacheVersion);
+	key.Add(name);
+	key.Add((dword)STOCKSIZE);
 
-	AddTexture(Grid, "STOCKTEX_GRID");
-	tmp->Release();
+	CacheEntry ent;
+	if(!OpenCachedLevels(&ent, key.Get()) || !LoadCachedLevels(tmp, ent)) {
+		Surface *surf;
+		tmp->GetSurfaceLevel(0, &surf);
 
+		dword *ptr, offs;
+		D3DLOCKED_RECT d3dlock;
+		assert(surf->LockRect(&d3dlock, 0, 0) == D3D_OK);
+		ptr = (dword*)d3dlock.pBits;
+		offs = (d3dlock.Pitch >> 2) - STOCKSIZE;
 
-	// ---------- biased linear falloff ---------
-	tmp = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true, true);
-	tmp->GetSurfaceLevel(0, &surf);
-	
-	assert(surf->LockRect(&d3dlock, 0, 0) == D3D_OK);
-	ptr = (dword*)d3dlock.pBits;
-	offs = (d3dlock.Pitch >> 2) - STOCKSIZE;
-
-	Center = Vector2((float)(STOCKSIZE>>1), (float)(STOCKSIZE>>1));
-
-	for(int y=0; y<STOCKSIZE; y++) {
-		for(int x=0; x<STOCKSIZE; x++) {
-			Vector2 pos((float)x, (float)y);
-			float dist = (pos - Center).Length();
-			// f[x] / ((1/b - 2) * (1 - f[x]) + 1)
-			float b = 0.3f;
-			float p = dist ? ((STOCKSIZE - dist) / STOCKSIZE) / ((1/b-2) * (1-((STOCKSIZE - dist) / STOCKSIZE)) + 1) : 1.0f;
-			
-			Color col(p, p, p, p);
-			*ptr++ = col.GetPacked32();
+		for(int y=0; y<STOCKSIZE; y++) {
+			for(int x=0; x<STOCKSIZE; x++) {
+				*ptr++ = texel(x, y);
+			}
+			ptr += offs;
 		}
-		ptr += offs;
-	}
 
-	surf->UnlockRect();
+		surf->UnlockRect();
+		surf->Release();
 
-	Texture *Blofm = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true);
-	gc->D3DDevice->UpdateTexture(tmp, Blofm);
-
-	UpdateMipmapChain(Blofm);
+		UpdateMipmapChain(tmp);
+		SaveCachedLevels(tmp, key.Get());
+	}
+	ent.Close();
 
-	AddTexture(Blofm, "STOCKTEX_BLOFM");
+	Texture *tex = CreateTexture(STOCKSIZE, STOCKSIZE, 0, true);
+	gc->D3DDevice->UpdateTexture(tmp, tex);
 	tmp->Release();
+
+	return AddTexture(tex, name);
 }
 
 void TextureManager::SetGraphicsContext(GraphicsContext *gc) {
 	this->gc = gc;
 }
 
+bool ReadTextureFile(TextureRequest *req) {
+	// try the data pack first, then the file system
+	const PackFile *pack = packfile::GetDataPack();
+	req->data = pack ? pack->Read(req->fname.c_str(), &req->size, &req->buf) : 0;
+	if(!req->data) {
+		if(!req->file.Open(req->fname.c_str())) return false;
+		req->data = req->file.GetData();
+		req->size = req->file.GetSize();
+	}
+
+	// decoding the image and filtering its mip chain is skipped if the
+	// cache has the levels made from this exact file
+	CacheKey key("texture", TextureCacheVersion);
+	key.Add(req->data, req->size);
+	req->key = key.Get();
+	OpenCachedLevels(&req->cached, req->key);
+	return true;
+}
+
+// creates the texture of a read request, on the main thread
+Texture *CreateRequestedTexture(GraphicsContext *gc, TextureRequest *req) {
+	if(!req->data) return 0;
+
+	Texture *tex = 0;
+	if(req->cached.GetData()) {
+		const TexLevels *hdr = (const TexLevels*)req->cached.GetData();
+		if(gc->D3DDevice->CreateTexture(hdr->width, hdr->height, hdr->levels, 0, (D3DFORMAT)hdr->format, D3DPOOL_MANAGED, &tex) == D3D_OK) {
+			if(!LoadCachedLevels(tex, req->cached)) {
+				tex->Release();
+				tex = 0;
+			}
+		} else {
+			tex = 0;
+		}
+	}
+
+	if(!tex) {
+		if(D3DXCreateTextureFromFileInMemory(gc->D3DDevice, req->data, req->size, &tex) != D3D_OK) return 0;
+		SaveCachedLevels(tex, req->key);
+	}
+	return tex;
+}
+
+void ReadTextureJob(void *data) {
+	TextureRequest *req = (TextureRequest*)data;
+	if(!ReadTextureFile(req)) req->data = 0;
+	req->texman->FinishRequest(req);
+}
+
 Texture *TextureManager::LoadTexture(const char *fname) {
 	if(!gc || !fname) return 0;
 
-	Texture *tex;
-
-	Pair<string, Texture*> *p;
+	TextureEntry *p;
 	if(!(p = textures.Find(fname))) {
-        if(D3DXCreateTextureFromFile(gc->D3DDevice, fname, &tex) != D3D_OK) return 0;
-		textures.Insert(fname, tex);
-	} else {
-		tex = p->val;
+		TextureRequest req;
+		req.fname = fname;
+		if(!ReadTextureFile(&req)) return 0;
+
+		TextureEntry entry;
+		if(!(entry.tex = CreateRequestedTexture(gc, &req))) return 0;
+		entry.uses = 0;
+		p = textures.Insert(fname, entry);
 	}
 
-	return tex;
+	p->uses++;
+	return p->tex;
+}
+
+void TextureManager::LoadTextureAsync(const char *fname, Texture **dest, TextureGroup *group) {
+	TextureRequest *req = new TextureRequest;
+	req->texman = this;
+	req->fname = fname;
+	req->dest = dest;
+	req->group = group;
+	req->data = 0;
+	req->size = 0;
+
+	if(group) AtomicIncrement(&group->pending);
+	pool->AddJob(ReadTextureJob, req);
+}
+
+// Called by the pool threads. The finished requests are kept in a lock-free
+// stack that UploadTextures takes whole, so there's nothing to contend on.
+void TextureManager::FinishRequest(TextureRequest *req) {
+	void *head;
+	do {
+		head = (void*)finished;
+		req->next = (TextureRequest*)head;
+	} while(AtomicCompareExchangePointer((void *volatile*)&finished, req, head) != head);
+}
+
+void TextureManager::UploadTextures() {
+	TextureRequest *list = (TextureRequest*)AtomicExchangePointer((void *volatile*)&finished, 0);
+
+	// back to the order they were finished in
+	TextureRequest *req = 0;
+	while(list) {
+		TextureRequest *next = list->next;
+		list->next = req;
+		req = list;
+		list = next;
+	}
+
+	while(req) {
+		// loaded in the meantime, or requested twice
+		TextureEntry *p = textures.Find(req->fname.c_str());
+		if(!p && gc) {
+			TextureEntry entry;
+			if((entry.tex = CreateRequestedTexture(gc, req))) {
+				entry.uses = 0;
+				p = textures.Insert(req->fname.c_str(), entry);
+			}
+		}
+
+		if(p) {
+			p->uses++;
+			*req->dest = p->tex;
+		}
+		if(req->group) AtomicDecrement(&req->group->pending);
+
+		TextureRequest *next = req->next;
+		delete req;
+		req = next;
+	}
+}
+
+void TextureManager::WaitTextures(TextureGroup *group) {
+	while(true) {
+		UploadTextures();
+		if(!group->pending) break;
+		ThreadSleep(1);
+	}
+}
+
+// Frees the texture with its last use. The device keeps its own references
+// on the textures bound to it, so unbind them first for it to really go.
+void TextureManager::ReleaseTexture(const char *fname) {
+	TextureEntry *p = textures.Find(fname);
+	if(!p || --p->uses > 0) return;
+
+	Texture *tex = p->tex;
+	textures.Remove(fname);
+	tex->Release();
 }
 
 Texture *TextureManager::CreateTexture(dword x, dword y, dword usage, bool mipmaps, bool local) {
@@ -189,8 +403,16 @@ Texture *TextureManager::CreateTexture(dword x, dword y, dword usage, bool mipma
 }
 
 Texture *TextureManager::AddTexture(Texture *tex, const char *name) {
-	string fname = name ? name : "not_a_file_" + notfilecount;
-	textures.Insert(fname, tex);
+	// every key has to be different
+	char fname[32];
+	if(!name) {
+		sprintf(fname, "not_a_file_%d", notfilecount++);
+		name = fname;
+	}
+	TextureEntry entry;
+	entry.tex = tex;
+	entry.uses = 1;
+	textures.Insert(name, entry);
 	return tex;
 }
 
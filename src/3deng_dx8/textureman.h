@@ -2,8 +2,9 @@
 #define _TEXTUREMAN_H_
 
 #include <string>
-#include "hashtable.h"
+#include "stringmap.h"
 #include "typedefs.h"
+#include "threadpool.h"
 #include "d3d8.h"
 #include "3dengtypes.h"
 
@@ -12,17 +13,39 @@ class GraphicsContext;
 const dword UsageRenderTarget	= D3DUSAGE_RENDERTARGET;
 const dword UsageDepthStencil	= D3DUSAGE_DEPTHSTENCIL;
 
+typedef dword (*StockTexelFunc)(int x, int y);
+
+struct TextureRequest;
+
+// the manager holds one reference on the texture itself, and counts the
+// LoadTexture calls still to be matched by a ReleaseTexture
+struct TextureEntry {
+	Texture *tex;
+	int uses;
+};
+
+// counts the textures of a batch of LoadTextureAsync calls still on their way
+struct TextureGroup {
+	volatile long pending;
+
+	TextureGroup() : pending(0) {}
+};
+
 class TextureManager {
 private:
 	GraphicsContext *gc;
-	HashTable<std::string, Texture*> textures;
+	StringMap<TextureEntry> textures;
 	int notfilecount;
 
+	ThreadPool *pool;
+	TextureRequest *volatile finished;
+
 	// private copy constructor and assignment op, to prohibit copying
 	TextureManager(const TextureManager &tm) {}
 	void operator =(const TextureManager &tm) {}
 
 	void CreateStockTextures();
+	Texture *CreateStockTexture(const char *name, StockTexelFunc texel);
 
 public:
 	TextureManager(GraphicsContext *gc = 0);
@@ -30,7 +53,22 @@ public:
 
 	void SetGraphicsContext(GraphicsContext *gc);
 
+	// every call counts as a use, to be dropped with ReleaseTexture
 	Texture *LoadTexture(const char *fname);
+	void ReleaseTexture(const char *fname);
+
+	// Reads the file (and its cached levels) on a pool thread and returns
+	// right away, can be called from any thread. *dest is set by a later
+	// UploadTextures, counting as a use as LoadTexture does, and stays as it
+	// is if the texture can't be loaded.
+	void LoadTextureAsync(const char *fname, Texture **dest, TextureGroup *group = 0);
+	void FinishRequest(TextureRequest *req);	// for the pool
+
+	// main thread: creates the textures that are done reading
+	void UploadTextures();
+	// main thread: uploads until every texture of the group is in
+	void WaitTextures(TextureGroup *group);
+
 	Texture *CreateTexture(dword x, dword y, dword usage, bool mipmaps, bool local=false);
 	Texture *AddTexture(Texture *tex, const char *name=0);
 	Texture *AddTexture(const char *fname);
@@ -2,26 +2,25 @@
 
 BeginPart::BeginPart(GraphicsContext *gc) {
 	this->gc = gc;
+}
 
-	this->gc = gc;
-
-	SceneLoader::SetNormalFileSaving(true);
-	SceneLoader::SetDataPath("data/textures/");
-	SceneLoader::LoadScene("data/geometry/begin.3ds", &scene);
+void BeginPart::Load() {
+	loader.SetNormalFileSaving(true);
+	loader.SetDataPath("data/textures/");
+	loader.LoadScene("data/geometry/begin.3ds", &scene);
+}
 
+void BeginPart::Upload() {
 	light = new DirLight(Vector3(0.0f, 0.0f, 1.0f));
 	light->SetIntensity(1.5f);
 	scene->AddLight(light);
 
 	// get stuff
-	Logo1 = scene->GetObject("LogoT");
-	scene->RemoveObject(Logo1);
+	Logo1 = TakeObject("LogoT");
 
-	Logo2 = scene->GetObject("LogoB");
-	scene->RemoveObject(Logo2);
+	Logo2 = TakeObject("LogoB");
 
-	VolumeLogo = scene->GetObject("VolumeLogo");
-	scene->RemoveObject(VolumeLogo);
+	VolumeLogo = TakeObject("VolumeLogo");
 	
 	Latin1 = scene->GetObject("Latin1");	
 	Latin2 = scene->GetObject("Latin2");	
@@ -30,13 +29,13 @@ BeginPart::BeginPart(GraphicsContext *gc) {
 	TheLabText[0] = scene->GetObject("LabText1");
 	TheLabText[1] = scene->GetObject("LabText2");
 
-	scene->RemoveObject(scene->GetObject("Plane01"));
+	TakeObject("Plane01");
 
 	gc->SetTextureTransformState(0, TexTransform2D);
 }
 
 BeginPart::~BeginPart() {
-	delete scene;
+	Evict();
 }
 
 #define psin(x) (sinf(x) / 2.0f + 0.5f)
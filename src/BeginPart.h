@@ -16,6 +16,9 @@ public:
 	BeginPart(GraphicsContext *gc);
 	~BeginPart();
 
+	virtual void Load();
+	virtual void Upload();
+
 	void MainLoop();
 };
 
@@ -7,11 +7,15 @@ extern FMUSIC_MODULE *mod;
 
 DemonPart::DemonPart(GraphicsContext *gc) {
 	this->gc = gc;
+}
 
-	//SceneLoader::SetNormalFileSaving(true);
-	SceneLoader::SetDataPath("data/textures/");
-	SceneLoader::LoadScene("data/geometry/demon.3ds", &scene);
+void DemonPart::Load() {
+	//loader.SetNormalFileSaving(true);
+	loader.SetDataPath("data/textures/");
+	loader.LoadScene("data/geometry/demon.3ds", &scene);
+}
 
+void DemonPart::Upload() {
 	curve = scene->GetCurve("Line01");
 	curve->SetArcParametrization(true);
 	cam = scene->GetCamera("Camera01");
@@ -19,7 +23,7 @@ DemonPart::DemonPart(GraphicsContext *gc) {
 }
 
 DemonPart::~DemonPart() {
-	delete scene;
+	Evict();
 }
 
 void DemonPart::MainLoop() {
@@ -12,6 +12,9 @@ public:
 	DemonPart(GraphicsContext *gc);
 	~DemonPart();
 
+	virtual void Load();
+	virtual void Upload();
+
 	void MainLoop();
 };
 
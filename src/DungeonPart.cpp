@@ -2,13 +2,16 @@
 #include "d3dx8.h"
 
 DungeonPart::DungeonPart(GraphicsContext *gc) {
-
 	this->gc = gc;
+}
 
-	SceneLoader::SetNormalFileSaving(true);
-	SceneLoader::SetDataPath("data/textures/");
-	SceneLoader::LoadScene("data/geometry/scene2.3ds", &scene);
-	
+void DungeonPart::Load() {
+	loader.SetNormalFileSaving(true);
+	loader.SetDataPath("data/textures/");
+	loader.LoadScene("data/geometry/scene2.3ds", &scene);
+}
+
+void DungeonPart::Upload() {
 	// setup camera paths
 	CamPath[0] = scene->GetCurve("cpath01");
 	CamPath[1] = scene->GetCurve("cpath02");
@@ -22,7 +25,6 @@ DungeonPart::DungeonPart(GraphicsContext *gc) {
 	TargPath[0]->SetArcParametrization(true);
 	TargPath[1]->SetArcParametrization(true);
 
-
 	cam[0] = scene->GetCamera("Camera01");
 	cam[1] = scene->GetCamera("Camera02");
 	cam[2] = scene->GetCamera("Camera03");
@@ -33,21 +35,18 @@ DungeonPart::DungeonPart(GraphicsContext *gc) {
 	cam[2]->SetCameraPath(CamPath[2], TargPath[1], 45000, 75000);
 	
 	// get the lava crust under control
-	LavaCrust = scene->GetObject("Plane02");
-	scene->RemoveObject(LavaCrust);
+	LavaCrust = TakeObject("Plane02");
 
 	// get the shadow-map walls under control
-	ShadowObj[0] = scene->GetObject("TunnelLigh");
-	scene->RemoveObject(ShadowObj[0]);
-	ShadowObj[1] = scene->GetObject("TunnelLig0");
-	scene->RemoveObject(ShadowObj[1]);
+	ShadowObj[0] = TakeObject("TunnelLigh");
+	ShadowObj[1] = TakeObject("TunnelLig0");
 
 	// load the flame textures
 	for(int i=0; i<FLAME_TEXTURES; i++) {
 		char num[3];
 		sprintf(num, "%02d", i);
 		string fname = string("data/textures/flame/flame") + string(num) + string(".jpg");
-		FlameTex[i] = gc->texman->AddTexture(fname.c_str());
+		FlameTex[i] = AddTexture(fname.c_str());
 	}
 
 	// get the flame objects and remove them from the scene (to take over the rendering)
@@ -56,26 +55,23 @@ DungeonPart::DungeonPart(GraphicsContext *gc) {
 		sprintf(num, "%02d", i);
 		string name = string("Fire") + string(num);
 		
-		Flame[i] = scene->GetObject(name.c_str());
-		scene->RemoveObject(Flame[i]);
+		Flame[i] = TakeObject(name.c_str());
 	}
 
-	LightRays = scene->GetObject("LightRays");
-	scene->RemoveObject(LightRays);
+	LightRays = TakeObject("LightRays");
 
-	Floor[0] = scene->GetObject("floor1");
-	Floor[1] = scene->GetObject("floor2");
-	Floor[2] = scene->GetObject("floor3");
-	for(int i=0; i<3; i++) scene->RemoveObject(Floor[i]);
+	Floor[0] = TakeObject("floor1");
+	Floor[1] = TakeObject("floor2");
+	Floor[2] = TakeObject("floor3");
 
-	Obj = scene->GetObject("DefSphere");
-	scene->RemoveObject(Obj);
+	Obj = TakeObject("DefSphere");
 
-	mobj = new Object(gc);
-	mobj->GetTriMesh()->SetData(Obj->GetTriMesh()->GetVertexArray(), Obj->GetTriMesh()->GetTriangleArray(), Obj->GetTriMesh()->GetVertexCount(), Obj->GetTriMesh()->GetTriangleCount());
+	// keeps the sphere as it was loaded, for Obj to go back to every frame
+	mobj = KeepObject(new Object(gc));
+	mobj->GetTriMesh()->ShareData(*Obj->GetTriMesh());
 
-	Obj->material.SetTexture(gc->texman->AddTexture("data/textures/rusty01.jpg"), TextureMap);
-	Obj->material.SetTexture(gc->texman->AddTexture("data/textures/refmap1.jpg"), EnvironmentMap);
+	Obj->material.SetTexture(AddTexture("data/textures/rusty01.jpg"), TextureMap);
+	Obj->material.SetTexture(AddTexture("data/textures/refmap1.jpg"), EnvironmentMap);
 
 	Obj->material.SetAmbient(Color(0.5f));
 	Obj->material.SetDiffuse(Color(0.5f));
@@ -87,21 +83,17 @@ DungeonPart::DungeonPart(GraphicsContext *gc) {
 	Obj->GetTriMesh()->ChangeMode(TriMeshDynamic);
 	mobj->GetTriMesh()->ChangeMode(TriMeshDynamic);
 
-	Crystals[0] = scene->GetObject("Box114");
-	Crystals[1] = scene->GetObject("Box115");
-	Crystals[2] = scene->GetObject("Box116");
-	Crystals[3] = scene->GetObject("Box117");
-	Crystals[4] = scene->GetObject("Box118");
-
-	for(int i=0; i<5; i++) {
-		scene->RemoveObject(Crystals[i]);
-	}
+	Crystals[0] = TakeObject("Box114");
+	Crystals[1] = TakeObject("Box115");
+	Crystals[2] = TakeObject("Box116");
+	Crystals[3] = TakeObject("Box117");
+	Crystals[4] = TakeObject("Box118");
 
-	Name = new Object(gc);
+	Name = KeepObject(new Object(gc));
 	Name->CreatePlane(1.7f, 0);
 	Name->Scale(1.0f, 0.3f, 1.0f);
 
-	Fade = new Object(gc);
+	Fade = KeepObject(new Object(gc));
 	Fade->CreatePlane(3.0f, 0);
 	Fade->material = Material(0.0f, 0.0f, 0.0f);
 	
@@ -109,14 +101,14 @@ DungeonPart::DungeonPart(GraphicsContext *gc) {
 	for(int i=0; i<8; i++) {
 		char fname[] = "data/textures/Absence/abx.jpg";
 		fname[24] = '1' + i;
-		NameTex[i] = gc->texman->AddTexture(fname);
+		NameTex[i] = AddTexture(fname);
 	}
 
 	cam[3]->Zoom(-1.0f);
 }
 
 DungeonPart::~DungeonPart() {
-	delete scene;
+	Evict();
 }
 
 #define INRANGE(a, b) (msec >= a && msec < b)
@@ -208,7 +200,7 @@ void DungeonPart::MainLoop() {
 
 	// The Morphing Object
 
-	Obj->GetTriMesh()->SetData(mobj->GetTriMesh()->GetVertexArray(), mobj->GetTriMesh()->GetTriangleArray(), mobj->GetTriMesh()->GetVertexCount(), mobj->GetTriMesh()->GetTriangleCount());
+	Obj->GetTriMesh()->ResetVertices(*mobj->GetTriMesh());
 	
 	dword VertCount = Obj->GetTriMesh()->GetVertexCount();
 	Vertex *verts = Obj->GetTriMesh()->GetModVertexArray();
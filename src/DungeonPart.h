@@ -26,6 +26,9 @@ public:
 	DungeonPart(GraphicsContext *gc);
 	~DungeonPart();
 
+	virtual void Load();
+	virtual void Upload();
+
 	virtual void MainLoop();
 };
 
@@ -5,16 +5,18 @@ extern Widget *win;
 
 GreetsPart::GreetsPart(GraphicsContext *gc) {
 	this->gc = gc;
+}
+
+void GreetsPart::Load() {
+	loader.SetNormalFileSaving(false);
+	loader.SetDataPath("data/textures/");
+	loader.LoadScene("data/geometry/greets.3ds", &scene);
+}
 
+void GreetsPart::Upload() {
 	gc->Clear(0);
 	gc->ClearZBufferStencil(1.0f, 0);
 
-
-	SceneLoader::SetNormalFileSaving(false);
-	SceneLoader::SetDataPath("data/textures/");
-	SceneLoader::LoadScene("data/geometry/greets.3ds", &scene);
-	SceneLoader::SetNormalFileSaving(true);
-
 	Parchment = scene->GetObject("Plane01");
 	//Scroll1 = scene->GetObject("Object01");
 	//Scroll2 = scene->GetObject("Object02");
@@ -24,20 +26,21 @@ GreetsPart::GreetsPart(GraphicsContext *gc) {
 		char num[3];
 		itoa(i, num, 10);
 		string fname = string("data/textures/flame/flame") + (i < 10 ? string("0") : string("")) + string(num) + string(".jpg");
-		FlameTex[i] = gc->texman->LoadTexture(fname.c_str());
+		FlameTex[i] = AddTexture(fname.c_str());
 	}
 
-	flame = scene->GetObject("Plane02");
-	scene->RemoveObject(flame);
+	flame = TakeObject("Plane02");
 
 	Parchment->SetScaling(9.0f, 1.0f, 1.0f);
 
-	Bottle = scene->GetObject("Bottle");
-	scene->RemoveObject(Bottle);
+	Bottle = TakeObject("Bottle");
 
 	light = scene->GetLight("Omni01");
 
     scene->SetShadows(true);
+	// the flame flicker moves the light by a few thousandths every frame,
+	// not enough to be worth remaking the candle's shadow for
+	scene->SetShadowTolerance(0.01f);
 	light->SetShadowCasting(true);
 	//scene->GetObject("CHolder")->SetShadowCasting(true);
 	scene->GetObject("Candle")->SetShadowCasting(true);
@@ -54,11 +57,10 @@ GreetsPart::GreetsPart(GraphicsContext *gc) {
 	LightPos = light->GetPosition();
 	light->SetIntensity(0.5f);
 	light->SetAttenuation(0.0f, 0.1f, 0.0f);
-
 }
 
 GreetsPart::~GreetsPart() {
-	delete scene;
+	Evict();
 }
 
 void GreetsPart::MainLoop() {
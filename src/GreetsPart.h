@@ -18,6 +18,9 @@ public:
 	GreetsPart(GraphicsContext *gc);
 	~GreetsPart();
 
+	virtual void Load();
+	virtual void Upload();
+
 	void MainLoop();
 };
 
@@ -3,11 +3,16 @@
 
 HellPart::HellPart(GraphicsContext *gc) {
 	this->gc = gc;
+}
 
-	SceneLoader::SetNormalFileSaving(true);
-	SceneLoader::SetDataPath("data/textures/");
-	SceneLoader::LoadScene("data/geometry/hell.3ds", &scene);
+void HellPart::Load() {
+	loader.SetNormalFileSaving(true);
+	loader.SetDataPath("data/textures/");
+	loader.SetDetailLevels(4);		// it's seen from up to 100000 away
+	loader.LoadScene("data/geometry/hell.3ds", &scene);
+}
 
+void HellPart::Upload() {
 	CamPath = scene->GetCurve("CamPath");
 	cam = const_cast<Camera*>(scene->GetActiveCamera());
 	cam->SetCameraPath(CamPath, 0, 0, 30000);
@@ -21,80 +26,72 @@ HellPart::HellPart(GraphicsContext *gc) {
 	Thunder = scene->GetLight("Omni01");
 	Thunder->SetIntensity(0.0f);
 
-	ThundEnv[0] = scene->GetObject("b1");
-	ThundEnv[1] = scene->GetObject("b2");
-	ThundEnv[2] = scene->GetObject("b3");
-	ThundEnv[3] = scene->GetObject("b4");
-	ThundEnv[4] = scene->GetObject("b5");
+	ThundEnv[0] = TakeObject("b1");
+	ThundEnv[1] = TakeObject("b2");
+	ThundEnv[2] = TakeObject("b3");
+	ThundEnv[3] = TakeObject("b4");
+	ThundEnv[4] = TakeObject("b5");
+
+	Stones[0] = TakeObject("Box01");
+	Stones[1] = TakeObject("Box02");
+	Stones[2] = TakeObject("Box03");
+	Stones[3] = TakeObject("Box04");
+	Stones[4] = TakeObject("Box05");
 	for(int i=0; i<5; i++) {
-		scene->RemoveObject(ThundEnv[i]);
-	}
-
-	Stones[0] = scene->GetObject("Box01");
-	Stones[1] = scene->GetObject("Box02");
-	Stones[2] = scene->GetObject("Box03");
-	Stones[3] = scene->GetObject("Box04");
-	Stones[4] = scene->GetObject("Box05");
-	for(int i=0; i<5; i++) {
-		scene->RemoveObject(Stones[i]);
 		Stones[i]->SetShadingMode(FlatShading);
 	}
 
-	Rings[0] = scene->GetObject("Tube01");
-	Rings[1] = scene->GetObject("Tube02");
-	Rings[2] = scene->GetObject("Tube03");
-	Rings[3] = scene->GetObject("Tube04");
-	Rings[4] = scene->GetObject("Tube05");
-	for(int i=0; i<5; i++) {
-		scene->RemoveObject(Rings[i]);
-	}
+	Rings[0] = TakeObject("Tube01");
+	Rings[1] = TakeObject("Tube02");
+	Rings[2] = TakeObject("Tube03");
+	Rings[3] = TakeObject("Tube04");
+	Rings[4] = TakeObject("Tube05");
 
 	// Load Credits
-	dbgtex = gc->texman->AddTexture("data/textures/psys02.jpg");
-	CredNuc[0] = gc->texman->AddTexture("data/textures/credits/nuc1.jpg");
-	CredNuc[1] = gc->texman->AddTexture("data/textures/credits/nuc2.jpg");
-	CredNuc[2] = gc->texman->AddTexture("data/textures/credits/nuc3.jpg");
-	CredNuc[3] = gc->texman->AddTexture("data/textures/credits/nuc4.jpg");
-	CredNuc[4] = gc->texman->AddTexture("data/textures/credits/nuc5.jpg");
-	CredNuc[5] = gc->texman->AddTexture("data/textures/credits/nuc6.jpg");
-	CredNuc[6] = gc->texman->AddTexture("data/textures/credits/nuc7.jpg");
-
-	CredRaw[0] = gc->texman->AddTexture("data/textures/credits/raw1.jpg");
-	CredRaw[1] = gc->texman->AddTexture("data/textures/credits/raw2.jpg");
-	CredRaw[2] = gc->texman->AddTexture("data/textures/credits/raw3.jpg");
-	CredRaw[3] = gc->texman->AddTexture("data/textures/credits/raw4.jpg");
-	CredRaw[4] = gc->texman->AddTexture("data/textures/credits/raw5.jpg");
-	CredRaw[5] = gc->texman->AddTexture("data/textures/credits/raw6.jpg");
-	CredRaw[6] = gc->texman->AddTexture("data/textures/credits/raw7.jpg");
-
-	CredAmi[0] = gc->texman->AddTexture("data/textures/credits/am1.jpg");
-	CredAmi[1] = gc->texman->AddTexture("data/textures/credits/am2.jpg");
-	CredAmi[2] = gc->texman->AddTexture("data/textures/credits/am3.jpg");
-	CredAmi[3] = gc->texman->AddTexture("data/textures/credits/am4.jpg");
-	CredAmi[4] = gc->texman->AddTexture("data/textures/credits/am5.jpg");
-	CredAmi[5] = gc->texman->AddTexture("data/textures/credits/am6.jpg");
-	CredAmi[6] = gc->texman->AddTexture("data/textures/credits/am7.jpg");
-
-	CredAmv[0] = gc->texman->AddTexture("data/textures/credits/amv1.jpg");
-	CredAmv[1] = gc->texman->AddTexture("data/textures/credits/amv2.jpg");
-	CredAmv[2] = gc->texman->AddTexture("data/textures/credits/amv3.jpg");
-	CredAmv[3] = gc->texman->AddTexture("data/textures/credits/amv4.jpg");
-	CredAmv[4] = gc->texman->AddTexture("data/textures/credits/amv5.jpg");
-	CredAmv[5] = gc->texman->AddTexture("data/textures/credits/amv6.jpg");
-	CredAmv[6] = gc->texman->AddTexture("data/textures/credits/amv7.jpg");
-
-	Credits = new Object(gc);
+	dbgtex = AddTexture("data/textures/psys02.jpg");
+	CredNuc[0] = AddTexture("data/textures/credits/nuc1.jpg");
+	CredNuc[1] = AddTexture("data/textures/credits/nuc2.jpg");
+	CredNuc[2] = AddTexture("data/textures/credits/nuc3.jpg");
+	CredNuc[3] = AddTexture("data/textures/credits/nuc4.jpg");
+	CredNuc[4] = AddTexture("data/textures/credits/nuc5.jpg");
+	CredNuc[5] = AddTexture("data/textures/credits/nuc6.jpg");
+	CredNuc[6] = AddTexture("data/textures/credits/nuc7.jpg");
+
+	CredRaw[0] = AddTexture("data/textures/credits/raw1.jpg");
+	CredRaw[1] = AddTexture("data/textures/credits/raw2.jpg");
+	CredRaw[2] = AddTexture("data/textures/credits/raw3.jpg");
+	CredRaw[3] = AddTexture("data/textures/credits/raw4.jpg");
+	CredRaw[4] = AddTexture("data/textures/credits/raw5.jpg");
+	CredRaw[5] = AddTexture("data/textures/credits/raw6.jpg");
+	CredRaw[6] = AddTexture("data/textures/credits/raw7.jpg");
+
+	CredAmi[0] = AddTexture("data/textures/credits/am1.jpg");
+	CredAmi[1] = AddTexture("data/textures/credits/am2.jpg");
+	CredAmi[2] = AddTexture("data/textures/credits/am3.jpg");
+	CredAmi[3] = AddTexture("data/textures/credits/am4.jpg");
+	CredAmi[4] = AddTexture("data/textures/credits/am5.jpg");
+	CredAmi[5] = AddTexture("data/textures/credits/am6.jpg");
+	CredAmi[6] = AddTexture("data/textures/credits/am7.jpg");
+
+	CredAmv[0] = AddTexture("data/textures/credits/amv1.jpg");
+	CredAmv[1] = AddTexture("data/textures/credits/amv2.jpg");
+	CredAmv[2] = AddTexture("data/textures/credits/amv3.jpg");
+	CredAmv[3] = AddTexture("data/textures/credits/amv4.jpg");
+	CredAmv[4] = AddTexture("data/textures/credits/amv5.jpg");
+	CredAmv[5] = AddTexture("data/textures/credits/amv6.jpg");
+	CredAmv[6] = AddTexture("data/textures/credits/amv7.jpg");
+
+	Credits = KeepObject(new Object(gc));
 	Credits->CreatePlane(1.7f, 0);
 	Credits->Scale(1.0f, 0.3f, 1.0f);
 
-	Blood = scene->GetObject("Blood");
-	scene->RemoveObject(Blood);
+	Blood = TakeObject("Blood");
 	Grail = scene->GetObject("Object13");
 	//scene->RemoveObject(Grail);
 }
 
 HellPart::~HellPart() {
-	delete scene;
+	Evict();
 }
 
 void HellPart::MainLoop() {
@@ -25,6 +25,9 @@ public:
 	HellPart(GraphicsContext *gc);
 	~HellPart();
 
+	virtual void Load();
+	virtual void Upload();
+
 	void MainLoop();
 };
 
@@ -2,8 +2,16 @@
 
 TreePart::TreePart(GraphicsContext *gc) {
 	this->gc = gc;
+}
+
+void TreePart::Load() {
+	loader.SetNormalFileSaving(true);
+	loader.SetDataPath("data/textures/");
+	loader.SetDetailLevels(4);		// it's seen from up to 80000 away
+	loader.LoadScene("data/geometry/tree2.3ds", &scene);
+}
 
-	scene = new Scene(gc);
+void TreePart::Upload() {
 /*
 	LeavesParticle = gc->texman->AddTexture("data/textures/leaf.png");
 
@@ -22,7 +30,7 @@ TreePart::TreePart(GraphicsContext *gc) {
 	leaves->SetMaxDispersionAngle(QuarterPi / 2.0f);
 	leaves->SetBlendingMode(BLEND_SRCALPHA, BLEND_INVSRCALPHA);
 */
-	WispParticle = gc->texman->AddTexture("data/textures/psys02.jpg");
+	WispParticle = AddTexture("data/textures/psys02.jpg");
     
 	for(int i=0; i<4; i++) {
         WispParticles[i] = new ParticleSystem(gc);
@@ -41,12 +49,7 @@ TreePart::TreePart(GraphicsContext *gc) {
 		WispParticles[i]->SetSpawningDifferenceDispersion(1.0f);
 	}
 	
-	SceneLoader::SetNormalFileSaving(true);
-	SceneLoader::SetDataPath("data/textures/");
-	SceneLoader::LoadScene("data/geometry/tree2.3ds", &scene);
-
-	Trees = scene->GetObject("Trees");
-	scene->RemoveObject(Trees);
+	Trees = TakeObject("Trees");
 
 	for(int i=0; i<3; i++) {
 		dummy[i] = new Camera;
@@ -92,16 +95,23 @@ TreePart::TreePart(GraphicsContext *gc) {
 	//scene->SetShadows(true);
 	//lights[3]->SetShadowCasting(true);
 
-	Moon = scene->GetObject("Moon");
-	scene->RemoveObject(Moon);
+	Moon = TakeObject("Moon");
 
-	Stars = scene->GetObject("StarDome");
-	scene->RemoveObject(Stars);
+	Stars = TakeObject("StarDome");
+}
 
+void TreePart::Release() {
+	for(int i=0; i<4; i++) {
+		delete WispParticles[i];
+	}
+	for(int i=0; i<3; i++) {
+		delete dummy[i];
+	}
+	Part::Release();
 }
 
 TreePart::~TreePart() {
-	delete scene;
+	Evict();
 	delete leaves;
 }
 
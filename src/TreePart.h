@@ -19,6 +19,10 @@ public:
 	TreePart(GraphicsContext *gc);
 	~TreePart();
 
+	virtual void Load();
+	virtual void Upload();
+	virtual void Release();
+
 	void MainLoop();
 };
 
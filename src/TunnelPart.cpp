@@ -2,11 +2,15 @@
 
 TunnelPart::TunnelPart(GraphicsContext *gc) {
 	this->gc = gc;
+}
 
-	SceneLoader::SetNormalFileSaving(true);
-	SceneLoader::SetDataPath("data/textures/");
-	SceneLoader::LoadScene("data/geometry/tunnel.3ds", &scene);
+void TunnelPart::Load() {
+	loader.SetNormalFileSaving(true);
+	loader.SetDataPath("data/textures/");
+	loader.LoadScene("data/geometry/tunnel.3ds", &scene);
+}
 
+void TunnelPart::Upload() {
 	CamPath = scene->GetCurve("Line01");
 	TargPath = scene->GetCurve("Line02");
 
@@ -18,7 +22,7 @@ TunnelPart::TunnelPart(GraphicsContext *gc) {
 }
 
 TunnelPart::~TunnelPart() {
-	delete scene;
+	Evict();
 }
 
 void TunnelPart::MainLoop() {
@@ -13,6 +13,9 @@ public:
 	TunnelPart(GraphicsContext *gc);
 	~TunnelPart();
 
+	virtual void Load();
+	virtual void Upload();
+
 	void MainLoop();
 };
 
@@ -1,5 +1,7 @@
 #include <cmath>
+#include <typeinfo>
 #include "curves.h"
+#include "datacache.h"
 
 Curve::Curve() {
 	ArcParametrize = false;
@@ -14,6 +16,10 @@ Curve::~Curve() {
 	
 }
 
+LinkedList<Vector3> *Curve::GetControlPoints() {
+	return &ControlPoints;
+}
+
 void Curve::SetArcParametrization(bool state) {
 	ArcParametrize = state;
 }
@@ -21,13 +27,31 @@ void Curve::SetArcParametrization(bool state) {
 #define Param	0
 #define ArcLen	1
 
+// bump when the sampling below changes
+const dword ArcLengthVersion = 1;
+
 void Curve::SampleArcLengths() {
 	const int SamplesPerSegment = 30;
 	SampleCount = GetSegmentCount() * SamplesPerSegment;
 
+	Samples = new Vector2[SampleCount];
+
+	// every sample walks the control point list, so long paths are slow to
+	// sample and the table comes from the data cache when possible
+	CacheKey key("arclen", ArcLengthVersion);
+	key.Add(typeid(*this).name());
+	key.Add((dword)SampleCount);
+	for(ListNode<Vector3> *iter = ControlPoints.Begin(); iter; iter = iter->next) {
+		key.Add(&iter->data, sizeof(Vector3));
+	}
+	dword bytes = SampleCount * sizeof(Vector2);
+	if(SampleCount > 0 && datacache::Fetch("arclen", key.Get(), Samples, bytes)) {
+		ArcParametrize = true;
+		return;
+	}
+
 	ArcParametrize = false;	// to be able to interpolate with the original values
 
-	Samples = new Vector2[SampleCount];
 	Vector3 prevpos;
 	float step = 1.0f / (float)(SampleCount-1);
 	for(int i=0; i<SampleCount; i++) {
@@ -48,6 +72,7 @@ void Curve::SampleArcLengths() {
 		Samples[i][ArcLen] /= maxlen;
 	}
 
+	if(SampleCount > 0) datacache::Store("arclen", key.Get(), Samples, bytes);
 	ArcParametrize = true;
 }
 
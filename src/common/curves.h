@@ -25,6 +25,7 @@ public:
 	Curve();
 	~Curve();
 	virtual void AddControlPoint(const Vector3 &cp);
+	LinkedList<Vector3> *GetControlPoints();
 
 	virtual int GetSegmentCount() const = 0;
 	virtual void SetArcParametrization(bool state);
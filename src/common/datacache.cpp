@@ -0,0 +1,151 @@
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif	// _WIN32
+#include "datacache.h"
+
+using std::string;
+
+namespace {
+	string CacheDir = "cache/";
+	bool enabled = true;
+
+	const qword FNVOffset = ((qword)0xcbf29ce4 << 32) | 0x84222325;
+	const qword FNVPrime = ((qword)0x100 << 32) | 0x000001b3;
+
+	string GetEntryName(const char *kind, qword key) {
+		char hex[32];
+		sprintf(hex, "-%08x%08x.bin", (unsigned int)(key >> 32), (unsigned int)key);
+		return CacheDir + kind + hex;
+	}
+
+	void MakeCacheDir() {
+		string dir = CacheDir;
+		if(!dir.empty() && (dir[dir.size() - 1] == '/' || dir[dir.size() - 1] == '\\')) {
+			dir.erase(dir.size() - 1);
+		}
+		if(dir.empty()) return;
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(), 0777);
+#endif	// _WIN32
+	}
+}
+
+void datacache::SetCacheDir(const char *path) {
+	CacheDir = path;
+	if(!CacheDir.empty() && CacheDir[CacheDir.size() - 1] != '/' && CacheDir[CacheDir.size() - 1] != '\\') {
+		CacheDir += "/";
+	}
+}
+
+void datacache::SetEnabled(bool enable) {
+	enabled = enable;
+}
+
+bool datacache::IsEnabled() {
+	return enabled;
+}
+
+bool datacache::Store(const char *kind, qword key, const void *data, dword size) {
+	return Store(kind, key, data, size, 0, 0);
+}
+
+bool datacache::Store(const char *kind, qword key, const void *data0, dword size0, const void *data1, dword size1) {
+	if(!enabled) return false;
+
+	string fname = GetEntryName(kind, key);
+	FILE *fp = fopen(fname.c_str(), "wb");
+	if(!fp) {
+		MakeCacheDir();
+		if(!(fp = fopen(fname.c_str(), "wb"))) return false;
+	}
+
+	Header hdr;
+	hdr.magic = Magic;
+	hdr.KeyLow = (dword)key;
+	hdr.KeyHigh = (dword)(key >> 32);
+	hdr.size = size0 + size1;
+
+	bool ok = fwrite(&hdr, sizeof hdr, 1, fp) == 1;
+	if(ok && size0) ok = fwrite(data0, 1, size0, fp) == size0;
+	if(ok && size1) ok = fwrite(data1, 1, size1, fp) == size1;
+	fclose(fp);
+
+	// a half written entry would just fail the size check, but don't leave it around
+	if(!ok) remove(fname.c_str());
+	return ok;
+}
+
+bool datacache::Fetch(const char *kind, qword key, void *dest, dword size) {
+	CacheEntry ent;
+	if(!ent.Open(kind, key) || ent.GetSize() != size) return false;
+
+	memcpy(dest, ent.GetData(), size);
+	return true;
+}
+
+////////////// CacheKey //////////////
+
+CacheKey::CacheKey(const char *kind, dword version) {
+	hash = FNVOffset;
+	Add(kind);
+	Add(version);
+}
+
+void CacheKey::Add(const void *data, dword size) {
+	const byte *ptr = (const byte*)data;
+	for(dword i=0; i<size; i++) {
+		hash ^= ptr[i];
+		hash *= FNVPrime;
+	}
+}
+
+void CacheKey::Add(dword val) {
+	Add(&val, sizeof val);
+}
+
+void CacheKey::Add(float val) {
+	Add(&val, sizeof val);
+}
+
+void CacheKey::Add(const char *str) {
+	Add(str, (dword)strlen(str) + 1);
+}
+
+qword CacheKey::Get() const {
+	return hash;
+}
+
+////////////// CacheEntry //////////////
+
+CacheEntry::CacheEntry() {}
+
+bool CacheEntry::Open(const char *kind, qword key) {
+	Close();
+	if(!datacache::IsEnabled()) return false;
+	if(!file.Open(GetEntryName(kind, key).c_str())) return false;
+
+	const datacache::Header *hdr = (const datacache::Header*)file.GetData();
+	bool ok = file.GetSize() >= sizeof *hdr && hdr->magic == datacache::Magic;
+	ok = ok && hdr->KeyLow == (dword)key && hdr->KeyHigh == (dword)(key >> 32);
+	ok = ok && hdr->size == file.GetSize() - sizeof *hdr;
+	if(!ok) Close();
+	return ok;
+}
+
+void CacheEntry::Close() {
+	file.Close();
+}
+
+const byte *CacheEntry::GetData() const {
+	return file.IsOpen() ? file.GetData() + sizeof(datacache::Header) : 0;
+}
+
+dword CacheEntry::GetSize() const {
+	return file.IsOpen() ? file.GetSize() - sizeof(datacache::Header) : 0;
+}
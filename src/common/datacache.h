@@ -0,0 +1,71 @@
+#ifndef _DATACACHE_H_
+#define _DATACACHE_H_
+
+#include <string>
+#include "typedefs.h"
+#include "mappedfile.h"
+
+// Cache for data that's expensive to derive from what's loaded (normals,
+// shadow volumes, mip chains...). Entries are looked up by a hash of
+// everything that went into making them, so they never go stale: a change
+// in the inputs, or in the code that made them (bump its version), just
+// gives a new key. Each entry is a file in the cache directory, written in
+// one go and mapped back in when it's used.
+namespace datacache {
+
+	const dword Magic = 0x48434e44;		// "DNCH"
+
+	struct Header {
+		dword magic;
+		dword KeyLow, KeyHigh;
+		dword size;		// of the data following the header
+	};
+
+	void SetCacheDir(const char *path);		// default "cache/"
+	void SetEnabled(bool enable);
+	bool IsEnabled();
+
+	// writes the entry, creating the cache directory if needed
+	bool Store(const char *kind, qword key, const void *data, dword size);
+	bool Store(const char *kind, qword key, const void *data0, dword size0, const void *data1, dword size1);
+
+	// copies an entry that must be exactly size bytes
+	bool Fetch(const char *kind, qword key, void *dest, dword size);
+}
+
+// 64bit FNV-1a hash of the inputs of some derived data. The kind and the
+// version of the code that derives it are part of the key.
+class CacheKey {
+private:
+	qword hash;
+
+public:
+	CacheKey(const char *kind, dword version);
+
+	void Add(const void *data, dword size);
+	void Add(dword val);
+	void Add(float val);
+	void Add(const char *str);
+
+	qword Get() const;
+};
+
+// a mapped cache entry
+class CacheEntry {
+private:
+	MappedFile file;
+
+	CacheEntry(const CacheEntry &ce) {}
+	void operator =(const CacheEntry &ce) {}
+
+public:
+	CacheEntry();
+
+	bool Open(const char *kind, qword key);
+	void Close();
+
+	const byte *GetData() const;
+	dword GetSize() const;
+};
+
+#endif	// _DATACACHE_H_
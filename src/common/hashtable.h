@@ -74,7 +74,7 @@ void HashTable<KeyType, ValType>::Remove(KeyType key) {
 
 	unsigned int pos = Hash(key);
 
-	std::list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
+	typename std::list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
 	while(iter != table[pos].end()) {
 		if(iter->key == key) {
 			table[pos].erase(iter);
@@ -89,7 +89,7 @@ Pair<KeyType, ValType> *HashTable<KeyType, ValType>::Find(KeyType key) {
 
 	unsigned int pos = Hash(key);
 
-	std::list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
+	typename std::list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
 	while(iter != table[pos].end()) {
 		if(iter->key == key) {
 			return &(*iter);
@@ -0,0 +1,152 @@
+#include <cstring>
+#include "lz4.h"
+
+namespace {
+	const int MinMatch = 4;
+	const int LastLiterals = 5;		// the block always ends with this many literals
+	const int MatchFindLimit = 12;	// no match may start this close to the end
+	const dword MaxOffset = 65535;
+	const int HashLog = 12;
+
+	inline dword Read32(const byte *ptr) {
+		dword val;
+		memcpy(&val, ptr, sizeof val);
+		return val;
+	}
+
+	inline dword Hash(dword seq) {
+		return (seq * 2654435761u) >> (32 - HashLog);
+	}
+
+	// token length fields go up to 15, the rest follows in 255 sized steps
+	inline byte *WriteLength(byte *op, dword len) {
+		while(len >= 255) {
+			*op++ = 255;
+			len -= 255;
+		}
+		*op++ = (byte)len;
+		return op;
+	}
+}
+
+dword lz4::CompressBound(dword size) {
+	return size + size / 255 + 16;
+}
+
+dword lz4::Compress(const byte *src, dword size, byte *dest) {
+	const byte *ip = src;
+	const byte *anchor = src;
+	const byte *end = src + size;
+	byte *op = dest;
+
+	if(size > MatchFindLimit) {
+		const byte *MatchLimit = end - LastLiterals;
+		const byte *SearchEnd = end - MatchFindLimit;
+
+		dword table[1 << HashLog];
+		memset(table, 0, sizeof table);
+
+		ip++;
+		while(ip < SearchEnd) {
+			dword h = Hash(Read32(ip));
+			const byte *ref = src + table[h];
+			table[h] = (dword)(ip - src);
+
+			if(ref >= ip || (dword)(ip - ref) > MaxOffset || Read32(ref) != Read32(ip)) {
+				ip++;
+				continue;
+			}
+
+			// extend the match backwards over pending literals
+			while(ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+
+			dword MatchLen = MinMatch;
+			while(ip + MatchLen < MatchLimit && ip[MatchLen] == ref[MatchLen]) MatchLen++;
+
+			dword LitLen = (dword)(ip - anchor);
+			byte *token = op++;
+			*token = (byte)((LitLen < 15 ? LitLen : 15) << 4);
+			if(LitLen >= 15) op = WriteLength(op, LitLen - 15);
+			memcpy(op, anchor, LitLen);
+			op += LitLen;
+
+			dword offset = (dword)(ip - ref);
+			*op++ = (byte)offset;
+			*op++ = (byte)(offset >> 8);
+
+			dword len = MatchLen - MinMatch;
+			*token |= (byte)(len < 15 ? len : 15);
+			if(len >= 15) op = WriteLength(op, len - 15);
+
+			ip += MatchLen;
+			anchor = ip;
+			if(ip < SearchEnd) table[Hash(Read32(ip - 2))] = (dword)(ip - 2 - src);
+		}
+	}
+
+	dword LitLen = (dword)(end - anchor);
+	*op++ = (byte)((LitLen < 15 ? LitLen : 15) << 4);
+	if(LitLen >= 15) op = WriteLength(op, LitLen - 15);
+	memcpy(op, anchor, LitLen);
+	op += LitLen;
+
+	return (dword)(op - dest);
+}
+
+bool lz4::Decompress(const byte *src, dword PackedSize, byte *dest, dword size) {
+	const byte *ip = src;
+	const byte *iend = src + PackedSize;
+	byte *op = dest;
+	byte *oend = dest + size;
+
+	while(ip < iend) {
+		byte token = *ip++;
+
+		dword len = token >> 4;
+		if(len == 15) {
+			byte b;
+			do {
+				if(ip >= iend) return false;
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		if(len > (dword)(iend - ip) || len > (dword)(oend - op)) return false;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		if(ip == iend) break;	// last literals, no match follows
+
+		if(iend - ip < 2) return false;
+		dword offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(!offset || offset > (dword)(op - dest)) return false;
+
+		len = token & 15;
+		if(len == 15) {
+			byte b;
+			do {
+				if(ip >= iend) return false;
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		len += MinMatch;
+		if(len > (dword)(oend - op)) return false;
+
+		// matches may overlap their own output
+		const byte *ref = op - offset;
+		if(offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			while(len--) *op++ = *ref++;
+		}
+	}
+
+	return op == oend;
+}
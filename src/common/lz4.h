@@ -0,0 +1,21 @@
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include "typedefs.h"
+
+// LZ4 block format compression (no frame format, the pack file keeps its
+// own block table). Decompression is fast enough to run on every load,
+// compression is a simple greedy parser meant for offline tools.
+namespace lz4 {
+
+	// worst case compressed size of size bytes
+	dword CompressBound(dword size);
+
+	// dest must hold at least CompressBound(size) bytes, returns the compressed size
+	dword Compress(const byte *src, dword size, byte *dest);
+
+	// fails on corrupt data or if the result isn't exactly size bytes
+	bool Decompress(const byte *src, dword PackedSize, byte *dest, dword size);
+}
+
+#endif	// _LZ4_H_
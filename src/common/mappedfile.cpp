@@ -0,0 +1,125 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {
+	file = mapping = 0;
+	data = 0;
+	size = 0;
+}
+
+MappedFile::MappedFile(const char *fname, bool CopyOnWrite) {
+	file = mapping = 0;
+	data = 0;
+	size = 0;
+	Open(fname, CopyOnWrite);
+}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char *fname, bool CopyOnWrite) {
+	Close();
+
+	HANDLE fh = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if(fh == INVALID_HANDLE_VALUE) return false;
+
+	size = GetFileSize(fh, 0);
+	if(!size || size == INVALID_FILE_SIZE) {
+		CloseHandle(fh);
+		size = 0;
+		return false;
+	}
+
+	HANDLE mh = CreateFileMapping(fh, 0, CopyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0);
+	if(!mh) {
+		CloseHandle(fh);
+		size = 0;
+		return false;
+	}
+
+	data = (byte*)MapViewOfFile(mh, CopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if(!data) {
+		CloseHandle(mh);
+		CloseHandle(fh);
+		size = 0;
+		return false;
+	}
+
+	file = fh;
+	mapping = mh;
+	return true;
+}
+
+void MappedFile::Close() {
+	if(data) UnmapViewOfFile(data);
+	if(mapping) CloseHandle((HANDLE)mapping);
+	if(file) CloseHandle((HANDLE)file);
+	file = mapping = 0;
+	data = 0;
+	size = 0;
+}
+
+#else	// posix
+
+bool MappedFile::Open(const char *fname, bool CopyOnWrite) {
+	Close();
+
+	int fd = open(fname, O_RDONLY);
+	if(fd == -1) return false;
+
+	struct stat st;
+	if(fstat(fd, &st) == -1 || !st.st_size) {
+		close(fd);
+		return false;
+	}
+	size = (dword)st.st_size;
+
+	int prot = CopyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+	void *ptr = mmap(0, size, prot, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping keeps its own reference to the file
+	if(ptr == MAP_FAILED) {
+		size = 0;
+		return false;
+	}
+	madvise(ptr, size, MADV_SEQUENTIAL);
+
+	data = (byte*)ptr;
+	return true;
+}
+
+void MappedFile::Close() {
+	if(data) munmap(data, size);
+	file = mapping = 0;
+	data = 0;
+	size = 0;
+}
+
+#endif	// _WIN32
+
+bool MappedFile::IsOpen() const {
+	return data != 0;
+}
+
+const byte *MappedFile::GetData() const {
+	return data;
+}
+
+byte *MappedFile::GetModData() {
+	return data;
+}
+
+dword MappedFile::GetSize() const {
+	return size;
+}
@@ -0,0 +1,32 @@
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+
+#include "typedefs.h"
+
+// read-only view of a whole file, mapped into the address space in one go
+class MappedFile {
+private:
+	void *file, *mapping;
+	byte *data;
+	dword size;
+
+	// private copy constructor and assignment op, to prohibit copying
+	MappedFile(const MappedFile &mf) {}
+	void operator =(const MappedFile &mf) {}
+
+public:
+	MappedFile();
+	MappedFile(const char *fname, bool CopyOnWrite = false);
+	~MappedFile();
+
+	// with CopyOnWrite the view may be modified in place, without touching the file
+	bool Open(const char *fname, bool CopyOnWrite = false);
+	void Close();
+
+	bool IsOpen() const;
+	const byte *GetData() const;
+	byte *GetModData();
+	dword GetSize() const;
+};
+
+#endif	// _MAPPEDFILE_H_
@@ -0,0 +1,627 @@
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "meshopt.h"
+
+using std::vector;
+
+static dword HashBytes(const byte *data, dword size) {
+	dword hash = 2166136261u;	// FNV-1a
+	for(dword i=0; i<size; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+dword WeldVertices(const void *verts, dword count, dword stride, dword *remap) {
+	const byte *vptr = (const byte*)verts;
+
+	dword TableSize = 1;
+	while(TableSize < count * 2) TableSize <<= 1;
+
+	const dword Empty = 0xffffffff;
+	vector<dword> table(TableSize, Empty);	// holds original vertex indices
+
+	dword unique = 0;
+	for(dword i=0; i<count; i++) {
+		const byte *v = vptr + i * stride;
+		dword slot = HashBytes(v, stride) & (TableSize - 1);
+
+		while(table[slot] != Empty && memcmp(vptr + table[slot] * stride, v, stride)) {
+			slot = (slot + 1) & (TableSize - 1);
+		}
+
+		if(table[slot] == Empty) {
+			table[slot] = i;
+			remap[i] = unique++;
+		} else {
+			remap[i] = remap[table[slot]];
+		}
+	}
+
+	return unique;
+}
+
+dword SplitBySmoothingGroups(dword *indices, dword TriCount, dword VertexCount, const dword *groups, dword *sources) {
+	dword IndexCount = TriCount * 3;
+
+	// the corners at each vertex, with a counting sort
+	vector<dword> offsets(VertexCount + 1, 0), corners(IndexCount);
+	for(dword i=0; i<IndexCount; i++) offsets[indices[i] + 1]++;
+	for(dword i=0; i<VertexCount; i++) offsets[i + 1] += offsets[i];
+	vector<dword> next(offsets.begin(), offsets.end() - 1);
+	for(dword i=0; i<IndexCount; i++) corners[next[indices[i]]++] = i;
+
+	// the sets of triangles around one vertex, merged as corners join them
+	const dword NoSet = 0xffffffff;
+	vector<dword> masks, parents, CornerSet;
+
+	dword count = 0;
+	for(dword v=0; v<VertexCount; v++) {
+		dword first = offsets[v], last = offsets[v + 1];
+		masks.clear();
+		parents.clear();
+		CornerSet.resize(last - first);
+
+		for(dword c=first; c<last; c++) {
+			dword g = groups[corners[c] / 3];
+			dword set = NoSet;
+			for(dword k=0; g && k<masks.size(); k++) {
+				if(parents[k] != k || !(masks[k] & g)) continue;
+				if(set == NoSet) {
+					set = k;
+					masks[k] |= g;
+				} else {
+					parents[k] = set;
+					masks[set] |= masks[k];
+				}
+			}
+			if(set == NoSet) {
+				set = (dword)masks.size();
+				masks.push_back(g);
+				parents.push_back(set);
+			}
+			CornerSet[c - first] = set;
+		}
+
+		// a vertex for each set left, masks now holding their new index
+		for(dword k=0; k<masks.size(); k++) {
+			if(parents[k] == k) {
+				masks[k] = count;
+				sources[count++] = v;
+			}
+		}
+		for(dword c=first; c<last; c++) {
+			dword set = CornerSet[c - first];
+			while(parents[set] != set) set = parents[set];
+			indices[corners[c]] = masks[set];
+		}
+	}
+	return count;
+}
+
+dword ReorderVerticesByFirstUse(const dword *indices, dword IndexCount, dword VertexCount, dword *remap) {
+	const dword Unused = 0xffffffff;
+	for(dword i=0; i<VertexCount; i++) remap[i] = Unused;
+
+	dword next = 0;
+	for(dword i=0; i<IndexCount; i++) {
+		if(remap[indices[i]] == Unused) remap[indices[i]] = next++;
+	}
+
+	dword used = next;
+	for(dword i=0; i<VertexCount; i++) {
+		if(remap[i] == Unused) remap[i] = next++;
+	}
+	return used;
+}
+
+void RemapVertices(void *verts, dword count, dword stride, const dword *remap) {
+	byte *vptr = (byte*)verts;
+	vector<byte> tmp(count * stride);
+	vector<bool> written(count, false);
+
+	for(dword i=0; i<count; i++) {
+		if(written[remap[i]]) continue;
+		memcpy(&tmp[remap[i] * stride], vptr + i * stride, stride);
+		written[remap[i]] = true;
+	}
+
+	// welded arrays shrink, only copy back what was written
+	dword NewCount = 0;
+	while(NewCount < count && written[NewCount]) NewCount++;
+	if(NewCount) memcpy(vptr, &tmp[0], NewCount * stride);
+}
+
+void RemapIndices(dword *indices, dword IndexCount, const dword *remap) {
+	for(dword i=0; i<IndexCount; i++) {
+		indices[i] = remap[indices[i]];
+	}
+}
+
+/////////////// vertex cache optimization ///////////////
+
+namespace {
+	const int MaxCacheSize = 32;
+	const float CacheDecayPower = 1.5f;
+	const float LastTriScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	struct VCacheVertex {
+		int CachePos;
+		float score;
+		dword TrisLeft;
+		dword FirstTri;		// into the vertex/triangle adjacency array
+	};
+
+	float VertexScore(const VCacheVertex &v) {
+		if(!v.TrisLeft) return -1.0f;
+
+		float score = 0.0f;
+		if(v.CachePos >= 0) {
+			if(v.CachePos < 3) {
+				score = LastTriScore;	// part of the triangle just added
+			} else {
+				float scaler = 1.0f / (MaxCacheSize - 3);
+				score = (float)pow(1.0f - (v.CachePos - 3) * scaler, CacheDecayPower);
+			}
+		}
+
+		// favour vertices with few triangles left, to get rid of lone triangles
+		score += ValenceBoostScale * (float)pow((float)v.TrisLeft, -ValenceBoostPower);
+		return score;
+	}
+}
+
+void OptimizeVertexCache(dword *indices, dword TriCount, dword VertexCount, dword *order) {
+	if(!TriCount || !VertexCount) return;
+
+	dword IndexCount = TriCount * 3;
+
+	vector<VCacheVertex> verts(VertexCount);
+	for(dword i=0; i<VertexCount; i++) {
+		verts[i].CachePos = -1;
+		verts[i].TrisLeft = 0;
+	}
+	for(dword i=0; i<IndexCount; i++) {
+		verts[indices[i]].TrisLeft++;
+	}
+
+	// triangles of each vertex, packed one vertex after the other
+	vector<dword> VertTris(IndexCount);
+	vector<dword> fill(VertexCount);
+	dword offs = 0;
+	for(dword i=0; i<VertexCount; i++) {
+		verts[i].FirstTri = offs;
+		offs += verts[i].TrisLeft;
+		fill[i] = verts[i].FirstTri;
+	}
+	for(dword i=0; i<IndexCount; i++) {
+		VertTris[fill[indices[i]]++] = i / 3;
+	}
+
+	for(dword i=0; i<VertexCount; i++) {
+		verts[i].score = VertexScore(verts[i]);
+	}
+
+	vector<float> TriScore(TriCount);
+	vector<bool> TriAdded(TriCount, false);
+	for(dword i=0; i<TriCount; i++) {
+		const dword *tri = indices + i * 3;
+		TriScore[i] = verts[tri[0]].score + verts[tri[1]].score + verts[tri[2]].score;
+	}
+
+	vector<dword> result;
+	result.reserve(IndexCount);
+
+	int cache[MaxCacheSize + 3];
+	int CacheCount = 0;
+
+	dword BestTri = 0;
+	for(dword i=1; i<TriCount; i++) {
+		if(TriScore[i] > TriScore[BestTri]) BestTri = i;
+	}
+
+	dword AddedCount = 0;
+	while(AddedCount < TriCount) {
+		const dword *tri = indices + BestTri * 3;
+		TriAdded[BestTri] = true;
+		if(order) order[AddedCount] = BestTri;
+		AddedCount++;
+		result.push_back(tri[0]);
+		result.push_back(tri[1]);
+		result.push_back(tri[2]);
+
+		// remove the triangle from its vertices' lists of triangles left
+		for(int i=0; i<3; i++) {
+			VCacheVertex &v = verts[tri[i]];
+			dword *list = &VertTris[v.FirstTri];
+			for(dword j=0; j<v.TrisLeft; j++) {
+				if(list[j] == BestTri) {
+					list[j] = list[v.TrisLeft - 1];
+					break;
+				}
+			}
+			v.TrisLeft--;
+		}
+
+		// move the triangle's vertices to the front of the LRU cache
+		int NewCache[MaxCacheSize + 3];
+		int NewCount = 0;
+		for(int i=0; i<3; i++) NewCache[NewCount++] = (int)tri[i];
+		for(int i=0; i<CacheCount; i++) {
+			int v = cache[i];
+			if(v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2]) {
+				NewCache[NewCount++] = v;
+			}
+		}
+
+		for(int i=0; i<NewCount; i++) {
+			int v = NewCache[i];
+			verts[v].CachePos = i < MaxCacheSize ? i : -1;
+			verts[v].score = VertexScore(verts[v]);
+		}
+		CacheCount = NewCount < MaxCacheSize ? NewCount : MaxCacheSize;
+		memcpy(cache, NewCache, CacheCount * sizeof *cache);
+
+		// rescore the triangles touching the cache and pick the best one from there
+		float BestScore = -1.0f;
+		BestTri = 0xffffffff;
+		for(int i=0; i<NewCount; i++) {
+			const VCacheVertex &v = verts[NewCache[i]];
+			for(dword j=0; j<v.TrisLeft; j++) {
+				dword t = VertTris[v.FirstTri + j];
+				const dword *ti = indices + t * 3;
+				TriScore[t] = verts[ti[0]].score + verts[ti[1]].score + verts[ti[2]].score;
+				if(TriScore[t] > BestScore) {
+					BestScore = TriScore[t];
+					BestTri = t;
+				}
+			}
+		}
+
+		// nothing connected to the cache, fall back to a full search
+		if(BestTri == 0xffffffff && AddedCount < TriCount) {
+			for(dword i=0; i<TriCount; i++) {
+				if(!TriAdded[i] && (BestTri == 0xffffffff || TriScore[i] > BestScore)) {
+					BestScore = TriScore[i];
+					BestTri = i;
+				}
+			}
+		}
+	}
+
+	memcpy(indices, &result[0], IndexCount * sizeof(dword));
+}
+
+float CalcACMR(const dword *indices, dword TriCount, dword CacheSize) {
+	if(!TriCount) return 0.0f;
+
+	vector<dword> fifo(CacheSize, 0xffffffff);
+	dword head = 0, misses = 0;
+
+	for(dword i=0; i<TriCount * 3; i++) {
+		bool hit = false;
+		for(dword j=0; j<CacheSize; j++) {
+			if(fifo[j] == indices[i]) {
+				hit = true;
+				break;
+			}
+		}
+		if(!hit) {
+			fifo[head] = indices[i];
+			head = (head + 1) % CacheSize;
+			misses++;
+		}
+	}
+
+	return (float)misses / (float)TriCount;
+}
+
+static dword HashEdge(dword v0, dword v1) {
+	return (v0 * 0x9e3779b1) ^ (v1 * 0x85ebca6b);
+}
+
+dword BuildEdgeTable(const dword *indices, dword TriCount, MeshEdge *edges) {
+	dword TableSize = 1;
+	while(TableSize < TriCount * 3 * 2) TableSize <<= 1;
+
+	const dword Empty = 0xffffffff;
+	vector<dword> table(TableSize, Empty);	// holds edge indices
+
+	dword EdgeCount = 0;
+	for(dword i=0; i<TriCount; i++) {
+		for(int j=0; j<3; j++) {
+			dword v0 = indices[i * 3 + j];
+			dword v1 = indices[i * 3 + (j + 1) % 3];
+			dword lo = v0 < v1 ? v0 : v1;
+			dword hi = v0 < v1 ? v1 : v0;
+
+			dword slot = HashEdge(lo, hi) & (TableSize - 1);
+			while(table[slot] != Empty) {
+				const MeshEdge &edge = edges[table[slot]];
+				dword elo = edge.vertices[0] < edge.vertices[1] ? edge.vertices[0] : edge.vertices[1];
+				dword ehi = edge.vertices[0] < edge.vertices[1] ? edge.vertices[1] : edge.vertices[0];
+				if(elo == lo && ehi == hi) break;
+				slot = (slot + 1) & (TableSize - 1);
+			}
+
+			// second triangle on a known edge
+			if(table[slot] != Empty && edges[table[slot]].faces[1] == NoFace) {
+				edges[table[slot]].faces[1] = i;
+				continue;
+			}
+
+			// new edge, or a third triangle which starts the next pair
+			MeshEdge &edge = edges[EdgeCount];
+			edge.vertices[0] = v0;
+			edge.vertices[1] = v1;
+			edge.faces[0] = i;
+			edge.faces[1] = NoFace;
+			table[slot] = EdgeCount++;
+		}
+	}
+
+	return EdgeCount;
+}
+
+dword FindSilhouetteEdges(const MeshEdge *edges, dword EdgeCount, const bool *backfacing, dword *silhouette) {
+	dword count = 0;
+	for(dword i=0; i<EdgeCount; i++) {
+		bool back0 = backfacing[edges[i].faces[0]];
+		bool back1 = !IsOpenEdge(edges[i]) && backfacing[edges[i].faces[1]];
+		if(back0 == back1) continue;
+
+		// the second triangle runs along the edge the other way
+		*silhouette++ = edges[i].vertices[back0 ? 0 : 1];
+		*silhouette++ = edges[i].vertices[back0 ? 1 : 0];
+		count++;
+	}
+	return count;
+}
+
+/////////////// simplification ///////////////
+
+namespace {
+	// sum of squared distances to a set of planes, the upper half of a
+	// symmetric 4x4 matrix
+	struct Quadric {
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	};
+
+	struct Collapse {
+		dword from, to;
+		double error;
+
+		bool operator <(const Collapse &c) const {return error < c.error;}
+	};
+
+	const float *GetPosition(const byte *verts, dword stride, dword i) {
+		return (const float*)(verts + i * stride);
+	}
+
+	void AddPlane(Quadric *q, double a, double b, double c, double d, double weight) {
+		q->a2 += a * a * weight;
+		q->ab += a * b * weight;
+		q->ac += a * c * weight;
+		q->ad += a * d * weight;
+		q->b2 += b * b * weight;
+		q->bc += b * c * weight;
+		q->bd += b * d * weight;
+		q->c2 += c * c * weight;
+		q->cd += c * d * weight;
+		q->d2 += d * d * weight;
+	}
+
+	void AddQuadric(Quadric *q, const Quadric &r) {
+		q->a2 += r.a2; q->ab += r.ab; q->ac += r.ac; q->ad += r.ad;
+		q->b2 += r.b2; q->bc += r.bc; q->bd += r.bd;
+		q->c2 += r.c2; q->cd += r.cd;
+		q->d2 += r.d2;
+	}
+
+	double QuadricError(const Quadric &q, const float *p) {
+		double x = p[0], y = p[1], z = p[2];
+		return q.a2 * x * x + 2.0 * q.ab * x * y + 2.0 * q.ac * x * z + 2.0 * q.ad * x
+			+ q.b2 * y * y + 2.0 * q.bc * y * z + 2.0 * q.bd * y
+			+ q.c2 * z * z + 2.0 * q.cd * z + q.d2;
+	}
+
+	void TriNormal(const float *p0, const float *p1, const float *p2, double *n) {
+		double e1[] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+		double e2[] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+
+	// whether moving vertex from onto to turns any of its triangles over
+	bool CollapseFlips(const byte *verts, dword stride, const dword *indices, const dword *TriOffsets, const dword *VertTris, dword from, dword to) {
+		const float *NewPos = GetPosition(verts, stride, to);
+
+		for(dword i=TriOffsets[from]; i<TriOffsets[from + 1]; i++) {
+			const dword *tri = indices + VertTris[i] * 3;
+			if(tri[0] == to || tri[1] == to || tri[2] == to) continue;	// goes away
+
+			const float *p[3], *moved[3];
+			for(int j=0; j<3; j++) {
+				p[j] = GetPosition(verts, stride, tri[j]);
+				moved[j] = tri[j] == from ? NewPos : p[j];
+			}
+
+			double before[3], after[3];
+			TriNormal(p[0], p[1], p[2], before);
+			TriNormal(moved[0], moved[1], moved[2], after);
+			if(before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0) return true;
+		}
+		return false;
+	}
+}
+
+dword SimplifyMesh(const void *verts, dword VertexCount, dword stride, const dword *indices, dword TriCount, dword TargetTriCount, dword *out,
+	const MeshEdge *IndexEdges, dword IndexEdgeCount) {
+	const byte *vptr = (const byte*)verts;
+	if(out != indices) memmove(out, indices, TriCount * 3 * sizeof(dword));
+	if(TriCount <= TargetTriCount) return TriCount;
+
+	// every vertex starts with the planes of its triangles, weighted by area
+	Quadric zero;
+	memset(&zero, 0, sizeof zero);
+	vector<Quadric> quadrics(VertexCount, zero);
+	for(dword i=0; i<TriCount; i++) {
+		const dword *tri = out + i * 3;
+		const float *p0 = GetPosition(vptr, stride, tri[0]);
+
+		double n[3];
+		TriNormal(p0, GetPosition(vptr, stride, tri[1]), GetPosition(vptr, stride, tri[2]), n);
+		double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if(len == 0.0) continue;
+
+		n[0] /= len;
+		n[1] /= len;
+		n[2] /= len;
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		for(int j=0; j<3; j++) {
+			AddPlane(&quadrics[tri[j]], n[0], n[1], n[2], d, len * 0.5);
+		}
+	}
+
+	vector<MeshEdge> table(TriCount * 3);
+	const MeshEdge *edges = IndexEdges;
+	dword EdgeCount = IndexEdgeCount;
+	vector<bool> locked(VertexCount, false);
+	vector<dword> TriOffsets(VertexCount + 1), VertTris(TriCount * 3), remap(VertexCount);
+	vector<bool> touched(VertexCount);
+	vector<Collapse> collapses;
+
+	// Collapses in passes: all the candidates are sorted once per pass, and a
+	// vertex takes part in one collapse at most, so that the checks made for
+	// one hold until the pass ends.
+	while(TriCount > TargetTriCount) {
+		// the collapses of the last pass changed the triangles
+		if(!edges) {
+			EdgeCount = BuildEdgeTable(out, TriCount, &table[0]);
+			edges = &table[0];
+		}
+
+		// once on an open edge, a vertex stays put
+		for(dword i=0; i<EdgeCount; i++) {
+			if(!IsOpenEdge(edges[i])) continue;
+			locked[edges[i].vertices[0]] = true;
+			locked[edges[i].vertices[1]] = true;
+		}
+
+		// triangles of each vertex, packed one vertex after the other
+		std::fill(TriOffsets.begin(), TriOffsets.end(), 0);
+		for(dword i=0; i<TriCount * 3; i++) {
+			TriOffsets[out[i] + 1]++;
+		}
+		for(dword i=0; i<VertexCount; i++) {
+			TriOffsets[i + 1] += TriOffsets[i];
+		}
+		vector<dword> fill(TriOffsets.begin(), TriOffsets.end() - 1);
+		for(dword i=0; i<TriCount * 3; i++) {
+			VertTris[fill[out[i]]++] = i / 3;
+		}
+
+		collapses.clear();
+		for(dword i=0; i<EdgeCount; i++) {
+			if(IsOpenEdge(edges[i])) continue;
+
+			for(int j=0; j<2; j++) {
+				Collapse c;
+				c.from = edges[i].vertices[j];
+				c.to = edges[i].vertices[1 - j];
+				if(locked[c.from]) continue;
+
+				Quadric q = quadrics[c.from];
+				AddQuadric(&q, quadrics[c.to]);
+				c.error = QuadricError(q, GetPosition(vptr, stride, c.to));
+				collapses.push_back(c);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end());
+
+		for(dword i=0; i<VertexCount; i++) {
+			remap[i] = i;
+			touched[i] = false;
+		}
+
+		// each collapse takes about two triangles with it
+		dword removed = 0, collapsed = 0;
+		for(size_t i=0; i<collapses.size() && TriCount - removed > TargetTriCount; i++) {
+			const Collapse &c = collapses[i];
+			if(touched[c.from] || touched[c.to]) continue;
+			if(CollapseFlips(vptr, stride, out, &TriOffsets[0], &VertTris[0], c.from, c.to)) continue;
+
+			remap[c.from] = c.to;
+			AddQuadric(&quadrics[c.to], quadrics[c.from]);
+
+			// the neighbours keep still, the flip test above counted on them
+			for(dword j=TriOffsets[c.from]; j<TriOffsets[c.from + 1]; j++) {
+				const dword *tri = out + VertTris[j] * 3;
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+			}
+			removed += 2;
+			collapsed++;
+		}
+		if(!collapsed) break;
+		edges = 0;
+
+		// drop the triangles that lost their area
+		RemapIndices(out, TriCount * 3, &remap[0]);
+		dword kept = 0;
+		for(dword i=0; i<TriCount; i++) {
+			const dword *tri = out + i * 3;
+			if(tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) continue;
+			if(kept != i) memmove(out + kept * 3, tri, 3 * sizeof(dword));
+			kept++;
+		}
+		TriCount = kept;
+	}
+
+	return TriCount;
+}
+
+dword SplitMesh(const dword *indices, dword TriCount, dword VertexCount, dword MaxVertices, MeshChunk *chunks, dword *vertices, dword *local) {
+	// where each vertex is in the chunk being filled, valid while owner is it
+	vector<dword> owner(VertexCount, NoFace), slot(VertexCount);
+
+	dword ChunkCount = 0, used = 0;
+	MeshChunk *chunk = 0;
+	for(dword i=0; i<TriCount; i++) {
+		const dword *tri = indices + i * 3;
+
+		// the vertices this triangle would add
+		dword added = 0;
+		for(int j=0; j<3; j++) {
+			if(chunk && owner[tri[j]] == ChunkCount - 1) continue;
+			if(j > 0 && tri[j] == tri[0]) continue;
+			if(j > 1 && tri[j] == tri[1]) continue;
+			added++;
+		}
+
+		if(!chunk || chunk->VertexCount + added > MaxVertices) {
+			chunk = chunks + ChunkCount++;
+			chunk->FirstVertex = used;
+			chunk->VertexCount = 0;
+			chunk->FirstTri = i;
+			chunk->TriCount = 0;
+		}
+
+		for(int j=0; j<3; j++) {
+			dword v = tri[j];
+			if(owner[v] != ChunkCount - 1) {
+				owner[v] = ChunkCount - 1;
+				slot[v] = chunk->VertexCount++;
+				vertices[used++] = v;
+			}
+			local[i * 3 + j] = slot[v];
+		}
+		chunk->TriCount++;
+	}
+	return ChunkCount;
+}
@@ -0,0 +1,91 @@
+#ifndef _MESHOPT_H_
+#define _MESHOPT_H_
+
+#include "typedefs.h"
+
+// Mesh optimization helpers working on plain vertex and index arrays, so both
+// the engine and the offline tools can use them. Index arrays hold 3 indices
+// per triangle.
+
+// Finds vertices that are bitwise identical. Fills remap with the new index of
+// every vertex (unique vertices keep their relative order) and returns the
+// number of unique vertices.
+dword WeldVertices(const void *verts, dword count, dword stride, dword *remap);
+
+// Gives each vertex a copy of its own for every set of triangles around it
+// that share smoothing groups (the bits of groups[triangle]), two triangles
+// being in the same set when they have a group in common, directly or
+// through others. Triangles without groups get their own vertices. Rewrites
+// the indices, writes the vertex each new one is a copy of to sources (room
+// for 3 * TriCount) and returns how many vertices there are now, in the
+// order of the ones they came from, leaving out those no triangle uses.
+// Linear in the number of triangles.
+dword SplitBySmoothingGroups(dword *indices, dword TriCount, dword VertexCount, const dword *groups, dword *sources);
+
+// Orders the vertices by the first triangle that uses them. Unused vertices go
+// last. Returns the number of vertices referenced by the index array.
+dword ReorderVerticesByFirstUse(const dword *indices, dword IndexCount, dword VertexCount, dword *remap);
+
+// Moves every vertex i to remap[i], keeping the first one when several map to
+// the same place, and rewrites the index array to match.
+void RemapVertices(void *verts, dword count, dword stride, const dword *remap);
+void RemapIndices(dword *indices, dword IndexCount, const dword *remap);
+
+// Reorders triangles for post transform vertex cache hits (Tom Forsyth's
+// linear-speed vertex cache optimisation). If order is given, it gets the
+// original index of each triangle in the new order.
+void OptimizeVertexCache(dword *indices, dword TriCount, dword VertexCount, dword *order = 0);
+
+// average number of vertices transformed per triangle, with a FIFO cache
+float CalcACMR(const dword *indices, dword TriCount, dword CacheSize = 16);
+
+// An edge with the triangles on either side. It runs from vertices[0] to
+// vertices[1] in the winding of faces[0], faces[1] is NoFace on open edges.
+struct MeshEdge {
+	dword vertices[2];
+	dword faces[2];
+};
+
+const dword NoFace = 0xffffffff;
+
+inline bool IsOpenEdge(const MeshEdge &edge) {return edge.faces[1] == NoFace;}
+
+// Finds the edges of the mesh, hashing the sorted vertex pairs, in linear
+// time. edges needs room for 3 per triangle, returns how many there are.
+// An edge with more than two triangles on it is split in pairs.
+dword BuildEdgeTable(const dword *indices, dword TriCount, MeshEdge *edges);
+
+// Writes the edges where exactly one side faces away (backfacing[face] set),
+// the missing side of open edges counting as facing. They come out as vertex
+// pairs in the winding of the triangle facing away, assuming the mesh winds
+// its triangles consistently. silhouette needs room for 2 per edge, returns
+// how many edges were written.
+dword FindSilhouetteEdges(const MeshEdge *edges, dword EdgeCount, const bool *backfacing, dword *silhouette);
+
+// Reduces the triangle count towards TargetTriCount by collapsing edges into
+// one of their vertices, cheapest first by the quadric error metric (Garland
+// and Heckbert). The positions are the first three floats of each vertex.
+// Vertices on open edges, which includes the seams where vertices were split
+// for texture coordinates, never move. Writes the triangles left to out (room
+// for TriCount, may be indices) as indices into the same vertices and returns
+// how many there are, which can be more than asked for. The edge table of
+// indices saves building it for the first pass, if there is one at hand.
+dword SimplifyMesh(const void *verts, dword VertexCount, dword stride, const dword *indices, dword TriCount, dword TargetTriCount, dword *out,
+	const MeshEdge *IndexEdges = 0, dword IndexEdgeCount = 0);
+
+// A run of triangles with a run of vertices of their own.
+struct MeshChunk {
+	dword FirstVertex, VertexCount;
+	dword FirstTri, TriCount;
+};
+
+// Cuts the triangles, in the order they are, into chunks that use at most
+// MaxVertices (at least 3) vertices each, for devices that only take 16 bit
+// indices. Keeping the order keeps what OptimizeVertexCache did within each
+// chunk. vertices gets the vertex each chunk vertex is, one chunk after the
+// other, and local the indices into the chunk's vertices. chunks, vertices
+// and local need room for TriCount, 3 * TriCount and 3 * TriCount. Returns
+// how many chunks there are; vertices on the cuts are in more than one.
+dword SplitMesh(const dword *indices, dword TriCount, dword VertexCount, dword MaxVertices, MeshChunk *chunks, dword *vertices, dword *local);
+
+#endif	// _MESHOPT_H_
@@ -1,3 +1,5 @@
+#include <cstring>
+#include <cstdlib>
 #include "n3dmath.h"
 
 #define fsin (float)sin
@@ -715,7 +717,11 @@ Matrix4x4::Matrix4x4(	float m00, float m01, float m02, float m03,
 						float m20, float m21, float m22, float m23,
 						float m30, float m31, float m32, float m33 ) {
 
-	memcpy(m, &m00, 16*sizeof(float));	// arguments are adjacent in stack
+	// don't rely on the arguments being adjacent in the stack, they aren't on x64
+	m[0][0] = m00; m[0][1] = m01; m[0][2] = m02; m[0][3] = m03;
+	m[1][0] = m10; m[1][1] = m11; m[1][2] = m12; m[1][3] = m13;
+	m[2][0] = m20; m[2][1] = m21; m[2][2] = m22; m[2][3] = m23;
+	m[3][0] = m30; m[3][1] = m31; m[3][2] = m32; m[3][3] = m33;
 }
 
 Matrix4x4 Matrix4x4::operator +(const Matrix4x4 &mat) const {
@@ -1095,7 +1101,9 @@ Matrix3x3::Matrix3x3(const Matrix3x3 &mat) {
 }
 
 Matrix3x3::Matrix3x3(float m00, float m01, float m02, float m10, float m11, float m12, float m20, float m21, float m22) {
-	memcpy(m, &m00, 9*sizeof(float));	// arguments are adjacent in stack
+	m[0][0] = m00; m[0][1] = m01; m[0][2] = m02;
+	m[1][0] = m10; m[1][1] = m11; m[1][2] = m12;
+	m[2][0] = m20; m[2][1] = m21; m[2][2] = m22;
 }
 
 Matrix3x3 Matrix3x3::operator +(const Matrix3x3 &mat) const {
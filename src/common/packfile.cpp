@@ -0,0 +1,327 @@
+#include <cstring>
+#include <cctype>
+#include "packfile.h"
+#include "lz4.h"
+#include "threads.h"
+
+using namespace packfile;
+using std::string;
+using std::vector;
+
+namespace {
+	// below this many blocks it's not worth starting threads
+	const dword ParallelBlocks = 4;
+
+	PackFile DataPack;
+
+	struct ExtractJob {
+		const byte *src;
+		const dword *PackedSizes;
+		const dword *offsets;		// of each block from src
+		byte *dest;
+		dword size;
+		volatile long failed;
+	};
+
+	void ExtractBlock(int i, void *data) {
+		ExtractJob *job = (ExtractJob*)data;
+		dword start = (dword)i * BlockSize;
+		dword len = job->size - start < BlockSize ? job->size - start : BlockSize;
+		const byte *src = job->src + job->offsets[i];
+
+		if(job->PackedSizes[i] == len) {
+			memcpy(job->dest + start, src, len);
+		} else if(!lz4::Decompress(src, job->PackedSizes[i], job->dest + start, len)) {
+			AtomicIncrement(&job->failed);
+		}
+	}
+
+	struct CompressJob {
+		const byte *src;
+		dword size;
+		vector<vector<byte> > *blocks;
+	};
+
+	void CompressBlock(int i, void *data) {
+		CompressJob *job = (CompressJob*)data;
+		dword start = (dword)i * BlockSize;
+		dword len = job->size - start < BlockSize ? job->size - start : BlockSize;
+
+		vector<byte> &block = (*job->blocks)[i];
+		block.resize(lz4::CompressBound(len));
+		dword packed = lz4::Compress(job->src + start, len, &block[0]);
+		if(packed < len) {
+			block.resize(packed);
+		} else {
+			block.assign(job->src + start, job->src + start + len);
+		}
+	}
+}
+
+string packfile::NormalizeName(const char *name) {
+	string str;
+	while(*name) {
+		char c = *name++;
+		if(c == '\\') c = '/';
+		str.push_back((char)tolower(c));
+	}
+	return str;
+}
+
+dword packfile::GetBlockCount(dword size) {
+	return (size + BlockSize - 1) / BlockSize;
+}
+
+bool packfile::OpenDataPack(const char *fname) {
+	return DataPack.Open(fname);
+}
+
+void packfile::CloseDataPack() {
+	DataPack.Close();
+}
+
+const PackFile *packfile::GetDataPack() {
+	return DataPack.IsOpen() ? &DataPack : 0;
+}
+
+////////////// PackFile //////////////
+
+PackFile::PackFile() {
+	index = 0;
+	EntryCount = 0;
+}
+
+PackFile::~PackFile() {
+	Close();
+}
+
+bool PackFile::Open(const char *fname) {
+	Close();
+	if(!file.Open(fname)) return false;
+
+	const byte *data = file.GetData();
+	dword size = file.GetSize();
+
+	const Header *hdr = (const Header*)data;
+	if(size < sizeof(Header) || hdr->magic != Magic || hdr->version != Version) {
+		file.Close();
+		return false;
+	}
+	if(hdr->IndexOffset > size || (size - hdr->IndexOffset) / sizeof(Entry) < hdr->EntryCount) {
+		file.Close();
+		return false;
+	}
+
+	index = (const Entry*)(data + hdr->IndexOffset);
+	EntryCount = hdr->EntryCount;
+
+	for(dword i=0; i<EntryCount; i++) {
+		if(index[i].offset > size || size - index[i].offset < index[i].PackedSize) {
+			Close();
+			return false;
+		}
+		string name(index[i].name, strnlen(index[i].name, MaxNameLength));
+		names[name] = i;
+	}
+	return true;
+}
+
+void PackFile::Close() {
+	file.Close();
+	names.clear();
+	index = 0;
+	EntryCount = 0;
+}
+
+bool PackFile::IsOpen() const {
+	return file.IsOpen();
+}
+
+const Entry *PackFile::Find(const char *name) const {
+	std::map<string, dword>::const_iterator iter = names.find(NormalizeName(name));
+	return iter == names.end() ? 0 : index + iter->second;
+}
+
+const byte *PackFile::Read(const char *name, dword *size, vector<byte> *buf) const {
+	const Entry *ent = Find(name);
+	if(!ent) return 0;
+
+	if(size) *size = ent->size;
+	if(!(ent->flags & FlagCompressed)) {
+		return file.GetData() + ent->offset;
+	}
+
+	buf->resize(ent->size);
+	if(!ent->size) return file.GetData() + ent->offset;
+	return Extract(ent, &(*buf)[0]) ? &(*buf)[0] : 0;
+}
+
+bool PackFile::Load(const char *name, vector<byte> *buf) const {
+	const Entry *ent = Find(name);
+	if(!ent) return false;
+
+	buf->resize(ent->size);
+	return !ent->size || Extract(ent, &(*buf)[0]);
+}
+
+bool PackFile::Extract(const Entry *ent, byte *dest) const {
+	const byte *src = file.GetData() + ent->offset;
+
+	if(!(ent->flags & FlagCompressed)) {
+		if(ent->PackedSize != ent->size) return false;
+		memcpy(dest, src, ent->size);
+		return true;
+	}
+
+	dword BlockCount = GetBlockCount(ent->size);
+	if(ent->PackedSize / sizeof(dword) < BlockCount) return false;
+
+	ExtractJob job;
+	vector<dword> PackedSizes(BlockCount), offsets(BlockCount);
+	if(BlockCount) memcpy(&PackedSizes[0], src, BlockCount * sizeof(dword));
+
+	// block offsets, checking that they all fit in the entry
+	dword offs = BlockCount * sizeof(dword);
+	for(dword i=0; i<BlockCount; i++) {
+		if(PackedSizes[i] > BlockSize || ent->PackedSize - offs < PackedSizes[i]) return false;
+		offsets[i] = offs;
+		offs += PackedSizes[i];
+	}
+
+	job.src = src;
+	job.PackedSizes = BlockCount ? &PackedSizes[0] : 0;
+	job.offsets = BlockCount ? &offsets[0] : 0;
+	job.dest = dest;
+	job.size = ent->size;
+	job.failed = 0;
+
+	if(BlockCount >= ParallelBlocks) {
+		ParallelFor((int)BlockCount, ExtractBlock, &job);
+	} else {
+		for(dword i=0; i<BlockCount; i++) {
+			ExtractBlock((int)i, &job);
+		}
+	}
+	return !job.failed;
+}
+
+dword PackFile::GetEntryCount() const {
+	return EntryCount;
+}
+
+const Entry *PackFile::GetEntry(dword i) const {
+	return i < EntryCount ? index + i : 0;
+}
+
+////////////// PackWriter //////////////
+
+PackWriter::PackWriter() {
+	fp = 0;
+	offset = 0;
+	compress = true;
+}
+
+PackWriter::~PackWriter() {
+	Close();
+}
+
+bool PackWriter::Open(const char *fname, bool compress) {
+	Close();
+	if(!(fp = fopen(fname, "wb"))) return false;
+
+	// header is written for real once the index position is known
+	Header hdr;
+	memset(&hdr, 0, sizeof hdr);
+	fwrite(&hdr, sizeof hdr, 1, fp);
+	offset = sizeof hdr;
+	index.clear();
+	this->compress = compress;
+	return true;
+}
+
+bool PackWriter::Close() {
+	if(!fp) return false;
+
+	Header hdr;
+	hdr.magic = Magic;
+	hdr.version = Version;
+	hdr.EntryCount = (dword)index.size();
+	hdr.IndexOffset = offset;
+
+	bool ok = true;
+	if(!index.empty()) {
+		ok = fwrite(&index[0], sizeof(Entry), index.size(), fp) == index.size();
+	}
+	fseek(fp, 0, SEEK_SET);
+	ok = ok && fwrite(&hdr, sizeof hdr, 1, fp) == 1;
+
+	fclose(fp);
+	fp = 0;
+	return ok;
+}
+
+bool PackWriter::Add(const char *name, const void *data, dword size) {
+	if(!fp) return false;
+
+	string nname = NormalizeName(name);
+	if(nname.size() >= MaxNameLength || Contains(nname.c_str())) return false;
+
+	Entry ent;
+	memset(&ent, 0, sizeof ent);
+	strcpy(ent.name, nname.c_str());
+	ent.offset = offset;
+	ent.size = ent.PackedSize = size;
+
+	if(compress && size) {
+		dword BlockCount = GetBlockCount(size);
+		vector<vector<byte> > blocks(BlockCount);
+
+		CompressJob job;
+		job.src = (const byte*)data;
+		job.size = size;
+		job.blocks = &blocks;
+		ParallelFor((int)BlockCount, CompressBlock, &job);
+
+		vector<dword> PackedSizes(BlockCount);
+		dword packed = BlockCount * sizeof(dword);
+		for(dword i=0; i<BlockCount; i++) {
+			PackedSizes[i] = (dword)blocks[i].size();
+			packed += PackedSizes[i];
+		}
+
+		if(packed < size) {
+			ent.PackedSize = packed;
+			ent.flags = FlagCompressed;
+
+			bool ok = fwrite(&PackedSizes[0], sizeof(dword), BlockCount, fp) == BlockCount;
+			for(dword i=0; i<BlockCount && ok; i++) {
+				ok = fwrite(&blocks[i][0], 1, blocks[i].size(), fp) == blocks[i].size();
+			}
+			if(!ok) return false;
+
+			offset += packed;
+			index.push_back(ent);
+			return true;
+		}
+	}
+
+	if(size && fwrite(data, 1, size, fp) != size) return false;
+	offset += size;
+
+	index.push_back(ent);
+	return true;
+}
+
+bool PackWriter::AddFile(const char *name, const char *path) {
+	MappedFile src;
+	if(!src.Open(path)) return false;
+	return Add(name, src.GetData(), src.GetSize());
+}
+
+bool PackWriter::Contains(const char *name) const {
+	string nname = NormalizeName(name);
+	for(size_t i=0; i<index.size(); i++) {
+		if(nname == index[i].name) return true;
+	}
+	return false;
+}
@@ -0,0 +1,112 @@
+#ifndef _PACKFILE_H_
+#define _PACKFILE_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include "typedefs.h"
+#include "mappedfile.h"
+
+class PackFile;
+
+// Pack files hold many data files back to back, in the order they were added
+// (which is the order the demo needs them in), followed by an index.
+// Files that compress are stored as independent LZ4 blocks, so that big ones
+// can be decompressed by several threads at once.
+namespace packfile {
+
+	const dword Magic = 0x4b41504e;		// "NPAK"
+	const dword Version = 2;
+	const int MaxNameLength = 112;
+	const dword BlockSize = 65536;
+
+	enum {
+		// data starts with a dword per block holding its packed size, followed by
+		// the blocks. A block as big as its unpacked size is stored as is.
+		FlagCompressed = 1
+	};
+
+	struct Header {
+		dword magic, version;
+		dword EntryCount;
+		dword IndexOffset;
+	};
+
+	struct Entry {
+		char name[MaxNameLength];	// normalized, see NormalizeName
+		dword offset, size;
+		dword PackedSize;			// bytes stored in the pack
+		dword flags;
+	};
+
+	// lowercase with forward slashes, so lookups match the way windows opens files
+	std::string NormalizeName(const char *name);
+
+	dword GetBlockCount(dword size);
+
+	// The demo's data pack. The loaders look files up here first and fall back
+	// to the file system, so loose files keep working during development.
+	bool OpenDataPack(const char *fname);
+	void CloseDataPack();
+	const PackFile *GetDataPack();
+}
+
+class PackFile {
+private:
+	MappedFile file;
+	const packfile::Entry *index;
+	dword EntryCount;
+	std::map<std::string, dword> names;
+
+	PackFile(const PackFile &pf) {}
+	void operator =(const PackFile &pf) {}
+
+public:
+	PackFile();
+	~PackFile();
+
+	bool Open(const char *fname);
+	void Close();
+	bool IsOpen() const;
+
+	const packfile::Entry *Find(const char *name) const;
+
+	// Returns the file's data, pointing straight into the mapped pack if it's
+	// stored uncompressed, or else decompressed into buf. 0 if not found.
+	const byte *Read(const char *name, dword *size, std::vector<byte> *buf) const;
+
+	// always copies, for callers that need to modify the data
+	bool Load(const char *name, std::vector<byte> *buf) const;
+
+	// dest must hold ent->size bytes
+	bool Extract(const packfile::Entry *ent, byte *dest) const;
+
+	dword GetEntryCount() const;
+	const packfile::Entry *GetEntry(dword i) const;
+};
+
+class PackWriter {
+private:
+	FILE *fp;
+	std::vector<packfile::Entry> index;
+	dword offset;
+	bool compress;
+
+	PackWriter(const PackWriter &pw) {}
+	void operator =(const PackWriter &pw) {}
+
+public:
+	PackWriter();
+	~PackWriter();
+
+	bool Open(const char *fname, bool compress = true);
+	bool Close();		// writes the index
+
+	// compressed only if that makes the file smaller
+	bool Add(const char *name, const void *data, dword size);
+	bool AddFile(const char *name, const char *path);
+	bool Contains(const char *name) const;
+};
+
+#endif	// _PACKFILE_H_
@@ -0,0 +1,25 @@
+#include "shadowvol.h"
+
+void ExtrudeSilhouette(const void *verts, dword stride, const dword *silhouette, dword EdgeCount, const ShadowLight &light, const Matrix4x4 &XForm, Vector3 *out) {
+	const byte *vptr = (const byte*)verts;
+
+	for(dword i=0; i<EdgeCount; i++) {
+		Vector3 quad[4];
+		quad[0] = *(const Vector3*)(vptr + silhouette[i * 2] * stride);
+		quad[1] = *(const Vector3*)(vptr + silhouette[i * 2 + 1] * stride);
+		quad[2] = quad[1] + GetShadowLightDir(light, quad[1]) * ShadowExtrusion;
+		quad[3] = quad[0] + GetShadowLightDir(light, quad[0]) * ShadowExtrusion;
+
+		for(int j=0; j<4; j++) {
+			quad[j].Transform(XForm);
+		}
+
+		*out++ = quad[0];
+		*out++ = quad[1];
+		*out++ = quad[2];
+
+		*out++ = quad[0];
+		*out++ = quad[2];
+		*out++ = quad[3];
+	}
+}
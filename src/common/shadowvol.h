@@ -0,0 +1,29 @@
+#ifndef _SHADOWVOL_H_
+#define _SHADOWVOL_H_
+
+#include "typedefs.h"
+#include "n3dmath.h"
+
+// Shadow volume geometry without anything from the engine, so the tools can
+// make (and check) it too. Only positions are made, that's all the stencil
+// passes draw.
+
+// the light, in the space of the mesh
+struct ShadowLight {
+	bool directional;
+	Vector3 vec;	// direction for directional lights, position otherwise
+};
+
+const float ShadowExtrusion = 100000.0f;
+
+inline Vector3 GetShadowLightDir(const ShadowLight &light, const Vector3 &pos) {
+	return light.directional ? light.vec : pos - light.vec;
+}
+
+// Writes the sides of the volume, two triangles for every silhouette edge (the
+// vertex pairs of FindSilhouetteEdges): the edge itself and the edge pushed
+// away from the light, transformed by XForm. verts are stride bytes apart,
+// starting with the position. out needs room for 6 per edge.
+void ExtrudeSilhouette(const void *verts, dword stride, const dword *silhouette, dword EdgeCount, const ShadowLight &light, const Matrix4x4 &XForm, Vector3 *out);
+
+#endif	// _SHADOWVOL_H_
@@ -0,0 +1,155 @@
+#ifndef _STRINGMAP_H_
+#define _STRINGMAP_H_
+
+#include <vector>
+#include <cstring>
+#include "typedefs.h"
+
+// 32bit FNV-1a over the whole string
+inline dword HashString(const char *str) {
+	dword hash = 0x811c9dc5;
+	while(*str) {
+		hash ^= (byte)*str++;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+// Hash map from strings to ValType with open addressing (linear probing).
+// The slots are one flat array and the keys are copied one after another into
+// a single buffer, so inserting allocates nothing but the occasional resize,
+// and a lookup is a hash and a short run through neighbouring slots, taking
+// plain const char* keys.
+template <class ValType>
+class StringMap {
+private:
+	// hash values 0 and 1 are taken to mark empty and removed slots
+	enum {SlotEmpty, SlotRemoved, SlotFirstHash};
+
+	struct Slot {
+		dword hash;
+		dword KeyOffset;	// in keys
+		ValType val;
+	};
+
+	std::vector<Slot> slots;	// always a power of two of them
+	std::vector<char> keys;
+	dword count, used;			// used counts removed slots as well
+
+	static dword SlotHash(const char *key) {
+		dword hash = HashString(key);
+		return hash < SlotFirstHash ? hash + SlotFirstHash : hash;
+	}
+
+	// the slot with the key, or the empty one where it would go
+	dword Probe(const char *key, dword hash) const {
+		dword mask = (dword)slots.size() - 1;
+		dword i = hash & mask;
+		dword FirstRemoved = 0xffffffff;
+
+		while(slots[i].hash != SlotEmpty) {
+			if(slots[i].hash == hash && !strcmp(&keys[slots[i].KeyOffset], key)) return i;
+			if(slots[i].hash == SlotRemoved && FirstRemoved == 0xffffffff) FirstRemoved = i;
+			i = (i + 1) & mask;
+		}
+		return FirstRemoved != 0xffffffff ? FirstRemoved : i;
+	}
+
+	void Resize(dword SlotCount) {
+		std::vector<Slot> OldSlots;
+		std::vector<char> OldKeys;
+		OldSlots.swap(slots);
+		OldKeys.swap(keys);
+
+		slots.resize(SlotCount);
+		for(dword i=0; i<SlotCount; i++) {
+			slots[i].hash = SlotEmpty;
+		}
+
+		// the removed keys are left behind
+		used = 0;
+		for(dword i=0; i<(dword)OldSlots.size(); i++) {
+			if(OldSlots[i].hash < SlotFirstHash) continue;
+
+			const char *key = &OldKeys[OldSlots[i].KeyOffset];
+			Slot &slot = slots[Probe(key, OldSlots[i].hash)];
+			slot.hash = OldSlots[i].hash;
+			slot.KeyOffset = AddKey(key);
+			slot.val = OldSlots[i].val;
+			used++;
+		}
+	}
+
+	dword AddKey(const char *key) {
+		dword offs = (dword)keys.size();
+		keys.insert(keys.end(), key, key + strlen(key) + 1);
+		return offs;
+	}
+
+public:
+
+	StringMap(dword capacity = 16) {
+		dword SlotCount = 16;
+		while(SlotCount < capacity + capacity / 3) SlotCount <<= 1;
+
+		slots.resize(SlotCount);
+		for(dword i=0; i<SlotCount; i++) {
+			slots[i].hash = SlotEmpty;
+		}
+		count = used = 0;
+	}
+
+	// adds the key or replaces its value, returns where the value went
+	ValType *Insert(const char *key, const ValType &val) {
+		// at most 3/4 full, removed slots included
+		if((used + 1) * 4 > (dword)slots.size() * 3) {
+			Resize(count * 2 + 2 > used ? (dword)slots.size() * 2 : (dword)slots.size());
+		}
+
+		dword hash = SlotHash(key);
+		Slot &slot = slots[Probe(key, hash)];
+		if(slot.hash < SlotFirstHash) {
+			if(slot.hash == SlotEmpty) used++;
+			slot.hash = hash;
+			slot.KeyOffset = AddKey(key);
+			count++;
+		}
+		slot.val = val;
+		return &slot.val;
+	}
+
+	bool Remove(const char *key) {
+		Slot &slot = slots[Probe(key, SlotHash(key))];
+		if(slot.hash < SlotFirstHash) return false;
+
+		slot.hash = SlotRemoved;
+		slot.val = ValType();
+		count--;
+		return true;
+	}
+
+	ValType *Find(const char *key) {
+		Slot &slot = slots[Probe(key, SlotHash(key))];
+		return slot.hash < SlotFirstHash ? 0 : &slot.val;
+	}
+
+	const ValType *Find(const char *key) const {
+		const Slot &slot = slots[Probe(key, SlotHash(key))];
+		return slot.hash < SlotFirstHash ? 0 : &slot.val;
+	}
+
+	dword GetCount() const {
+		return count;
+	}
+
+	void Clear() {
+		for(dword i=0; i<(dword)slots.size(); i++) {
+			slots[i].hash = SlotEmpty;
+			slots[i].val = ValType();
+		}
+		keys.clear();
+		count = used = 0;
+	}
+};
+
+#endif	// _STRINGMAP_H_
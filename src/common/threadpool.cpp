@@ -0,0 +1,103 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int ThreadCount) {
+	if(ThreadCount <= 0) ThreadCount = GetProcessorCount();
+
+	WorkerCount = ThreadCount;
+	workers = new Thread[WorkerCount];
+	for(int i=0; i<WorkerCount; i++) {
+		workers[i].Start(WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	// a worker that wakes up to an empty queue quits
+	for(int i=0; i<WorkerCount; i++) {
+		JobCount.Post();
+	}
+	delete [] workers;	// joins
+}
+
+void ThreadPool::AddJob(JobFunc func, void *data) {
+	Job job;
+	job.func = func;
+	job.data = data;
+
+	QueueLock.Lock();
+	queue.push_back(job);
+	QueueLock.Unlock();
+	JobCount.Post();
+}
+
+int ThreadPool::GetThreadCount() const {
+	return WorkerCount;
+}
+
+struct PoolForJob {
+	int count;
+	volatile long next, done;
+	volatile long refs;		// the calling thread and each helper job
+	ParallelFunc func;
+	void *data;
+	Semaphore finished;
+};
+
+static void RunPoolFor(PoolForJob *job) {
+	int i;
+	while((i = (int)AtomicIncrement(&job->next) - 1) < job->count) {
+		job->func(i, job->data);
+		if(AtomicIncrement(&job->done) == job->count) job->finished.Post();
+	}
+}
+
+static void ReleasePoolFor(PoolForJob *job) {
+	if(AtomicDecrement(&job->refs) == 0) delete job;
+}
+
+static void PoolForHelper(void *data) {
+	PoolForJob *job = (PoolForJob*)data;
+	RunPoolFor(job);
+	ReleasePoolFor(job);
+}
+
+void ThreadPool::ParallelFor(int count, ParallelFunc func, void *data) {
+	if(count <= 0) return;
+
+	int helpers = count - 1 < WorkerCount ? count - 1 : WorkerCount;
+
+	// on the heap, the helpers may get to it after this returns
+	PoolForJob *job = new PoolForJob;
+	job->count = count;
+	job->next = 0;
+	job->done = 0;
+	job->refs = helpers + 1;
+	job->func = func;
+	job->data = data;
+
+	for(int i=0; i<helpers; i++) {
+		AddJob(PoolForHelper, job);
+	}
+
+	RunPoolFor(job);
+	job->finished.Wait();
+	ReleasePoolFor(job);
+}
+
+void ThreadPool::WorkerLoop(void *pool) {
+	ThreadPool *tp = (ThreadPool*)pool;
+
+	while(true) {
+		tp->JobCount.Wait();
+
+		tp->QueueLock.Lock();
+		if(tp->queue.empty()) {
+			tp->QueueLock.Unlock();
+			return;
+		}
+		Job job = tp->queue.front();
+		tp->queue.pop_front();
+		tp->QueueLock.Unlock();
+
+		job.func(job.data);
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <deque>
+#include "threads.h"
+
+typedef void (*JobFunc)(void *data);
+
+// a fixed set of worker threads running jobs in the order they were added
+class ThreadPool {
+private:
+	struct Job {
+		JobFunc func;
+		void *data;
+	};
+
+	Thread *workers;
+	int WorkerCount;
+
+	Mutex QueueLock;
+	std::deque<Job> queue;
+	Semaphore JobCount;
+
+	ThreadPool(const ThreadPool &tp) {}
+	void operator =(const ThreadPool &tp) {}
+
+	static void WorkerLoop(void *pool);
+
+public:
+	ThreadPool(int ThreadCount = 0);	// 0 for one per cpu
+	~ThreadPool();		// runs the jobs left, then joins the threads
+
+	void AddJob(JobFunc func, void *data);
+	int GetThreadCount() const;
+
+	// Runs func(i, data) for i in [0, count) on the pool threads and the
+	// calling thread, and returns when all of them are done. The calling
+	// thread doesn't wait for pool threads busy with other jobs, if they come
+	// to it late there's just nothing left for them.
+	void ParallelFor(int count, ParallelFunc func, void *data);
+};
+
+#endif	// _THREADPOOL_H_
@@ -0,0 +1,241 @@
+#include "threads.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#endif
+
+Thread::Thread() {
+	handle = 0;
+	func = 0;
+	data = 0;
+}
+
+Thread::~Thread() {
+	Join();
+}
+
+bool Thread::IsRunning() const {
+	return handle != 0;
+}
+
+#ifdef _WIN32
+
+unsigned long __stdcall Thread::Entry(void *self) {
+	Thread *thr = (Thread*)self;
+	thr->func(thr->data);
+	return 0;
+}
+
+bool Thread::Start(ThreadFunc func, void *data) {
+	if(handle) return false;
+
+	this->func = func;
+	this->data = data;
+	handle = CreateThread(0, 0, Entry, this, 0, 0);
+	return handle != 0;
+}
+
+void Thread::Join() {
+	if(!handle) return;
+	WaitForSingleObject((HANDLE)handle, INFINITE);
+	CloseHandle((HANDLE)handle);
+	handle = 0;
+}
+
+Mutex::Mutex() {
+	CRITICAL_SECTION *cs = new CRITICAL_SECTION;
+	InitializeCriticalSection(cs);
+	impl = cs;
+}
+
+Mutex::~Mutex() {
+	DeleteCriticalSection((CRITICAL_SECTION*)impl);
+	delete (CRITICAL_SECTION*)impl;
+}
+
+void Mutex::Lock() {
+	EnterCriticalSection((CRITICAL_SECTION*)impl);
+}
+
+void Mutex::Unlock() {
+	LeaveCriticalSection((CRITICAL_SECTION*)impl);
+}
+
+Semaphore::Semaphore(int count) {
+	impl = CreateSemaphore(0, count, 0x7fffffff, 0);
+}
+
+Semaphore::~Semaphore() {
+	CloseHandle((HANDLE)impl);
+}
+
+void Semaphore::Post() {
+	ReleaseSemaphore((HANDLE)impl, 1, 0);
+}
+
+void Semaphore::Wait() {
+	WaitForSingleObject((HANDLE)impl, INFINITE);
+}
+
+long AtomicIncrement(volatile long *val) {
+	return InterlockedIncrement(val);
+}
+
+long AtomicDecrement(volatile long *val) {
+	return InterlockedDecrement(val);
+}
+
+void *AtomicExchangePointer(void *volatile *ptr, void *val) {
+	return InterlockedExchangePointer(ptr, val);
+}
+
+void *AtomicCompareExchangePointer(void *volatile *ptr, void *val, void *cmp) {
+	return InterlockedCompareExchangePointer(ptr, val, cmp);
+}
+
+int GetProcessorCount() {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+void ThreadSleep(int msec) {
+	Sleep(msec);
+}
+
+#else	// posix
+
+void *Thread::Entry(void *self) {
+	Thread *thr = (Thread*)self;
+	thr->func(thr->data);
+	return 0;
+}
+
+bool Thread::Start(ThreadFunc func, void *data) {
+	if(handle) return false;
+
+	this->func = func;
+	this->data = data;
+
+	pthread_t *thr = new pthread_t;
+	if(pthread_create(thr, 0, Entry, this) != 0) {
+		delete thr;
+		return false;
+	}
+	handle = thr;
+	return true;
+}
+
+void Thread::Join() {
+	if(!handle) return;
+	pthread_join(*(pthread_t*)handle, 0);
+	delete (pthread_t*)handle;
+	handle = 0;
+}
+
+Mutex::Mutex() {
+	pthread_mutex_t *mx = new pthread_mutex_t;
+	pthread_mutex_init(mx, 0);
+	impl = mx;
+}
+
+Mutex::~Mutex() {
+	pthread_mutex_destroy((pthread_mutex_t*)impl);
+	delete (pthread_mutex_t*)impl;
+}
+
+void Mutex::Lock() {
+	pthread_mutex_lock((pthread_mutex_t*)impl);
+}
+
+void Mutex::Unlock() {
+	pthread_mutex_unlock((pthread_mutex_t*)impl);
+}
+
+Semaphore::Semaphore(int count) {
+	sem_t *sem = new sem_t;
+	sem_init(sem, 0, count);
+	impl = sem;
+}
+
+Semaphore::~Semaphore() {
+	sem_destroy((sem_t*)impl);
+	delete (sem_t*)impl;
+}
+
+void Semaphore::Post() {
+	sem_post((sem_t*)impl);
+}
+
+void Semaphore::Wait() {
+	while(sem_wait((sem_t*)impl) != 0);		// interrupted by a signal
+}
+
+long AtomicIncrement(volatile long *val) {
+	return __sync_add_and_fetch(val, 1);
+}
+
+long AtomicDecrement(volatile long *val) {
+	return __sync_sub_and_fetch(val, 1);
+}
+
+void *AtomicExchangePointer(void *volatile *ptr, void *val) {
+	__sync_synchronize();
+	return __sync_lock_test_and_set(ptr, val);
+}
+
+void *AtomicCompareExchangePointer(void *volatile *ptr, void *val, void *cmp) {
+	return __sync_val_compare_and_swap(ptr, cmp, val);
+}
+
+int GetProcessorCount() {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
+
+void ThreadSleep(int msec) {
+	usleep(msec * 1000);
+}
+
+#endif	// _WIN32
+
+
+struct ParallelJob {
+	int count;
+	volatile long next;
+	ParallelFunc func;
+	void *data;
+};
+
+static void ParallelWorker(void *data) {
+	ParallelJob *job = (ParallelJob*)data;
+
+	int i;
+	while((i = (int)AtomicIncrement(&job->next) - 1) < job->count) {
+		job->func(i, job->data);
+	}
+}
+
+void ParallelFor(int count, ParallelFunc func, void *data, int ThreadCount) {
+	if(ThreadCount <= 0) ThreadCount = GetProcessorCount();
+	if(ThreadCount > count) ThreadCount = count;
+
+	ParallelJob job;
+	job.count = count;
+	job.next = 0;
+	job.func = func;
+	job.data = data;
+
+	// the calling thread takes part as well
+	Thread *workers = ThreadCount > 1 ? new Thread[ThreadCount - 1] : 0;
+	for(int i=0; i<ThreadCount - 1; i++) {
+		workers[i].Start(ParallelWorker, &job);
+	}
+	ParallelWorker(&job);
+
+	delete [] workers;	// joins
+}
@@ -0,0 +1,88 @@
+#ifndef _THREADS_H_
+#define _THREADS_H_
+
+typedef void (*ThreadFunc)(void *data);
+
+class Thread {
+private:
+	void *handle;
+	ThreadFunc func;
+	void *data;
+
+	// private copy constructor and assignment op, to prohibit copying
+	Thread(const Thread &t) {}
+	void operator =(const Thread &t) {}
+
+#ifdef _WIN32
+	static unsigned long __stdcall Entry(void *self);
+#else
+	static void *Entry(void *self);
+#endif
+
+public:
+	Thread();
+	~Thread();
+
+	bool Start(ThreadFunc func, void *data);
+	void Join();
+	bool IsRunning() const;
+};
+
+class Mutex {
+private:
+	void *impl;
+
+	Mutex(const Mutex &m) {}
+	void operator =(const Mutex &m) {}
+
+public:
+	Mutex();
+	~Mutex();
+
+	void Lock();
+	void Unlock();
+};
+
+class Semaphore {
+private:
+	void *impl;
+
+	Semaphore(const Semaphore &s) {}
+	void operator =(const Semaphore &s) {}
+
+public:
+	Semaphore(int count = 0);
+	~Semaphore();
+
+	void Post();
+	void Wait();
+};
+
+// locks a mutex for the lifetime of the object
+class MutexLock {
+private:
+	Mutex *mutex;
+
+public:
+	MutexLock(Mutex *m) : mutex(m) { mutex->Lock(); }
+	~MutexLock() { mutex->Unlock(); }
+};
+
+// both return the new value
+long AtomicIncrement(volatile long *val);
+long AtomicDecrement(volatile long *val);
+
+// both return the previous value, the second only stores val if that was cmp
+void *AtomicExchangePointer(void *volatile *ptr, void *val);
+void *AtomicCompareExchangePointer(void *volatile *ptr, void *val, void *cmp);
+
+int GetProcessorCount();
+
+// puts the calling thread to sleep for at least msec milliseconds
+void ThreadSleep(int msec);
+
+// runs func(i, data) for i in [0, count) on up to ThreadCount threads (0 for one per cpu)
+typedef void (*ParallelFunc)(int index, void *data);
+void ParallelFor(int count, ParallelFunc func, void *data, int ThreadCount = 0);
+
+#endif	// _THREADS_H_
@@ -3,11 +3,18 @@
 
 typedef char int8;
 typedef short int16;
-typedef long int32;
 
 typedef unsigned char uint8;
 typedef unsigned short uint16;
+
+#ifdef _WIN32
+typedef long int32;
 typedef unsigned long uint32;
+#else
+// long is 64bit on LP64 systems, keep the file formats the same everywhere
+typedef int int32;
+typedef unsigned int uint32;
+#endif	// _WIN32
 
 #ifdef _MSC_VER
 typedef __int64 int64;
@@ -3,6 +3,10 @@
 #include "3deng_dx8/3deng.h"
 #include "demosystem/demosys.h"
 #include "fmod.h"
+#include "common/packfile.h"
+#include "demosystem/loadgraph.h"
+#include <cstdio>
+#include <cstring>
 
 // parts
 #include "beginpart.h"
@@ -21,6 +25,7 @@ Engine3D eng3d;
 GraphicsContext *gc;
 DemoSystem *demo;
 FMUSIC_MODULE *mod;
+std::vector<byte> SongData;	// fmod plays the song straight from this
 
 
 // parts
@@ -40,6 +45,21 @@ int CloseHandler(Widget *win, int arg);
 int MouseHandler(Widget *win, int x, int y, bool left, bool middle, bool right);
 int WheelHandler(Widget *win, int x, int y, int rot);
 
+// startup loading stages
+struct LoadingScreen {
+	Object *quad;
+	Texture **pics;
+	int PicCount, current;
+};
+
+void LoadPart(void *data);
+void UploadPart(void *data);
+void LoadSong(void *data);
+void StartSound(void *data);
+void ShowProgress(float progress, void *data);
+
+void BenchmarkSceneLoading(const char *fname);
+
 
 int main() {
 
@@ -59,6 +79,9 @@ int main() {
 
 bool Init() {
 
+	// everything is loaded from the pack if there is one, else from the data dir
+	packfile::OpenDataPack("data.pak");
+
 	ContextInitParameters cip;
 	try {
 		cip = eng3d.LoadContextParamsConfigFile("n3dinit.conf");
@@ -89,6 +112,21 @@ bool Init() {
 
 	demo = new DemoSystem(gc);
 	SceneLoader::SetGraphicsContext(gc);
+	SceneLoader::SetMeshOptimization(true);
+
+	// the shipped scenes come cooked, "-compilescenes" writes .n3s files next
+	// to the ones in the data dir while loading them, for working on the data
+	if(Arguments && strstr(Arguments, "-compilescenes")) {
+		SceneLoader::SetSceneCompiling(true);
+	}
+
+	// "-loadbench" on the command line times the scene loading instead of running the demo
+	if(Arguments && strstr(Arguments, "-loadbench")) {
+		// from the files in the data dir, not the pack
+		packfile::CloseDataPack();
+		BenchmarkSceneLoading("data/geometry/scene2.3ds");
+		return false;
+	}
 
 	Object *quad = new Object(gc);
 	quad->CreatePlane(4.0f, 0);
@@ -105,61 +143,51 @@ bool Init() {
 	quad->material.SetTexture(loading[0], TextureMap);
 	quad->Render();
 	gc->Flip();
+
 	beginpart = new BeginPart(gc);
 	beginpart->SetTimingRel(0, 11000);
-	demo->AddPart(beginpart);
-
-	quad->material.SetTexture(loading[1], TextureMap);
-	quad->Render();
-	gc->Flip();
 	dungeonpart = new DungeonPart(gc);
 	dungeonpart->SetTimingRel(11000, 75000);
-	demo->AddPart(dungeonpart);
-
-	quad->material.SetTexture(loading[2], TextureMap);
-	quad->Render();
-	gc->Flip();
 	treepart = new TreePart(gc);
 	treepart->SetTimingRel(85900, 40000);
-    demo->AddPart(treepart);
-
-	quad->material.SetTexture(loading[3], TextureMap);
-	quad->Render();
-	gc->Flip();
 	tunnelpart = new TunnelPart(gc);
 	tunnelpart->SetTimingRel(125900, 30000);
-	demo->AddPart(tunnelpart);
-
-	quad->material.SetTexture(loading[4], TextureMap);
-	quad->Render();
-	gc->Flip();
 	hellpart = new HellPart(gc);
 	hellpart->SetTimingRel(155900, 40000);
-	demo->AddPart(hellpart);
-
-	quad->material.SetTexture(loading[5], TextureMap);
-	quad->Render();
-	gc->Flip();
 	greetspart = new GreetsPart(gc);
 	greetspart->SetTimingRel(196000, 12000);
-	demo->AddPart(greetspart);
-
-	quad->material.SetTexture(loading[6], TextureMap);
-	quad->Render();
-	gc->Flip();
 	demonpart = new DemonPart(gc);
 	demonpart->SetTimingRel(208000, 2000);
-	demo->AddPart(demonpart);
 
-	quad->material.SetTexture(loading[7], TextureMap);
-	quad->Render();
-	gc->Flip();
-	FSOUND_SetHWND(win);
-	FSOUND_SetOutput(FSOUND_OUTPUT_DSOUND);
-	FSOUND_SetBufferSize(200);
-	FSOUND_Init(44100, 32, FSOUND_INIT_GLOBALFOCUS);
-	mod = FMUSIC_LoadSong("data/GOTH03.XM");
-	FMUSIC_SetMasterVolume(mod, 250);
+	// Load what's needed to start all at once, the parts' scenes and the song
+	// on worker threads, the textures and whatever else needs the device on
+	// this one. The rest of the parts are streamed in by the demo system
+	// while it plays.
+	Part *parts[] = {beginpart, dungeonpart, treepart, tunnelpart, hellpart, greetspart, demonpart};
+	const int PartCount = sizeof parts / sizeof *parts;
+
+	LoadGraph graph;
+	for(int i=0; i<PartCount; i++) {
+		if(parts[i]->GetStartTime() > demo->GetPrefetchTime()) continue;
+
+		int load = graph.AddStage(LoadPart, parts[i], LoadStageWorker);
+		int upload = graph.AddStage(UploadPart, parts[i], LoadStageMain);
+		graph.AddDependency(upload, load);
+	}
+	int song = graph.AddStage(LoadSong, 0, LoadStageWorker);
+	int sound = graph.AddStage(StartSound, 0, LoadStageMain);
+	graph.AddDependency(sound, song);
+
+	LoadingScreen screen;
+	screen.quad = quad;
+	screen.pics = loading;
+	screen.PicCount = 8;
+	screen.current = 0;
+	graph.Run(ShowProgress, &screen);
+
+	for(int i=0; i<PartCount; i++) {
+		demo->AddPart(parts[i]);
+	}
 
 	quad->material.SetTexture(loading[8], TextureMap);
 	quad->Render();
@@ -177,6 +205,58 @@ bool Init() {
 	return true;
 }
 
+void BenchmarkSceneLoading(const char *fname) {
+	const int iterations = 10;
+	dword mapped, streamed, compiled;
+
+	char msg[256];
+	if(SceneLoader::BenchmarkLoad(fname, iterations, &mapped, &streamed, &compiled)) {
+		sprintf(msg, "%s, %d loads\nmapped: %u ms\nstreamed: %u ms\ncompiled: %u ms", fname, iterations, mapped, streamed, compiled);
+	} else {
+		sprintf(msg, "failed to load %s", fname);
+	}
+	MessageBox(win, msg, "Scene Loading", MB_OK);
+}
+
+void LoadPart(void *data) {
+	((Part*)data)->Fetch();
+}
+
+void UploadPart(void *data) {
+	((Part*)data)->Activate();
+}
+
+void LoadSong(void *data) {
+	const PackFile *pack = packfile::GetDataPack();
+	if(!pack || !pack->Load("data/GOTH03.XM", &SongData)) SongData.clear();
+}
+
+void StartSound(void *data) {
+	FSOUND_SetHWND(win);
+	FSOUND_SetOutput(FSOUND_OUTPUT_DSOUND);
+	FSOUND_SetBufferSize(200);
+	FSOUND_Init(44100, 32, FSOUND_INIT_GLOBALFOCUS);
+	if(!SongData.empty()) {
+		mod = FMUSIC_LoadSongMemory(&SongData[0], (int)SongData.size());
+	} else {
+		mod = FMUSIC_LoadSong("data/GOTH03.XM");
+	}
+	FMUSIC_SetMasterVolume(mod, 250);
+}
+
+void ShowProgress(float progress, void *data) {
+	LoadingScreen *screen = (LoadingScreen*)data;
+
+	int pic = (int)(progress * (float)screen->PicCount);
+	if(pic > screen->PicCount) pic = screen->PicCount;
+	if(pic == screen->current) return;
+	screen->current = pic;
+
+	screen->quad->material.SetTexture(screen->pics[pic], TextureMap);
+	screen->quad->Render();
+	gc->Flip();
+}
+
 void MainLoop() {
 	demo->Update();
 	gc->Flip();
@@ -186,7 +266,18 @@ void CleanUp() {
 	ShowCursor(true);
 	FMUSIC_FreeSong(mod);
 	FSOUND_Close();
+
+	// parts still loading read from the pack
+	demo->ShutDown();
+	delete beginpart;
+	delete dungeonpart;
+	delete treepart;
+	delete tunnelpart;
+	delete hellpart;
+	delete greetspart;
+	delete demonpart;
 	delete demo;
+	packfile::CloseDataPack();
 }
 
 ///////// handlers /////////
@@ -4,12 +4,141 @@
 
 Part::Part() {
 	gc = 0;
+	scene = 0;
 
 	rmode = RenderModeNormal;
 	RenderTexture = 0;
 
 	SetTimingAbs(0, 0);
 	paused = false;
+
+	loader = *SceneLoader::GetDefaultContext();
+	loader.SetTextureDeferring(true);
+
+	LoadState = PartUnloaded;
+	LoadDone = 0;
+}
+
+// the derived destructors evict the part, joining the load, while what the
+// load writes to is still there
+Part::~Part() {}
+
+void Part::Load() {}
+
+void Part::Upload() {}
+
+void Part::Release() {
+	for(size_t i=0; i<TakenObjects.size(); i++) {
+		loader.ReleaseTextures(TakenObjects[i]);
+		delete TakenObjects[i];
+	}
+	for(size_t i=0; i<OwnObjects.size(); i++) {
+		delete OwnObjects[i];
+	}
+	TakenObjects.clear();
+	OwnObjects.clear();
+
+	if(scene) {
+		loader.ReleaseTextures(scene);
+		delete scene;
+		scene = 0;
+	}
+
+	for(size_t i=0; i<TexNames.size(); i++) {
+		gc->texman->ReleaseTexture(TexNames[i].c_str());
+	}
+	TexNames.clear();
+}
+
+Texture *Part::AddTexture(const char *fname) {
+	Texture *tex = gc->texman->LoadTexture(fname);
+	if(tex) TexNames.push_back(fname);
+	return tex;
+}
+
+Object *Part::TakeObject(const char *name) {
+	Object *obj = scene->GetObject(name);
+	if(obj) {
+		scene->RemoveObject(obj);
+		TakenObjects.push_back(obj);
+	}
+	return obj;
+}
+
+Object *Part::KeepObject(Object *obj) {
+	OwnObjects.push_back(obj);
+	return obj;
+}
+
+//// loading lifecycle ////
+
+void Part::LoadEntry(void *part) {
+	Part *p = (Part*)part;
+	p->Load();
+	if(p->scene) p->loader.RequestTextures(p->scene, &p->SceneTextures);
+	AtomicIncrement(&p->LoadDone);
+}
+
+void Part::Prefetch() {
+	if(LoadState != PartUnloaded) return;
+
+	LoadState = PartLoading;
+	LoadDone = 0;
+	if(!LoadThread.Start(LoadEntry, this)) {
+		LoadEntry(this);
+	}
+}
+
+void Part::Fetch() {
+	if(LoadState == PartUnloaded) {
+		Load();
+		if(scene) loader.RequestTextures(scene, &SceneTextures);
+		LoadState = PartLoaded;
+	}
+}
+
+bool Part::IsLoaded() {
+	if(LoadState == PartLoading && LoadDone) {
+		LoadThread.Join();
+		LoadState = PartLoaded;
+	}
+	return LoadState == PartLoaded || LoadState == PartReady;
+}
+
+bool Part::IsFetched() {
+	return IsLoaded() && !SceneTextures.pending;
+}
+
+void Part::Activate() {
+	Fetch();
+	if(LoadState == PartLoading) {
+		LoadThread.Join();
+		LoadState = PartLoaded;
+	}
+	if(LoadState == PartLoaded) {
+		gc->texman->WaitTextures(&SceneTextures);
+		if(scene) loader.LoadTextures(scene);
+		Upload();
+		LoadState = PartReady;
+	}
+}
+
+void Part::Evict() {
+	if(LoadState == PartUnloaded) return;
+
+	// Release undoes a whole load, so finish it first
+	Activate();
+
+	// the device holds on to the textures still bound
+	for(int i=0; i<gc->GetTextureStageNumber(); i++) {
+		gc->SetTexture(i, 0);
+	}
+	Release();
+	LoadState = PartUnloaded;
+}
+
+PartState Part::GetLoadState() const {
+	return LoadState;
 }
 
 void Part::SetGraphicsContext(GraphicsContext *gc) {
@@ -99,6 +228,7 @@ Scene *Part::GetScene() {
 DemoSystem::DemoSystem(GraphicsContext *gc) {
 	this->gc = gc;
 	state = DemoStateStopped;
+	PrefetchTime = 20000;
 }
 
 void DemoSystem::AddPart(Part *part) {
@@ -115,6 +245,14 @@ Part *DemoSystem::GetActivePart() {
 	return *active.begin();
 }
 
+void DemoSystem::SetPrefetchTime(dword msec) {
+	PrefetchTime = msec;
+}
+
+dword DemoSystem::GetPrefetchTime() const {
+	return PrefetchTime;
+}
+
 //// demo flow control ////
 
 // Run demo from the beggining
@@ -140,6 +278,15 @@ void DemoSystem::Stop() {
 	state = DemoStateStopped;
 }
 
+void DemoSystem::ShutDown() {
+	Stop();
+
+	std::list<Part*>::iterator iter = parts.begin();
+	while(iter != parts.end()) {
+		(*iter++)->Evict();
+	}
+}
+
 // Pause the demo (freeze the timers)
 void DemoSystem::Pause() {
 
@@ -174,10 +321,28 @@ void DemoSystem::Update() {
 
 	dword time = timer.GetMilliSec();
 
-	// Check if there are any inactive parts to launch
+	// textures loaded in the background go to the card here
+	gc->texman->UploadTextures();
+
+	// Stream in the parts coming up. Their loads run on threads of their own,
+	// the uploads happen here as soon as the loads are done, while earlier
+	// parts are still playing.
 	std::list<Part*>::iterator iter = inactive.begin();
+	while(iter != inactive.end()) {
+		Part *part = *iter++;
+		if(time + PrefetchTime >= part->GetStartTime()) {
+			part->Prefetch();
+			// not before the textures are in too, Activate would wait for them
+			// here; UploadTextures above keeps bringing them in until then
+			if(part->IsFetched()) part->Activate();
+		}
+	}
+
+	// Check if there are any inactive parts to launch
+	iter = inactive.begin();
 	while(iter != inactive.end()) {
 		if(time >= (*iter)->GetStartTime()) {
+			(*iter)->Activate();	// if it's not ready yet, there's nothing to do but wait
 			(*iter)->Launch();
 			active.push_back(*iter);
 			iter = inactive.erase(iter);
@@ -191,6 +356,7 @@ void DemoSystem::Update() {
 	while(iter != active.end()) {
 		if(time >= (*iter)->GetEndTime()) {
 			(*iter)->ShutDown();
+			(*iter)->Evict();
 			iter = active.erase(iter);
 		} else {
 			// run the part
@@ -2,8 +2,11 @@
 #define _DEMOSYS_H_
 
 #include <list>
+#include <vector>
+#include <string>
 #include "typedefs.h"
 #include "timing.h"
+#include "threads.h"
 
 #ifdef NUC3D_API_OPENGL
 #include "n3dgl/nuc3dhw.h"
@@ -13,6 +16,7 @@
 
 enum {TIMETYPE_ABSOLUTE, TIMETYPE_RELATIVE};
 enum RenderMode {RenderModeNormal, RenderModeTexture};
+enum PartState {PartUnloaded, PartLoading, PartLoaded, PartReady};
 
 // ----- Abstract Base Class Part -----
 class Part {
@@ -28,9 +32,49 @@ protected:
 
 	bool paused;
 
+	// loads the part's scenes in Load, leaving the textures and mesh buffers for Activate
+	SceneLoader::Context loader;
+	TextureGroup SceneTextures;		// requested once the scene is loaded
+
+	PartState LoadState;
+	Thread LoadThread;
+	volatile long LoadDone;
+
+	// what Release frees besides the scene
+	std::vector<std::string> TexNames;
+	std::vector<Object*> TakenObjects, OwnObjects;
+
+	static void LoadEntry(void *part);
+
+	// for Upload: a texture released with the part, an object taken out of
+	// the scene and one made by the part, both deleted with it
+	Texture *AddTexture(const char *fname);
+	Object *TakeObject(const char *name);
+	Object *KeepObject(Object *obj);
+
 public:
 
 	Part();
+	virtual ~Part();
+
+	// A part is built in two steps: Load runs on a worker thread and must not
+	// touch the device, then Upload runs on the main thread, once the scene's
+	// textures are in and its meshes have their buffers (the loader leaves
+	// both out on the worker, Activate makes them before Upload). Release
+	// frees it all again, the default frees the scene and what the helpers
+	// above kept. Derived destructors call Evict, before their members go.
+	virtual void Load();
+	virtual void Upload();
+	virtual void Release();
+
+	// lifecycle, driven by the DemoSystem from the timeline (or the startup loader)
+	void Prefetch();	// starts Load on a thread of its own
+	void Fetch();		// runs Load on the calling thread
+	void Activate();	// waits for the load if needed, then uploads
+	void Evict();		// main thread only
+	bool IsLoaded();	// checks if the prefetch is done (and collects it)
+	bool IsFetched();	// and the scene's textures are in, so Activate won't wait
+	PartState GetLoadState() const;
 
 	virtual void SetGraphicsContext(GraphicsContext *gc);
 	virtual GraphicsContext *GetGraphicsContext();
@@ -72,6 +116,8 @@ private:
 	Timer timer;	// global demo timer
 	DemoState state;
 
+	dword PrefetchTime;
+
 public:
 
 	DemoSystem(GraphicsContext *gc);
@@ -79,10 +125,18 @@ public:
 	void AddPart(Part *part);
 	Part *GetActivePart();
 
+	// parts start loading this long before they're due, and are released
+	// when they end, so only the ones playing or coming up are kept around
+	void SetPrefetchTime(dword msec);
+	dword GetPrefetchTime() const;
+
 	void Run();
 	void Pause();
 	void Resume();
 	void Stop();
+	// evicts every part, waiting for the loads still running, before what
+	// they load from goes away
+	void ShutDown();
 
 	void Update();
 
@@ -0,0 +1,123 @@
+#include <deque>
+#include "loadgraph.h"
+#include "threads.h"
+
+int LoadGraph::AddStage(LoadFunc func, void *data, LoadStageType type) {
+	Stage stage;
+	stage.func = func;
+	stage.data = data;
+	stage.type = type;
+	stage.DependencyCount = 0;
+
+	stages.push_back(stage);
+	return (int)stages.size() - 1;
+}
+
+void LoadGraph::AddDependency(int stage, int DependsOn) {
+	stages[DependsOn].dependents.push_back(stage);
+	stages[stage].DependencyCount++;
+}
+
+int LoadGraph::GetStageCount() const {
+	return (int)stages.size();
+}
+
+namespace {
+	// a worker thread running one stage at a time
+	struct WorkerSlot {
+		Thread thread;
+		LoadFunc func;
+		void *data;
+		int stage;			// -1 when idle
+		volatile long done;
+	};
+
+	void WorkerEntry(void *data) {
+		WorkerSlot *slot = (WorkerSlot*)data;
+		slot->func(slot->data);
+		AtomicIncrement(&slot->done);
+	}
+}
+
+bool LoadGraph::Run(LoadProgressFunc progress, void *ProgressData, int ThreadCount) {
+	int count = (int)stages.size();
+	if(ThreadCount <= 0) ThreadCount = GetProcessorCount();
+
+	std::vector<int> waiting(count);
+	std::deque<int> ReadyWorker, ReadyMain;
+	for(int i=0; i<count; i++) {
+		waiting[i] = stages[i].DependencyCount;
+		if(!waiting[i]) {
+			(stages[i].type == LoadStageMain ? ReadyMain : ReadyWorker).push_back(i);
+		}
+	}
+
+	WorkerSlot *slots = new WorkerSlot[ThreadCount];
+	for(int i=0; i<ThreadCount; i++) {
+		slots[i].stage = -1;
+	}
+
+	int finished = 0, running = 0;
+	bool ok = true;
+	while(finished < count) {
+		// keep the workers busy
+		for(int i=0; i<ThreadCount && !ReadyWorker.empty(); i++) {
+			if(slots[i].stage != -1) continue;
+
+			WorkerSlot *slot = slots + i;
+			slot->stage = ReadyWorker.front();
+			slot->func = stages[slot->stage].func;
+			slot->data = stages[slot->stage].data;
+			slot->done = 0;
+			if(slot->thread.Start(WorkerEntry, slot)) {
+				running++;
+			} else {
+				// no thread to be had, do it here
+				slot->func(slot->data);
+				slot->done = 1;
+			}
+			ReadyWorker.pop_front();
+		}
+
+		// collect what's done, then run one main stage
+		int stage = -1;
+		for(int i=0; i<ThreadCount; i++) {
+			if(slots[i].stage != -1 && slots[i].done) {
+				stage = slots[i].stage;
+				slots[i].stage = -1;
+				if(slots[i].thread.IsRunning()) {
+					slots[i].thread.Join();
+					running--;
+				}
+				break;
+			}
+		}
+		if(stage == -1 && !ReadyMain.empty()) {
+			stage = ReadyMain.front();
+			ReadyMain.pop_front();
+			stages[stage].func(stages[stage].data);
+		}
+
+		if(stage == -1) {
+			if(!running && ReadyWorker.empty()) {
+				ok = false;		// the rest depend on each other
+				break;
+			}
+			ThreadSleep(1);
+			continue;
+		}
+
+		const std::vector<int> &dep = stages[stage].dependents;
+		for(int i=0; i<(int)dep.size(); i++) {
+			if(!--waiting[dep[i]]) {
+				(stages[dep[i]].type == LoadStageMain ? ReadyMain : ReadyWorker).push_back(dep[i]);
+			}
+		}
+
+		finished++;
+		if(progress) progress((float)finished / (float)count, ProgressData);
+	}
+
+	delete [] slots;	// joins
+	return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef _LOADGRAPH_H_
+#define _LOADGRAPH_H_
+
+#include <vector>
+
+typedef void (*LoadFunc)(void *data);
+typedef void (*LoadProgressFunc)(float progress, void *data);
+
+// worker stages run on their own thread and must not touch the device,
+// main stages run on the thread that calls Run (the one owning the device)
+enum LoadStageType {LoadStageWorker, LoadStageMain};
+
+// ----- startup loading as a graph of stages -----
+// Each stage is started as soon as all the stages it depends on are done,
+// so independent loads overlap and the whole thing takes about as long as
+// the slowest chain instead of the sum of everything.
+class LoadGraph {
+private:
+	struct Stage {
+		LoadFunc func;
+		void *data;
+		LoadStageType type;
+		std::vector<int> dependents;
+		int DependencyCount;
+	};
+
+	std::vector<Stage> stages;
+
+public:
+
+	// returns the index of the stage, for AddDependency
+	int AddStage(LoadFunc func, void *data, LoadStageType type);
+	void AddDependency(int stage, int DependsOn);
+
+	int GetStageCount() const;
+
+	// Runs every stage, the worker ones on up to ThreadCount threads at once
+	// (0 for one per cpu). progress is called on the calling thread after each
+	// stage with the fraction done. Fails if the dependencies have a cycle.
+	bool Run(LoadProgressFunc progress = 0, void *ProgressData = 0, int ThreadCount = 0);
+};
+
+#endif	// _LOADGRAPH_H_
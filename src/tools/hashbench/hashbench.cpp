@@ -0,0 +1,103 @@
+// hashbench - StringMap against the old HashTable, on texture names
+// Fills both with names laid out like the demo's texture paths and times
+// lookups of every name (and of names that aren't there). HashTable gets the
+// hash TextureManager used to give it, the sum of the first three characters.
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "hashtable.h"
+#include "stringmap.h"
+
+using std::string;
+using std::vector;
+
+unsigned int OldHash(const string &key, unsigned long size) {
+	return ((unsigned int)key[0] + (unsigned int)key[1] + (unsigned int)key[2]) % size;
+}
+
+void MakeNames(int count, vector<string> *names, vector<string> *missing) {
+	const char *dirs[] = {"flame/flame", "credits/nuc", "credits/raw", "credits/am", "credits/amv", "Absence/ab", "Loading/loading", ""};
+	const int DirCount = sizeof dirs / sizeof *dirs;
+
+	char buf[256];
+	for(int i=0; i<count; i++) {
+		sprintf(buf, "data/textures/%s%02d.jpg", dirs[i % DirCount], i / DirCount);
+		names->push_back(buf);
+		sprintf(buf, "data/textures/%s%02d.png", dirs[i % DirCount], i / DirCount);
+		missing->push_back(buf);
+	}
+}
+
+// msec for rounds lookups of every name, the found count in *found
+template <class Lookup>
+double TimeLookups(Lookup &lookup, const vector<string> &names, int rounds, int *found) {
+	*found = 0;
+	clock_t start = clock();
+	for(int r=0; r<rounds; r++) {
+		for(size_t i=0; i<names.size(); i++) {
+			if(lookup(names[i])) (*found)++;
+		}
+	}
+	return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+struct HashTableLookup {
+	HashTable<string, int> *table;
+	bool operator ()(const string &name) {return table->Find(name) != 0;}
+};
+
+struct StringMapLookup {
+	StringMap<int> *map;
+	bool operator ()(const string &name) {return map->Find(name.c_str()) != 0;}
+};
+
+void Bench(int count, int rounds) {
+	vector<string> names, missing;
+	MakeNames(count, &names, &missing);
+
+	HashTable<string, int> table;
+	table.SetHashFunction(OldHash);
+	StringMap<int> map;
+	for(int i=0; i<count; i++) {
+		table.Insert(names[i], i);
+		map.Insert(names[i].c_str(), i);
+	}
+
+	HashTableLookup OldLookup = {&table};
+	StringMapLookup NewLookup = {&map};
+
+	int found[4];
+	double msec[4];
+	msec[0] = TimeLookups(OldLookup, names, rounds, found);
+	msec[1] = TimeLookups(NewLookup, names, rounds, found + 1);
+	msec[2] = TimeLookups(OldLookup, missing, rounds, found + 2);
+	msec[3] = TimeLookups(NewLookup, missing, rounds, found + 3);
+
+	if(found[0] != found[1] || found[2] != found[3]) {
+		printf("%6d names: the maps disagree!\n", count);
+		return;
+	}
+
+	double lookups = (double)count * rounds;
+	printf("%6d names  hit: %8.1f ns  %8.1f ns   miss: %8.1f ns  %8.1f ns\n", count,
+		msec[0] * 1e6 / lookups, msec[1] * 1e6 / lookups, msec[2] * 1e6 / lookups, msec[3] * 1e6 / lookups);
+}
+
+int main(int argc, char **argv) {
+	int lookups = argc > 1 ? atoi(argv[1]) : 2000000;
+	if(lookups < 1) {
+		printf("usage: hashbench [lookups per test]\n");
+		return 1;
+	}
+
+	printf("per lookup         HashTable  StringMap         HashTable  StringMap\n");
+	int counts[] = {16, 64, 256, 1024, 4096};
+	for(int i=0; i<(int)(sizeof counts / sizeof *counts); i++) {
+		int rounds = lookups / counts[i];
+		Bench(counts[i], rounds > 1 ? rounds : 1);
+	}
+	return 0;
+}
@@ -0,0 +1,514 @@
+// n3scook - offline asset cooker
+// Turns .3ds scenes into optimized compiled scenes (.n3s) and packs them,
+// together with their textures and any other files given, in the order they
+// are listed on the command line (which should be the order the demo loads
+// them in).
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "scene3ds.h"
+#include "meshopt.h"
+#include "packfile.h"
+#include "threads.h"
+#include "n3dmath.h"
+
+using std::string;
+using std::vector;
+using namespace n3sfile;
+
+struct CookOptions {
+	string PackName;
+	string TexPath;
+	int threads;
+	bool loose;
+	bool compress;
+	bool optimize;
+};
+
+struct CookStats {
+	dword VertsIn, VertsOut, tris;
+	float AcmrIn, AcmrOut;
+};
+
+struct Asset {
+	string fname;
+	bool scene;
+	bool ok;
+	string error;
+	vector<byte> n3s;
+	vector<string> textures;
+	CookStats stats;
+	dword SourceSize, SourceTime;
+};
+
+static CookOptions opt;
+
+static bool IsScene(const string &fname) {
+	if(fname.size() < 4) return false;
+	string ext = packfile::NormalizeName(fname.substr(fname.size() - 4).c_str());
+	return ext == ".3ds";
+}
+
+static bool GetFileStamp(const char *fname, dword *size, dword *time) {
+	struct stat st;
+	if(stat(fname, &st) == -1) return false;
+
+	*size = (dword)st.st_size;
+	*time = (dword)st.st_mtime;
+	return true;
+}
+
+/////////////// geometry processing ///////////////
+
+// Snapping positions to a 16bit grid over the object's bounding box and
+// texture coordinates to 1/8192 lets vertices that only differ by export
+// noise weld, and makes the vertex data compress a lot better.
+static void QuantizeVertices(vector<VertexRec> &verts) {
+	if(verts.empty()) return;
+
+	float vmin[3], vmax[3];
+	for(int j=0; j<3; j++) vmin[j] = vmax[j] = verts[0].pos[j];
+	for(size_t i=1; i<verts.size(); i++) {
+		for(int j=0; j<3; j++) {
+			if(verts[i].pos[j] < vmin[j]) vmin[j] = verts[i].pos[j];
+			if(verts[i].pos[j] > vmax[j]) vmax[j] = verts[i].pos[j];
+		}
+	}
+
+	for(size_t i=0; i<verts.size(); i++) {
+		VertexRec &v = verts[i];
+		for(int j=0; j<3; j++) {
+			float step = (vmax[j] - vmin[j]) / 65535.0f;
+			if(step > 0.0f) v.pos[j] = vmin[j] + (float)floor((v.pos[j] - vmin[j]) / step + 0.5f) * step;
+		}
+		for(int t=0; t<4; t++) {
+			v.tex[t][0] = (float)floor(v.tex[t][0] * 8192.0f + 0.5f) / 8192.0f;
+			v.tex[t][1] = (float)floor(v.tex[t][1] * 8192.0f + 0.5f) / 8192.0f;
+		}
+	}
+}
+
+// welds identical vertices, SplitHardEdges takes apart the ones it shouldn't have
+static void Weld(CookObject &obj) {
+	dword count = (dword)obj.verts.size();
+	vector<dword> remap(count);
+	dword unique = WeldVertices(&obj.verts[0], count, sizeof(VertexRec), &remap[0]);
+	RemapVertices(&obj.verts[0], count, sizeof(VertexRec), &remap[0]);
+	RemapIndices(&obj.indices[0], (dword)obj.indices.size(), &remap[0]);
+	obj.verts.resize(unique);
+}
+
+// splits the vertices where the faces using them have no smoothing group in
+// common, so the normals stay sharp there, like the engine's .3ds loader does
+static void SplitHardEdges(CookObject &obj) {
+	dword TriCount = (dword)obj.indices.size() / 3;
+	vector<dword> sources(TriCount * 3);
+	dword count = SplitBySmoothingGroups(&obj.indices[0], TriCount, (dword)obj.verts.size(), &obj.SmoothingGroups[0], &sources[0]);
+
+	vector<VertexRec> verts(count);
+	for(dword i=0; i<count; i++) verts[i] = obj.verts[sources[i]];
+	obj.verts.swap(verts);
+}
+
+// same as TriMesh::CalculateNormals, triangle normals are left unnormalized so
+// big triangles weigh more on the vertex normals
+static void CalculateNormals(vector<TriangleRec> &tris, vector<VertexRec> &verts) {
+	vector<Vector3> sums(verts.size(), Vector3(0.0f, 0.0f, 0.0f));
+
+	for(size_t i=0; i<tris.size(); i++) {
+		TriangleRec &tri = tris[i];
+		const float *p0 = verts[tri.vertices[0]].pos;
+		const float *p1 = verts[tri.vertices[1]].pos;
+		const float *p2 = verts[tri.vertices[2]].pos;
+
+		Vector3 v1 = Vector3(p1[0], p1[1], p1[2]) - Vector3(p0[0], p0[1], p0[2]);
+		Vector3 v2 = Vector3(p2[0], p2[1], p2[2]) - Vector3(p0[0], p0[1], p0[2]);
+		Vector3 normal = v1.CrossProduct(v2);
+		tri.normal[0] = normal.x;
+		tri.normal[1] = normal.y;
+		tri.normal[2] = normal.z;
+
+		for(int j=0; j<3; j++) sums[tri.vertices[j]] += normal;
+	}
+
+	for(size_t i=0; i<verts.size(); i++) {
+		Vector3 n = sums[i];
+		if(n.Length() > 0.0f) n.Normalize();
+		verts[i].normal[0] = (float)floor(n.x * 32767.0f + 0.5f) / 32767.0f;
+		verts[i].normal[1] = (float)floor(n.y * 32767.0f + 0.5f) / 32767.0f;
+		verts[i].normal[2] = (float)floor(n.z * 32767.0f + 0.5f) / 32767.0f;
+	}
+}
+
+static bool ProcessObject(CookObject &obj, vector<TriangleRec> &tris, CookStats *stats, string *error) {
+	dword TriCount = (dword)obj.indices.size() / 3;
+	stats->VertsIn += (dword)obj.verts.size();
+	stats->tris += TriCount;
+
+	if(!obj.verts.empty() && TriCount) {
+		if(opt.optimize) {
+			QuantizeVertices(obj.verts);
+			Weld(obj);
+		}
+		SplitHardEdges(obj);
+
+		stats->AcmrIn += CalcACMR(&obj.indices[0], TriCount) * TriCount;
+
+		if(opt.optimize) {
+			dword count = (dword)obj.verts.size();
+			vector<dword> order(TriCount);
+			OptimizeVertexCache(&obj.indices[0], TriCount, count, &order[0]);
+
+			// the smoothing groups go along with their triangles
+			vector<dword> groups(TriCount);
+			for(dword i=0; i<TriCount; i++) groups[i] = obj.SmoothingGroups[order[i]];
+			obj.SmoothingGroups.swap(groups);
+
+			vector<dword> remap(count);
+			dword used = ReorderVerticesByFirstUse(&obj.indices[0], TriCount * 3, count, &remap[0]);
+			RemapVertices(&obj.verts[0], count, sizeof(VertexRec), &remap[0]);
+			RemapIndices(&obj.indices[0], TriCount * 3, &remap[0]);
+			obj.verts.resize(used);
+		}
+
+		stats->AcmrOut += CalcACMR(&obj.indices[0], TriCount) * TriCount;
+	}
+	stats->VertsOut += (dword)obj.verts.size();
+
+	tris.resize(TriCount);
+	for(dword i=0; i<TriCount; i++) {
+		TriangleRec &tri = tris[i];
+		memset(&tri, 0, sizeof tri);
+		for(int j=0; j<3; j++) tri.vertices[j] = obj.indices[i * 3 + j];
+		tri.SmoothingGroup = obj.SmoothingGroups[i];
+	}
+
+	CalculateNormals(tris, obj.verts);
+	return true;
+}
+
+/////////////// compiled scene writing ///////////////
+
+// appends data to the file buffer aligned to 8 bytes, returns its offset
+static dword Append(vector<byte> &buf, const void *data, dword size) {
+	dword offset = ((dword)buf.size() + 7) & ~7;
+	buf.resize(offset + size, 0);
+	if(size) memcpy(&buf[offset], data, size);
+	return offset;
+}
+
+static dword AppendString(vector<byte> &buf, const string &str) {
+	return Append(buf, str.c_str(), (dword)str.size() + 1);
+}
+
+template <class T>
+static void SetRef(Ref<T> &ref, dword offset) {
+	ref.offset = offset;
+}
+
+static void PackMaterial(vector<byte> &buf, const CookMaterial &mat, MaterialRec *rec) {
+	SetRef(rec->name, AppendString(buf, mat.name));
+	for(int i=0; i<MapCount; i++) {
+		if(!mat.maps[i].empty()) SetRef(rec->maps[i], AppendString(buf, mat.maps[i]));
+	}
+	memcpy(rec->ambient, mat.ambient, sizeof rec->ambient);
+	memcpy(rec->diffuse, mat.diffuse, sizeof rec->diffuse);
+	memcpy(rec->specular, mat.specular, sizeof rec->specular);
+	memcpy(rec->emissive, mat.emissive, sizeof rec->emissive);
+	rec->power = mat.power;
+	rec->alpha = mat.alpha;
+	rec->EnvBlend = mat.EnvBlend;
+	rec->BumpIntensity = mat.BumpIntensity;
+	rec->SpecularEnable = mat.SpecularEnable;
+
+	// the alpha channel of the texture is only known once it's loaded
+	rec->HasTransparentTex = mat.maps[0].empty() ? 0 : TransparencyUnknown;
+}
+
+static bool CookScene3DS(Asset &asset) {
+	CookScene scene;
+	if(!Load3DS(asset.fname.c_str(), &scene)) {
+		asset.error = "can't read " + asset.fname;
+		return false;
+	}
+
+	vector<byte> buf(sizeof(Header), 0);
+	vector<ObjectRec> opaque, transparent;
+
+	for(size_t i=0; i<scene.objects.size(); i++) {
+		CookObject &obj = scene.objects[i];
+
+		vector<TriangleRec> tris;
+		if(!ProcessObject(obj, tris, &asset.stats, &asset.error)) return false;
+
+		ObjectRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, obj.name));
+		rec.VertexCount = (dword)obj.verts.size();
+		rec.TriCount = (dword)tris.size();
+		if(rec.VertexCount) SetRef(rec.varray, Append(buf, &obj.verts[0], rec.VertexCount * sizeof(VertexRec)));
+		if(rec.TriCount) SetRef(rec.tarray, Append(buf, &tris[0], rec.TriCount * sizeof(TriangleRec)));
+		CalcBounds(rec.VertexCount ? &obj.verts[0] : 0, rec.VertexCount, &rec);
+		memcpy(rec.RotMat, obj.RotMat, sizeof rec.RotMat);
+		memcpy(rec.TransMat, obj.TransMat, sizeof rec.TransMat);
+
+		const CookMaterial *mat = scene.FindMaterial(obj.MatName);
+		PackMaterial(buf, mat && !obj.MatName.empty() ? *mat : CookMaterial(), &rec.material);
+		for(int j=0; j<MapCount; j++) {
+			if(mat && !obj.MatName.empty() && !mat->maps[j].empty()) asset.textures.push_back(mat->maps[j]);
+		}
+
+		if(rec.material.alpha < 1.0f) {
+			transparent.push_back(rec);
+		} else {
+			opaque.push_back(rec);
+		}
+	}
+
+	// same order Scene::AddObject leaves them in when loading the 3ds
+	vector<ObjectRec> ObjRecs(opaque.rbegin(), opaque.rend());
+	ObjRecs.insert(ObjRecs.end(), transparent.begin(), transparent.end());
+
+	vector<LightRec> LightRecs;
+	for(size_t i=0; i<scene.lights.size() && LightRecs.size() < 8; i++) {
+		const CookLight &lt = scene.lights[i];
+
+		LightRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, lt.name));
+		rec.type = lt.spot ? LTYPE_TARGETSPOT : LTYPE_POINT;
+		memcpy(rec.pos, lt.pos, sizeof rec.pos);
+		memcpy(rec.target, lt.target, sizeof rec.target);
+		memcpy(rec.color, lt.color, sizeof rec.color);
+		rec.intensity = lt.intensity;
+		rec.InnerCone = lt.InnerCone;
+		rec.OuterCone = lt.OuterCone;
+		rec.CastShadows = lt.CastShadows;
+		LightRecs.push_back(rec);
+	}
+
+	vector<CameraRec> CamRecs;
+	for(size_t i=0; i<scene.cameras.size(); i++) {
+		const CookCamera &cam = scene.cameras[i];
+
+		CameraRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, cam.name));
+		memcpy(rec.pos, cam.pos, sizeof rec.pos);
+		memcpy(rec.target, cam.target, sizeof rec.target);
+		memcpy(rec.up, cam.up, sizeof rec.up);
+		rec.fov = cam.fov;
+		CamRecs.push_back(rec);
+	}
+
+	vector<CurveRec> CurveRecs;
+	for(size_t i=0; i<scene.curves.size(); i++) {
+		const CookCurve &crv = scene.curves[i];
+
+		CurveRec rec;
+		memset(&rec, 0, sizeof rec);
+		SetRef(rec.name, AppendString(buf, crv.name));
+		rec.PointCount = (dword)crv.points.size() / 3;
+		if(rec.PointCount) SetRef(rec.points, Append(buf, &crv.points[0], (dword)crv.points.size() * sizeof(float)));
+		CurveRecs.push_back(rec);
+	}
+
+	Header hdr;
+	memset(&hdr, 0, sizeof hdr);
+	hdr.magic = Magic;
+	hdr.version = Version;
+	hdr.VertexSize = sizeof(VertexRec);
+	hdr.TriangleSize = sizeof(TriangleRec);
+	hdr.SourceSize = asset.SourceSize;
+	hdr.SourceTime = asset.SourceTime;
+	memcpy(hdr.ambient, scene.ambient, sizeof hdr.ambient);
+
+	hdr.ObjectCount = (dword)ObjRecs.size();
+	hdr.LightCount = (dword)LightRecs.size();
+	hdr.CameraCount = (dword)CamRecs.size();
+	hdr.CurveCount = (dword)CurveRecs.size();
+	if(hdr.ObjectCount) SetRef(hdr.objects, Append(buf, &ObjRecs[0], hdr.ObjectCount * sizeof(ObjectRec)));
+	if(hdr.LightCount) SetRef(hdr.lights, Append(buf, &LightRecs[0], hdr.LightCount * sizeof(LightRec)));
+	if(hdr.CameraCount) SetRef(hdr.cameras, Append(buf, &CamRecs[0], hdr.CameraCount * sizeof(CameraRec)));
+	if(hdr.CurveCount) SetRef(hdr.curves, Append(buf, &CurveRecs[0], hdr.CurveCount * sizeof(CurveRec)));
+
+	hdr.FileSize = (dword)buf.size();
+	memcpy(&buf[0], &hdr, sizeof hdr);
+
+	asset.n3s.swap(buf);
+	return true;
+}
+
+static void CookAsset(int index, void *data) {
+	Asset &asset = (*(vector<Asset>*)data)[index];
+	memset(&asset.stats, 0, sizeof asset.stats);
+	asset.SourceSize = asset.SourceTime = 0;
+
+	if(!GetFileStamp(asset.fname.c_str(), &asset.SourceSize, &asset.SourceTime)) {
+		asset.error = "can't find " + asset.fname;
+		asset.ok = false;
+		return;
+	}
+	asset.ok = asset.scene ? CookScene3DS(asset) : true;
+}
+
+/////////////// output ///////////////
+
+static bool WriteFile(const string &fname, const vector<byte> &data) {
+	FILE *fp = fopen(fname.c_str(), "wb");
+	if(!fp) return false;
+	bool ok = data.empty() || fwrite(&data[0], 1, data.size(), fp) == data.size();
+	fclose(fp);
+	return ok;
+}
+
+static bool WritePack(const vector<Asset> &assets) {
+	PackWriter pack;
+	if(!pack.Open(opt.PackName.c_str(), opt.compress)) {
+		fprintf(stderr, "can't create %s\n", opt.PackName.c_str());
+		return false;
+	}
+
+	bool ok = true;
+	for(size_t i=0; i<assets.size() && ok; i++) {
+		const Asset &asset = assets[i];
+		if(!asset.scene) {
+			if(!pack.Contains(asset.fname.c_str())) ok = pack.AddFile(asset.fname.c_str(), asset.fname.c_str());
+			continue;
+		}
+
+		string name = asset.fname + ".n3s";
+		ok = pack.Add(name.c_str(), &asset.n3s[0], (dword)asset.n3s.size());
+
+		// textures right after the scene that uses them
+		for(size_t j=0; j<asset.textures.size() && ok; j++) {
+			string tex = opt.TexPath + asset.textures[j];
+			if(pack.Contains(tex.c_str())) continue;
+			if(!pack.AddFile(tex.c_str(), tex.c_str())) {
+				fprintf(stderr, "warning: can't read texture %s\n", tex.c_str());
+			}
+		}
+	}
+
+	ok = pack.Close() && ok;
+	if(!ok) fprintf(stderr, "error writing %s\n", opt.PackName.c_str());
+	return ok;
+}
+
+static void PrintStats(const vector<Asset> &assets) {
+	for(size_t i=0; i<assets.size(); i++) {
+		const Asset &asset = assets[i];
+		if(!asset.scene) continue;
+
+		const CookStats &st = asset.stats;
+		float tris = st.tris ? (float)st.tris : 1.0f;
+		printf("%s: %u tris, %u -> %u verts, ACMR %.3f -> %.3f, %u bytes\n", asset.fname.c_str(),
+			(unsigned int)st.tris, (unsigned int)st.VertsIn, (unsigned int)st.VertsOut,
+			st.AcmrIn / tris, st.AcmrOut / tris, (unsigned int)asset.n3s.size());
+	}
+}
+
+static void ReadList(const char *fname, vector<string> &files) {
+	FILE *fp = fopen(fname, "r");
+	if(!fp) {
+		fprintf(stderr, "can't open list file %s\n", fname);
+		return;
+	}
+
+	char line[512];
+	while(fgets(line, sizeof line, fp)) {
+		string str = line;
+		while(!str.empty() && (unsigned char)str[str.size() - 1] <= ' ') str.erase(str.size() - 1);
+		if(!str.empty() && str[0] != '#') files.push_back(str);
+	}
+	fclose(fp);
+}
+
+static void Usage() {
+	printf("usage: n3scook [options] files...\n");
+	printf("  -o <pack>     output pack file (default data.pak)\n");
+	printf("  -t <path>     where the scene textures are (default data/textures/)\n");
+	printf("  -l <list>     read the file list from a text file, one per line\n");
+	printf("  -j <threads>  number of worker threads (default one per cpu)\n");
+	printf("  -loose        also write <scene>.3ds.n3s next to each scene\n");
+	printf("  -noopt        don't weld, quantize or reorder the geometry\n");
+	printf("  -store        don't compress the pack\n");
+	printf("files are packed in the order given, which should be the order they are loaded in\n");
+}
+
+int main(int argc, char **argv) {
+	opt.PackName = "data.pak";
+	opt.TexPath = "data/textures/";
+	opt.threads = 0;
+	opt.loose = false;
+	opt.compress = true;
+	opt.optimize = true;
+
+	vector<string> files;
+	for(int i=1; i<argc; i++) {
+		if(!strcmp(argv[i], "-o") && i + 1 < argc) {
+			opt.PackName = argv[++i];
+		} else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+			opt.TexPath = argv[++i];
+		} else if(!strcmp(argv[i], "-l") && i + 1 < argc) {
+			ReadList(argv[++i], files);
+		} else if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+			opt.threads = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-loose")) {
+			opt.loose = true;
+		} else if(!strcmp(argv[i], "-noopt")) {
+			opt.optimize = false;
+		} else if(!strcmp(argv[i], "-store")) {
+			opt.compress = false;
+		} else if(argv[i][0] == '-') {
+			Usage();
+			return 1;
+		} else {
+			files.push_back(argv[i]);
+		}
+	}
+
+	if(files.empty()) {
+		Usage();
+		return 1;
+	}
+
+	vector<Asset> assets(files.size());
+	for(size_t i=0; i<files.size(); i++) {
+		assets[i].fname = files[i];
+		assets[i].scene = IsScene(files[i]);
+		assets[i].ok = false;
+	}
+
+	ParallelFor((int)assets.size(), CookAsset, &assets, opt.threads);
+
+	bool ok = true;
+	for(size_t i=0; i<assets.size(); i++) {
+		if(!assets[i].ok) {
+			fprintf(stderr, "%s\n", assets[i].error.c_str());
+			ok = false;
+		}
+	}
+	if(!ok) return 1;
+
+	PrintStats(assets);
+
+	if(opt.loose) {
+		for(size_t i=0; i<assets.size(); i++) {
+			if(!assets[i].scene) continue;
+			string name = assets[i].fname + ".n3s";
+			if(!WriteFile(name, assets[i].n3s)) {
+				fprintf(stderr, "can't write %s\n", name.c_str());
+				ok = false;
+			}
+		}
+	}
+
+	return WritePack(assets) && ok ? 0 : 1;
+}
@@ -0,0 +1,511 @@
+#include <cstring>
+#include <string>
+#include "scene3ds.h"
+#include "mappedfile.h"
+#include "n3dmath.h"
+#include "3deng_dx8/3dschunks.h"
+
+using std::string;
+using namespace n3sfile;
+
+// texture slots, same numbering as the engine's TextureType
+enum {
+	MapTexture, MapDetail, MapOpacity, MapLight, MapBump, MapEnvironment, MapSpecular
+};
+
+const dword HeaderSize = 6;
+
+// a cursor over the mapped file, reads past the end just set the error flag
+struct Reader {
+	const byte *ptr, *end;
+	bool error;
+};
+
+struct Chunk {
+	word id;
+	const byte *end;
+};
+
+static void ReadBytes(Reader &rd, void *dest, dword bytes) {
+	if((dword)(rd.end - rd.ptr) < bytes) {
+		memset(dest, 0, bytes);
+		rd.ptr = rd.end;
+		rd.error = true;
+		return;
+	}
+	memcpy(dest, rd.ptr, bytes);
+	rd.ptr += bytes;
+}
+
+static word ReadWord(Reader &rd) {
+	word val;
+	ReadBytes(rd, &val, sizeof val);
+	return val;
+}
+
+static dword ReadDword(Reader &rd) {
+	dword val;
+	ReadBytes(rd, &val, sizeof val);
+	return val;
+}
+
+static float ReadFloat(Reader &rd) {
+	float val;
+	ReadBytes(rd, &val, sizeof val);
+	return val;
+}
+
+static Vector3 ReadVector(Reader &rd) {
+	Vector3 vec;
+	vec.x = ReadFloat(rd);
+	vec.z = ReadFloat(rd);	// flip YZ
+	vec.y = ReadFloat(rd);
+	return vec;
+}
+
+static string ReadString(Reader &rd) {
+	const byte *start = rd.ptr;
+	while(rd.ptr < rd.end && *rd.ptr) rd.ptr++;
+
+	string str((const char*)start, rd.ptr - start);
+	if(rd.ptr < rd.end) {
+		rd.ptr++;
+	} else {
+		rd.error = true;
+	}
+	return str;
+}
+
+static Chunk ReadChunk(Reader &rd, const byte *parent) {
+	Chunk ch;
+	const byte *start = rd.ptr;
+	ch.id = ReadWord(rd);
+	dword size = ReadDword(rd);
+	if(rd.error || size < HeaderSize || (dword)(parent - start) < size) {
+		rd.error = true;
+		ch.end = parent;
+	} else {
+		ch.end = start + size;
+	}
+	return ch;
+}
+
+static void SkipTo(Reader &rd, const byte *pos) {
+	rd.ptr = pos;
+}
+
+static void ReadColor(Reader &rd, float *col) {
+	Chunk ch = ReadChunk(rd, rd.end);
+	col[0] = col[1] = col[2] = col[3] = 1.0f;
+
+	if(ch.id == Chunk_Color_Byte3 || ch.id == Chunk_Color_GammaByte3) {
+		byte rgb[3];
+		ReadBytes(rd, rgb, 3);
+		for(int i=0; i<3; i++) col[i] = rgb[i] / 255.0f;
+	} else if(ch.id == Chunk_Color_Float3 || ch.id == Chunk_Color_GammaFloat3) {
+		for(int i=0; i<3; i++) col[i] = ReadFloat(rd);
+	} else {
+		col[0] = col[1] = col[2] = -1.0f;	// what the scene loader does
+	}
+	SkipTo(rd, ch.end);
+}
+
+// returns the percentage as 0 - 1, and optionally as 0 - 100 like the scene loader
+static float ReadPercent(Reader &rd, int *IntPercent = 0) {
+	Chunk ch = ReadChunk(rd, rd.end);
+	float p = 0.0f;
+	int ip = 0;
+	if(ch.id == Chunk_PercentInt) {
+		ip = ReadWord(rd);
+		p = (float)ip / 100.0f;
+	} else if(ch.id == Chunk_PercentFloat) {
+		p = ReadFloat(rd);
+		ip = (int)(p * 100.0f);
+	}
+	SkipTo(rd, ch.end);
+	if(IntPercent) *IntPercent = ip;
+	return p;
+}
+
+static float Clamp(float x) {
+	return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+static void PackMatrix(float *dest, const Matrix4x4 &mat) {
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			*dest++ = mat.m[i][j];
+		}
+	}
+}
+
+
+CookMaterial::CookMaterial() {
+	for(int i=0; i<4; i++) {
+		ambient[i] = diffuse[i] = 1.0f;
+		specular[i] = i < 3 ? 1.0f : 0.0f;
+		emissive[i] = 0.0f;
+	}
+	power = 0.0f;
+	alpha = 1.0f;
+	EnvBlend = 1.0f;
+	BumpIntensity = 0.0f;
+	SpecularEnable = false;
+}
+
+const CookMaterial *CookScene::FindMaterial(const string &name) const {
+	for(size_t i=0; i<materials.size(); i++) {
+		if(materials[i].name == name) return &materials[i];
+	}
+	return 0;
+}
+
+
+static float ReadTextureMap(Reader &rd, const Chunk &ch, string *fname) {
+	float intensity = 0.0f;
+	while(!rd.error && rd.ptr < ch.end) {
+		const byte *start = rd.ptr;
+		Chunk sub = ReadChunk(rd, ch.end);
+		switch(sub.id) {
+		case Chunk_PercentInt:
+		case Chunk_PercentFloat:
+			rd.ptr = start;
+			intensity = ReadPercent(rd);
+			break;
+
+		case Chunk_Map_FileName:
+			*fname = ReadString(rd);
+			break;
+		}
+		SkipTo(rd, sub.end);
+	}
+	return intensity;
+}
+
+static void ReadMaterial(Reader &rd, const Chunk &ch, CookMaterial *mat) {
+	while(!rd.error && rd.ptr < ch.end) {
+		Chunk sub = ReadChunk(rd, ch.end);
+		float p;
+		int ip;
+
+		switch(sub.id) {
+		case Chunk_Mat_Name:
+			mat->name = ReadString(rd);
+			break;
+
+		case Chunk_Mat_AmbientColor:
+			ReadColor(rd, mat->ambient);
+			break;
+
+		case Chunk_Mat_DiffuseColor:
+			ReadColor(rd, mat->diffuse);
+			break;
+
+		case Chunk_Mat_SpecularColor:
+			ReadColor(rd, mat->specular);
+			break;
+
+		case Chunk_Mat_Specular:
+			ReadPercent(rd, &ip);
+			mat->power = (float)ip;
+			if(mat->power > 0.0f) mat->SpecularEnable = true;
+			break;
+
+		case Chunk_Mat_SpecularIntensity:
+			p = ReadPercent(rd);
+			for(int i=0; i<3; i++) mat->specular[i] *= p;
+			break;
+
+		case Chunk_Mat_Transparency:
+			mat->alpha = 1.0f - ReadPercent(rd);
+			break;
+
+		case Chunk_Mat_SelfIllumination:
+			p = Clamp(ReadPercent(rd));
+			mat->emissive[0] = mat->emissive[1] = mat->emissive[2] = p;
+			mat->emissive[3] = 1.0f;
+			break;
+
+		case Chunk_Mat_TextureMap:
+			ReadTextureMap(rd, sub, &mat->maps[MapTexture]);
+			break;
+
+		case Chunk_Mat_TextureMap2:
+			ReadTextureMap(rd, sub, &mat->maps[MapDetail]);
+			break;
+
+		case Chunk_Mat_OpacityMap:
+			ReadTextureMap(rd, sub, &mat->maps[MapOpacity]);
+			break;
+
+		case Chunk_Mat_SelfIlluminationMap:
+			ReadTextureMap(rd, sub, &mat->maps[MapLight]);
+			break;
+
+		case Chunk_Mat_ReflectionMap:
+			mat->EnvBlend = ReadTextureMap(rd, sub, &mat->maps[MapEnvironment]);
+			break;
+
+		case Chunk_Mat_BumpMap:
+			mat->BumpIntensity = ReadTextureMap(rd, sub, &mat->maps[MapBump]);
+			break;
+		}
+		SkipTo(rd, sub.end);
+	}
+}
+
+static void ReadTriMesh(Reader &rd, const byte *end, const string &name, CookScene *scene) {
+	CookObject obj;
+	obj.name = name;
+
+	Base base;
+	Vector3 translation;
+	bool curve = true;
+
+	while(!rd.error && rd.ptr < end) {
+		Chunk ch = ReadChunk(rd, end);
+
+		switch(ch.id) {
+		case Chunk_TriMesh_VertexList:
+			{
+				dword count = ReadWord(rd);
+				VertexRec zero;
+				memset(&zero, 0, sizeof zero);
+				zero.color = 0x00ffffff;
+				obj.verts.assign(count, zero);
+				for(dword i=0; i<count; i++) {
+					Vector3 pos = ReadVector(rd);
+					obj.verts[i].pos[0] = pos.x;
+					obj.verts[i].pos[1] = pos.y;
+					obj.verts[i].pos[2] = pos.z;
+				}
+			}
+			break;
+
+		case Chunk_TriMesh_FaceDesc:
+			{
+				curve = false;
+				dword count = ReadWord(rd);
+				obj.indices.resize(count * 3);
+				obj.SmoothingGroups.assign(count, 1);	// all smooth, unless the file says otherwise
+				for(dword i=0; i<count; i++) {
+					obj.indices[i * 3] = ReadWord(rd);
+					obj.indices[i * 3 + 2] = ReadWord(rd);	// flip order to CW
+					obj.indices[i * 3 + 1] = ReadWord(rd);
+					ReadWord(rd);
+				}
+			}
+			continue;	// face material and smoothing chunks are nested in here
+
+		case Chunk_Face_Material:
+			obj.MatName = ReadString(rd);
+			break;
+
+		case Chunk_TriMesh_TexCoords:
+			{
+				dword count = ReadWord(rd);
+				for(dword i=0; i<count; i++) {
+					float u = ReadFloat(rd);
+					float v = -ReadFloat(rd);
+					if(i >= obj.verts.size()) continue;
+					obj.verts[i].tex[0][0] = obj.verts[i].tex[1][0] = u;
+					obj.verts[i].tex[0][1] = obj.verts[i].tex[1][1] = v;
+				}
+			}
+			break;
+
+		case Chunk_TriMesh_SmoothingGroup:
+			for(size_t i=0; i<obj.SmoothingGroups.size(); i++) {
+				obj.SmoothingGroups[i] = ReadDword(rd);
+			}
+			break;
+
+		case Chunk_TriMesh_WorldTransform:
+			base.i = ReadVector(rd);
+			base.k = ReadVector(rd);	// flip
+			base.j = ReadVector(rd);
+			translation = ReadVector(rd);
+			break;
+		}
+		SkipTo(rd, ch.end);
+	}
+
+	if(curve) {
+		CookCurve crv;
+		crv.name = name;
+		for(size_t i=0; i<obj.verts.size(); i++) {
+			crv.points.insert(crv.points.end(), obj.verts[i].pos, obj.verts[i].pos + 3);
+		}
+		scene->curves.push_back(crv);
+		return;
+	}
+
+	for(size_t i=0; i<obj.indices.size(); i++) {
+		if(obj.indices[i] >= obj.verts.size()) {
+			rd.error = true;
+			return;
+		}
+	}
+
+	base.i.Normalize();
+	base.j.Normalize();
+	base.k.Normalize();
+	Matrix3x3 RotXForm = base.CreateRotationMatrix();
+	RotXForm.OrthoNormalize();
+	Matrix3x3 InvRot = RotXForm.Transposed();
+
+	for(size_t i=0; i<obj.verts.size(); i++) {
+		float *p = obj.verts[i].pos;
+		Vector3 pos(p[0], p[1], p[2]);
+		pos.Translate(-translation.x, -translation.y, -translation.z);
+		pos.Transform(InvRot);
+		p[0] = pos.x;
+		p[1] = pos.y;
+		p[2] = pos.z;
+	}
+
+	Matrix4x4 TransMat;
+	TransMat.SetTranslation(translation.x, translation.y, translation.z);
+	PackMatrix(obj.RotMat, Matrix4x4(RotXForm));
+	PackMatrix(obj.TransMat, TransMat);
+
+	scene->objects.push_back(obj);
+}
+
+static void ReadLight(Reader &rd, const byte *end, const string &name, CookScene *scene) {
+	CookLight lt;
+	memset(lt.pos, 0, sizeof lt.pos);
+	memset(lt.target, 0, sizeof lt.target);
+	lt.name = name;
+	lt.spot = false;
+	lt.intensity = 1.0f;
+	lt.InnerCone = lt.OuterCone = 0.0f;
+	lt.CastShadows = false;
+
+	Vector3 pos = ReadVector(rd);
+	lt.pos[0] = pos.x;
+	lt.pos[1] = pos.y;
+	lt.pos[2] = pos.z;
+	ReadColor(rd, lt.color);
+	for(int i=0; i<4; i++) lt.color[i] = Clamp(lt.color[i]);
+
+	while(!rd.error && rd.ptr < end) {
+		Chunk ch = ReadChunk(rd, end);
+
+		switch(ch.id) {
+		case Chunk_Light_SpotLight:
+			{
+				lt.spot = true;
+				Vector3 targ = ReadVector(rd);
+				lt.target[0] = targ.x;
+				lt.target[1] = targ.y;
+				lt.target[2] = targ.z;
+				lt.InnerCone = ReadFloat(rd) / 180.0f;
+				lt.OuterCone = ReadFloat(rd) / 180.0f;
+			}
+			continue;	// spot settings are nested in here
+
+		case Chunk_Light_Intensity:
+			lt.intensity = ReadFloat(rd);
+			break;
+
+		case Chunk_Spot_CastShadows:
+			lt.CastShadows = true;
+			break;
+		}
+		SkipTo(rd, ch.end);
+	}
+
+	scene->lights.push_back(lt);
+}
+
+static void ReadCamera(Reader &rd, const string &name, CookScene *scene) {
+	Vector3 pos = ReadVector(rd);
+	Vector3 targ = ReadVector(rd);
+	float roll = ReadFloat(rd);
+	float fov = ReadFloat(rd);
+
+	Vector3 up = VECTOR3_J;
+	Vector3 view = targ - pos;
+	up.Rotate(view.Normalized(), roll);
+
+	CookCamera cam;
+	cam.name = name;
+	cam.pos[0] = pos.x;
+	cam.pos[1] = pos.y;
+	cam.pos[2] = pos.z;
+	cam.target[0] = targ.x;
+	cam.target[1] = targ.y;
+	cam.target[2] = targ.z;
+	cam.up[0] = up.x;
+	cam.up[1] = up.y;
+	cam.up[2] = up.z;
+	cam.fov = DEGTORAD(fov) / 1.33333f;
+
+	scene->cameras.push_back(cam);
+}
+
+static void ReadObject(Reader &rd, const Chunk &ch, CookScene *scene) {
+	string name = ReadString(rd);
+
+	while(!rd.error && rd.ptr < ch.end) {
+		Chunk sub = ReadChunk(rd, ch.end);
+
+		switch(sub.id) {
+		case Chunk_Obj_TriMesh:
+			ReadTriMesh(rd, sub.end, name, scene);
+			break;
+
+		case Chunk_Obj_Light:
+			ReadLight(rd, sub.end, name, scene);
+			break;
+
+		case Chunk_Obj_Camera:
+			ReadCamera(rd, name, scene);
+			break;
+		}
+		SkipTo(rd, sub.end);
+	}
+}
+
+bool Load3DS(const char *fname, CookScene *scene) {
+	MappedFile file;
+	if(!file.Open(fname)) return false;
+
+	Reader rd;
+	rd.ptr = file.GetData();
+	rd.end = rd.ptr + file.GetSize();
+	rd.error = false;
+
+	Chunk main = ReadChunk(rd, rd.end);
+	if(rd.error || main.id != Chunk_3DSMain) return false;
+
+	scene->ambient[0] = scene->ambient[1] = scene->ambient[2] = 0.0f;
+	scene->ambient[3] = 1.0f;
+
+	while(!rd.error && rd.ptr < main.end) {
+		Chunk ch = ReadChunk(rd, main.end);
+
+		switch(ch.id) {
+		case Chunk_Main_3DEditor:
+			continue;	// descend
+
+		case Chunk_Edit_AmbientColor:
+			ReadColor(rd, scene->ambient);
+			for(int i=0; i<4; i++) scene->ambient[i] = Clamp(scene->ambient[i]);
+			break;
+
+		case Chunk_Edit_Material:
+			scene->materials.push_back(CookMaterial());
+			ReadMaterial(rd, ch, &scene->materials.back());
+			break;
+
+		case Chunk_Edit_Object:
+			ReadObject(rd, ch, scene);
+			break;
+		}
+		SkipTo(rd, ch.end);
+	}
+
+	return !rd.error;
+}
@@ -0,0 +1,64 @@
+#ifndef _SCENE3DS_H_
+#define _SCENE3DS_H_
+
+#include <string>
+#include <vector>
+#include "typedefs.h"
+#include "3deng_dx8/n3sformat.h"
+
+// engine independent copy of what SceneLoader makes out of a 3ds file,
+// with the same conventions (flipped YZ, CW faces, object space vertices)
+
+struct CookMaterial {
+	std::string name;
+	float ambient[4], diffuse[4], specular[4], emissive[4];
+	float power, alpha, EnvBlend, BumpIntensity;
+	bool SpecularEnable;
+	std::string maps[n3sfile::MapCount];
+
+	CookMaterial();
+};
+
+struct CookObject {
+	std::string name;
+	std::vector<n3sfile::VertexRec> verts;
+	std::vector<dword> indices;			// 3 per triangle
+	std::vector<dword> SmoothingGroups;	// 1 per triangle
+	std::string MatName;
+	float RotMat[16], TransMat[16];
+};
+
+struct CookLight {
+	std::string name;
+	bool spot;
+	float pos[3], target[3];
+	float color[4];
+	float intensity, InnerCone, OuterCone;
+	bool CastShadows;
+};
+
+struct CookCamera {
+	std::string name;
+	float pos[3], target[3], up[3];
+	float fov;
+};
+
+struct CookCurve {
+	std::string name;
+	std::vector<float> points;
+};
+
+struct CookScene {
+	float ambient[4];
+	std::vector<CookMaterial> materials;
+	std::vector<CookObject> objects;
+	std::vector<CookLight> lights;
+	std::vector<CookCamera> cameras;
+	std::vector<CookCurve> curves;
+
+	const CookMaterial *FindMaterial(const std::string &name) const;
+};
+
+bool Load3DS(const char *fname, CookScene *scene);
+
+#endif	// _SCENE3DS_H_
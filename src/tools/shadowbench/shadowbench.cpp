@@ -0,0 +1,258 @@
+// shadowbench - silhouette extraction for the shadow volumes, old against new
+// Loads the greets scene and, for the shadow casting meshes of GreetsPart,
+// finds the contour edges for a light circling around each of them, once
+// with the old edge list (a linear search for every edge added) and once
+// with the edge table, checking that both find the same edges. Then it
+// extrudes the edges into the volume sides, as full vertices like the engine
+// used to and as bare positions like it does now, and checks that the
+// positions come out the same.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "tools/n3scook/scene3ds.h"
+#include "meshopt.h"
+#include "shadowvol.h"
+#include "n3dmath.h"
+
+using std::string;
+using std::vector;
+using n3sfile::VertexRec;
+
+struct BenchMesh {
+	string name;
+	vector<VertexRec> verts;
+	vector<Vector3> pos;
+	vector<dword> indices;
+	vector<Vector3> normals;	// unnormalized like Triangle::CalculateNormal
+	Vector3 center;
+	float radius;
+};
+
+static void SetupMesh(const CookObject &obj, BenchMesh *mesh) {
+	mesh->name = obj.name;
+	mesh->verts = obj.verts;
+	mesh->indices = obj.indices;
+
+	Vector3 vmin(1e30f, 1e30f, 1e30f), vmax(-1e30f, -1e30f, -1e30f);
+	for(size_t i=0; i<obj.verts.size(); i++) {
+		Vector3 p(obj.verts[i].pos[0], obj.verts[i].pos[1], obj.verts[i].pos[2]);
+		mesh->pos.push_back(p);
+		vmin = Vector3(std::min(vmin.x, p.x), std::min(vmin.y, p.y), std::min(vmin.z, p.z));
+		vmax = Vector3(std::max(vmax.x, p.x), std::max(vmax.y, p.y), std::max(vmax.z, p.z));
+	}
+	mesh->center = (vmin + vmax) / 2.0f;
+	mesh->radius = (vmax - vmin).Length() / 2.0f;
+
+	for(size_t i=0; i<mesh->indices.size(); i+=3) {
+		const Vector3 &p0 = mesh->pos[mesh->indices[i]];
+		Vector3 v1 = mesh->pos[mesh->indices[i + 1]] - p0;
+		Vector3 v2 = mesh->pos[mesh->indices[i + 2]] - p0;
+		mesh->normals.push_back(v1.CrossProduct(v2));
+	}
+}
+
+// the triangles looking away from a point light, as CreateShadowVolume decides
+static void FindBackfacing(const BenchMesh &mesh, const Vector3 &LightPos, bool *backfacing) {
+	for(size_t i=0; i<mesh.normals.size(); i++) {
+		const dword *tri = &mesh.indices[i * 3];
+		Vector3 pos = (mesh.pos[tri[0]] + mesh.pos[tri[1]] + mesh.pos[tri[2]]) / 3.0f;
+		backfacing[i] = DotProduct(mesh.normals[i], pos - LightPos) >= 0.0f;
+	}
+}
+
+// the way CreateShadowVolume used to do it
+static dword AddEdge(dword *edges, dword EdgeCount, dword v0, dword v1) {
+	for(dword i=0; i<EdgeCount; i++) {
+		if((edges[i * 2] == v0 && edges[i * 2 + 1] == v1) || (edges[i * 2] == v1 && edges[i * 2 + 1] == v0)) {
+			EdgeCount--;
+			edges[i * 2] = edges[EdgeCount * 2];
+			edges[i * 2 + 1] = edges[EdgeCount * 2 + 1];
+			return EdgeCount;
+		}
+	}
+
+	edges[EdgeCount * 2] = v0;
+	edges[EdgeCount * 2 + 1] = v1;
+	return EdgeCount + 1;
+}
+
+static dword OldSilhouette(const BenchMesh &mesh, const bool *backfacing, dword *edges) {
+	dword EdgeCount = 0;
+	for(size_t i=0; i<mesh.normals.size(); i++) {
+		if(!backfacing[i]) continue;
+		const dword *tri = &mesh.indices[i * 3];
+		EdgeCount = AddEdge(edges, EdgeCount, tri[0], tri[1]);
+		EdgeCount = AddEdge(edges, EdgeCount, tri[1], tri[2]);
+		EdgeCount = AddEdge(edges, EdgeCount, tri[2], tri[0]);
+	}
+	return EdgeCount;
+}
+
+// builds the edge table every time, as CreateShadowVolume did before the
+// meshes kept theirs
+static dword NewSilhouette(const BenchMesh &mesh, const bool *backfacing, MeshEdge *table, dword *edges) {
+	dword TriCount = (dword)mesh.normals.size();
+	dword EdgeCount = BuildEdgeTable(&mesh.indices[0], TriCount, table);
+	return FindSilhouetteEdges(table, EdgeCount, backfacing, edges);
+}
+
+// the sides the way CreateShadowVolume used to make them, a whole vertex
+// copied for every corner and the position transformed afterwards
+static void OldExtrude(const BenchMesh &mesh, const dword *edges, dword EdgeCount, const ShadowLight &light, const Matrix4x4 &XForm, VertexRec *out) {
+	VertexRec blank;
+	memset(&blank, 0, sizeof blank);
+	blank.color = 0x00ffffff;
+
+	for(dword i=0; i<EdgeCount; i++) {
+		VertexRec quad[4];
+		quad[0] = mesh.verts[edges[i * 2]];
+		quad[1] = mesh.verts[edges[i * 2 + 1]];
+		quad[2] = quad[3] = blank;
+
+		Vector3 p0(quad[0].pos[0], quad[0].pos[1], quad[0].pos[2]);
+		Vector3 p1(quad[1].pos[0], quad[1].pos[1], quad[1].pos[2]);
+		Vector3 p2 = p1 + GetShadowLightDir(light, p1) * ShadowExtrusion;
+		Vector3 p3 = p0 + GetShadowLightDir(light, p0) * ShadowExtrusion;
+		memcpy(quad[2].pos, &p2, sizeof p2);
+		memcpy(quad[3].pos, &p3, sizeof p3);
+
+		const int corners[] = {0, 1, 2, 0, 2, 3};
+		for(int j=0; j<6; j++) {
+			out[i * 6 + j] = quad[corners[j]];
+			Vector3 p(out[i * 6 + j].pos[0], out[i * 6 + j].pos[1], out[i * 6 + j].pos[2]);
+			p.Transform(XForm);
+			memcpy(out[i * 6 + j].pos, &p, sizeof p);
+		}
+	}
+}
+
+static bool SamePositions(const VertexRec *verts, const Vector3 *pos, dword count) {
+	for(dword i=0; i<count; i++) {
+		if(verts[i].pos[0] != pos[i].x || verts[i].pos[1] != pos[i].y || verts[i].pos[2] != pos[i].z) return false;
+	}
+	return true;
+}
+
+static bool SameEdges(const dword *a, const dword *b, dword count) {
+	vector<std::pair<dword, dword> > ea, eb;
+	for(dword i=0; i<count; i++) {
+		ea.push_back(std::make_pair(a[i * 2], a[i * 2 + 1]));
+		eb.push_back(std::make_pair(b[i * 2], b[i * 2 + 1]));
+	}
+	std::sort(ea.begin(), ea.end());
+	std::sort(eb.begin(), eb.end());
+	return ea == eb;
+}
+
+static void Bench(const BenchMesh &mesh, int LightCount) {
+	dword TriCount = (dword)mesh.normals.size();
+	if(!TriCount) return;
+
+	bool *backfacing = new bool[TriCount];
+	vector<MeshEdge> table(TriCount * 3);
+	vector<dword> OldEdges(TriCount * 6), NewEdges(TriCount * 6);
+
+	vector<VertexRec> OldSides(TriCount * 18);
+	vector<Vector3> NewSides(TriCount * 18);
+
+	// somewhere in the world, for the transforms
+	Matrix4x4 XForm;
+	XForm.Rotate(0.3f, 1.2f, 0.0f);
+	XForm.Translate(10.0f, -5.0f, 3.0f);
+
+	double OldTime = 0.0, NewTime = 0.0, OldExtrudeTime = 0.0, NewExtrudeTime = 0.0;
+	dword silhouettes = 0;
+	int mismatches = 0, PosMismatches = 0;
+
+	for(int i=0; i<LightCount; i++) {
+		float angle = (float)i / (float)LightCount * 2.0f * 3.1415926f;
+		Vector3 LightPos = mesh.center + Vector3(cosf(angle), 0.5f, sinf(angle)) * mesh.radius * 3.0f;
+		FindBackfacing(mesh, LightPos, backfacing);
+
+		clock_t start = clock();
+		dword OldCount = OldSilhouette(mesh, backfacing, &OldEdges[0]);
+		OldTime += (double)(clock() - start);
+
+		start = clock();
+		dword NewCount = NewSilhouette(mesh, backfacing, &table[0], &NewEdges[0]);
+		NewTime += (double)(clock() - start);
+
+		if(OldCount != NewCount || !SameEdges(&OldEdges[0], &NewEdges[0], OldCount)) mismatches++;
+		silhouettes += NewCount;
+
+		ShadowLight light;
+		light.directional = false;
+		light.vec = LightPos;
+
+		start = clock();
+		OldExtrude(mesh, &NewEdges[0], NewCount, light, XForm, &OldSides[0]);
+		OldExtrudeTime += (double)(clock() - start);
+
+		start = clock();
+		ExtrudeSilhouette(&mesh.verts[0], sizeof(VertexRec), &NewEdges[0], NewCount, light, XForm, &NewSides[0]);
+		NewExtrudeTime += (double)(clock() - start);
+
+		if(!SamePositions(&OldSides[0], &NewSides[0], NewCount * 6)) PosMismatches++;
+	}
+	delete [] backfacing;
+
+	double ms = 1000.0 / CLOCKS_PER_SEC / LightCount;
+	dword edges = silhouettes / LightCount;
+	printf("%-12s %6u tris %6u edges\n", mesh.name.c_str(), TriCount, edges);
+	printf("    silhouette  old: %9.4f ms  new: %9.4f ms", OldTime * ms, NewTime * ms);
+	if(mismatches) {
+		// open or inconsistently wound meshes are the only ones that may differ
+		printf("  (%d lights differ)", mismatches);
+	}
+	printf("\n");
+	printf("    extrusion   old: %9.4f ms  new: %9.4f ms  %7u bytes against %6u", OldExtrudeTime * ms, NewExtrudeTime * ms,
+		edges * 6 * (dword)sizeof(VertexRec), edges * 6 * (dword)sizeof(Vector3));
+	if(PosMismatches) printf("  (positions differ for %d lights!)", PosMismatches);
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	const char *fname = argc > 1 ? argv[1] : "data/geometry/greets.3ds";
+	int LightCount = argc > 2 ? atoi(argv[2]) : 200;
+	if(LightCount < 1) {
+		printf("usage: shadowbench [scene.3ds] [light positions] [objects...]\n");
+		return 1;
+	}
+
+	CookScene scene;
+	if(!Load3DS(fname, &scene)) {
+		printf("can't read %s\n", fname);
+		return 1;
+	}
+
+	// the candle is what casts the shadows in GreetsPart, the bottles sit
+	// next to it and get their volumes precomputed
+	vector<string> names;
+	for(int i=3; i<argc; i++) names.push_back(argv[i]);
+	if(names.empty()) {
+		names.push_back("Candle");
+		names.push_back("Bottle");
+		names.push_back("Bottle01");
+	}
+
+	printf("per light\n");
+	for(size_t i=0; i<names.size(); i++) {
+		size_t j = 0;
+		while(j < scene.objects.size() && scene.objects[j].name != names[i]) j++;
+		if(j == scene.objects.size()) {
+			printf("%-12s not in %s\n", names[i].c_str(), fname);
+			continue;
+		}
+
+		BenchMesh mesh;
+		SetupMesh(scene.objects[j], &mesh);
+		Bench(mesh, LightCount);
+	}
+	return 0;
+}